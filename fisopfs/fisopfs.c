@@ -1,6 +1,7 @@
 #define FUSE_USE_VERSION 30
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -9,14 +10,218 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 
 #include "fs_lib.c"
+#include "fs_trace.c"
 
-fs_t *fs;
+// # MONTAJES
+//
+// Un mismo proceso puede atender varios montajes, cada uno con su propio
+// sistema de archivos, imagen y opciones. Las operaciones reciben el montaje
+// en fuse_get_context()->private_data (lo devuelve fisopfs_init), así que no
+// hay estado global por montaje. Con un solo montaje se usa fuse_main; con
+// varios (--mount=...), un grupo de hilos compartido atiende los pedidos de
+// todos (ver serve_mounts), y todos comparten la reserva de bloques.
+
+#define MAX_MONTAJES 16
+
+// Hilos libres que mantiene el grupo compartido (ver serve_worker)
+#define MAX_HILOS_MONTAJES 16
+
+// Microsegundos que espera un commit a otros pedidos (--commit-window=)
+#define VENTANA_COMMIT_US 500
+
+typedef struct fisopfs_mount {
+	fs_t *fs;
+	char mountpoint[PATH_MAX];
+
+	// PERSISTENCIA
+	char image[PATH_MAX];
+	int save;
+
+	// IMPORTACIÓN (vacío si no se importa nada)
+	char import_dir[PATH_MAX];
+
+	// COMMITS
+	long commit_window_us;
+
+	// CAPACIDAD en bloques que informa statfs (0 para la por defecto)
+	size_t capacity;
+
+	// SÓLO LECTURA (-o ro, o ro en --mount): la imagen se mapea y no se
+	// guarda nunca (ver fs_init_read_only)
+	int read_only;
+
+	// TRAZAS (NULL si no se registra una traza)
+	fs_trace_t *trace;
+
+	// EVENTOS: lectores abiertos de ARCHIVO_EVENTOS
+	pthread_mutex_t readers_lock;
+	struct event_reader *readers;
+
+	// Sólo con varios montajes
+	struct fuse *fuse;
+	struct fuse_chan *ch;
+	int finished;
+} fisopfs_mount_t;
+
+static fisopfs_mount_t mounts[MAX_MONTAJES];
+static size_t n_mounts;
+
+// ## current_mount
+//
+// Devuelve el montaje que atiende la operación en curso.
+//
+static fisopfs_mount_t *
+current_mount(void)
+{
+	return fuse_get_context()->private_data;
+}
+
+// Se termina de atender pedidos cuando se recibe una señal o se desmontan
+// todos los sistemas de archivos (sólo con varios montajes).
+static int serving = 1;
+static size_t finished_mounts;
 
-// PERSISTENCIA
-const char *path = "fs.fisopfs";
-int save = 0;
+// ## request_interrupted
+//
+// Lo revisan las operaciones que esperan (eventos, locks): además de un
+// pedido interrumpido, corta la espera si se está terminando de atender
+// pedidos, para que serve_mounts no espere para siempre a esos hilos.
+//
+// Devuelve distinto de 0 si la operación en curso tiene que terminar.
+//
+static int
+request_interrupted(void)
+{
+	return fuse_interrupted() ||
+	       !__atomic_load_n(&serving, __ATOMIC_RELAXED);
+}
+
+// Segundos que el kernel recuerda que un path no existe. Se puede cambiar
+// con -o negative_timeout=N.
+#define TIMEOUT_NEGATIVO "-onegative_timeout=1"
+
+// # EVENTOS
+//
+// ARCHIVO_EVENTOS es un archivo virtual, de sólo lectura, con los cambios
+// del sistema de archivos (ver fs_events_read): en lugar de recorrer los
+// directorios con ls y stat para encontrar qué cambió, se lo lee y cada
+// read devuelve los eventos nuevos, o espera a que haya. Con O_NONBLOCK, un
+// read sin eventos nuevos termina con EAGAIN y se puede esperar con poll.
+//
+// Cada apertura del archivo tiene su propia posición, así que cada lector
+// ve todos los eventos posteriores a su open. DIR_EVENTOS no aparece en el
+// listado de la raíz, y su path queda reservado: no se puede crear ni borrar
+// (si una imagen vieja tiene una entrada con ese nombre, queda oculta).
+
+#define DIR_EVENTOS "/.fisopfs"
+#define ARCHIVO_EVENTOS DIR_EVENTOS "/events"
+
+typedef struct event_reader {
+	uint64_t pos;                // próximo evento a leer
+	struct fuse_pollhandle *ph;  // poll pendiente, o NULL
+	struct event_reader *next;
+} event_reader_t;
+
+// ## events_getattr
+//
+// Completa los atributos de DIR_EVENTOS y ARCHIVO_EVENTOS a partir de los de
+// la raíz.
+//
+// Devuelve 0, o -ENOENT si path no es ninguno de los dos.
+//
+static int
+events_getattr(fisopfs_mount_t *m, const char *path, struct stat *st)
+{
+	int is_dir = strcmp(path, DIR_EVENTOS) == 0;
+	if (!is_dir && strcmp(path, ARCHIVO_EVENTOS) != 0)
+		return -ENOENT;
+
+	int status = fs_getattr(m->fs, ROOT, st);
+	if (status < 0)
+		return status;
+
+	st->st_mode = is_dir ? __S_IFDIR | 0555 : __S_IFREG | 0444;
+	st->st_nlink = is_dir ? 2 : 1;
+	st->st_size = 0;
+	st->st_blocks = 0;
+	return 0;
+}
+
+// ## events_notify
+//
+// Avisa a los lectores que esperan con poll que hay eventos nuevos. Se
+// llama después de cada evento (ver event_add).
+//
+static void
+events_notify(void *arg)
+{
+	fisopfs_mount_t *m = arg;
+	pthread_mutex_lock(&m->readers_lock);
+	for (event_reader_t *r = m->readers; r; r = r->next) {
+		if (!r->ph)
+			continue;
+		fuse_notify_poll(r->ph);
+		fuse_pollhandle_destroy(r->ph);
+		r->ph = NULL;
+	}
+	pthread_mutex_unlock(&m->readers_lock);
+}
+
+// ## events_open
+//
+// Agrega un lector de eventos y lo guarda en fi->fh. El archivo no tiene
+// tamaño ni posiciones, así que se lee sin caché y sin offsets.
+//
+static int
+events_open(fisopfs_mount_t *m, struct fuse_file_info *fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+
+	event_reader_t *r = calloc(1, sizeof(event_reader_t));
+	if (!r)
+		return -ENOMEM;
+
+	int status = fs_events_open(m->fs, &r->pos);
+	if (status < 0) {
+		free(r);
+		return status;
+	}
+
+	pthread_mutex_lock(&m->readers_lock);
+	r->next = m->readers;
+	m->readers = r;
+	pthread_mutex_unlock(&m->readers_lock);
+
+	fi->fh = (uintptr_t) r;
+	fi->direct_io = 1;
+	fi->nonseekable = 1;
+	return 0;
+}
+
+// ## events_release
+//
+// Quita el lector de eventos de fi.
+//
+static void
+events_release(fisopfs_mount_t *m, struct fuse_file_info *fi)
+{
+	event_reader_t *r = (event_reader_t *) (uintptr_t) fi->fh;
+	pthread_mutex_lock(&m->readers_lock);
+	event_reader_t **link = &m->readers;
+	while (*link != r)
+		link = &(*link)->next;
+	*link = r->next;
+	pthread_mutex_unlock(&m->readers_lock);
+
+	if (r->ph)
+		fuse_pollhandle_destroy(r->ph);
+	free(r);
+}
 
 // # OPERACIONES DEL SISTEMA DE ARCHIVOS
 
@@ -33,8 +238,16 @@ int save = 0;
 static int
 fisopfs_mkdir(const char *path, mode_t mode)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_mkdir - path: %s\n", path);
-	return fs_mkdir(fs, path, mode);
+	if (strcmp(path, DIR_EVENTOS) == 0)
+		return -EEXIST;
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_mkdir(m->fs, path, mode);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_MKDIR, path, 0, 0, mode, status, start);
+	return status;
 }
 
 // ## Creación de archivos
@@ -48,8 +261,17 @@ fisopfs_mkdir(const char *path, mode_t mode)
 static int
 fisopfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_create - path: %s\n", path);
-	return fs_create(fs, path, mode);
+	if (strcmp(path, DIR_EVENTOS) == 0 ||
+	    strcmp(path, ARCHIVO_EVENTOS) == 0)
+		return -EEXIST;
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_create(m->fs, path, mode);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_CREATE, path, 0, 0, mode, status, start);
+	return status;
 }
 
 // ## Cambio de tiempo de acceso y modificación
@@ -66,8 +288,21 @@ fisopfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 static int
 fisopfs_utimens(const char *path, const struct timespec ts[2])
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_utimens - path: %s\n", path);
-	return fs_utimens(fs, path, ts);
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_utimens(m->fs, path, ts);
+	fs_end_update(m->fs);
+	trace_record(m->trace,
+	             TRAZA_UTIMENS,
+	             path,
+	             ts[0].tv_sec,
+	             ts[1].tv_sec,
+	             0,
+	             status,
+	             start);
+	return status;
 }
 
 // ## Lectura de directorios
@@ -88,33 +323,27 @@ fisopfs_readdir(const char *path,
                 off_t offset,
                 struct fuse_file_info *fi)
 {
-	printf("[debug] fisopfs_readdir - path: %s\n", path);
-
-	// Los directorios '.' y '..'
-	filler(buffer, ".", NULL, 0);
-	filler(buffer, "..", NULL, 0);
-
-	fs_d_entry_t *dir = get_dir(fs, path);
-	if (!dir) {
-		printf("[debug] fisopfs_readdir - directory %s not found\n", path);
-		return -ENOENT;
+	fisopfs_mount_t *m = current_mount();
+	printf("[debug] fisopfs_readdir - path: %s, offset: %lu\n", path, offset);
+	if (strcmp(path, DIR_EVENTOS) == 0) {
+		filler(buffer, ".", NULL, 0);
+		filler(buffer, "..", NULL, 0);
+		filler(buffer, "events", NULL, 0);
+		return 0;
 	}
 
-	for (int i = 0; i < fs->f_size; i++) {
-		if (strcmp(fs->files[i].entry->path, dir->path) == 0) {
-			filler(buffer, basename(fs->files[i].path), NULL, 0);
-		}
-	}
-
-	for (int i = 0; i < fs->d_size; i++) {
-		if (fs->directories[i].d_parent &&
-		    strcmp(fs->directories[i].d_parent->path, dir->path) == 0) {
-			filler(buffer, basename(fs->directories[i].path), NULL, 0);
-		}
-	}
+	// Cada entrada lleva sus atributos y su cookie como offset: si el
+	// buffer se llena, FUSE vuelve a llamar con la cookie de la última
+	// entrada agregada.
+	uint64_t start = trace_start(m->trace);
+	fs_lock(m->fs);
+	int status = fs_readdir(m->fs, path, buffer, filler, offset);
+	fs_unlock(m->fs);
+	trace_record(m->trace, TRAZA_READDIR, path, offset, 0, 0, status, start);
+	if (status == -ENOENT)
+		printf("[debug] fisopfs_readdir - directory %s not found\n", path);
 
-	dir->time_last_access = time(NULL);
-	return EXIT_SUCCESS;
+	return status;
 }
 
 // ## Lectura de archivos
@@ -133,42 +362,42 @@ fisopfs_read(const char *path,
              off_t offset,
              struct fuse_file_info *fi)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_read - path: %s, offset: %lu, size: %lu\n",
 	       path,
 	       offset,
 	       size);
 
-	if (offset < 0 || size < 0) {
-		fprintf(stderr, "Error: datos invalidos\n");
-		return -EINVAL;
+	// Los eventos se leen sin lock, y con O_NONBLOCK no se espera
+	if (strcmp(path, ARCHIVO_EVENTOS) == 0) {
+		event_reader_t *r = (event_reader_t *) (uintptr_t) fi->fh;
+		return fs_events_read(m->fs,
+		                      &r->pos,
+		                      buffer,
+		                      size,
+		                      !(fi->flags & O_NONBLOCK),
+		                      request_interrupted);
 	}
 
-	fs_file_t *file = get_file(fs, path);
-	if (!file) {
+	uint64_t start = trace_start(m->trace);
+	fs_lock(m->fs);
+	int status = fs_read(m->fs, path, buffer, size, offset);
+	fs_unlock(m->fs);
+	trace_record(m->trace, TRAZA_READ, path, offset, size, 0, status, start);
+	if (status == -ENOENT)
 		printf("[debug] fisopfs_read - file %s not found\n", path);
-		return -ENOENT;
-	}
-
-	char *content = file->content;
-	size_t file_size = file->size;
-	if (offset > file_size) {
-		fprintf(stderr, "Error: offset mayor que el tamaño del archivo\n");
-		return -EINVAL;
-	}
-
-	if (file_size < size - offset)
-		size = file_size - offset;
-
-	strncpy(buffer, content + offset, size);
-	file->time_last_access = time(NULL);
 
-	return size;
+	return status;
 }
 
 // ## Escritura de archivos
 //
 // As for read above, except that it can't return 0.
 //
+// Las escrituras al final del archivo (o con O_APPEND, que siempre van al
+// final) usan el camino rápido de fs_appendv; el resto, o si el camino
+// rápido no se puede usar, fs_write con el lock exclusivo.
+//
 // Example: echo "hola" > [file]
 //
 static int
@@ -178,37 +407,47 @@ fisopfs_write(const char *path,
               off_t offset,
               struct fuse_file_info *fi)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_write - path: %s\n", path);
 
-	if (offset < 0 || size < 0 || offset + size > MAX_CONTENIDO) {
-		fprintf(stderr, "Error: datos invalidos\n");
-		return -EINVAL;
+	uint64_t start = trace_start(m->trace);
+	int append = (fi->flags & O_APPEND) != 0;
+	fs_lock_shared(m->fs);
+	int status = fs_append(m->fs, path, buffer, size, offset, append);
+	fs_unlock(m->fs);
+	if (status != -EAGAIN && status != -ENOENT) {
+		trace_record(m->trace,
+		             TRAZA_WRITE,
+		             path,
+		             offset,
+		             size,
+		             0,
+		             status,
+		             start);
+		return status;
 	}
 
-	fs_file_t *file = get_file(fs, path);
+	fs_begin_update(m->fs);
+	fs_file_t *file = get_file(m->fs, path);
 	if (!file) {
 		char dir_path[MAX_NAME];
 		strcpy(dir_path, path);
-		int status = fisopfs_create(basename(dir_path), 33024, fi);
+		status = fs_create(m->fs, basename(dir_path), 33024);
 		if (status < 0) {
+			fs_end_update(m->fs);
 			fprintf(stderr, "Error: no se pudo crear el archivo\n");
 			return status;
 		}
-		file = get_file(fs, path);
 	}
 
-	if (file->size < offset) {
-		fprintf(stderr, "Error: datos invalidos\n");
-		return -EINVAL;
-	}
+	file = get_file(m->fs, path);
+	if (append && file)
+		offset = file->size;
 
-	strncpy(file->content + offset, buffer, size);
-	file->time_last_access = time(NULL);
-	file->time_last_modification = time(NULL);
-	file->size = strlen(file->content);
-	file->content[file->size] = '\0';
-
-	return (int) size;
+	status = fs_write(m->fs, path, buffer, size, offset);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_WRITE, path, offset, size, 0, status, start);
+	return status;
 }
 
 // ## Acceder a las estadísticas de un archivo
@@ -224,8 +463,15 @@ fisopfs_write(const char *path,
 static int
 fisopfs_getattr(const char *path, struct stat *st)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_getattr - path: %s\n", path);
-	int status = fs_getattr(fs, path, st);
+	if (events_getattr(m, path, st) == 0)
+		return 0;
+
+	// Sin lock (ver fs_getattr)
+	uint64_t start = trace_start(m->trace);
+	int status = fs_getattr(m->fs, path, st);
+	trace_record(m->trace, TRAZA_GETATTR, path, 0, 0, 0, status, start);
 	if (status < 0)
 		fprintf(stderr,
 		        "[debug] fisopfs_getattr - attributes not found\n");
@@ -244,8 +490,16 @@ fisopfs_getattr(const char *path, struct stat *st)
 static int
 fisopfs_unlink(const char *path)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_unlink - path: %s\n", path);
-	return fs_unlink(fs, path);
+	if (strcmp(path, ARCHIVO_EVENTOS) == 0)
+		return -EACCES;
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_unlink(m->fs, path);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_UNLINK, path, 0, 0, 0, status, start);
+	return status;
 }
 
 // ## Borrado de directorios
@@ -258,8 +512,49 @@ fisopfs_unlink(const char *path)
 static int
 fisopfs_rmdir(const char *path)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_rmdir - path: %s\n", path);
-	return fs_rmdir(fs, path);
+	if (strcmp(path, DIR_EVENTOS) == 0)
+		return -EBUSY;
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_rmdir(m->fs, path);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_RMDIR, path, 0, 0, 0, status, start);
+	return status;
+}
+
+// Atributo extendido que borra un directorio con todo su contenido
+#define XATTR_BORRAR_ARBOL "user.fisopfs.rmtree"
+
+// ## Atributos extendidos
+//
+// Set an extended attribute. See setxattr(2).
+//
+// No se guardan atributos extendidos: el único que se acepta es
+// XATTR_BORRAR_ARBOL, que en un directorio lo borra junto con todo su
+// contenido en una sola operación (ver fs_rmtree). El valor no importa.
+//
+// Example: setfattr -n user.fisopfs.rmtree [dir]
+//
+static int
+fisopfs_setxattr(const char *path,
+                 const char *name,
+                 const char *value,
+                 size_t size,
+                 int flags)
+{
+	fisopfs_mount_t *m = current_mount();
+	printf("[debug] fisopfs_setxattr - path: %s, name: %s\n", path, name);
+	if (strcmp(name, XATTR_BORRAR_ARBOL) != 0)
+		return -ENOTSUP;
+
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_rmtree(m->fs, path);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_RMTREE, path, 0, 0, 0, status, start);
+	return status;
 }
 
 // ## Cambio de tamaño de un archivo
@@ -273,25 +568,251 @@ fisopfs_rmdir(const char *path)
 static int
 fisopfs_truncate(const char *path, off_t size)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] fisopfs_truncate - path: %s\n", path);
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_truncate(m->fs, path, size);
+	fs_end_update(m->fs);
+	trace_record(m->trace, TRAZA_TRUNCATE, path, size, 0, 0, status, start);
+	return status;
+}
 
-	if (size < 0 || size > MAX_CONTENIDO) {
-		fprintf(stderr, "Error: tamaño invalido\n");
-		return -EINVAL;
-	}
+// ## Reserva de espacio y perforación de huecos
+//
+// Allocates space for an open file. With mode 0 the blocks covering the range
+// are reserved and the file grows if needed; FALLOC_FL_KEEP_SIZE keeps its
+// size and FALLOC_FL_PUNCH_HOLE (with KEEP_SIZE) deallocates the range,
+// leaving a hole. See fallocate(2) for details.
+//
+// Example: fallocate -l [len] [file] , fallocate -p -o [off] -l [len] [file]
+//
+static int
+fisopfs_fallocate(const char *path,
+                  int mode,
+                  off_t offset,
+                  off_t len,
+                  struct fuse_file_info *fi)
+{
+	fisopfs_mount_t *m = current_mount();
+	printf("[debug] fisopfs_fallocate - path: %s, mode: %d, offset: %lu, "
+	       "len: %lu\n",
+	       path,
+	       mode,
+	       offset,
+	       len);
+	uint64_t start = trace_start(m->trace);
+	fs_begin_update(m->fs);
+	int status = fs_fallocate(m->fs, path, mode, offset, len);
+	fs_end_update(m->fs);
+	trace_record(
+	        m->trace, TRAZA_FALLOCATE, path, offset, len, mode, status, start);
+	return status;
+}
 
-	fs_file_t *file = get_file(fs, path);
-	if (!file) {
-		fprintf(stderr, "Error: archivo no encontrado\n");
-		return -ENOENT;
+// ## Sincronización de un archivo
+//
+// Synchronize file contents. If the datasync parameter is non-zero, then
+// only the user data should be flushed, not the meta data.
+//
+// Como la imagen guarda todo el sistema de archivos, se hacen durables todos
+// los cambios (ver fs_fsync: los fsync concurrentes comparten un mismo
+// commit). Sin persistencia (-p) no hay nada que hacer durable.
+//
+// Example: sync [file]
+//
+static int
+fisopfs_fsync(const char *file_path, int datasync, struct fuse_file_info *fi)
+{
+	fisopfs_mount_t *m = current_mount();
+	printf("[debug] fisopfs_fsync - path: %s\n", file_path);
+	if (!m->save)
+		return EXIT_SUCCESS;
+
+	uint64_t start = trace_start(m->trace);
+	int status = fs_fsync(m->fs, m->image);
+	trace_record(m->trace, TRAZA_FSYNC, file_path, 0, 0, datasync, status, start);
+	return status;
+}
+
+// ## Sincronización de un directorio
+//
+// Like fsync, but for directories.
+//
+static int
+fisopfs_fsyncdir(const char *file_path, int datasync, struct fuse_file_info *fi)
+{
+	printf("[debug] fisopfs_fsyncdir - path: %s\n", file_path);
+	return fisopfs_fsync(file_path, datasync, fi);
+}
+
+// ## Cierre de un archivo
+//
+// Called on each close() of a file descriptor. Not the same as fsync: a
+// close does not guarantee that the data is durable.
+//
+// Los datos ya están en memoria, así que no hay nada que hacer: la
+// durabilidad se pide con fsync.
+//
+static int
+fisopfs_flush(const char *file_path, struct fuse_file_info *fi)
+{
+	return EXIT_SUCCESS;
+}
+
+// ## Apertura de un archivo
+//
+// Open a file. If you aren't using file handles, this function should just
+// check for existence and permissions and return either success or an error
+// code.
+//
+// Los archivos del sistema de archivos no necesitan nada al abrirse; al
+// abrir ARCHIVO_EVENTOS se agrega un lector de eventos (ver events_open).
+//
+// Example: cat [mountpoint]/.fisopfs/events
+//
+static int
+fisopfs_open(const char *path, struct fuse_file_info *fi)
+{
+	printf("[debug] fisopfs_open - path: %s\n", path);
+	if (strcmp(path, ARCHIVO_EVENTOS) == 0)
+		return events_open(current_mount(), fi);
+	return EXIT_SUCCESS;
+}
+
+// ## Espera con poll
+//
+// Poll for IO readiness events. If ph is non-NULL, the client should notify
+// when IO readiness events occur by calling fuse_notify_poll() with the
+// specified ph.
+//
+// Sólo ARCHIVO_EVENTOS puede no estar listo: los demás archivos siempre se
+// pueden leer y escribir.
+//
+static int
+fisopfs_poll(const char *path,
+             struct fuse_file_info *fi,
+             struct fuse_pollhandle *ph,
+             unsigned *reventsp)
+{
+	fisopfs_mount_t *m = current_mount();
+	if (strcmp(path, ARCHIVO_EVENTOS) != 0) {
+		if (ph)
+			fuse_pollhandle_destroy(ph);
+		*reventsp |= POLLIN | POLLOUT;
+		return 0;
 	}
 
-	file->size = size;
-	file->time_last_modification = time(NULL);
+	// Con readers_lock tomado, un evento posterior a fs_events_ready
+	// encuentra ph (ver events_notify)
+	event_reader_t *r = (event_reader_t *) (uintptr_t) fi->fh;
+	pthread_mutex_lock(&m->readers_lock);
+	if (ph) {
+		if (r->ph)
+			fuse_pollhandle_destroy(r->ph);
+		r->ph = ph;
+	}
+	if (fs_events_ready(m->fs, &r->pos))
+		*reventsp |= POLLIN;
+	pthread_mutex_unlock(&m->readers_lock);
+	return 0;
+}
 
+// ## Liberación de un archivo
+//
+// Release an open file. Release is called when there are no more references
+// to an open file: all file descriptors are closed and all memory mappings
+// are unmapped.
+//
+// Se sueltan los locks que le queden al dueño del archivo abierto (ver
+// fs_unlock_owner).
+//
+static int
+fisopfs_release(const char *path, struct fuse_file_info *fi)
+{
+	printf("[debug] fisopfs_release - path: %s\n", path);
+	if (strcmp(path, ARCHIVO_EVENTOS) == 0)
+		events_release(current_mount(), fi);
+	else
+		fs_unlock_owner(current_mount()->fs, path, fi->lock_owner);
 	return EXIT_SUCCESS;
 }
 
+// ## Bloqueo de rangos
+//
+// Perform POSIX file locking operation. The cmd argument will be either
+// F_GETLK, F_SETLK or F_SETLKW. For checking lock ownership, the
+// 'fuse_file_info->lock_owner' argument must be used.
+//
+// Los locks se guardan en un árbol por archivo (ver fs_setlk). Un F_SETLKW
+// espera sin bloquear las demás operaciones y termina con -EINTR si se lo
+// interrumpe.
+//
+// Example: fcntl(fd, F_SETLKW, &lock)
+//
+static int
+fisopfs_lock(const char *path,
+             struct fuse_file_info *fi,
+             int cmd,
+             struct flock *lock)
+{
+	fisopfs_mount_t *m = current_mount();
+	printf("[debug] fisopfs_lock - path: %s, cmd: %d, type: %d\n",
+	       path,
+	       cmd,
+	       lock->l_type);
+	switch (cmd) {
+	case F_GETLK:
+		return fs_getlk(m->fs, path, fi->lock_owner, lock);
+	case F_SETLK:
+	case F_SETLKW:
+		return fs_setlk(m->fs,
+		                path,
+		                fi->lock_owner,
+		                lock,
+		                cmd == F_SETLKW,
+		                request_interrupted);
+	default:
+		return -EINVAL;
+	}
+}
+
+// ## Bloqueo de un archivo entero
+//
+// Perform BSD file locking operation. The op argument will be either
+// LOCK_SH, LOCK_EX or LOCK_UN. Nonblocking requests will be indicated by
+// ORing LOCK_NB to the above operations.
+//
+// Example: flock [file] -c [cmd]
+//
+static int
+fisopfs_flock(const char *path, struct fuse_file_info *fi, int op)
+{
+	printf("[debug] fisopfs_flock - path: %s, op: %d\n", path, op);
+	return fs_flock(current_mount()->fs,
+	                path,
+	                fi->lock_owner,
+	                op,
+	                request_interrupted);
+}
+
+// ## Estadísticas del sistema de archivos
+//
+// Get file system statistics. The 'f_favail', 'f_fsid' and 'f_flag' fields
+// are ignored.
+//
+// Los contadores de uso se mantienen al día en cada operación, así que no
+// hace falta recorrer el sistema de archivos ni tomar el lock. La capacidad
+// se puede cambiar con --capacity=<MiB>.
+//
+// Example: df [dir]
+//
+static int
+fisopfs_statfs(const char *path, struct statvfs *st)
+{
+	printf("[debug] fisopfs_statfs - path: %s\n", path);
+	return fs_statfs(current_mount()->fs, st);
+}
 
 // ----------------------------------------------------------------------
 
@@ -315,16 +836,37 @@ fisopfs_truncate(const char *path, off_t size)
 void *
 fisopfs_init(struct fuse_conn_info *conn)
 {
+	fisopfs_mount_t *m = current_mount();
 	printf("[debug] Initialize Filesystem! Welcome.\n");
-	if (save)
+	if (m->save)
 		printf("[debug] Persistency activated - File System will be "
 		       "saved\n");
 
-	fs = fs_init(path);
-	if (!fs)
+	if (m->read_only)
+		printf("[debug] Read-only mount - Image will be mapped, not "
+		       "saved\n");
+
+	pthread_mutex_init(&m->readers_lock, NULL);
+	m->fs = m->read_only ? fs_init_read_only(m->image) : fs_init(m->image);
+	if (!m->fs) {
 		fprintf(stderr, "Error al iniciar el file system.\n");
+	} else {
+		m->fs->commit_window_us = m->commit_window_us;
+		m->fs->event_notify = events_notify;
+		m->fs->event_notify_arg = m;
+		if (m->capacity > 0)
+			m->fs->capacity = m->capacity;
+		if (fs_scrub_start(m->fs) != 0)
+			fprintf(stderr,
+			        "No se pudo verificar la imagen en segundo "
+			        "plano.\n");
+	}
 
-	return NULL;
+	if (m->fs && m->import_dir[0] != '\0' &&
+	    fs_import(m->fs, m->import_dir) < 0)
+		fprintf(stderr, "Error al importar %s.\n", m->import_dir);
+
+	return m;
 }
 
 // ## Destroy
@@ -338,16 +880,34 @@ fisopfs_init(struct fuse_conn_info *conn)
 void
 fisopfs_destroy(void *private_data)
 {
+	fisopfs_mount_t *m = private_data;
 	printf("[debug] Filesystem destroy\n");
-	if (save)
+	if (m->save)
 		printf("[debug] Saving filesystem\n");
 
-	fs_destroy(path, fs, save);
+	printf("[debug] ");
+	fs_arena_report(stdout);
+	if (m->fs)
+		fs_destroy(m->image, m->fs, m->save);
+	trace_close(m->trace);
+	m->fs = NULL;
+	m->trace = NULL;
+
+	// Lectores que no llegaron a cerrarse
+	while (m->readers) {
+		event_reader_t *r = m->readers;
+		m->readers = r->next;
+		if (r->ph)
+			fuse_pollhandle_destroy(r->ph);
+		free(r);
+	}
+	pthread_mutex_destroy(&m->readers_lock);
 }
 
 static struct fuse_operations operations = {
 	.getattr = fisopfs_getattr,
 	.readdir = fisopfs_readdir,
+	.open = fisopfs_open,
 	.read = fisopfs_read,
 	.mkdir = fisopfs_mkdir,
 	.create = fisopfs_create,
@@ -356,19 +916,447 @@ static struct fuse_operations operations = {
 	.truncate = fisopfs_truncate,
 	.unlink = fisopfs_unlink,
 	.rmdir = fisopfs_rmdir,
+	.setxattr = fisopfs_setxattr,
+	.fallocate = fisopfs_fallocate,
+	.fsync = fisopfs_fsync,
+	.fsyncdir = fisopfs_fsyncdir,
+	.flush = fisopfs_flush,
+	.release = fisopfs_release,
+	.lock = fisopfs_lock,
+	.flock = fisopfs_flock,
+	.statfs = fisopfs_statfs,
+	.poll = fisopfs_poll,
 
 	.init = fisopfs_init,
 	.destroy = fisopfs_destroy,
 };
 
+// ## parse_capacity
+//
+// Convierte una capacidad en MiB (de --capacity=) a bloques.
+//
+// Devuelve la cantidad de bloques, o 0 (la capacidad por defecto) si value
+// no es un número positivo.
+//
+static size_t
+parse_capacity(const char *value)
+{
+	long mib = atol(value);
+	return mib > 0 ? (size_t) mib * (1 << 20) / TAM_BLOQUE : 0;
+}
+
+// ## parse_mount
+//
+// Agrega el montaje descrito por spec, de la forma
+// <punto de montaje>[,image=<imagen>][,persist][,import=<dir>]
+// [,commit-window=<us>][,trace=<archivo>][,capacity=<MiB>][,ro]. Sin image=, la
+// imagen es <nombre del punto de montaje>.fisopfs en el directorio actual.
+// Los paths se resuelven acá porque FUSE cambia el directorio actual al
+// pasar a segundo plano.
+//
+// Devuelve 0 si es válido, -1 en caso contrario.
+//
+static int
+parse_mount(char *spec)
+{
+	if (n_mounts == MAX_MONTAJES) {
+		fprintf(stderr,
+		        "No se pueden atender más de %d montajes.\n",
+		        MAX_MONTAJES);
+		return -1;
+	}
+
+	fisopfs_mount_t *m = &mounts[n_mounts];
+	char *state;
+	char *dir = strtok_r(spec, ",", &state);
+	if (!dir || !realpath(dir, m->mountpoint)) {
+		perror(dir ? dir : "--mount");
+		return -1;
+	}
+	m->commit_window_us = VENTANA_COMMIT_US;
+
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) {
+		perror("getcwd");
+		return -1;
+	}
+	char temp[PATH_MAX];
+	strcpy(temp, m->mountpoint);
+	int len = snprintf(
+	        m->image, PATH_MAX, "%s/%s.fisopfs", cwd, basename(temp));
+
+	for (char *opt = strtok_r(NULL, ",", &state); opt && len < PATH_MAX;
+	     opt = strtok_r(NULL, ",", &state)) {
+		if (strncmp(opt, "image=", 6) == 0) {
+			if (opt[6] == '/')
+				len = snprintf(m->image, PATH_MAX, "%s", opt + 6);
+			else
+				len = snprintf(
+				        m->image, PATH_MAX, "%s/%s", cwd, opt + 6);
+		} else if (strcmp(opt, "persist") == 0) {
+			m->save = 1;
+		} else if (strncmp(opt, "import=", 7) == 0) {
+			if (!realpath(opt + 7, m->import_dir)) {
+				perror(opt + 7);
+				return -1;
+			}
+		} else if (strncmp(opt, "commit-window=", 14) == 0) {
+			m->commit_window_us = atol(opt + 14);
+		} else if (strncmp(opt, "capacity=", 9) == 0) {
+			m->capacity = parse_capacity(opt + 9);
+		} else if (strcmp(opt, "ro") == 0) {
+			m->read_only = 1;
+		} else if (strncmp(opt, "trace=", 6) == 0) {
+			trace_close(m->trace);
+			if (!(m->trace = trace_open(opt + 6)))
+				return -1;
+		} else {
+			fprintf(stderr, "Opción de montaje desconocida: %s\n", opt);
+			return -1;
+		}
+	}
+
+	if (len >= PATH_MAX) {
+		fprintf(stderr, "%s: el path de la imagen es muy largo\n", dir);
+		return -1;
+	}
+
+	n_mounts++;
+	return 0;
+}
+
+// Hilos del grupo compartido: cuántos hay y cuántos esperan pedidos
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_done = PTHREAD_COND_INITIALIZER;
+static size_t n_workers;
+static size_t idle_workers;
+
+static void *serve_worker(void *arg);
+
+// ## start_worker
+//
+// Agrega un hilo libre al grupo compartido. Se llama con workers_lock
+// tomado; arg es el tamaño de buffer de serve_worker.
+//
+// Devuelve 0, o -1 si no se pudo crear el hilo.
+//
+static int
+start_worker(void *arg)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int status = pthread_create(&thread, &attr, serve_worker, arg);
+	pthread_attr_destroy(&attr);
+	if (status != 0)
+		return -1;
+
+	n_workers++;
+	idle_workers++;
+	return 0;
+}
+
+// ## serve_worker
+//
+// Hilo del grupo compartido: espera pedidos en los canales de todos los
+// montajes y los procesa. Los canales son no bloqueantes, porque varios
+// hilos pueden despertarse por el mismo pedido.
+//
+// Un pedido puede esperar mucho (un read bloqueante de ARCHIVO_EVENTOS, un
+// F_SETLKW), así que, como fuse_loop_mt, el grupo crece cuando el último
+// hilo libre toma un pedido: siempre queda uno para atender a los demás
+// montajes y los INTERRUPT que cortan esas esperas. Al terminar un pedido,
+// el hilo se va si ya hay MAX_HILOS_MONTAJES libres.
+//
+static void *
+serve_worker(void *arg)
+{
+	size_t bufsize = *(size_t *) arg;
+	char *buf = malloc(bufsize);
+	struct pollfd fds[MAX_MONTAJES];
+	int idle = 1;
+
+	while (buf && idle && __atomic_load_n(&serving, __ATOMIC_RELAXED)) {
+		for (size_t i = 0; i < n_mounts; i++) {
+			fisopfs_mount_t *m = &mounts[i];
+			int done = __atomic_load_n(&m->finished, __ATOMIC_RELAXED);
+			fds[i].fd = done ? -1 : fuse_chan_fd(m->ch);
+			fds[i].events = POLLIN;
+		}
+		if (poll(fds, n_mounts, 100) <= 0)
+			continue;
+
+		for (size_t i = 0; i < n_mounts && idle; i++) {
+			fisopfs_mount_t *m = &mounts[i];
+			if (fds[i].fd < 0 || !fds[i].revents)
+				continue;
+
+			struct fuse_session *se = fuse_get_session(m->fuse);
+			struct fuse_chan *ch = m->ch;
+			int res = fuse_chan_recv(&ch, buf, bufsize);
+			if (res == -EAGAIN || res == -EINTR)
+				continue;
+			if (res > 0) {
+				pthread_mutex_lock(&workers_lock);
+				if (--idle_workers == 0)
+					start_worker(arg);
+				pthread_mutex_unlock(&workers_lock);
+
+				fuse_session_process(se, buf, res, ch);
+
+				pthread_mutex_lock(&workers_lock);
+				if (idle_workers < MAX_HILOS_MONTAJES)
+					idle_workers++;
+				else
+					idle = 0;
+				pthread_mutex_unlock(&workers_lock);
+				continue;
+			}
+
+			// Se desmontó (o falló el canal): el último hilo en
+			// notarlo avisa si ya no queda ningún montaje.
+			fuse_session_exit(se);
+			if (__atomic_exchange_n(&m->finished, 1, __ATOMIC_RELAXED) == 0 &&
+			    __atomic_add_fetch(&finished_mounts, 1, __ATOMIC_RELAXED) ==
+			            n_mounts)
+				kill(getpid(), SIGTERM);
+		}
+	}
+
+	pthread_mutex_lock(&workers_lock);
+	if (idle)
+		idle_workers--;
+	if (--n_workers == 0)
+		pthread_cond_signal(&workers_done);
+	pthread_mutex_unlock(&workers_lock);
+	free(buf);
+	return NULL;
+}
+
+// ## serve_mounts
+//
+// Monta todos los sistemas de archivos y los atiende con un grupo de hilos
+// compartido hasta recibir SIGINT, SIGTERM o SIGHUP, o hasta que se
+// desmonten todos. args tiene las opciones de FUSE comunes a todos.
+//
+// Devuelve EXIT_SUCCESS o EXIT_FAILURE.
+//
+static int
+serve_mounts(struct fuse_args *args, int foreground)
+{
+	int status = EXIT_FAILURE;
+	size_t mounted = 0;
+	size_t bufsize = 0;
+
+	// Las señales se atienden sólo en este hilo, con sigwait
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	for (; mounted < n_mounts; mounted++) {
+		fisopfs_mount_t *m = &mounts[mounted];
+
+		// fuse_mount y fuse_new consumen las opciones que reconocen
+		struct fuse_args margs = FUSE_ARGS_INIT(0, NULL);
+		for (int i = 0; i < args->argc; i++) {
+			if (fuse_opt_add_arg(&margs, args->argv[i]) != 0)
+				goto out;
+		}
+		if (m->read_only && fuse_opt_add_arg(&margs, "-oro") != 0)
+			goto out;
+
+		m->ch = fuse_mount(m->mountpoint, &margs);
+		if (m->ch)
+			m->fuse = fuse_new(
+			        m->ch, &margs, &operations, sizeof(operations), m);
+		fuse_opt_free_args(&margs);
+		if (!m->fuse) {
+			if (m->ch)
+				fuse_unmount(m->mountpoint, m->ch);
+			fprintf(stderr, "No se pudo montar %s.\n", m->mountpoint);
+			goto out;
+		}
+
+		int fd = fuse_chan_fd(m->ch);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		if (fuse_chan_bufsize(m->ch) > bufsize)
+			bufsize = fuse_chan_bufsize(m->ch);
+		printf("[debug] %s montado con la imagen %s\n",
+		       m->mountpoint,
+		       m->image);
+	}
+
+	if (fuse_daemonize(foreground) != 0)
+		goto out;
+
+	// Dos hilos por CPU: mientras uno espera un lock o la imagen, otro
+	// puede atender pedidos de otro montaje.
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_threads = cpus < 1 ? 2 : 2 * (size_t) cpus;
+	if (n_threads > MAX_HILOS_MONTAJES)
+		n_threads = MAX_HILOS_MONTAJES;
+
+	pthread_mutex_lock(&workers_lock);
+	while (n_workers < n_threads && start_worker(&bufsize) == 0)
+		;
+	int started = n_workers > 0;
+	pthread_mutex_unlock(&workers_lock);
+
+	if (started) {
+		int sig;
+		sigwait(&signals, &sig);
+		status = EXIT_SUCCESS;
+	}
+
+	// Los hilos que esperan en una operación la cortan al ver que terminó
+	// serving (ver request_interrupted)
+	__atomic_store_n(&serving, 0, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&workers_lock);
+	while (n_workers > 0)
+		pthread_cond_wait(&workers_done, &workers_lock);
+	pthread_mutex_unlock(&workers_lock);
+
+out:
+	// Como en fuse_main: se desmonta y después se destruye (lo que llama a
+	// fisopfs_destroy y guarda la imagen)
+	for (size_t i = 0; i < mounted; i++) {
+		fuse_unmount(mounts[i].mountpoint, mounts[i].ch);
+		fuse_destroy(mounts[i].fuse);
+	}
+	return status;
+}
+
+#define OPCION_SOLO_LECTURA 0
+
+static const struct fuse_opt read_only_opts[] = {
+	FUSE_OPT_KEY("ro", OPCION_SOLO_LECTURA),
+	FUSE_OPT_END,
+};
+
+// ## keep_ro_option
+//
+// Procesa los argumentos de fuse_opt_parse: marca en data si se pidió -o ro
+// y deja todos los argumentos para FUSE.
+//
+static int
+keep_ro_option(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+	if (key == OPCION_SOLO_LECTURA)
+		*(int *) data = 1;
+	return 1;
+}
+
 int
 main(int argc, char *argv[])
 {
+	// El montaje principal es el del punto de montaje que se le pasa a
+	// FUSE, con la imagen fs.fisopfs y las opciones --import, --trace,
+	// --commit-window, --capacity y -p. Se pueden agregar otros con
+	// --mount=... (ver parse_mount).
+	fisopfs_mount_t *main_mount = &mounts[n_mounts++];
+	strcpy(main_mount->image, "fs.fisopfs");
+	main_mount->commit_window_us = VENTANA_COMMIT_US;
+
+	// Importación de un directorio del host (--import=/host/dir). Se
+	// resuelve el path antes de montar porque FUSE cambia el directorio
+	// actual al pasar a segundo plano.
+	// También se abre acá la traza (--trace=<archivo>), por el mismo
+	// motivo.
+	int kept = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--mount=", 8) == 0) {
+			if (parse_mount(argv[i] + 8) != 0)
+				return EXIT_FAILURE;
+			continue;
+		}
+		if (strncmp(argv[i], "--commit-window=", 16) == 0) {
+			main_mount->commit_window_us = atol(argv[i] + 16);
+			continue;
+		}
+		if (strncmp(argv[i], "--capacity=", 11) == 0) {
+			main_mount->capacity = parse_capacity(argv[i] + 11);
+			continue;
+		}
+		if (strncmp(argv[i], "--trace=", 8) == 0) {
+			trace_close(main_mount->trace);
+			if (!(main_mount->trace = trace_open(argv[i] + 8)))
+				return EXIT_FAILURE;
+			continue;
+		}
+		if (strncmp(argv[i], "--import=", 9) != 0) {
+			argv[kept++] = argv[i];
+			continue;
+		}
+		if (!realpath(argv[i] + 9, main_mount->import_dir)) {
+			perror(argv[i] + 9);
+			return EXIT_FAILURE;
+		}
+	}
+	argc = kept;
+	argv[argc] = NULL;
+
 	// Persistencia
 	if (strcmp(argv[argc - 1], "-p") == 0) {
-		save = 1;
+		main_mount->save = 1;
 		argc--;
 	}
 
-	return fuse_main(argc, argv, &operations, NULL);
+	// Las búsquedas de paths inexistentes se cachean también en el kernel.
+	// Se agrega al principio para que una opción del usuario la reemplace.
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (fuse_opt_insert_arg(&args, 1, TIMEOUT_NEGATIVO) != 0)
+		return EXIT_FAILURE;
+
+	// Con -o ro todos los montajes son de sólo lectura. La opción se deja
+	// para que también el kernel rechace las modificaciones.
+	int read_only = 0;
+	if (fuse_opt_parse(&args, &read_only, read_only_opts, keep_ro_option) !=
+	    0)
+		return EXIT_FAILURE;
+	for (size_t i = 0; i < n_mounts; i++) {
+		mounts[i].read_only |= read_only;
+		if (mounts[i].read_only && mounts[i].save) {
+			fprintf(stderr,
+			        "%s es de sólo lectura: no se guarda la "
+			        "imagen.\n",
+			        i == 0 ? "El montaje principal"
+			               : mounts[i].mountpoint);
+			mounts[i].save = 0;
+		}
+	}
+
+	int status;
+	if (n_mounts == 1) {
+		status = fuse_main(args.argc, args.argv, &operations, main_mount);
+	} else {
+		// El punto de montaje principal es opcional con varios montajes
+		char *mountpoint = NULL;
+		int multithreaded, foreground;
+		if (fuse_parse_cmdline(
+		            &args, &mountpoint, &multithreaded, &foreground) != 0) {
+			fuse_opt_free_args(&args);
+			return EXIT_FAILURE;
+		}
+		if (mountpoint && !realpath(mountpoint, main_mount->mountpoint)) {
+			perror(mountpoint);
+			free(mountpoint);
+			fuse_opt_free_args(&args);
+			return EXIT_FAILURE;
+		}
+		if (!mountpoint) {
+			// Se descarta el montaje principal
+			trace_close(main_mount->trace);
+			n_mounts--;
+			memmove(&mounts[0], &mounts[1], n_mounts * sizeof(fisopfs_mount_t));
+		}
+		free(mountpoint);
+		status = serve_mounts(&args, foreground);
+	}
+
+	fuse_opt_free_args(&args);
+	return status;
 }
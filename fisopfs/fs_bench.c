@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_lib.c"
+
+// # fisopfs-bench
+//
+// Mide cuántos getattr por segundo se pueden hacer según la cantidad de
+// hilos, comparando la lectura sin lock de fs_getattr con la misma búsqueda
+// hecha con el lock tomado. Mientras tanto un hilo modifica metadatos
+// continuamente, para que los lectores tengan que validar sus lecturas.
+//
+// También mide cuántos bloques por segundo se reservan y liberan según la
+// cantidad de hilos, con las listas por hilo de block_new/block_put y con
+// calloc/free directamente.
+//
+// Mide cuántas escrituras al final de un archivo por segundo se hacen según
+// la cantidad de hilos, todos sobre el mismo archivo o cada uno sobre el
+// suyo, con fs_append (lock compartido y lock de cola por archivo) y con
+// fs_write con el lock exclusivo.
+//
+// Mide cuántos pares de bloqueo y desbloqueo de rangos (fcntl) por segundo
+// se hacen según la cantidad de hilos, todos sobre rangos disjuntos del
+// mismo archivo, sin otros locks y con cada hilo reteniendo
+// LOCKS_RETENIDOS locks más.
+//
+// Por último mide cuántas búsquedas por nombre por segundo se hacen en el
+// índice de directorios de 1k a 1M entradas, con cada implementación de la
+// comparación de etiquetas que soporte la CPU y comparando nombre por nombre
+// con strcmp.
+//
+// Además mide cuántos bytes por segundo procesa cada implementación del
+// CRC32C que soporte la CPU, y cuánto tarda con cada una guardar una imagen
+// con todos los archivos llenos y verificar todos sus bloques.
+//
+// Uso: fisopfs-bench [-d milisegundos por medición]
+
+#define MAX_HILOS_BENCH 64
+#define DURACION_MS 200
+#define MAX_ENTRADAS_BENCH (1 << 20)
+#define IMAGEN_BENCH "./bench.dat"
+#define LOCKS_RETENIDOS 1024
+
+typedef struct bench {
+	fs_t *fs;
+	void *(*worker)(void *);
+	int baseline;  // medir la variante de comparación (con lock, calloc/free)
+	int same_file;  // todas las escrituras al final en el mismo archivo
+	size_t held_locks;  // locks que retiene cada hilo de lock_worker
+	int stop;
+	char paths[MAX_ARCHIVOS + MAX_DIRECTORIOS][MAX_NAME];
+	size_t n_paths;
+} bench_t;
+
+typedef struct bench_thread {
+	bench_t *bench;
+	size_t id;
+	size_t ops;
+	pthread_t thread;
+} bench_thread_t;
+
+static void *
+stat_worker(void *arg)
+{
+	bench_thread_t *t = arg;
+	bench_t *b = t->bench;
+	struct stat st;
+	size_t i = t->id;
+
+	while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+		for (int j = 0; j < 64; j++, i++) {
+			const char *path = b->paths[i % b->n_paths];
+			if (b->baseline) {
+				fs_lock(b->fs);
+				lookup_stat(b->fs, path, &st);
+				fs_unlock(b->fs);
+			} else {
+				fs_getattr(b->fs, path, &st);
+			}
+		}
+		t->ops += 64;
+	}
+
+	return NULL;
+}
+
+// Reserva y libera bloques de a 16, como al escribir un archivo nuevo
+static void *
+block_worker(void *arg)
+{
+	bench_thread_t *t = arg;
+	bench_t *b = t->bench;
+	fs_block_t *blocks[16];
+
+	while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+		for (int i = 0; i < 16; i++) {
+			blocks[i] = b->baseline ? calloc(1, sizeof(fs_block_t))
+			                         : block_new();
+			blocks[i]->data[0] = i;
+		}
+		for (int i = 0; i < 16; i++) {
+			if (b->baseline)
+				free(blocks[i]);
+			else
+				block_put(blocks[i]);
+		}
+		t->ops += 16;
+	}
+
+	return NULL;
+}
+
+// Agrega registros de 64 bytes al final de un archivo; cuando se llena, lo
+// vacía
+static void *
+append_worker(void *arg)
+{
+	bench_thread_t *t = arg;
+	bench_t *b = t->bench;
+	size_t file = b->same_file ? 0 : t->id % MAX_ARCHIVOS;
+	const char *path = b->paths[2 * file];
+	char record[64];
+	memset(record, 'r', sizeof(record));
+
+	while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+		int status;
+		if (b->baseline) {
+			fs_begin_update(b->fs);
+			off_t end = get_file(b->fs, path)->size;
+			status = fs_write(b->fs, path, record, sizeof(record), end);
+			fs_end_update(b->fs);
+		} else {
+			fs_lock_shared(b->fs);
+			status = fs_append(
+			        b->fs, path, record, sizeof(record), 0, 1);
+			fs_unlock(b->fs);
+		}
+
+		if (status == -EFBIG) {
+			fs_begin_update(b->fs);
+			fs_truncate(b->fs, path, 0);
+			fs_end_update(b->fs);
+			continue;
+		}
+		t->ops++;
+	}
+
+	return NULL;
+}
+
+// Bloquea y desbloquea rangos de un byte del primer archivo, intercalados
+// con los held_locks que retiene. Cada hilo usa su propia zona del archivo.
+static void *
+lock_worker(void *arg)
+{
+	bench_thread_t *t = arg;
+	bench_t *b = t->bench;
+	const char *path = b->paths[0];
+	uint64_t owner = t->id + 1;
+	off_t base = (off_t) t->id << 32;
+	struct flock lock = { .l_whence = SEEK_SET, .l_len = 1 };
+
+	lock.l_type = F_WRLCK;
+	for (size_t i = 0; i < b->held_locks; i++) {
+		lock.l_start = base + 2 * i;
+		fs_setlk(b->fs, path, owner, &lock, 0, NULL);
+	}
+
+	size_t next = 0;
+	while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+		lock.l_start = base + 2 * next + 1;
+		lock.l_type = F_WRLCK;
+		fs_setlk(b->fs, path, owner, &lock, 1, NULL);
+		lock.l_type = F_UNLCK;
+		fs_setlk(b->fs, path, owner, &lock, 0, NULL);
+		next = next + 1 < b->held_locks ? next + 1 : 0;
+		t->ops++;
+	}
+
+	fs_unlock_owner(b->fs, path, owner);
+	return NULL;
+}
+
+static void *
+update_worker(void *arg)
+{
+	bench_t *b = arg;
+	struct timespec ts[2] = { 0 };
+
+	while (!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+		fs_begin_update(b->fs);
+		ts[1].tv_sec++;
+		fs_utimens(b->fs, b->paths[0], ts);
+		fs_end_update(b->fs);
+		usleep(100);
+	}
+
+	return NULL;
+}
+
+// Búsqueda en el índice comparando nombre por nombre
+static ssize_t
+dir_index_find_strcmp(fs_d_entry_t *dir, const char *name)
+{
+	for (size_t i = 0; i < dir->n_entries; i++) {
+		if (strcmp(dir->entries[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// ## measure_lookups
+//
+// Busca durante ms milisegundos entradas de dir elegidas al azar, con kernel
+// o con strcmp si kernel es NULL.
+//
+// Devuelve la cantidad de búsquedas por segundo.
+//
+static double
+measure_lookups(fs_d_entry_t *dir, const tag_kernel_t *kernel, int ms)
+{
+	struct timespec start;
+	size_t ops = 0;
+	unsigned seed = 1;
+	char name[MAX_NAME];
+
+	if (kernel)
+		tag_kernel = kernel;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (int i = 0; i < 16; i++) {
+			size_t n = rand_r(&seed) % dir->n_entries;
+			snprintf(name, MAX_NAME, "e%zu", n);
+			ssize_t found = kernel ? dir_index_find(dir, name)
+			                       : dir_index_find_strcmp(dir, name);
+			if (found < 0)
+				abort();
+		}
+		ops += 16;
+	} while (elapsed_ms(&start) < ms);
+
+	return ops * 1000.0 / elapsed_ms(&start);
+}
+
+// ## measure_crc
+//
+// Calcula durante ms milisegundos el CRC32C de buffers de len bytes con
+// kernel.
+//
+// Devuelve la cantidad de bytes procesados por segundo.
+//
+static double
+measure_crc(const crc32c_kernel_t *kernel, const char *buf, size_t len, int ms)
+{
+	struct timespec start;
+	size_t bytes = 0;
+	uint32_t crc = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (int i = 0; i < 64; i++)
+			crc = kernel->update(crc, buf, len);
+		bytes += 64 * len;
+	} while (elapsed_ms(&start) < ms);
+
+	// Para que no se descarte el cálculo
+	if (crc == 1)
+		printf(" ");
+	return bytes * 1000.0 / elapsed_ms(&start);
+}
+
+// ## measure_image
+//
+// Guarda fs en una imagen y la vuelve a cargar verificando todos sus
+// bloques, con kernel. Deja en save_ms y scrub_ms cuánto tardó cada parte.
+//
+// Devuelve 0, o -1 si no se pudo guardar o cargar la imagen.
+//
+static int
+measure_image(fs_t *fs,
+              const crc32c_kernel_t *kernel,
+              double *save_ms,
+              double *scrub_ms)
+{
+	struct timespec start;
+	crc32c_kernel = kernel;
+
+	// Las sumas de los bloques en memoria se invalidan, para que se
+	// calculen con kernel
+	for (size_t i = 0; i < fs->f_size; i++) {
+		for (size_t j = 0; j < MAX_BLOQUES; j++) {
+			if (fs->files[i].blocks[j])
+				fs->files[i].blocks[j]->crc_valid = 0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (fs_save(IMAGEN_BENCH, fs) != 0)
+		return -1;
+	*save_ms = elapsed_ms(&start);
+
+	fs_t *loaded = fs_init(IMAGEN_BENCH);
+	if (!loaded)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t corrupt = image_scrub(loaded, loaded->image_n_blocks);
+	*scrub_ms = elapsed_ms(&start);
+	fs_free(loaded);
+
+	return corrupt == 0 ? 0 : -1;
+}
+
+// ## measure
+//
+// Corre n_threads hilos con b->worker durante ms milisegundos.
+//
+// Devuelve la cantidad de operaciones por segundo.
+//
+static double
+measure(bench_t *b, size_t n_threads, int ms)
+{
+	bench_thread_t threads[MAX_HILOS_BENCH] = { 0 };
+	pthread_t updater;
+
+	b->stop = 0;
+	pthread_create(&updater, NULL, update_worker, b);
+	for (size_t i = 0; i < n_threads; i++) {
+		threads[i].bench = b;
+		threads[i].id = i;
+		pthread_create(&threads[i].thread, NULL, b->worker, &threads[i]);
+	}
+
+	usleep(ms * 1000);
+	__atomic_store_n(&b->stop, 1, __ATOMIC_RELAXED);
+
+	size_t ops = 0;
+	for (size_t i = 0; i < n_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		ops += threads[i].ops;
+	}
+	pthread_join(updater, NULL);
+
+	return ops * 1000.0 / ms;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int ms = DURACION_MS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:")) != -1) {
+		if (opt != 'd' || (ms = atoi(optarg)) <= 0) {
+			fprintf(stderr, "Uso: %s [-d milisegundos]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	bench_t b = { .fs = fs_build() };
+	if (!b.fs)
+		return EXIT_FAILURE;
+
+	// Se llena el file system; la mitad de las búsquedas son de paths que
+	// existen y la otra mitad de paths que no.
+	for (size_t i = 0; i < MAX_ARCHIVOS; i++) {
+		char path[MAX_NAME];
+		snprintf(path, MAX_NAME, "/archivo%zu", i);
+		fs_create(b.fs, path, 0644);
+		strcpy(b.paths[b.n_paths++], path);
+		snprintf(b.paths[b.n_paths++], MAX_NAME, "/no_existe%zu", i);
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	printf("getattr por segundo (%ld CPUs, %d ms por medición)\n", cpus, ms);
+	printf("%6s %16s %16s\n", "hilos", "sin lock", "con lock");
+	b.worker = stat_worker;
+	for (size_t n = 1; n <= MAX_HILOS_BENCH; n *= 2) {
+		b.baseline = 0;
+		double lock_free = measure(&b, n, ms);
+		b.baseline = 1;
+		double locked = measure(&b, n, ms);
+		printf("%6zu %16.0f %16.0f\n", n, lock_free, locked);
+	}
+
+	printf("\nbloques reservados y liberados por segundo\n");
+	printf("%6s %16s %16s\n", "hilos", "listas por hilo", "calloc/free");
+	b.worker = block_worker;
+	for (size_t n = 1; n <= MAX_HILOS_BENCH; n *= 2) {
+		b.baseline = 0;
+		double cached = measure(&b, n, ms);
+		b.baseline = 1;
+		double direct = measure(&b, n, ms);
+		printf("%6zu %16.0f %16.0f\n", n, cached, direct);
+	}
+
+	printf("\nescrituras al final por segundo\n");
+	printf("%6s %16s %16s %16s %16s\n",
+	       "hilos",
+	       "mismo (rápido)",
+	       "mismo (lock)",
+	       "propio (rápido)",
+	       "propio (lock)");
+	b.worker = append_worker;
+	for (size_t n = 1; n <= MAX_HILOS_BENCH; n *= 2) {
+		double results[4];
+		for (int i = 0; i < 4; i++) {
+			b.same_file = i < 2;
+			b.baseline = i % 2;
+			results[i] = measure(&b, n, ms);
+		}
+		printf("%6zu %16.0f %16.0f %16.0f %16.0f\n",
+		       n,
+		       results[0],
+		       results[1],
+		       results[2],
+		       results[3]);
+	}
+	for (size_t i = 0; i < MAX_ARCHIVOS; i++)
+		fs_truncate(b.fs, b.paths[2 * i], 0);
+
+	printf("\nbloqueos y desbloqueos de rangos por segundo (mismo "
+	       "archivo)\n");
+	printf("%6s %16s %16s\n", "hilos", "sin otros locks", "1024 por hilo");
+	b.worker = lock_worker;
+	for (size_t n = 1; n <= MAX_HILOS_BENCH; n *= 2) {
+		b.held_locks = 0;
+		double alone = measure(&b, n, ms);
+		b.held_locks = LOCKS_RETENIDOS;
+		double held = measure(&b, n, ms);
+		printf("%6zu %16.0f %16.0f\n", n, alone, held);
+	}
+
+	printf("\nbúsquedas por nombre por segundo en un directorio\n");
+	printf("%8s", "entradas");
+	pthread_once(&tag_kernel_once, tag_kernel_select);
+	const tag_kernel_t *selected = tag_kernel;
+	for (size_t k = 0; k < N_TAG_KERNELS; k++) {
+		if (tag_kernel_supported(&tag_kernels[k]))
+			printf(" %12s", tag_kernels[k].name);
+	}
+	printf(" %12s\n", "strcmp");
+
+	fs_d_entry_t dir = { .path = ROOT };
+	for (size_t n = 1024; n <= MAX_ENTRADAS_BENCH; n *= 32) {
+		while (dir.n_entries < n) {
+			char path[MAX_NAME];
+			snprintf(path, MAX_NAME, "/e%zu", dir.n_entries);
+			if (dir_index_add(&dir, path) != 0)
+				return EXIT_FAILURE;
+		}
+
+		printf("%8zu", n);
+		for (size_t k = 0; k < N_TAG_KERNELS; k++) {
+			if (tag_kernel_supported(&tag_kernels[k]))
+				printf(" %12.0f", measure_lookups(&dir, &tag_kernels[k], ms));
+		}
+		printf(" %12.0f\n", measure_lookups(&dir, NULL, ms));
+	}
+	tag_kernel = selected;
+	free(dir.entries);
+	free(dir.tags);
+
+	static char crc_buf[1 << 20];
+	for (size_t i = 0; i < sizeof(crc_buf); i++)
+		crc_buf[i] = i * 31;
+	printf("\nMB por segundo de CRC32C según el tamaño del buffer\n");
+	printf("%8s %12s %12s %12s\n", "", "64 B", "4 KiB", "1 MiB");
+	pthread_once(&crc32c_once, crc32c_select);
+	const crc32c_kernel_t *selected_crc = crc32c_kernel;
+	for (size_t k = 0; k < N_CRC32C_KERNELS; k++) {
+		const crc32c_kernel_t *kernel = &crc32c_kernels[k];
+		if (!crc32c_kernel_supported(kernel))
+			continue;
+		printf("%8s", kernel->name);
+		for (size_t len = 64; len <= sizeof(crc_buf); len *= 128)
+			printf(" %12.0f",
+			       measure_crc(kernel, crc_buf, len, ms) / 1e6);
+		printf("\n");
+	}
+
+	// Todos los archivos llenos, con bloques distintos
+	for (size_t i = 0; i < b.fs->f_size; i++) {
+		for (size_t j = 0; j < MAX_BLOQUES; j++) {
+			crc_buf[0] = i;
+			crc_buf[1] = j;
+			fs_write(b.fs,
+			         b.fs->files[i].path,
+			         crc_buf,
+			         TAM_BLOQUE,
+			         j * TAM_BLOQUE);
+		}
+	}
+	printf("\nguardar y verificar una imagen de %zu bloques (ms)\n",
+	       b.fs->f_size * MAX_BLOQUES);
+	printf("%8s %12s %12s\n", "", "guardar", "verificar");
+	for (size_t k = 0; k < N_CRC32C_KERNELS; k++) {
+		const crc32c_kernel_t *kernel = &crc32c_kernels[k];
+		double save_ms, scrub_ms;
+		if (!crc32c_kernel_supported(kernel))
+			continue;
+		if (measure_image(b.fs, kernel, &save_ms, &scrub_ms) != 0)
+			return EXIT_FAILURE;
+		printf("%8s %12.2f %12.2f\n", kernel->name, save_ms, scrub_ms);
+	}
+	crc32c_kernel = selected_crc;
+	unlink(IMAGEN_BENCH);
+
+	printf("\n");
+	fs_arena_report(stdout);
+
+	fs_free(b.fs);
+	return EXIT_SUCCESS;
+}
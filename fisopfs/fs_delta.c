@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <libgen.h>
+
+// # Exportación de cambios
+//
+// (Se incluye después de fs_lib.c.)
+//
+// fisopfs-send escribe un delta con lo que cambió en una imagen desde una
+// transacción dada (ver txn_next) y fisopfs-recv lo aplica a otra imagen,
+// la réplica. Como se buscan los números de transacción mayores al de
+// partida, el delta sólo lleva el contenido de los bloques que cambiaron:
+// replicar cuesta según cuánto se modificó, no según el tamaño total.
+//
+// El delta empieza con una cabecera (fs_delta_header_t) seguida de un
+// registro (fs_delta_entry_t) por directorio, padres antes que hijos, y uno
+// por archivo, cada uno seguido de path_len bytes con el path (sin el '\0').
+// Se listan todas las entradas, así la réplica sabe qué se borró; de las
+// que no cambiaron sólo se manda el path. Al final van, archivo por
+// archivo, los n_blocks bloques que cambiaron de cada uno: un
+// fs_delta_block_t seguido de TAM_BLOQUE bytes, salvo que sea un hueco.
+//
+// Un delta desde la transacción n se aplica a una réplica de la misma
+// historia (fs->id) que ya tenga los cambios hasta n. Un delta desde la
+// transacción 0 tiene todo el contenido y reemplaza a cualquier réplica.
+
+#define DELTA_MAGIC "FISODLT"
+#define DELTA_VERSION 1
+
+typedef struct fs_delta_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_dirs;
+	uint32_t n_files;
+	uint32_t padding;
+	uint64_t id;     // historia del origen
+	uint64_t since;  // transacción de partida
+	uint64_t txn;    // última transacción del origen
+} fs_delta_header_t;
+
+// Los atributos sólo valen si changed es distinto de 0.
+typedef struct fs_delta_entry {
+	int64_t time_last_access;
+	int64_t time_last_modification;
+	int64_t time_creation;
+	uint64_t size;
+	uint64_t txn;
+	uint64_t birth;  // sólo archivos
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t n_blocks;  // sólo archivos
+	uint8_t changed;
+	uint8_t path_len;
+	uint8_t padding[6];
+} fs_delta_entry_t;
+
+typedef struct fs_delta_block {
+	uint64_t txn;
+	uint32_t index;
+	uint32_t hole;
+} fs_delta_block_t;
+
+typedef struct fs_delta_stats {
+	size_t entries;  // directorios y archivos que cambiaron
+	size_t blocks;   // bloques que cambiaron (con datos o huecos)
+} fs_delta_stats_t;
+
+// ## delta_write_entry
+//
+// Escribe el registro de una entrada seguido de su path.
+//
+// Devuelve 0, o -EIO si no se pudo escribir.
+//
+static int
+delta_write_entry(FILE *out, fs_delta_entry_t *entry, const char *path)
+{
+	entry->path_len = strlen(path);
+	if (fwrite(entry, sizeof(*entry), 1, out) != 1 ||
+	    fwrite(path, 1, entry->path_len, out) != entry->path_len)
+		return -EIO;
+	return 0;
+}
+
+// ## delta_file_entry
+//
+// Completa el registro de un archivo, contando los bloques que cambiaron
+// después de since.
+//
+static void
+delta_file_entry(fs_file_t *file, uint64_t since, fs_delta_entry_t *entry)
+{
+	memset(entry, 0, sizeof(*entry));
+	if (file->txn <= since)
+		return;
+
+	entry->changed = 1;
+	entry->mode = file->mode;
+	entry->uid = file->uid;
+	entry->gid = file->gid;
+	entry->time_last_access = file->time_last_access;
+	entry->time_last_modification = file->time_last_modification;
+	entry->time_creation = file->time_creation;
+	entry->size = file->size;
+	entry->txn = file->txn;
+	entry->birth = file->birth;
+	for (size_t i = 0; i < MAX_BLOQUES; i++)
+		entry->n_blocks += file->block_txn[i] > since;
+}
+
+// ## delta_write_blocks
+//
+// Escribe los bloques de un archivo que cambiaron después de since. Los
+// bloques que sólo están en la imagen se leen (y verifican) de a uno.
+//
+// Devuelve 0 o un error negativo.
+//
+static int
+delta_write_blocks(fs_t *fs, fs_file_t *file, uint64_t since, FILE *out)
+{
+	for (size_t i = 0; i < MAX_BLOQUES; i++) {
+		if (file->block_txn[i] <= since)
+			continue;
+
+		fs_delta_block_t block = { .txn = file->block_txn[i],
+			                   .index = i,
+			                   .hole = !file_has_block(file, i) };
+		char *data = block.hole ? NULL : file_block(fs, file, i, 0);
+		if (!block.hole && !data)
+			return -EIO;
+
+		if (fwrite(&block, sizeof(block), 1, out) != 1 ||
+		    (data && fwrite(data, TAM_BLOQUE, 1, out) != 1))
+			return -EIO;
+		fs_trim_cache(fs);
+	}
+
+	return 0;
+}
+
+// ## delta_send
+//
+// Escribe en out el delta de fs desde la transacción since.
+//
+// Devuelve 0, -EINVAL si since es posterior a la última transacción de fs,
+// o algún otro error negativo.
+//
+static int
+delta_send(fs_t *fs, uint64_t since, FILE *out, fs_delta_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	fs_lock(fs);
+
+	int status = 0;
+	if (since > fs->txn) {
+		status = -EINVAL;
+		goto out;
+	}
+
+	fs_delta_header_t header = { .magic = DELTA_MAGIC,
+		                     .version = DELTA_VERSION,
+		                     .n_dirs = fs->d_size,
+		                     .n_files = fs->f_size,
+		                     .id = fs->id,
+		                     .since = since,
+		                     .txn = fs->txn };
+	if (fwrite(&header, sizeof(header), 1, out) != 1) {
+		status = -EIO;
+		goto out;
+	}
+
+	// Un path es más largo que el de su padre, así que ordenar por largo
+	// deja a cada directorio después de su padre
+	size_t order[MAX_DIRECTORIOS];
+	for (size_t i = 0; i < fs->d_size; i++) {
+		size_t j = i;
+		size_t len = strlen(fs->directories[i].path);
+		fs_d_entry_t *dirs = fs->directories;
+		while (j > 0 && strlen(dirs[order[j - 1]].path) > len) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	for (size_t i = 0; i < fs->d_size && status == 0; i++) {
+		fs_d_entry_t *dir = &fs->directories[order[i]];
+		fs_delta_entry_t entry = { 0 };
+		if (dir->txn > since) {
+			entry.changed = 1;
+			entry.mode = dir->mode;
+			entry.uid = dir->uid;
+			entry.gid = dir->gid;
+			entry.time_last_access = dir->time_last_access;
+			entry.time_last_modification =
+			        dir->time_last_modification;
+			entry.time_creation = dir->time_creation;
+			entry.size = dir->size;
+			entry.txn = dir->txn;
+			stats->entries++;
+		}
+		status = delta_write_entry(out, &entry, dir->path);
+	}
+
+	for (size_t i = 0; i < fs->f_size && status == 0; i++) {
+		fs_delta_entry_t entry;
+		delta_file_entry(&fs->files[i], since, &entry);
+		stats->entries += entry.changed;
+		stats->blocks += entry.n_blocks;
+		status = delta_write_entry(out, &entry, fs->files[i].path);
+	}
+
+	for (size_t i = 0; i < fs->f_size && status == 0; i++) {
+		fs_file_t *file = &fs->files[i];
+		if (file->txn > since)
+			status = delta_write_blocks(fs, file, since, out);
+	}
+
+	if (status == 0 && fflush(out) != 0)
+		status = -EIO;
+
+out:
+	fs_unlock(fs);
+	return status;
+}
+
+// Entrada leída de un delta
+typedef struct delta_entry {
+	fs_delta_entry_t record;
+	char path[MAX_NAME];
+	fs_file_t *file;  // archivo de la réplica, después de crearlo
+} delta_entry_t;
+
+// ## delta_read_entries
+//
+// Lee n registros de entradas con sus paths.
+//
+// Devuelve 0, o -EINVAL si el delta está incompleto o es inválido.
+//
+static int
+delta_read_entries(FILE *in, delta_entry_t *entries, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		fs_delta_entry_t *r = &entries[i].record;
+		if (fread(r, sizeof(*r), 1, in) != 1 || r->path_len == 0 ||
+		    r->path_len >= MAX_NAME ||
+		    fread(entries[i].path, 1, r->path_len, in) != r->path_len)
+			return -EINVAL;
+		entries[i].path[r->path_len] = '\0';
+		entries[i].file = NULL;
+	}
+	return 0;
+}
+
+static delta_entry_t *
+delta_find(delta_entry_t *entries, size_t n, const char *path)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (strcmp(entries[i].path, path) == 0)
+			return &entries[i];
+	}
+	return NULL;
+}
+
+// ## delta_remove_missing
+//
+// Borra de la réplica los archivos que no están en el delta o que se
+// crearon después de since (otro archivo con el mismo path) y los
+// directorios que no están en el delta, con su contenido.
+//
+static void
+delta_remove_missing(fs_t *fs,
+                     uint64_t since,
+                     delta_entry_t *dirs,
+                     size_t n_dirs,
+                     delta_entry_t *files,
+                     size_t n_files)
+{
+	// remove_file mueve el último archivo al lugar del borrado
+	for (size_t i = fs->f_size; i-- > 0;) {
+		const char *path = fs->files[i].path;
+		delta_entry_t *e = delta_find(files, n_files, path);
+		if (!e || (e->record.changed && e->record.birth > since))
+			remove_file(fs, path, 0);
+	}
+
+	char paths[MAX_DIRECTORIOS][MAX_NAME];
+	size_t n = 0;
+	for (size_t i = 0; i < fs->d_size; i++) {
+		if (!delta_find(dirs, n_dirs, fs->directories[i].path))
+			strcpy(paths[n++], fs->directories[i].path);
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (get_dir(fs, paths[i]))
+			fs_rmtree(fs, paths[i]);
+	}
+}
+
+// ## delta_create_entry
+//
+// Busca en la réplica la entrada e, creándola si cambió y no existe.
+//
+// Devuelve 0, -ESTALE si no existe y es anterior a since (la réplica no
+// tiene los cambios hasta since), o algún otro error negativo.
+//
+static int
+delta_create_entry(fs_t *fs, delta_entry_t *e, int is_dir, uint64_t since)
+{
+	fs_d_entry_t *dir = get_dir(fs, e->path);
+	fs_file_t *file = get_file(fs, e->path);
+	if ((is_dir && dir) || (!is_dir && file)) {
+		e->file = file;
+		return 0;
+	}
+	if (!e->record.changed || (!is_dir && e->record.birth <= since))
+		return -ESTALE;
+	if (dir || file || strcmp(e->path, ROOT) == 0 || e->path[0] != '/')
+		return -EINVAL;
+
+	char temp_path[MAX_NAME];
+	strcpy(temp_path, e->path);
+	fs_d_entry_t *parent = get_dir(fs, dirname(temp_path));
+	if (!parent)
+		return -EINVAL;
+
+	if (is_dir) {
+		if (fs->d_size == MAX_DIRECTORIOS)
+			return -ENOSPC;
+		if (!fs_create_dir(fs, e->path, parent, e->record.mode))
+			return -ENOMEM;
+		return 0;
+	}
+
+	if (fs->f_size == MAX_ARCHIVOS)
+		return -ENOSPC;
+	e->file = fs_create_file(fs, e->path, parent, e->record.mode);
+	return e->file ? 0 : -ENOMEM;
+}
+
+// ## delta_read_blocks
+//
+// Lee los bloques de un archivo y los aplica a la réplica.
+//
+// Devuelve 0 o un error negativo.
+//
+static int
+delta_read_blocks(fs_t *fs, delta_entry_t *e, FILE *in, size_t *n_blocks)
+{
+	fs_file_t *file = e->file;
+	for (size_t n = 0; n < e->record.n_blocks; n++) {
+		fs_delta_block_t block;
+		if (fread(&block, sizeof(block), 1, in) != 1 ||
+		    block.index >= MAX_BLOQUES)
+			return -EINVAL;
+
+		if (block.hole) {
+			file_drop_block(fs, file, block.index);
+		} else {
+			char *data = file_block(fs, file, block.index, 1);
+			if (!data)
+				return -ENOMEM;
+			if (fread(data, TAM_BLOQUE, 1, in) != 1)
+				return -EINVAL;
+		}
+		file->block_txn[block.index] = block.txn;
+		(*n_blocks)++;
+		fs_trim_cache(fs);
+	}
+
+	return 0;
+}
+
+// ## delta_recv
+//
+// Aplica a fs el delta que se lee de in. Si falla, fs puede quedar a medio
+// actualizar, así que la réplica sólo se debe guardar si devuelve 0.
+//
+// Devuelve 0, -ESTALE si fs no es una réplica del origen que tenga los
+// cambios hasta la transacción de partida del delta, -EINVAL si el delta
+// está incompleto o es inválido, o algún otro error negativo.
+//
+static int
+delta_recv(fs_t *fs, FILE *in, fs_delta_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	fs_delta_header_t header;
+	if (fread(&header, sizeof(header), 1, in) != 1 ||
+	    memcmp(header.magic, DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0 ||
+	    header.version != DELTA_VERSION || header.n_dirs == 0 ||
+	    header.n_dirs > MAX_DIRECTORIOS || header.n_files > MAX_ARCHIVOS ||
+	    header.since > header.txn)
+		return -EINVAL;
+
+	if (header.since > 0 &&
+	    (fs->id != header.id || fs->txn < header.since ||
+	     fs->txn > header.txn))
+		return -ESTALE;
+
+	delta_entry_t *entries =
+	        calloc(header.n_dirs + header.n_files, sizeof(delta_entry_t));
+	if (!entries)
+		return -ENOMEM;
+	delta_entry_t *dirs = entries;
+	delta_entry_t *files = entries + header.n_dirs;
+
+	int status = delta_read_entries(in, dirs, header.n_dirs);
+	if (status == 0)
+		status = delta_read_entries(in, files, header.n_files);
+	if (status != 0 || strcmp(dirs[0].path, ROOT) != 0) {
+		free(entries);
+		return -EINVAL;
+	}
+
+	fs_begin_update(fs);
+	delta_remove_missing(
+	        fs, header.since, dirs, header.n_dirs, files, header.n_files);
+
+	for (size_t i = 0; i < header.n_dirs && status == 0; i++) {
+		delta_entry_t *e = &dirs[i];
+		status = delta_create_entry(fs, e, 1, header.since);
+		if (status != 0 || !e->record.changed)
+			continue;
+
+		fs_d_entry_t *dir = get_dir(fs, e->path);
+		dir->mode = e->record.mode;
+		dir->uid = e->record.uid;
+		dir->gid = e->record.gid;
+		dir->time_last_access = e->record.time_last_access;
+		dir->time_last_modification = e->record.time_last_modification;
+		dir->time_creation = e->record.time_creation;
+		dir->size = e->record.size;
+		dir->txn = e->record.txn;
+		stats->entries++;
+	}
+
+	for (size_t i = 0; i < header.n_files && status == 0; i++) {
+		delta_entry_t *e = &files[i];
+		status = delta_create_entry(fs, e, 0, header.since);
+		if (status != 0 || !e->record.changed)
+			continue;
+
+		if (e->record.size > MAX_CONTENIDO)
+			status = -EINVAL;
+		else
+			status = fs_truncate(fs, e->path, e->record.size);
+	}
+
+	// Como ya no se borran archivos, los de e->file no se mueven
+	for (size_t i = 0; i < header.n_files && status == 0; i++) {
+		delta_entry_t *e = &files[i];
+		if (!e->record.changed)
+			continue;
+
+		status = delta_read_blocks(fs, e, in, &stats->blocks);
+		if (status != 0)
+			break;
+
+		fs_file_t *file = e->file;
+		file->mode = e->record.mode;
+		file->uid = e->record.uid;
+		file->gid = e->record.gid;
+		file->time_last_access = e->record.time_last_access;
+		file->time_last_modification = e->record.time_last_modification;
+		file->time_creation = e->record.time_creation;
+		file->txn = e->record.txn;
+		file->birth = e->record.birth;
+		stats->entries++;
+	}
+
+	if (status == 0 && fgetc(in) != EOF)
+		status = -EINVAL;
+
+	if (status == 0) {
+		fs->txn = header.txn;
+		fs->id = header.id;
+	}
+	fs_end_update(fs);
+
+	free(entries);
+	return status;
+}
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fs_lib.c"
+
+// # fisopfs-fsck
+//
+// Verifica una imagen de fisopfs sin montarla y, opcionalmente, escribe una
+// copia compactada.
+//
+// Uso: fisopfs-fsck [-c destino] imagen
+//
+// Se verifican la cabecera, la tabla de segmentos, el CRC de cada segmento y
+// el de cada registro de metadatos y cada bloque de datos (que se leen de a
+// uno por vez, por lo que la memoria usada no depende del tamaño de la
+// imagen), y luego la coherencia de los metadatos: nombres, enlaces a
+// directorios padre, tamaños, números de bloque y números de transacción
+// (ninguno posterior a la última transacción de la imagen, y los de cada
+// bloque no posteriores a los de su archivo). Se informan como huérfanos
+// los bloques de datos que ningún archivo usa y las entradas que no llegan a
+// la raíz.
+//
+// Con -c, si la imagen no tiene errores, se escribe en destino una imagen
+// nueva sin bloques huérfanos y con los bloques de cada archivo contiguos.
+
+typedef struct fsck {
+	const char *image;
+	int fd;
+	fs_load_t load;
+	size_t errors;
+	size_t orphans;
+} fsck_t;
+
+static void
+fsck_error(fsck_t *fsck, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "%s: ", fsck->image);
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	fsck->errors++;
+}
+
+// ## check_header
+//
+// Lee y verifica la cabecera y la tabla de segmentos.
+//
+// Devuelve 0 si son válidas, -1 en caso contrario (y no se puede seguir).
+//
+static int
+check_header(fsck_t *fsck)
+{
+	fs_image_header_t *h = &fsck->load.header;
+	struct stat st;
+
+	if (fstat(fsck->fd, &st) != 0 ||
+	    read_full(fsck->fd, h, sizeof(*h), 0) != 0 ||
+	    memcmp(h->magic, IMAGEN_MAGIC, sizeof(IMAGEN_MAGIC)) != 0) {
+		fsck_error(fsck, "no es una imagen de fisopfs");
+		return -1;
+	}
+
+	if (h->version != IMAGEN_VERSION) {
+		fsck_error(fsck, "versión de formato %u desconocida", h->version);
+		return -1;
+	}
+
+	if (h->header_crc != crc32c(0, h, offsetof(fs_image_header_t, header_crc))) {
+		fsck_error(fsck, "el CRC de la cabecera no coincide");
+		return -1;
+	}
+
+	size_t max_segments =
+	        SEGMENTO_DATOS + (MAX_ARCHIVOS * MAX_BLOQUES) / BLOQUES_POR_SEGMENTO;
+	if (h->d_size == 0 || h->d_size > MAX_DIRECTORIOS ||
+	    h->f_size > MAX_ARCHIVOS || h->n_blocks > MAX_ARCHIVOS * MAX_BLOQUES ||
+	    h->n_segments > max_segments) {
+		fsck_error(fsck,
+		           "cantidades fuera de rango: %u directorios, %u "
+		           "archivos, %lu bloques, %u segmentos",
+		           h->d_size,
+		           h->f_size,
+		           (unsigned long) h->n_blocks,
+		           h->n_segments);
+		return -1;
+	}
+
+	size_t table_len = h->n_segments * sizeof(fs_segment_t);
+	fsck->load.segments = malloc(table_len);
+	if (!fsck->load.segments ||
+	    read_full(fsck->fd, fsck->load.segments, table_len, sizeof(*h)) != 0 ||
+	    h->table_crc != crc32c(0, fsck->load.segments, table_len)) {
+		fsck_error(fsck, "la tabla de segmentos está dañada");
+		return -1;
+	}
+
+	if (check_segments(&fsck->load, st.st_size) != 0) {
+		fsck_error(fsck, "la tabla de segmentos no es coherente");
+		return -1;
+	}
+
+	return 0;
+}
+
+// ## check_record_crcs
+//
+// Verifica el CRC de cada registro de metadatos, para señalar cuáles están
+// dañados.
+//
+static void
+check_record_crcs(fsck_t *fsck)
+{
+	fs_image_header_t *h = &fsck->load.header;
+	fs_dir_record_t *dirs = (fs_dir_record_t *) fsck->load.meta;
+	fs_file_record_t *files = (fs_file_record_t *) (dirs + h->d_size);
+
+	for (size_t i = 0; i < h->d_size; i++) {
+		if (dirs[i].crc != DIR_RECORD_CRC(&dirs[i]))
+			fsck_error(fsck,
+			           "directorio %zu: el CRC del registro no coincide",
+			           i);
+	}
+
+	for (size_t i = 0; i < h->f_size; i++) {
+		if (files[i].crc != FILE_RECORD_CRC(&files[i]))
+			fsck_error(fsck,
+			           "archivo %zu: el CRC del registro no coincide",
+			           i);
+	}
+}
+
+// ## check_block_crcs
+//
+// Verifica cada bloque de datos contra su suma.
+//
+static void
+check_block_crcs(fsck_t *fsck)
+{
+	fs_image_header_t *h = &fsck->load.header;
+	char data[TAM_BLOQUE];
+
+	for (size_t i = SEGMENTO_DATOS; i < h->n_segments; i++) {
+		fs_segment_t *segment = &fsck->load.segments[i];
+		for (size_t j = 0; j < segment->length / TAM_BLOQUE; j++) {
+			size_t b = segment->first_block + j;
+			off_t off = segment->offset + j * TAM_BLOQUE;
+			if (read_full(fsck->fd, data, TAM_BLOQUE, off) != 0 ||
+			    crc32c(0, data, TAM_BLOQUE) != fsck->load.sums[b])
+				fsck_error(fsck,
+				           "el CRC del bloque %zu no coincide",
+				           b + 1);
+		}
+	}
+}
+
+// ## check_segment_crcs
+//
+// Verifica el CRC de los segmentos de metadatos, nombres y sumas, que quedan
+// en memoria para las verificaciones siguientes, y el de cada registro de
+// metadatos y cada bloque de datos.
+//
+// Devuelve 0 si los metadatos y los nombres son legibles, -1 en caso
+// contrario.
+//
+static int
+check_segment_crcs(fsck_t *fsck)
+{
+	static const char *const kinds[] = { "metadatos", "nombres", "sumas" };
+	int damaged = 0;
+
+	for (size_t i = 0; i < SEGMENTO_DATOS; i++) {
+		if (load_segment(&fsck->load, &fsck->load.segments[i]) != 0) {
+			fsck_error(fsck,
+			           "el segmento de %s está dañado",
+			           kinds[i]);
+			damaged |= 1 << i;
+		}
+	}
+
+	// Con los registros se puede señalar qué parte de los metadatos está
+	// dañada, pero no se sigue verificando su contenido
+	if (fsck->load.meta)
+		check_record_crcs(fsck);
+
+	if (fsck->load.sums && !(damaged & (1 << SEGMENTO_SUMAS)))
+		check_block_crcs(fsck);
+
+	return damaged & ~(1 << SEGMENTO_SUMAS) ? -1 : 0;
+}
+
+// ## check_name
+//
+// Verifica que el nombre de una entrada sea válido y coherente con el de su
+// directorio padre.
+//
+static void
+check_name(fsck_t *fsck, const char *kind, size_t i, uint32_t name, int32_t parent)
+{
+	fs_dir_record_t *dirs = (fs_dir_record_t *) fsck->load.meta;
+	char path[MAX_NAME];
+	char parent_path[MAX_NAME];
+
+	if (record_name(&fsck->load, name, path) != 0) {
+		fsck_error(fsck, "%s %zu: nombre inválido", kind, i);
+		return;
+	}
+
+	if (parent < 0) {
+		if (strcmp(path, ROOT) != 0)
+			fsck_error(fsck, "la raíz se llama '%s'", path);
+		return;
+	}
+
+	if (path[0] != '/' || strcmp(path, ROOT) == 0) {
+		fsck_error(fsck, "%s %zu: nombre inválido '%s'", kind, i, path);
+		return;
+	}
+
+	if (record_name(&fsck->load, dirs[parent].name, parent_path) != 0)
+		return;
+
+	char temp_path[MAX_NAME];
+	strcpy(temp_path, path);
+	if (strcmp(dirname(temp_path), parent_path) != 0)
+		fsck_error(fsck,
+		           "%s '%s' no está dentro de su directorio padre '%s'",
+		           kind,
+		           path,
+		           parent_path);
+}
+
+// ## check_metadata
+//
+// Verifica los registros de directorios y archivos: nombres, enlaces a
+// directorios padre (que lleguen a la raíz sin ciclos), nombres repetidos,
+// tamaños, números de bloque y números de transacción. Marca en used los
+// bloques que usa algún archivo.
+//
+static void
+check_metadata(fsck_t *fsck, unsigned char *used)
+{
+	fs_image_header_t *h = &fsck->load.header;
+	fs_dir_record_t *dirs = (fs_dir_record_t *) fsck->load.meta;
+	fs_file_record_t *files = (fs_file_record_t *) (dirs + h->d_size);
+
+	if (dirs[0].parent != -1)
+		fsck_error(fsck, "la raíz tiene directorio padre");
+
+	for (size_t i = 0; i < h->d_size; i++) {
+		int32_t parent = dirs[i].parent;
+		if (i > 0 && (parent < 0 || parent >= (int32_t) h->d_size)) {
+			fsck_error(fsck, "directorio %zu: padre %d inexistente", i, parent);
+			fsck->orphans++;
+			continue;
+		}
+
+		// Se sube por los padres: si no se llega a la raíz hay un ciclo
+		size_t steps = 0;
+		while (parent > 0 && steps++ < h->d_size)
+			parent = dirs[parent].parent;
+		if (i > 0 && parent != 0) {
+			fsck_error(fsck, "directorio %zu: no llega a la raíz", i);
+			fsck->orphans++;
+			continue;
+		}
+
+		check_name(fsck, "directorio", i, dirs[i].name, i > 0 ? dirs[i].parent : -1);
+
+		if (dirs[i].txn > h->txn)
+			fsck_error(fsck,
+			           "directorio %zu: transacción %lu posterior "
+			           "a la de la imagen",
+			           i,
+			           (unsigned long) dirs[i].txn);
+	}
+
+	for (size_t i = 0; i < h->f_size; i++) {
+		int32_t parent = files[i].parent;
+		if (parent < 0 || parent >= (int32_t) h->d_size) {
+			fsck_error(fsck, "archivo %zu: directorio %d inexistente", i, parent);
+			fsck->orphans++;
+		} else {
+			check_name(fsck, "archivo", i, files[i].name, parent);
+		}
+
+		if (files[i].size > MAX_CONTENIDO)
+			fsck_error(fsck,
+			           "archivo %zu: tamaño %lu mayor al máximo",
+			           i,
+			           (unsigned long) files[i].size);
+
+		if (files[i].txn > h->txn || files[i].birth > files[i].txn)
+			fsck_error(fsck,
+			           "archivo %zu: transacciones incoherentes "
+			           "(creación %lu, última %lu)",
+			           i,
+			           (unsigned long) files[i].birth,
+			           (unsigned long) files[i].txn);
+
+		for (size_t j = 0; j < MAX_BLOQUES; j++) {
+			uint32_t n = files[i].blocks[j];
+			if (n > h->n_blocks)
+				fsck_error(fsck, "archivo %zu: bloque %u inexistente", i, n);
+			else if (n > 0)
+				used[n - 1] = 1;
+
+			if (files[i].block_txn[j] > files[i].txn)
+				fsck_error(fsck,
+				           "archivo %zu: bloque %zu con "
+				           "transacción posterior a la del "
+				           "archivo",
+				           i,
+				           j);
+		}
+	}
+
+	// Nombres repetidos (la cantidad de entradas está acotada)
+	size_t n_entries = h->d_size + h->f_size;
+	for (size_t i = 0; i < n_entries; i++) {
+		uint32_t a = i < h->d_size ? dirs[i].name : files[i - h->d_size].name;
+		char path_a[MAX_NAME];
+		if (record_name(&fsck->load, a, path_a) != 0)
+			continue;
+
+		for (size_t j = i + 1; j < n_entries; j++) {
+			uint32_t b = j < h->d_size ? dirs[j].name
+			                           : files[j - h->d_size].name;
+			char path_b[MAX_NAME];
+			if (record_name(&fsck->load, b, path_b) == 0 &&
+			    strcmp(path_a, path_b) == 0)
+				fsck_error(fsck, "'%s' aparece más de una vez", path_a);
+		}
+	}
+
+	for (size_t b = 0; b < h->n_blocks; b++) {
+		if (!used[b]) {
+			printf("%s: bloque de datos %zu huérfano\n", fsck->image, b + 1);
+			fsck->orphans++;
+		}
+	}
+}
+
+// ## compact
+//
+// Escribe en dest una copia compactada de la imagen.
+//
+// Devuelve 0 si pudo escribirla, -1 en caso contrario.
+//
+static int
+compact(const char *image, const char *dest)
+{
+	fs_t *fs = fs_init(image);
+	if (!fs)
+		return -1;
+
+	int status = fs_save(dest, fs);
+	fs_free(fs);
+	return status;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *dest = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		if (opt != 'c') {
+			fprintf(stderr, "Uso: %s [-c destino] imagen\n", argv[0]);
+			return 2;
+		}
+		dest = optarg;
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "Uso: %s [-c destino] imagen\n", argv[0]);
+		return 2;
+	}
+
+	fsck_t fsck = { .image = argv[optind] };
+	pthread_mutex_init(&fsck.load.lock, NULL);
+	fsck.fd = fsck.load.fd = open(fsck.image, O_RDONLY);
+	if (fsck.fd < 0) {
+		perror(fsck.image);
+		return 2;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	unsigned char *used = NULL;
+	int valid_header = check_header(&fsck) == 0;
+	if (valid_header && check_segment_crcs(&fsck) == 0) {
+		used = calloc(fsck.load.header.n_blocks + 1, 1);
+		if (used)
+			check_metadata(&fsck, used);
+		else
+			fsck_error(&fsck, "no hay memoria suficiente");
+	}
+
+	fs_image_header_t *h = &fsck.load.header;
+	if (valid_header)
+		printf("%s: %u directorios, %u archivos, %lu bloques, "
+		       "transacción %lu\n",
+		       fsck.image,
+		       h->d_size,
+		       h->f_size,
+		       (unsigned long) h->n_blocks,
+		       (unsigned long) h->txn);
+	printf("%s: %zu errores, %zu huérfanos (%.2f ms)\n",
+	       fsck.image,
+	       fsck.errors,
+	       fsck.orphans,
+	       elapsed_ms(&start));
+
+	close(fsck.fd);
+	free(used);
+	free(fsck.load.segments);
+	free(fsck.load.meta);
+	free(fsck.load.names);
+	free(fsck.load.sums);
+
+	if (fsck.errors > 0)
+		return EXIT_FAILURE;
+
+	if (dest) {
+		if (compact(fsck.image, dest) != 0) {
+			fprintf(stderr, "%s: no se pudo escribir la imagen compactada\n", dest);
+			return EXIT_FAILURE;
+		}
+		printf("%s: imagen compactada escrita en %s\n", fsck.image, dest);
+	}
+
+	return EXIT_SUCCESS;
+}
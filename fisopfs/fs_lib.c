@@ -8,6 +8,33 @@
 #include <libgen.h>
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/statvfs.h>
+#include <sched.h>
+#include <sys/random.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Mensajes de depuración ("[debug] ...") por la salida estándar. Quien
+// incluye este archivo y no debe escribir en la salida estándar del proceso
+// (libfisopfs) define FS_DEBUG en 0 antes de incluirlo.
+#ifndef FS_DEBUG
+#define FS_DEBUG 1
+#endif
+
+#define fs_debug(...)                                                          \
+	do {                                                                   \
+		if (FS_DEBUG)                                                  \
+			printf(__VA_ARGS__);                                   \
+	} while (0)
 
 #define F_WRITE "w"
 #define F_READ "r"
@@ -16,12 +43,99 @@
 
 #define MAX_DIRECTORIOS 20
 #define MAX_ARCHIVOS 20
-#define MAX_CONTENIDO 100
 #define MAX_NAME 50
 
+// El contenido de un archivo se divide en bloques de TAM_BLOQUE bytes que se
+// reservan recién cuando reciben datos. Un bloque sin reservar (NULL) es un
+// hueco y se lee como ceros.
+#define TAM_BLOQUE 4096
+#define MAX_BLOQUES 256
+#define MAX_CONTENIDO (TAM_BLOQUE * MAX_BLOQUES)
+
+// Cantidad de bloques leídos de la imagen que se mantienen en memoria antes
+// de empezar a descartarlos.
+#define MAX_BLOQUES_EN_CACHE 1024
+
+// Filtro de Bloom de los paths existentes, para responder rápido las
+// búsquedas de paths que no existen.
+#define BLOOM_BITS 8192
+#define BLOOM_HASHES 4
+
+// Las búsquedas por nombre comparan etiquetas de un byte de a
+// GRUPO_ETIQUETAS por vez; los arreglos de etiquetas se redondean a un
+// múltiplo de esa cantidad.
+#define GRUPO_ETIQUETAS 32
+#define ETIQUETAS(n)                                                           \
+	(((n) + GRUPO_ETIQUETAS - 1) / GRUPO_ETIQUETAS * GRUPO_ETIQUETAS)
+
+// Bloques que un archivo reserva como máximo de una vez para las escrituras
+// al final (ver file_take_reserved).
+#define MAX_RESERVA_COLA 32
+
+// Los contadores de uso (ver fs_statfs) se reparten en RANURAS_USO ranuras,
+// una por CPU. Salvo que se configure otra, la capacidad que se informa es
+// la de todos los archivos con el tamaño máximo.
+#define RANURAS_USO 64
+#define CAPACIDAD_BLOQUES (MAX_ARCHIVOS * MAX_BLOQUES)
+
+// Intentos de una lectura sin lock antes de tomar el lock.
+#define MAX_REINTENTOS_LECTURA 64
+
+// Reserva de bloques: cada hilo guarda bloques libres y los pide o devuelve
+// de a LOTE_BLOQUES a una reserva global.
+#define LOTE_BLOQUES 32
+
+// Arenas: los bloques se toman de regiones de TAM_ARENA_BLOQUES bytes
+// alineadas a páginas enormes de TAM_PAGINA_ENORME bytes.
+#define TAM_PAGINA_ENORME (2UL << 20)
+#define TAM_ARENA_BLOQUES (16 * TAM_PAGINA_ENORME)
+
+// Región de memoria mapeada con arena_map (ver "Arenas").
+typedef struct arena {
+	char *base;
+	size_t len;
+	int hugetlb;  // mapeada con MAP_HUGETLB
+} arena_t;
+
+// Un bloque puede estar compartido por varios archivos (o varias posiciones
+// de un mismo archivo) después de un copy_file_range: refs cuenta cuántas
+// referencias tiene, y se copia antes de modificarlo si refs > 1.
+//
+// crc es el CRC32C de data si crc_valid es distinto de 0: se conoce al leer
+// el bloque de la imagen y deja de valer cuando se lo modifica (ver
+// file_block), por lo que al guardar sólo se calcula el de los bloques
+// modificados.
+typedef struct fs_block {
+	union {
+		size_t refs;
+		struct fs_block *next_free;  // en una lista de bloques libres
+	};
+	char data[TAM_BLOQUE];
+	uint32_t crc;
+	int crc_valid;
+} fs_block_t;
+
+// Entrada del índice de un directorio. La cookie identifica a la entrada
+// mientras exista: es el offset que recibe readdir para seguir listando.
+typedef struct fs_dirent {
+	off_t cookie;
+	char name[MAX_NAME];
+} fs_dirent_t;
+
 typedef struct fs_d_entry {
 	char path[MAX_NAME];
 	struct fs_d_entry *d_parent;
+	// Índice de los archivos y subdirectorios, ordenado por cookie. Las
+	// cookies se asignan en orden creciente y no se reutilizan. tags tiene
+	// la etiqueta del nombre de cada entrada (ver tags_next), con lugar
+	// para cap_entries etiquetas. De las n_entries entradas, n_removed
+	// están quitadas (ver dir_index_remove).
+	fs_dirent_t *entries;
+	uint8_t *tags;
+	size_t n_entries;
+	size_t cap_entries;
+	size_t n_removed;
+	off_t next_cookie;
 	// Stats:
 	mode_t mode;
 	uid_t uid;
@@ -30,12 +144,18 @@ typedef struct fs_d_entry {
 	time_t time_last_modification;
 	time_t time_creation;
 	size_t size;
+
+	uint64_t txn;  // última transacción que lo modificó (ver txn_next)
 } fs_d_entry_t;
 
 typedef struct fs_file {
 	char path[MAX_NAME];
 	fs_d_entry_t *entry;
-	char content[MAX_CONTENIDO];
+	fs_block_t *blocks[MAX_BLOQUES];
+	// Bloque de la imagen que respalda a cada bloque (0 si no hay ninguno).
+	// Un bloque respaldado puede no estar en memoria (blocks[i] == NULL):
+	// se lee de la imagen la primera vez que se lo usa.
+	uint32_t image[MAX_BLOQUES];
 	// Stats:
 	mode_t mode;
 	uid_t uid;
@@ -44,15 +164,455 @@ typedef struct fs_file {
 	time_t time_last_modification;
 	time_t time_creation;
 	size_t size;
+
+	// Bloques en cero reservados para las escrituras al final (ver
+	// fs_appendv), y cuántos se reservan la próxima vez.
+	fs_block_t *reserve[MAX_RESERVA_COLA];
+	size_t n_reserve;
+	size_t reserve_chunk;
+
+	// Locks de fcntl y de flock (ver file_lock_tree)
+	struct fs_lock_tree *locks;
+
+	// Transacción en la que se creó, la última que lo modificó y la última
+	// que modificó cada bloque (ver txn_next)
+	uint64_t birth;
+	uint64_t txn;
+	uint64_t block_txn[MAX_BLOQUES];
 } fs_file_t;
 
+// Parte de los contadores de uso que actualiza una CPU. Cada ranura ocupa su
+// propia línea de caché, para que CPUs distintas no se la disputen.
+typedef struct fs_usage_slot {
+	int64_t inodes;
+	int64_t blocks;
+	int64_t bytes;
+} __attribute__((aligned(64))) fs_usage_slot_t;
+
 typedef struct fs {
 	fs_d_entry_t directories[MAX_DIRECTORIOS];
 	size_t d_size;
 	fs_file_t files[MAX_ARCHIVOS];
 	size_t f_size;
+
+	// Carga de bloques bajo demanda desde la imagen
+	int image_fd;
+	struct fs_segment *image_segments;  // segmentos de datos de la imagen
+	size_t image_n_segments;
+	size_t image_n_blocks;
+	uint32_t *image_crcs;     // CRC de cada bloque de datos de la imagen
+	uint8_t *image_verified;  // estado de cada bloque (image_check_block)
+	// Bloque en memoria con el contenido de cada bloque de la imagen, si
+	// hay alguno (ver file_load_block)
+	struct fs_block **image_loaded;
+	size_t cached;  // bloques respaldados por la imagen en memoria
+	size_t max_cached;
+	size_t evict_hand;
+
+	// Sólo lectura (ver fs_init_read_only): la imagen está mapeada entera
+	// y no se modifica nada, ni siquiera los tiempos de acceso
+	int read_only;
+	const char *image_map;
+	size_t image_map_len;
+
+	// Filtro de Bloom con los paths de todos los directorios y archivos.
+	// Si un path no está en el filtro, no existe. Los borrados no se pueden
+	// quitar del filtro: se cuentan y cada tanto se lo vuelve a armar.
+	uint64_t bloom[BLOOM_BITS / 64];
+	size_t bloom_removed;
+
+	// Etiqueta del path de cada directorio y archivo (ver tags_next)
+	uint8_t dir_tags[ETIQUETAS(MAX_DIRECTORIOS)];
+	uint8_t file_tags[ETIQUETAS(MAX_ARCHIVOS)];
+
+	// Las operaciones toman lock, salvo getattr, que lee sin lock y se
+	// valida con seq (ver fs_getattr). Las escrituras al final lo toman
+	// compartido y se ordenan con el lock de cola de cada archivo
+	// (tail_locks, por posición en files) y con seq_lock.
+	pthread_rwlock_t lock;
+	unsigned seq;  // impar mientras se modifican los metadatos
+	pthread_mutex_t seq_lock;
+	pthread_mutex_t tail_locks[MAX_ARCHIVOS];
+
+	// Commits agrupados de fs_fsync
+	pthread_mutex_t commit_lock;
+	pthread_cond_t commit_done;
+	uint64_t commit_requested;  // último pedido de commit
+	uint64_t commit_durable;    // último pedido cubierto por un commit
+	int commit_running;
+	int commit_status;           // resultado del último commit
+	uint64_t committed_txn;      // txn de la última imagen guardada
+	long commit_window_us;       // cuánto espera un commit a otros pedidos
+	size_t commits;              // imágenes guardadas por fs_fsync
+
+	// Verificación en segundo plano de los bloques de la imagen (ver
+	// fs_scrub_start)
+	pthread_mutex_t scrub_lock;
+	pthread_cond_t scrub_wake;
+	pthread_t scrub_thread;
+	int scrub_running;
+	int scrub_stop;
+	size_t scrub_next;  // próximo bloque a verificar
+
+	// Liberación en segundo plano de los bloques de los árboles borrados
+	// con fs_rmtree (ver reclaim_worker)
+	pthread_mutex_t reclaim_lock;
+	pthread_cond_t reclaim_wake;
+	pthread_t reclaim_thread;
+	int reclaim_running;
+	int reclaim_stop;
+	int reclaim_busy;  // el hilo está soltando bloques
+	struct fs_reclaim *reclaim_pending;
+	size_t reclaimed;  // bloques soltados por el hilo
+
+	// Inodos, bloques y bytes ocupados (ver usage_add) y capacidad en
+	// bloques que informa fs_statfs
+	fs_usage_slot_t usage[RANURAS_USO];
+	size_t capacity;
+
+	// Última transacción y el identificador de la historia a la que
+	// pertenece (ver txn_next), que se conservan en la imagen
+	uint64_t txn;
+	uint64_t id;
+
+	// Eventos de los cambios (ver fs_events_open): NULL hasta que alguien
+	// los lee. event_notify, si no es NULL, se llama después de cada evento
+	// nuevo.
+	struct fs_events *events;
+	void (*event_notify)(void *arg);
+	void *event_notify_arg;
+
+	arena_t arena;  // región en la que está este fs_t (ver fs_alloc)
 } fs_t;
 
+static int image_read_block(fs_t *fs, uint32_t n, char *data);
+static const char *image_map_block(fs_t *fs, uint32_t n);
+static void fs_scrub_stop(fs_t *fs);
+
+// # Concurrencia
+//
+// Todas las operaciones se hacen con fs->lock tomado, salvo fs_getattr (y la
+// búsqueda de paths que hace), que es la más frecuente y no toma ningún lock
+// ni modifica nada compartido: es un seqlock. Las operaciones que modifican
+// lo que ve fs_getattr incrementan fs->seq antes y después (queda impar
+// mientras tanto), y fs_getattr repite la lectura si seq era impar o cambió.
+//
+// Las entradas viven en los arreglos de fs_t, que no se liberan mientras el
+// sistema de archivos existe, así que un lector nunca accede a memoria
+// liberada: a lo sumo lee datos a medio escribir, y en ese caso seq cambió y
+// descarta el resultado. Por eso no hace falta diferir liberaciones (el
+// índice de cada directorio sí se libera, pero fs_getattr no lo usa).
+//
+// fs->lock es un lock de lectura y escritura: todas las operaciones lo
+// toman en modo exclusivo salvo las escrituras al final de un archivo
+// (fs_appendv), que lo toman compartido. Así, los archivos no se crean,
+// borran ni mueven mientras tanto y varias escrituras al final de archivos
+// distintos avanzan en paralelo; las de un mismo archivo se ordenan con su
+// lock de cola, y como pueden ser varias a la vez, incrementan seq con
+// seq_lock tomado.
+//
+// Un sistema de archivos de sólo lectura no cambia nunca después de
+// cargarlo, así que no hace falta ningún lock: fs_lock y las demás no hacen
+// nada y las lecturas van directo a la imagen mapeada.
+
+// ## seq_write_begin
+//
+// Marca el comienzo de una modificación de lo que lee fs_getattr.
+//
+static void
+seq_write_begin(fs_t *fs)
+{
+	__atomic_store_n(&fs->seq, fs->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// ## seq_write_end
+//
+// Publica una modificación de lo que lee fs_getattr.
+//
+static void
+seq_write_end(fs_t *fs)
+{
+	__atomic_store_n(&fs->seq, fs->seq + 1, __ATOMIC_RELEASE);
+}
+
+// ## fs_lock
+//
+// Toma el lock para una operación que no modifica lo que lee fs_getattr
+// (lectura de archivos y directorios).
+//
+static void
+fs_lock(fs_t *fs)
+{
+	if (!fs->read_only)
+		pthread_rwlock_wrlock(&fs->lock);
+}
+
+static void
+fs_unlock(fs_t *fs)
+{
+	if (!fs->read_only)
+		pthread_rwlock_unlock(&fs->lock);
+}
+
+// ## fs_lock_shared
+//
+// Toma el lock para escrituras al final de un archivo (ver fs_appendv). Se
+// suelta con fs_unlock.
+//
+static void
+fs_lock_shared(fs_t *fs)
+{
+	if (!fs->read_only)
+		pthread_rwlock_rdlock(&fs->lock);
+}
+
+// ## fs_init_locks
+//
+// Inicializa los locks de un sistema de archivos recién creado.
+//
+static void
+fs_init_locks(fs_t *fs)
+{
+	// Con preferencia por los escritores, para que las escrituras al final
+	// no demoren indefinidamente al resto de las operaciones
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(
+	        &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&fs->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	pthread_mutex_init(&fs->seq_lock, NULL);
+	for (size_t i = 0; i < MAX_ARCHIVOS; i++)
+		pthread_mutex_init(&fs->tail_locks[i], NULL);
+	pthread_mutex_init(&fs->commit_lock, NULL);
+	pthread_cond_init(&fs->commit_done, NULL);
+	pthread_mutex_init(&fs->scrub_lock, NULL);
+	pthread_cond_init(&fs->scrub_wake, NULL);
+	pthread_mutex_init(&fs->reclaim_lock, NULL);
+	pthread_cond_init(&fs->reclaim_wake, NULL);
+}
+
+// ## fs_begin_update
+//
+// Toma el lock para una operación que modifica metadatos.
+//
+static void
+fs_begin_update(fs_t *fs)
+{
+	if (fs->read_only)
+		return;
+	pthread_rwlock_wrlock(&fs->lock);
+	seq_write_begin(fs);
+}
+
+static void
+fs_end_update(fs_t *fs)
+{
+	if (fs->read_only)
+		return;
+	seq_write_end(fs);
+	pthread_rwlock_unlock(&fs->lock);
+}
+
+// ## path_hash
+//
+// Hash FNV-1a de 64 bits de un path.
+//
+static uint64_t
+path_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (const unsigned char *p = (const unsigned char *) path; *p; p++) {
+		h ^= *p;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+// ## bloom_add
+//
+// Agrega un path al filtro de Bloom. Las BLOOM_HASHES posiciones se derivan
+// de un solo hash (h1 + i * h2).
+//
+static void
+bloom_add(fs_t *fs, const char *path)
+{
+	uint64_t h = path_hash(path);
+	uint64_t h2 = (h >> 32) | 1;
+	for (size_t i = 0; i < BLOOM_HASHES; i++, h += h2) {
+		size_t bit = h % BLOOM_BITS;
+		fs->bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+// ## bloom_test
+//
+// Devuelve 0 si el path con hash h seguro no existe, 1 si puede existir.
+//
+static int
+bloom_test(fs_t *fs, uint64_t h)
+{
+	uint64_t h2 = (h >> 32) | 1;
+	for (size_t i = 0; i < BLOOM_HASHES; i++, h += h2) {
+		size_t bit = h % BLOOM_BITS;
+		if (!(fs->bloom[bit / 64] & (1ULL << (bit % 64))))
+			return 0;
+	}
+	return 1;
+}
+
+// ## bloom_may_contain
+//
+// Devuelve 0 si el path seguro no existe, 1 si puede existir.
+//
+static int
+bloom_may_contain(fs_t *fs, const char *path)
+{
+	return bloom_test(fs, path_hash(path));
+}
+
+// ## bloom_removal
+//
+// Registra que se borró una entrada. Cuando hubo más borrados que entradas
+// vivas se vuelve a armar el filtro, para que los paths borrados dejen de
+// dar falsos positivos (el costo queda amortizado entre los borrados).
+//
+static void
+bloom_removal(fs_t *fs)
+{
+	if (++fs->bloom_removed <= fs->d_size + fs->f_size)
+		return;
+
+	memset(fs->bloom, 0, sizeof(fs->bloom));
+	for (size_t i = 0; i < fs->d_size; i++)
+		bloom_add(fs, fs->directories[i].path);
+	for (size_t i = 0; i < fs->f_size; i++)
+		bloom_add(fs, fs->files[i].path);
+	fs->bloom_removed = 0;
+}
+
+// # Comparación de nombres
+//
+// Cada nombre tiene una etiqueta de un byte (los 8 bits altos de su hash),
+// guardada en un arreglo aparte y contiguo. Una búsqueda compara primero la
+// etiqueta buscada con GRUPO_ETIQUETAS etiquetas a la vez, con SSE2 (dos
+// comparaciones de 16 bytes) o AVX2 (una de 32), y sólo compara el nombre
+// completo de los candidatos: en promedio, uno de cada 256 nombres
+// distintos. La implementación se elige la primera vez según lo que
+// soporte la CPU; en otras arquitecturas se usa la versión escalar.
+
+typedef struct tag_kernel {
+	const char *name;
+	// Devuelve una máscara con un bit por cada una de las GRUPO_ETIQUETAS
+	// etiquetas de tags que es igual a tag.
+	uint32_t (*match)(const uint8_t *tags, uint8_t tag);
+} tag_kernel_t;
+
+static uint32_t
+tag_match_scalar(const uint8_t *tags, uint8_t tag)
+{
+	uint32_t mask = 0;
+	for (size_t i = 0; i < GRUPO_ETIQUETAS; i++)
+		mask |= (uint32_t) (tags[i] == tag) << i;
+	return mask;
+}
+
+#if defined(__x86_64__)
+static uint32_t
+tag_match_sse2(const uint8_t *tags, uint8_t tag)
+{
+	__m128i t = _mm_set1_epi8(tag);
+	__m128i lo = _mm_loadu_si128((const __m128i *) tags);
+	__m128i hi = _mm_loadu_si128((const __m128i *) (tags + 16));
+	uint32_t mask_lo = _mm_movemask_epi8(_mm_cmpeq_epi8(lo, t));
+	uint32_t mask_hi = _mm_movemask_epi8(_mm_cmpeq_epi8(hi, t));
+	return mask_lo | mask_hi << 16;
+}
+
+__attribute__((target("avx2"))) static uint32_t
+tag_match_avx2(const uint8_t *tags, uint8_t tag)
+{
+	__m256i t = _mm256_set1_epi8(tag);
+	__m256i v = _mm256_loadu_si256((const __m256i *) tags);
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, t));
+}
+#endif
+
+// De la más lenta a la más rápida
+static const tag_kernel_t tag_kernels[] = {
+	{ "escalar", tag_match_scalar },
+#if defined(__x86_64__)
+	{ "sse2", tag_match_sse2 },
+	{ "avx2", tag_match_avx2 },
+#endif
+};
+
+#define N_TAG_KERNELS (sizeof(tag_kernels) / sizeof(tag_kernels[0]))
+
+static const tag_kernel_t *tag_kernel;
+static pthread_once_t tag_kernel_once = PTHREAD_ONCE_INIT;
+
+// ## tag_kernel_supported
+//
+// Devuelve 1 si la CPU soporta las instrucciones que usa kernel, 0 si no.
+//
+static int
+tag_kernel_supported(const tag_kernel_t *kernel)
+{
+#if defined(__x86_64__)
+	if (kernel->match == tag_match_avx2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return 1;
+}
+
+static void
+tag_kernel_select(void)
+{
+	for (size_t i = 0; i < N_TAG_KERNELS; i++) {
+		if (tag_kernel_supported(&tag_kernels[i]))
+			tag_kernel = &tag_kernels[i];
+	}
+}
+
+// ## path_tag
+//
+// Devuelve la etiqueta de un path con hash h.
+//
+static uint8_t
+path_tag(uint64_t h)
+{
+	return h >> 56;
+}
+
+// ## tags_next
+//
+// Busca entre las n etiquetas de tags, desde la posición start, la primera
+// igual a tag. tags debe tener lugar para ETIQUETAS(n) etiquetas (las que
+// sobran pueden tener cualquier valor).
+//
+// Devuelve su posición, o n si no hay ninguna.
+//
+static size_t
+tags_next(const uint8_t *tags, size_t n, uint8_t tag, size_t start)
+{
+	pthread_once(&tag_kernel_once, tag_kernel_select);
+
+	size_t group = start / GRUPO_ETIQUETAS * GRUPO_ETIQUETAS;
+	for (; group < n; group += GRUPO_ETIQUETAS) {
+		uint32_t mask = tag_kernel->match(tags + group, tag);
+		if (start > group)
+			mask &= ~0U << (start - group);
+		if (n - group < GRUPO_ETIQUETAS)
+			mask &= (1U << (n - group)) - 1;
+		if (mask)
+			return group + __builtin_ctz(mask);
+	}
+
+	return n;
+}
+
 
 static int
 get_dir_index(fs_t *fs, const char *path)
@@ -60,8 +620,16 @@ get_dir_index(fs_t *fs, const char *path)
 	if (strcmp(path, ROOT) == 0 || strlen(path) == 0)
 		return 0;
 
-	for (size_t i = 0; i < fs->d_size; i++) {
-		if (strcmp(fs->directories[i].path, path) == 0)
+	uint64_t h = path_hash(path);
+	if (!bloom_test(fs, h))
+		return -1;
+
+	// strncmp: un lector sin lock puede ver un path a medio escribir
+	size_t n = fs->d_size;
+	uint8_t tag = path_tag(h);
+	for (size_t i = tags_next(fs->dir_tags, n, tag, 0); i < n;
+	     i = tags_next(fs->dir_tags, n, tag, i + 1)) {
+		if (strncmp(fs->directories[i].path, path, MAX_NAME) == 0)
 			return i;
 	}
 
@@ -91,8 +659,15 @@ get_file_index(fs_t *fs, const char *path)
 	if (fs == NULL || path == NULL)
 		return -1;
 
-	for (size_t i = 0; i < fs->f_size; i++) {
-		if (strcmp(fs->files[i].path, path) == 0)
+	uint64_t h = path_hash(path);
+	if (!bloom_test(fs, h))
+		return -1;
+
+	size_t n = fs->f_size;
+	uint8_t tag = path_tag(h);
+	for (size_t i = tags_next(fs->file_tags, n, tag, 0); i < n;
+	     i = tags_next(fs->file_tags, n, tag, i + 1)) {
+		if (strncmp(fs->files[i].path, path, MAX_NAME) == 0)
 			return i;
 	}
 
@@ -115,451 +690,4778 @@ get_file(fs_t *fs, const char *path)
 	return NULL;
 }
 
-// ## fs_create_dir
-//
-// Crea un directorio con el nombre y directorio especificados.
+// ## file_has_block
 //
-// Devuelve un puntero al directorio creado, NULL en caso de error.
+// Indica si el bloque número i de un archivo tiene datos, ya sea en memoria
+// o en la imagen. Si no, es un hueco.
 //
-static fs_d_entry_t *
-fs_create_dir(fs_t *fs, const char *name, fs_d_entry_t *parent, mode_t mode)
+static int
+file_has_block(fs_file_t *file, size_t i)
 {
-	if (fs == NULL || name == NULL)
-		return NULL;
-
-	strcpy(fs->directories[fs->d_size].path, name);
-
-	fs->directories[fs->d_size].d_parent = parent;
-
-	fs->directories[fs->d_size].size = 0;
-	fs->directories[fs->d_size].uid = 1717;
-	fs->directories[fs->d_size].gid = getgid();
-	fs->directories[fs->d_size].mode = mode;
-	fs->directories[fs->d_size].time_last_access = time(NULL);
-	fs->directories[fs->d_size].time_last_modification = time(NULL);
-	fs->directories[fs->d_size].time_creation = time(NULL);
-
-	fs->d_size++;
-	return &fs->directories[fs->d_size - 1];
+	return file->blocks[i] || file->image[i];
 }
 
-// ## Creación de directorios
+// ## file_allocated_blocks
 //
-static int
-fs_mkdir(fs_t *fs, const char *path, mode_t mode)
+// Devuelve la cantidad de bloques de contenido reservados por un archivo.
+// Los huecos no cuentan.
+//
+static size_t
+file_allocated_blocks(fs_file_t *file)
 {
-	if (strlen(path) < 2) {
-		fprintf(stderr, "Nombre de directorio inválido.\n");
-		return -1;
-	}
+	size_t amount = 0;
 
-	if (strlen(path) - 1 == MAX_NAME) {
-		fprintf(stderr, "Nombre de directorio demasiado largo.\n");
-		return -ENAMETOOLONG;
+	for (size_t i = 0; i < MAX_BLOQUES; i++) {
+		if (file_has_block(file, i))
+			amount++;
 	}
 
-	if (fs->d_size == MAX_DIRECTORIOS) {
-		fprintf(stderr, "No se pueden crear más directorios.\n");
-		return -1;
-	}
+	return amount;
+}
 
-	char temp_path[MAX_NAME];
-	strcpy(temp_path, path);
-	char parent_path[MAX_NAME];
-	strcpy(parent_path, dirname(temp_path));
-	fs_d_entry_t *dir = get_dir(fs, parent_path);
-	if (!dir) {
-		fprintf(stderr, "Error al crear el directorio.\n");
-		return -1;
-	}
-	fs_d_entry_t *new_dir = fs_create_dir(fs, path, dir, mode);
-	if (!new_dir) {
-		fprintf(stderr, "Error al crear el directorio.\n");
-		return -1;
-	}
+// # Uso del sistema de archivos
+//
+// fs_statfs informa cuántos inodos (directorios y archivos), bloques y
+// bytes están ocupados sin recorrer el sistema de archivos: cada operación
+// que los cambia suma la diferencia con usage_add. Un bloque compartido por
+// varios archivos cuenta una vez por cada uno, como en st_blocks.
+//
+// Las escrituras al final de archivos distintos se hacen en paralelo, así
+// que los contadores se actualizan con operaciones atómicas; para que no
+// compitan por una misma línea de caché, cada CPU suma en su propia ranura
+// y fs_usage suma todas las ranuras. Una ranura puede quedar negativa (un
+// bloque se reserva en una CPU y se libera en otra), pero el total no.
 
-	return EXIT_SUCCESS;
-}
+typedef struct fs_usage {
+	size_t inodes;
+	size_t blocks;
+	size_t bytes;
+} fs_usage_t;
 
-static int
-dir_set_ts(fs_d_entry_t *dir, const struct timespec ts[2])
+// ## usage_add
+//
+// Suma inodes, blocks y bytes (que pueden ser negativos) a los contadores de
+// uso de la CPU actual.
+//
+static void
+usage_add(fs_t *fs, int64_t inodes, int64_t blocks, int64_t bytes)
 {
-	dir->time_last_access = ts[0].tv_sec;
-	dir->time_last_modification = ts[1].tv_sec;
-	return EXIT_SUCCESS;
+	int cpu = sched_getcpu();
+	fs_usage_slot_t *slot = &fs->usage[(cpu < 0 ? 0 : cpu) % RANURAS_USO];
+
+	if (inodes)
+		__atomic_add_fetch(&slot->inodes, inodes, __ATOMIC_RELAXED);
+	if (blocks)
+		__atomic_add_fetch(&slot->blocks, blocks, __ATOMIC_RELAXED);
+	if (bytes)
+		__atomic_add_fetch(&slot->bytes, bytes, __ATOMIC_RELAXED);
 }
 
-static int
-file_set_ts(fs_file_t *file, const struct timespec ts[2])
+// ## file_set_size
+//
+// Cambia el tamaño de un archivo, actualizando los bytes ocupados.
+//
+static void
+file_set_size(fs_t *fs, fs_file_t *file, size_t size)
 {
-	file->time_last_access = ts[0].tv_sec;
-	file->time_last_modification = ts[1].tv_sec;
-	return EXIT_SUCCESS;
+	usage_add(fs, 0, 0, (int64_t) size - (int64_t) file->size);
+	file->size = size;
 }
 
-// ## Cambio de tiempo de acceso y modificación de un archivo o directorio
+// ## fs_usage
 //
-static int
-fs_utimens(fs_t *fs, const char *path, const struct timespec ts[2])
+// Suma los contadores de uso de todas las CPUs. Se puede llamar sin lock: si
+// hay operaciones en curso, el resultado puede no incluirlas.
+//
+static void
+fs_usage(fs_t *fs, fs_usage_t *usage)
 {
-	fs_d_entry_t *dir = get_dir(fs, path);
-	if (dir)
-		return dir_set_ts(dir, ts);
+	int64_t inodes = 0, blocks = 0, bytes = 0;
 
-	fs_file_t *file = get_file(fs, path);
-	if (file)
-		return file_set_ts(file, ts);
+	for (size_t i = 0; i < RANURAS_USO; i++) {
+		fs_usage_slot_t *slot = &fs->usage[i];
+		inodes += __atomic_load_n(&slot->inodes, __ATOMIC_RELAXED);
+		blocks += __atomic_load_n(&slot->blocks, __ATOMIC_RELAXED);
+		bytes += __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+	}
 
-	fprintf(stderr,
-	        "Error al actualizar los tiempos de acceso y modificación.\n");
-	return -ENOENT;
+	usage->inodes = inodes > 0 ? inodes : 0;
+	usage->blocks = blocks > 0 ? blocks : 0;
+	usage->bytes = bytes > 0 ? bytes : 0;
 }
 
-// ## Obtener atributos de un archivo
+// ## Estadísticas del sistema de archivos
+//
+// Completa st como statvfs(3): la capacidad es fs->capacity bloques de
+// TAM_BLOQUE bytes y MAX_DIRECTORIOS + MAX_ARCHIVOS inodos. No toma ningún
+// lock.
+//
+static int
+fs_statfs(fs_t *fs, struct statvfs *st)
+{
+	fs_usage_t usage;
+	fs_usage(fs, &usage);
+
+	memset(st, 0, sizeof(*st));
+	st->f_bsize = TAM_BLOQUE;
+	st->f_frsize = TAM_BLOQUE;
+	st->f_blocks = fs->capacity;
+	st->f_bfree = usage.blocks < fs->capacity ? fs->capacity - usage.blocks
+	                                          : 0;
+	st->f_bavail = st->f_bfree;
+	st->f_files = MAX_DIRECTORIOS + MAX_ARCHIVOS;
+	st->f_ffree = usage.inodes < st->f_files ? st->f_files - usage.inodes
+	                                         : 0;
+	st->f_favail = st->f_ffree;
+	st->f_namemax = MAX_NAME - 2;  // sin la '/' inicial ni el '\0'
+	if (fs->read_only)
+		st->f_flag = ST_RDONLY;
+	return 0;
+}
+
+// # Transacciones
+//
+// Cada cambio a un directorio o archivo (o a un bloque de un archivo) toma
+// un número de transacción nuevo de fs->txn, que sólo crece, y lo anota en
+// lo que cambió. Así, para saber qué cambió desde la transacción n alcanza
+// con buscar los números mayores a n, sin comparar contenidos (ver
+// fs_delta.c). Los borrados también toman un número, aunque no queda
+// anotado en ningún lado, así que fs->txn cambia con cada modificación y
+// fs_fsync lo usa para saber si hay algo que guardar. Los tiempos de acceso
+// no cuentan como cambios.
+//
+// fs->id identifica la historia de números: se elige al azar al crear un
+// sistema de archivos vacío y se conserva en la imagen, para no mezclar
+// números de sistemas de archivos distintos.
+
+// ## txn_next
+//
+// Devuelve un número de transacción nuevo. Se puede llamar con fs->lock
+// compartido (ver fs_appendv).
+//
+static uint64_t
+txn_next(fs_t *fs)
+{
+	return __atomic_add_fetch(&fs->txn, 1, __ATOMIC_RELAXED);
+}
+
+// ## txn_new_id
+//
+// Elige el identificador de una historia nueva.
+//
+static uint64_t
+txn_new_id(void)
+{
+	uint64_t id;
+	if (getrandom(&id, sizeof(id), 0) == sizeof(id))
+		return id;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ((uint64_t) now.tv_sec << 32) ^ now.tv_nsec ^ getpid();
+}
+
+// ## file_touch, file_touch_block, dir_touch
+//
+// Anotan que cambiaron los atributos de un archivo, su bloque número i (y
+// por lo tanto el archivo) o los atributos de un directorio.
+//
+static void
+file_touch(fs_t *fs, fs_file_t *file)
+{
+	file->txn = txn_next(fs);
+}
+
+static void
+file_touch_block(fs_t *fs, fs_file_t *file, size_t i)
+{
+	file->block_txn[i] = file->txn = txn_next(fs);
+}
+
+static void
+dir_touch(fs_t *fs, fs_d_entry_t *dir)
+{
+	dir->txn = txn_next(fs);
+}
+
+// # Eventos
+//
+// Los cambios a directorios y archivos se anotan como eventos en un buffer
+// circular de MAX_EVENTOS eventos, numerados en orden. Cada lector recuerda
+// el número del próximo evento que le toca (su posición) y los lee como
+// líneas de texto "<número> <tipo> <path>" (ver fs_events_read), sin tener
+// que recorrer los directorios para encontrar qué cambió.
+//
+// El buffer se crea cuando aparece el primer lector: mientras no haya
+// ninguno, anotar un evento no cuesta nada.
+
+#define MAX_EVENTOS 4096
+
+// Cada cuánto revisa un lector que espera eventos si se lo interrumpió
+#define ESPERA_EVENTOS_MS 100
+
+enum {
+	EVENTO_MKDIR,
+	EVENTO_CREATE,
+	EVENTO_WRITE,
+	EVENTO_UNLINK,
+	EVENTO_RMDIR,
+	TIPOS_DE_EVENTO
+};
+
+static const char *const event_names[TIPOS_DE_EVENTO] = {
+	[EVENTO_MKDIR] = "mkdir",   [EVENTO_CREATE] = "create",
+	[EVENTO_WRITE] = "write",   [EVENTO_UNLINK] = "unlink",
+	[EVENTO_RMDIR] = "rmdir",
+};
+
+typedef struct fs_event {
+	uint64_t seq;
+	int type;
+	char path[MAX_NAME];
+} fs_event_t;
+
+typedef struct fs_events {
+	pthread_mutex_t mutex;
+	pthread_cond_t added;  // hay eventos nuevos o se cierra el buffer
+	pthread_cond_t idle;   // dejó de esperar el último lector
+	uint64_t next;         // número del próximo evento
+	uint64_t read;         // mayor posición a la que llegó un lector
+	size_t waiting;        // lectores esperando eventos
+	int closed;
+	// El evento número n está en ring[n % MAX_EVENTOS]
+	fs_event_t ring[MAX_EVENTOS];
+} fs_events_t;
+
+// ## event_add
+//
+// Anota un evento de tipo type sobre path, si hay lectores. Una escritura
+// sobre el mismo path que el último evento, que todavía no leyó nadie, no
+// agrega otro: los lectores ya se van a enterar de que el archivo cambió.
+// Se llama con fs->lock tomado, aunque sea compartido.
+//
+static void
+event_add(fs_t *fs, int type, const char *path)
+{
+	fs_events_t *events = __atomic_load_n(&fs->events, __ATOMIC_ACQUIRE);
+	if (!events)
+		return;
+
+	pthread_mutex_lock(&events->mutex);
+	uint64_t next = events->next;
+	if (type == EVENTO_WRITE && next > events->read) {
+		fs_event_t *last = &events->ring[(next - 1) % MAX_EVENTOS];
+		if (last->type == type && strcmp(last->path, path) == 0) {
+			pthread_mutex_unlock(&events->mutex);
+			return;
+		}
+	}
+
+	fs_event_t *event = &events->ring[events->next % MAX_EVENTOS];
+	event->seq = events->next++;
+	event->type = type;
+	strncpy(event->path, path, MAX_NAME - 1);
+	event->path[MAX_NAME - 1] = '\0';
+	pthread_cond_broadcast(&events->added);
+	pthread_mutex_unlock(&events->mutex);
+
+	if (fs->event_notify)
+		fs->event_notify(fs->event_notify_arg);
+}
+
+// ## fs_events_open
+//
+// Agrega un lector de eventos, creando el buffer si todavía no existe. El
+// lector empieza en el próximo evento: no ve los cambios anteriores.
+//
+// Devuelve 0 y guarda la posición del lector en pos, o -ENOMEM.
+//
+static int
+fs_events_open(fs_t *fs, uint64_t *pos)
+{
+	fs_events_t *events = __atomic_load_n(&fs->events, __ATOMIC_ACQUIRE);
+	if (!events) {
+		fs_events_t *created = calloc(1, sizeof(fs_events_t));
+		if (!created)
+			return -ENOMEM;
+		pthread_mutex_init(&created->mutex, NULL);
+		pthread_cond_init(&created->added, NULL);
+		pthread_cond_init(&created->idle, NULL);
+
+		if (__atomic_compare_exchange_n(&fs->events,
+		                                &events,
+		                                created,
+		                                0,
+		                                __ATOMIC_ACQ_REL,
+		                                __ATOMIC_ACQUIRE)) {
+			events = created;
+		} else {
+			pthread_mutex_destroy(&created->mutex);
+			pthread_cond_destroy(&created->added);
+			pthread_cond_destroy(&created->idle);
+			free(created);
+		}
+	}
+
+	pthread_mutex_lock(&events->mutex);
+	*pos = events->next;
+	pthread_mutex_unlock(&events->mutex);
+	return 0;
+}
+
+// ## fs_events_ready
+//
+// Devuelve 1 si hay eventos a partir de la posición *pos, o 0 si no. La
+// posición se lee con el mutex de los eventos, ya que un read concurrente
+// del mismo lector puede estar avanzándola.
+//
+static int
+fs_events_ready(fs_t *fs, const uint64_t *pos)
+{
+	fs_events_t *events = __atomic_load_n(&fs->events, __ATOMIC_ACQUIRE);
+	if (!events)
+		return 0;
+
+	pthread_mutex_lock(&events->mutex);
+	int ready = *pos < events->next;
+	pthread_mutex_unlock(&events->mutex);
+	return ready;
+}
+
+// ## fs_events_read
+//
+// Copia en buffer, como líneas de texto, todos los eventos desde la
+// posición pos que entren en size bytes, y avanza pos. Si el lector se
+// atrasó más de MAX_EVENTOS eventos, los que se perdieron se informan con
+// una línea "<número> overflow <cantidad>". Si no hay eventos y wait es
+// distinto de 0, espera a que haya; mientras tanto, cada ESPERA_EVENTOS_MS
+// revisa si interrupted (que puede ser NULL) indica que se interrumpió la
+// lectura. No se llama con fs->lock tomado.
+//
+// Devuelve la cantidad de bytes copiados, 0 si se está cerrando el sistema
+// de archivos, -EAGAIN si no hay eventos y no se espera, -EINTR, o -EINVAL
+// si el primer evento no entra en buffer.
+//
+static int
+fs_events_read(fs_t *fs,
+               uint64_t *pos,
+               char *buffer,
+               size_t size,
+               int wait,
+               int (*interrupted)(void))
+{
+	fs_events_t *events = __atomic_load_n(&fs->events, __ATOMIC_ACQUIRE);
+	if (!events)
+		return -EINVAL;
+
+	int status = 0;
+	pthread_mutex_lock(&events->mutex);
+	while (*pos >= events->next && !events->closed) {
+		if (!wait) {
+			status = -EAGAIN;
+			break;
+		}
+		if (interrupted && interrupted()) {
+			status = -EINTR;
+			break;
+		}
+
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += ESPERA_EVENTOS_MS * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		events->waiting++;
+		pthread_cond_timedwait(&events->added, &events->mutex, &until);
+		if (--events->waiting == 0 && events->closed)
+			pthread_cond_broadcast(&events->idle);
+	}
+
+	if (status < 0 || events->closed) {
+		pthread_mutex_unlock(&events->mutex);
+		return status;
+	}
+
+	char line[MAX_NAME + 64];
+	size_t done = 0;
+	if (events->next - *pos > MAX_EVENTOS) {
+		uint64_t first = events->next - MAX_EVENTOS;
+		int len = snprintf(line,
+		                   sizeof(line),
+		                   "%lu overflow %lu\n",
+		                   (unsigned long) *pos,
+		                   (unsigned long) (first - *pos));
+		if ((size_t) len > size) {
+			pthread_mutex_unlock(&events->mutex);
+			return -EINVAL;
+		}
+		memcpy(buffer, line, len);
+		done = len;
+		*pos = first;
+	}
+
+	while (*pos < events->next) {
+		fs_event_t *event = &events->ring[*pos % MAX_EVENTOS];
+		int len = snprintf(line,
+		                   sizeof(line),
+		                   "%lu %s %s\n",
+		                   (unsigned long) event->seq,
+		                   event_names[event->type],
+		                   event->path);
+		if (done + len > size)
+			break;
+		memcpy(buffer + done, line, len);
+		done += len;
+		(*pos)++;
+	}
+
+	if (*pos > events->read)
+		events->read = *pos;
+	pthread_mutex_unlock(&events->mutex);
+
+	return done > 0 ? (int) done : -EINVAL;
+}
+
+// ## fs_events_close
+//
+// Despierta a los lectores que esperan eventos, que ven el final de los
+// eventos, y espera a que dejen de esperar. La llama fs_free antes de
+// liberar el buffer.
+//
+static void
+fs_events_close(fs_t *fs)
+{
+	fs_events_t *events = fs->events;
+	if (!events)
+		return;
+
+	pthread_mutex_lock(&events->mutex);
+	events->closed = 1;
+	pthread_cond_broadcast(&events->added);
+	while (events->waiting > 0)
+		pthread_cond_wait(&events->idle, &events->mutex);
+	pthread_mutex_unlock(&events->mutex);
+}
+
+// # Arenas
+//
+// Los bloques y las estructuras de cada sistema de archivos no se reservan
+// con malloc sino de regiones grandes (arenas) mapeadas con mmap y alineadas
+// a TAM_PAGINA_ENORME, para que el kernel las pueda respaldar con páginas
+// enormes: con un árbol grande en memoria, las búsquedas y recorridos
+// provocan muchos menos fallos de TLB que con páginas de 4 KiB.
+//
+// Primero se intenta con páginas enormes explícitas (MAP_HUGETLB), que
+// requieren páginas reservadas por el administrador (vm.nr_hugepages). Si no
+// hay, se usan páginas comunes y se le pide al kernel que las junte en
+// páginas enormes transparentes con madvise(MADV_HUGEPAGE). Las regiones
+// menores a una página enorme se mapean con páginas comunes.
+
+typedef struct arena_usage {
+	size_t regions;  // regiones mapeadas
+	size_t mapped;   // bytes mapeados
+	size_t hugetlb;  // de esos, bytes con páginas enormes explícitas
+	size_t used;     // bytes ya entregados (bloques o estructuras)
+} arena_usage_t;
+
+static arena_usage_t arena_usage;
+
+// ## arena_map
+//
+// Mapea en arena una región de al menos len bytes llenos de ceros. Si len es
+// de al menos una página enorme, la región queda alineada a
+// TAM_PAGINA_ENORME y con un tamaño múltiplo de ella.
+//
+// Devuelve 0 si pudo mapearla, -1 en caso contrario.
+//
+static int
+arena_map(arena_t *arena, size_t len)
+{
+	int prot = PROT_READ | PROT_WRITE;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	size_t page = sysconf(_SC_PAGESIZE);
+	char *region;
+
+	arena->hugetlb = 0;
+	if (len < TAM_PAGINA_ENORME) {
+		len = (len + page - 1) & ~(page - 1);
+		region = mmap(NULL, len, prot, flags, -1, 0);
+		if (region == MAP_FAILED)
+			return -1;
+	} else {
+		len = (len + TAM_PAGINA_ENORME - 1) & ~(TAM_PAGINA_ENORME - 1);
+		region = mmap(NULL, len, prot, flags | MAP_HUGETLB, -1, 0);
+		arena->hugetlb = region != MAP_FAILED;
+	}
+
+	if (region == MAP_FAILED) {
+		// Se mapea una página enorme de más para poder recortar la
+		// región a una dirección alineada.
+		size_t raw_len = len + TAM_PAGINA_ENORME;
+		char *raw = mmap(NULL, raw_len, prot, flags, -1, 0);
+		if (raw == MAP_FAILED)
+			return -1;
+
+		region = (char *) (((uintptr_t) raw + TAM_PAGINA_ENORME - 1) &
+		                   ~(TAM_PAGINA_ENORME - 1));
+		if (region > raw)
+			munmap(raw, region - raw);
+		if (region + len < raw + raw_len)
+			munmap(region + len, raw + raw_len - (region + len));
+		madvise(region, len, MADV_HUGEPAGE);
+	}
+
+	arena->base = region;
+	arena->len = len;
+	__atomic_add_fetch(&arena_usage.regions, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&arena_usage.mapped, len, __ATOMIC_RELAXED);
+	if (arena->hugetlb)
+		__atomic_add_fetch(&arena_usage.hugetlb, len, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// ## arena_unmap
+//
+// Devuelve al sistema una región mapeada con arena_map.
+//
+static void
+arena_unmap(arena_t arena)
+{
+	munmap(arena.base, arena.len);
+	__atomic_sub_fetch(&arena_usage.regions, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&arena_usage.mapped, arena.len, __ATOMIC_RELAXED);
+	if (arena.hugetlb)
+		__atomic_sub_fetch(&arena_usage.hugetlb, arena.len, __ATOMIC_RELAXED);
+}
+
+// ## fs_arena_usage
+//
+// Devuelve una copia del uso actual de las arenas.
+//
+static arena_usage_t
+fs_arena_usage(void)
+{
+	arena_usage_t usage;
+	usage.regions = __atomic_load_n(&arena_usage.regions, __ATOMIC_RELAXED);
+	usage.mapped = __atomic_load_n(&arena_usage.mapped, __ATOMIC_RELAXED);
+	usage.hugetlb = __atomic_load_n(&arena_usage.hugetlb, __ATOMIC_RELAXED);
+	usage.used = __atomic_load_n(&arena_usage.used, __ATOMIC_RELAXED);
+	return usage;
+}
+
+// # Reserva de bloques
+//
+// Los bloques libres no se devuelven enseguida al sistema: cada hilo tiene
+// una lista propia de la que toma bloques sin sincronizar nada, y la llena o
+// vacía de a LOTE_BLOQUES contra una reserva global protegida por un lock.
+// Así, hilos que reservan y liberan bloques en paralelo (la importación, o
+// escrituras de distintos archivos) casi nunca compiten por la reserva
+// global. Cuando un hilo termina, sus bloques vuelven a la reserva global.
+//
+// Los bloques nuevos se cortan de arenas de TAM_ARENA_BLOQUES bytes. Su
+// memoria no se devuelve al sistema: un bloque liberado queda en la reserva
+// para volver a usarse.
+
+typedef struct block_list {
+	fs_block_t *head;
+	size_t n;
+} block_list_t;
+
+static struct {
+	pthread_mutex_t lock;
+	block_list_t free;
+	arena_t arena;  // arena de la que se cortan bloques nuevos
+	size_t arena_used;
+} block_pool = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread block_list_t block_cache;
+static __thread int block_cache_registered;
+static pthread_key_t block_cache_key;
+static pthread_once_t block_cache_once = PTHREAD_ONCE_INIT;
+
+// ## block_list_move
+//
+// Mueve hasta n bloques de la lista from a la lista to.
+//
+static void
+block_list_move(block_list_t *from, block_list_t *to, size_t n)
+{
+	while (n-- > 0 && from->head) {
+		fs_block_t *block = from->head;
+		from->head = block->next_free;
+		from->n--;
+		block->next_free = to->head;
+		to->head = block;
+		to->n++;
+	}
+}
+
+// ## block_pool_put
+//
+// Devuelve a la reserva global hasta n bloques de list.
+//
+static void
+block_pool_put(block_list_t *list, size_t n)
+{
+	pthread_mutex_lock(&block_pool.lock);
+	block_list_move(list, &block_pool.free, n);
+	pthread_mutex_unlock(&block_pool.lock);
+}
+
+static void
+block_cache_release(void *cache)
+{
+	block_pool_put(cache, ((block_list_t *) cache)->n);
+}
+
+static void
+block_cache_key_init(void)
+{
+	pthread_key_create(&block_cache_key, block_cache_release);
+}
+
+// ## block_cache_get
+//
+// Devuelve la lista de bloques libres del hilo. La primera vez la registra
+// para que sus bloques vuelvan a la reserva global cuando el hilo termine.
+//
+static block_list_t *
+block_cache_get(void)
+{
+	if (!block_cache_registered) {
+		pthread_once(&block_cache_once, block_cache_key_init);
+		pthread_setspecific(block_cache_key, &block_cache);
+		block_cache_registered = 1;
+	}
+	return &block_cache;
+}
+
+// ## block_cache_refill
+//
+// Llena la lista del hilo con un lote de bloques de la reserva global. Si
+// la reserva no alcanza, se cortan bloques nuevos de la arena (y se mapea
+// otra cuando se termina).
+//
+static void
+block_cache_refill(block_list_t *cache)
+{
+	pthread_mutex_lock(&block_pool.lock);
+	block_list_move(&block_pool.free, cache, LOTE_BLOQUES);
+
+	while (cache->n < LOTE_BLOQUES) {
+		arena_t *arena = &block_pool.arena;
+		if (!arena->base ||
+		    block_pool.arena_used + sizeof(fs_block_t) > arena->len) {
+			// El resto de la arena anterior queda sin usar
+			if (arena_map(arena, TAM_ARENA_BLOQUES) != 0) {
+				arena->base = NULL;
+				break;
+			}
+			block_pool.arena_used = 0;
+		}
+
+		fs_block_t *block =
+		        (fs_block_t *) (arena->base + block_pool.arena_used);
+		block_pool.arena_used += sizeof(fs_block_t);
+		__atomic_add_fetch(&arena_usage.used,
+		                   sizeof(fs_block_t),
+		                   __ATOMIC_RELAXED);
+		block->next_free = cache->head;
+		cache->head = block;
+		cache->n++;
+	}
+	pthread_mutex_unlock(&block_pool.lock);
+}
+
+// ## fs_arena_report
+//
+// Escribe en file el uso de las arenas y cuántos de los bloques entregados
+// están libres en la reserva global.
+//
+static void
+fs_arena_report(FILE *file)
+{
+	arena_usage_t usage = fs_arena_usage();
+	pthread_mutex_lock(&block_pool.lock);
+	size_t free_blocks = block_pool.free.n;
+	pthread_mutex_unlock(&block_pool.lock);
+
+	fprintf(file,
+	        "arenas: %zu regiones, %.1f MiB mapeados (%.1f MiB con páginas "
+	        "enormes explícitas), %.1f MiB entregados, %zu bloques libres\n",
+	        usage.regions,
+	        usage.mapped / 1048576.0,
+	        usage.hugetlb / 1048576.0,
+	        usage.used / 1048576.0,
+	        free_blocks);
+}
+
+// ## block_new
+//
+// Reserva un bloque lleno de ceros con una sola referencia.
+//
+// Devuelve NULL si no hay memoria suficiente.
+//
+static fs_block_t *
+block_new()
+{
+	block_list_t *cache = block_cache_get();
+	if (!cache->head)
+		block_cache_refill(cache);
+	if (!cache->head)
+		return NULL;
+
+	fs_block_t *block = cache->head;
+	cache->head = block->next_free;
+	cache->n--;
+
+	block->refs = 1;
+	block->crc_valid = 0;
+	memset(block->data, 0, TAM_BLOQUE);
+	return block;
+}
+
+// ## block_put
+//
+// Suelta una referencia a un bloque. Si era la última, el bloque vuelve a la
+// lista del hilo; si la lista crece demasiado, un lote pasa a la reserva
+// global.
+//
+static void
+block_put(fs_block_t *block)
+{
+	if (!block || --block->refs > 0)
+		return;
+
+	block_list_t *cache = block_cache_get();
+	block->next_free = cache->head;
+	cache->head = block;
+	cache->n++;
+
+	if (cache->n > 2 * LOTE_BLOQUES)
+		block_pool_put(cache, LOTE_BLOQUES);
+}
+
+// ## file_load_block
+//
+// Trae a memoria el bloque número i de un archivo si sólo está en la imagen.
+// Los bloques compartidos se guardan una sola vez en la imagen (ver
+// block_number): si otro archivo (u otra posición) ya trajo el mismo bloque
+// de la imagen, se lo comparte en lugar de leerlo otra vez, así que una
+// copia hecha con fs_copy_file_range sigue sin ocupar memoria después de
+// volver a montar.
+//
+// Devuelve 0 si el bloque quedó en memoria (o es un hueco), o un error
+// negativo si no se pudo leer.
+//
+static int
+file_load_block(fs_t *fs, fs_file_t *file, size_t i)
+{
+	if (file->blocks[i] || !file->image[i])
+		return 0;
+
+	uint32_t n = file->image[i];
+	fs_block_t *block = fs->image_loaded ? fs->image_loaded[n - 1] : NULL;
+	if (block) {
+		block->refs++;
+		file->blocks[i] = block;
+		fs->cached++;
+		return 0;
+	}
+
+	block = block_new();
+	if (!block)
+		return -ENOMEM;
+
+	if (image_read_block(fs, n, block->data) != 0) {
+		block_put(block);
+		return -EIO;
+	}
+
+	block->crc = fs->image_crcs[n - 1];
+	block->crc_valid = 1;
+
+	file->blocks[i] = block;
+	fs->cached++;
+	if (fs->image_loaded)
+		fs->image_loaded[n - 1] = block;
+	return 0;
+}
+
+// ## file_forget_image_block
+//
+// Se llama antes de soltar o modificar el bloque número i de un archivo que
+// está respaldado por la imagen: si es la última referencia al bloque, deja
+// de ser el bloque en memoria de su bloque de la imagen.
+//
+static void
+file_forget_image_block(fs_t *fs, fs_file_t *file, size_t i)
+{
+	fs_block_t *block = file->blocks[i];
+	uint32_t n = file->image[i];
+	if (block && n && block->refs == 1 && fs->image_loaded &&
+	    fs->image_loaded[n - 1] == block)
+		fs->image_loaded[n - 1] = NULL;
+}
+
+// ## file_block
+//
+// Devuelve los datos del bloque de contenido número i de un archivo,
+// leyéndolo de la imagen si hace falta.
+//
+// Si alloc es distinto de 0 el bloque se va a modificar: si es un hueco se
+// reserva lleno de ceros, si está compartido con otro archivo se copia
+// (copy-on-write) para que el cambio no se vea desde el otro lado, y deja de
+// estar respaldado por la imagen.
+//
+// Devuelve NULL si el bloque es un hueco (y no se pidió reservarlo) o si no
+// hay memoria suficiente o no se pudo leer de la imagen.
+//
+static char *
+file_block(fs_t *fs, fs_file_t *file, size_t i, int alloc)
+{
+	if (file_load_block(fs, file, i) != 0)
+		return NULL;
+
+	fs_block_t *block = file->blocks[i];
+
+	if (alloc && !block) {
+		block = file->blocks[i] = block_new();
+		if (block)
+			usage_add(fs, 0, 1, 0);
+	} else if (alloc && block->refs > 1) {
+		fs_block_t *copy = block_new();
+		if (!copy)
+			return NULL;
+
+		memcpy(copy->data, block->data, TAM_BLOQUE);
+		block_put(block);
+		block = file->blocks[i] = copy;
+	}
+
+	if (alloc && block && file->image[i]) {
+		file_forget_image_block(fs, file, i);
+		file->image[i] = 0;
+		fs->cached--;
+	}
+
+	if (alloc && block) {
+		block->crc_valid = 0;
+		file_touch_block(fs, file, i);
+	}
+
+	return block ? block->data : NULL;
+}
+
+// ## file_drop_block
+//
+// Suelta el bloque número i de un archivo, convirtiéndolo en un hueco.
+//
+static void
+file_drop_block(fs_t *fs, fs_file_t *file, size_t i)
+{
+	if (file->blocks[i] && file->image[i])
+		fs->cached--;
+	if (file_has_block(file, i)) {
+		usage_add(fs, 0, -1, 0);
+		file_touch_block(fs, file, i);
+	}
+
+	file_forget_image_block(fs, file, i);
+	block_put(file->blocks[i]);
+	file->blocks[i] = NULL;
+	file->image[i] = 0;
+}
+
+// ## file_free_blocks
+//
+// Suelta los bloques de un archivo a partir del bloque número first,
+// convirtiéndolos en huecos. Si first es 0 también suelta los bloques
+// reservados para escribir al final.
+//
+static void
+file_free_blocks(fs_t *fs, fs_file_t *file, size_t first)
+{
+	for (size_t i = first; i < MAX_BLOQUES; i++)
+		file_drop_block(fs, file, i);
+
+	if (first > 0)
+		return;
+
+	while (file->n_reserve > 0)
+		block_put(file->reserve[--file->n_reserve]);
+	file->reserve_chunk = 0;
+}
+
+// ## fs_trim_cache
+//
+// Si hay más bloques leídos de la imagen en memoria que los permitidos,
+// descarta bloques que no fueron modificados (se pueden volver a leer de la
+// imagen) hasta bajar a tres cuartos del máximo. Recorre los bloques de
+// forma circular, retomando desde donde terminó la vez anterior.
+//
+static void
+fs_trim_cache(fs_t *fs)
+{
+	if (fs->cached <= fs->max_cached)
+		return;
+
+	size_t target = fs->max_cached * 3 / 4;
+	size_t slots = fs->f_size * MAX_BLOQUES;
+
+	for (size_t n = 0; n < slots && fs->cached > target; n++) {
+		size_t slot = fs->evict_hand++ % slots;
+		fs_file_t *file = &fs->files[slot / MAX_BLOQUES];
+		size_t i = slot % MAX_BLOQUES;
+
+		if (file->blocks[i] && file->image[i]) {
+			file_forget_image_block(fs, file, i);
+			block_put(file->blocks[i]);
+			file->blocks[i] = NULL;
+			fs->cached--;
+		}
+	}
+}
+
+// # Índice de los directorios
+//
+// Cada directorio guarda sus entradas en un arreglo ordenado por cookie. Como
+// las cookies son crecientes, agregar una entrada es agregarla al final, y
+// borrarla no cambia las cookies de las demás: un listado que se retoma desde
+// una cookie no repite ni saltea entradas que existían al empezar, aunque se
+// creen o borren otras en el medio. Las cookies 1 y 2 son las de '.' y '..'.
+//
+// Quitar una entrada no corre las siguientes: se la marca con un nombre vacío
+// y el arreglo se compacta recién cuando la mitad de las entradas están
+// quitadas, así que vaciar un directorio cuesta lo mismo que recorrerlo.
+
+#define COOKIE_PUNTO 1
+#define COOKIE_PUNTO_PUNTO 2
+
+typedef int (*fs_fill_dir_t)(void *buf,
+                             const char *name,
+                             const struct stat *st,
+                             off_t off);
+
+// ## dir_index_add
+//
+// Agrega la entrada de path al índice de dir.
+//
+// Devuelve 0 en caso de éxito, -ENOMEM si no hay memoria.
+//
+static void dir_index_compact(fs_d_entry_t *dir);
+
+static int
+dir_index_add(fs_d_entry_t *dir, const char *path)
+{
+	if (dir->n_entries == dir->cap_entries && dir->n_removed > 0)
+		dir_index_compact(dir);
+
+	if (dir->n_entries == dir->cap_entries) {
+		// La capacidad es múltiplo de GRUPO_ETIQUETAS, como pide tags_next
+		size_t cap = dir->cap_entries ? dir->cap_entries * 2 : GRUPO_ETIQUETAS;
+		fs_dirent_t *entries = realloc(dir->entries, cap * sizeof(fs_dirent_t));
+		if (!entries)
+			return -ENOMEM;
+		dir->entries = entries;
+		uint8_t *tags = realloc(dir->tags, cap);
+		if (!tags)
+			return -ENOMEM;
+		dir->tags = tags;
+		dir->cap_entries = cap;
+	}
+
+	if (dir->next_cookie <= COOKIE_PUNTO_PUNTO)
+		dir->next_cookie = COOKIE_PUNTO_PUNTO + 1;
+
+	char temp_path[MAX_NAME];
+	strcpy(temp_path, path);
+	const char *name = basename(temp_path);
+	dir->tags[dir->n_entries] = path_tag(path_hash(name));
+	fs_dirent_t *entry = &dir->entries[dir->n_entries++];
+	entry->cookie = dir->next_cookie++;
+	strcpy(entry->name, name);
+	return 0;
+}
+
+// ## dir_index_find
+//
+// Busca en el índice de dir la entrada llamada name.
+//
+// Devuelve su posición en el índice, o -1 si no está.
+//
+static ssize_t
+dir_index_find(fs_d_entry_t *dir, const char *name)
+{
+	size_t n = dir->n_entries;
+	uint8_t tag = path_tag(path_hash(name));
+
+	for (size_t i = tags_next(dir->tags, n, tag, 0); i < n;
+	     i = tags_next(dir->tags, n, tag, i + 1)) {
+		if (strcmp(dir->entries[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+// ## dir_index_compact
+//
+// Saca del índice de dir las entradas quitadas, sin cambiar el orden de las
+// demás.
+//
+static void
+dir_index_compact(fs_d_entry_t *dir)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < dir->n_entries; i++) {
+		if (dir->entries[i].name[0] == '\0')
+			continue;
+
+		dir->entries[kept] = dir->entries[i];
+		dir->tags[kept] = dir->tags[i];
+		kept++;
+	}
+
+	dir->n_entries = kept;
+	dir->n_removed = 0;
+}
+
+// ## dir_index_remove
+//
+// Quita la entrada de path del índice de dir. La entrada queda en el arreglo
+// con el nombre vacío (ninguna búsqueda la encuentra) hasta que más de la
+// mitad de las entradas estén quitadas.
+//
+static void
+dir_index_remove(fs_d_entry_t *dir, const char *path)
+{
+	char temp_path[MAX_NAME];
+	strcpy(temp_path, path);
+
+	ssize_t i = dir_index_find(dir, basename(temp_path));
+	if (i < 0)
+		return;
+
+	dir->entries[i].name[0] = '\0';
+	dir->n_removed++;
+	if (2 * dir->n_removed > dir->n_entries)
+		dir_index_compact(dir);
+}
+
+// ## dir_children
+//
+// Devuelve la cantidad de archivos y subdirectorios de dir.
+//
+static size_t
+dir_children(fs_d_entry_t *dir)
+{
+	return dir->n_entries - dir->n_removed;
+}
+
+// ## dir_index_seek
+//
+// Busca en el índice de dir la primera entrada con cookie mayor a offset.
+//
+// Devuelve su posición en el índice (n_entries si no hay ninguna).
+//
+static size_t
+dir_index_seek(fs_d_entry_t *dir, off_t offset)
+{
+	size_t lo = 0;
+	size_t hi = dir->n_entries;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (dir->entries[mid].cookie <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// ## fs_create_dir
+//
+// Crea un directorio con el nombre y directorio especificados.
+//
+// Devuelve un puntero al directorio creado, NULL en caso de error.
+//
+static fs_d_entry_t *
+fs_create_dir(fs_t *fs, const char *name, fs_d_entry_t *parent, mode_t mode)
+{
+	if (fs == NULL || name == NULL)
+		return NULL;
+
+	if (parent && dir_index_add(parent, name) != 0)
+		return NULL;
+
+	memset(&fs->directories[fs->d_size], 0, sizeof(fs_d_entry_t));
+	strcpy(fs->directories[fs->d_size].path, name);
+
+	fs->directories[fs->d_size].d_parent = parent;
+
+	fs->directories[fs->d_size].size = 0;
+	fs->directories[fs->d_size].uid = 1717;
+	fs->directories[fs->d_size].gid = getgid();
+	fs->directories[fs->d_size].mode = mode;
+	fs->directories[fs->d_size].time_last_access = time(NULL);
+	fs->directories[fs->d_size].time_last_modification = time(NULL);
+	fs->directories[fs->d_size].time_creation = time(NULL);
+	dir_touch(fs, &fs->directories[fs->d_size]);
+
+	fs->dir_tags[fs->d_size] = path_tag(path_hash(name));
+	fs->d_size++;
+	bloom_add(fs, name);
+	usage_add(fs, 1, 0, 0);
+	return &fs->directories[fs->d_size - 1];
+}
+
+// ## Creación de directorios
+//
+static int
+fs_mkdir(fs_t *fs, const char *path, mode_t mode)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (strlen(path) < 2) {
+		fprintf(stderr, "Nombre de directorio inválido.\n");
+		return -1;
+	}
+
+	if (strlen(path) - 1 == MAX_NAME) {
+		fprintf(stderr, "Nombre de directorio demasiado largo.\n");
+		return -ENAMETOOLONG;
+	}
+
+	if (fs->d_size == MAX_DIRECTORIOS) {
+		fprintf(stderr, "No se pueden crear más directorios.\n");
+		return -1;
+	}
+
+	char temp_path[MAX_NAME];
+	strcpy(temp_path, path);
+	char parent_path[MAX_NAME];
+	strcpy(parent_path, dirname(temp_path));
+	fs_d_entry_t *dir = get_dir(fs, parent_path);
+	if (!dir) {
+		fprintf(stderr, "Error al crear el directorio.\n");
+		return -1;
+	}
+	fs_d_entry_t *new_dir = fs_create_dir(fs, path, dir, mode);
+	if (!new_dir) {
+		fprintf(stderr, "Error al crear el directorio.\n");
+		return -1;
+	}
+
+	event_add(fs, EVENTO_MKDIR, path);
+	return EXIT_SUCCESS;
+}
+
+static int
+dir_set_ts(fs_d_entry_t *dir, const struct timespec ts[2])
+{
+	dir->time_last_access = ts[0].tv_sec;
+	dir->time_last_modification = ts[1].tv_sec;
+	return EXIT_SUCCESS;
+}
+
+static int
+file_set_ts(fs_file_t *file, const struct timespec ts[2])
+{
+	file->time_last_access = ts[0].tv_sec;
+	file->time_last_modification = ts[1].tv_sec;
+	return EXIT_SUCCESS;
+}
+
+// ## Cambio de tiempo de acceso y modificación de un archivo o directorio
+//
+static int
+fs_utimens(fs_t *fs, const char *path, const struct timespec ts[2])
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	fs_d_entry_t *dir = get_dir(fs, path);
+	if (dir) {
+		dir_touch(fs, dir);
+		return dir_set_ts(dir, ts);
+	}
+
+	fs_file_t *file = get_file(fs, path);
+	if (file) {
+		file_touch(fs, file);
+		return file_set_ts(file, ts);
+	}
+
+	fprintf(stderr,
+	        "Error al actualizar los tiempos de acceso y modificación.\n");
+	return -ENOENT;
+}
+
+// ## dir_stat
+//
+// Completa st con los atributos de un directorio.
+//
+static void
+dir_stat(fs_t *fs, fs_d_entry_t *dir, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_mode = __S_IFDIR | 0755;
+	st->st_nlink = 2;
+	st->st_uid = dir->uid;
+	st->st_gid = dir->gid;
+	st->st_size = dir->size;
+	st->st_atime =
+	        __atomic_load_n(&dir->time_last_access, __ATOMIC_RELAXED);
+	st->st_mtime = dir->time_last_modification;
+	st->st_ctime = dir->time_creation;
+	st->st_dev = 0;
+	st->st_ino = dir - fs->directories;
+}
+
+// ## file_stat
+//
+// Completa st con los atributos de un archivo.
+//
+static void
+file_stat(fs_t *fs, fs_file_t *file, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_mode = __S_IFREG | 0644;
+	st->st_nlink = 1;
+	st->st_uid = file->uid;
+	st->st_gid = file->gid;
+	st->st_size = file->size;
+	st->st_blocks = file_allocated_blocks(file) * (TAM_BLOQUE / 512);
+	st->st_blksize = TAM_BLOQUE;
+	st->st_atime =
+	        __atomic_load_n(&file->time_last_access, __ATOMIC_RELAXED);
+	st->st_mtime = file->time_last_modification;
+	st->st_ctime = file->time_creation;
+	st->st_dev = 0;
+	st->st_ino = file - fs->files;
+}
+
+// ## lookup_stat
+//
+// Busca path y completa st con sus atributos. No modifica nada, así que se
+// puede llamar sin lock (ver fs_getattr).
+//
+// Devuelve 0 si existe, -ENOENT en caso contrario.
+//
+static int
+lookup_stat(fs_t *fs, const char *path, struct stat *st)
+{
+	fs_d_entry_t *dir = get_dir(fs, path);
+	if (dir) {
+		dir_stat(fs, dir, st);
+		return EXIT_SUCCESS;
+	}
+
+	fs_file_t *file = get_file(fs, path);
+	if (file) {
+		file_stat(fs, file, st);
+		return EXIT_SUCCESS;
+	}
+
+	return -ENOENT;
+}
+
+// ## Obtener atributos de un archivo
+//
+// No toma ningún lock: lee los atributos y verifica con fs->seq que ninguna
+// modificación haya ocurrido mientras tanto; si ocurrió, los vuelve a leer.
+// Si tras MAX_REINTENTOS_LECTURA intentos sigue habiendo modificaciones,
+// toma el lock para no esperar indefinidamente.
 //
 static int
 fs_getattr(fs_t *fs, const char *path, struct stat *st)
 {
-	fs_d_entry_t *dir = get_dir(fs, path);
-	if (dir) {
-		st->st_mode = __S_IFDIR | 0755;
-		st->st_nlink = 2;
-		st->st_uid = dir->uid;
-		st->st_gid = dir->gid;
-		st->st_size = dir->size;
-		st->st_atime = dir->time_last_access;
-		st->st_mtime = dir->time_last_modification;
-		st->st_ctime = dir->time_creation;
-		st->st_dev = 0;
-		st->st_ino = get_dir_index(fs, path);
-		return EXIT_SUCCESS;
+	for (int i = 0; i < MAX_REINTENTOS_LECTURA; i++) {
+		unsigned seq = __atomic_load_n(&fs->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		int status = lookup_stat(fs, path, st);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&fs->seq, __ATOMIC_RELAXED) == seq)
+			return status;
+	}
+
+	fs_lock(fs);
+	int status = lookup_stat(fs, path, st);
+	fs_unlock(fs);
+	return status;
+}
+
+// ## fs_create_file
+//
+// Crea un archivo con el nombre especificado dentro de parent, sin buscar el
+// directorio por su path.
+//
+// Devuelve un puntero al archivo creado, NULL en caso de error.
+//
+static fs_file_t *
+fs_create_file(fs_t *fs, const char *path, fs_d_entry_t *parent, mode_t mode)
+{
+	if (fs == NULL || path == NULL || parent == NULL)
+		return NULL;
+
+	if (dir_index_add(parent, path) != 0)
+		return NULL;
+
+	fs_file_t file = { 0 };
+
+	strcpy(file.path, path);
+
+	file.entry = parent;
+
+	file.mode = mode;
+	file.uid = 1818;
+	file.gid = getgid();
+	file.size = 0;
+	file.time_last_access = time(NULL);
+	file.time_last_modification = time(NULL);
+	file.time_creation = time(NULL);
+	file.birth = file.txn = txn_next(fs);
+
+	fs->files[fs->f_size] = file;
+	fs->file_tags[fs->f_size] = path_tag(path_hash(path));
+	fs->f_size++;
+	bloom_add(fs, path);
+	usage_add(fs, 1, 0, 0);
+
+	return &fs->files[fs->f_size - 1];
+}
+
+// ## create_file
+//
+// Crea un archivo con el nombre y directorio especificados.
+//
+// Devuelve 0 en caso de éxito, -1 en caso de error.
+//
+static int
+create_file(fs_t *fs, const char *path, mode_t mode)
+{
+	if (fs == NULL || path == NULL)
+		return -1;
+
+	char temp_path[MAX_NAME];
+	strcpy(temp_path, path);
+	char parent_path[MAX_NAME];
+	strcpy(parent_path, dirname(temp_path));
+	fs_d_entry_t *dir = get_dir(fs, parent_path);
+	if (!dir || !fs_create_file(fs, path, dir, mode)) {
+		fprintf(stderr, "Error al crear el archivo.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// ## touch_file
+//
+// Actualiza la fecha de modificación de un archivo.
+//
+// Devuelve 0 si pudo actualizar la fecha de modificación, -1 en caso contrario.
+//
+static int
+touch_file(fs_t *fs, fs_file_t *file)
+{
+	if (fs == NULL || file == NULL)
+		return -1;
+
+	file->time_last_modification = time(NULL);
+	file_touch(fs, file);
+	return 0;
+}
+
+// ## Creación de archivos
+//
+static int
+fs_create(fs_t *fs, const char *path, mode_t mode)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (strlen(path) < 2) {
+		fprintf(stderr, "Nombre de archivo inválido.\n");
+		return -1;
+	}
+
+	if (strlen(path) - 1 == MAX_NAME) {
+		fprintf(stderr, "Nombre de archivo demasiado largo.\n");
+		return -ENAMETOOLONG;
+	}
+
+	if (fs->f_size == MAX_ARCHIVOS) {
+		fprintf(stderr, "No se pueden crear más archivos.\n");
+		return -1;
+	}
+
+	fs_file_t *file = get_file(fs, path);
+
+	if (!file) {
+		int status = create_file(fs, path, mode);
+		if (status == -1)
+			return -1;
+		event_add(fs, EVENTO_CREATE, path);
+	} else {
+		int status = touch_file(fs, file);
+		if (status == -1)
+			return -1;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// ## Lectura de directorios
+//
+// Llama a filler con cada entrada de path cuya cookie sea mayor a offset,
+// pasándole sus atributos y la cookie como offset, hasta que filler devuelva
+// distinto de 0 (no hay más lugar en el buffer). El listado se retoma
+// llamando de nuevo con la cookie de la última entrada que se pudo agregar.
+//
+// Devuelve 0 en caso de éxito, -ENOENT si el directorio no existe.
+//
+static int
+fs_readdir(fs_t *fs, const char *path, void *buf, fs_fill_dir_t filler, off_t offset)
+{
+	fs_d_entry_t *dir = get_dir(fs, path);
+	if (!dir)
+		return -ENOENT;
+
+	// El tiempo de acceso no pasa por seq (ver dir_stat)
+	if (!fs->read_only)
+		__atomic_store_n(
+		        &dir->time_last_access, time(NULL), __ATOMIC_RELAXED);
+
+	struct stat st;
+	if (offset < COOKIE_PUNTO) {
+		dir_stat(fs, dir, &st);
+		if (filler(buf, ".", &st, COOKIE_PUNTO) != 0)
+			return EXIT_SUCCESS;
+	}
+	if (offset < COOKIE_PUNTO_PUNTO) {
+		dir_stat(fs, dir->d_parent ? dir->d_parent : dir, &st);
+		if (filler(buf, "..", &st, COOKIE_PUNTO_PUNTO) != 0)
+			return EXIT_SUCCESS;
+	}
+
+	const char *sep = strcmp(dir->path, ROOT) == 0 ? "" : "/";
+	for (size_t i = dir_index_seek(dir, offset); i < dir->n_entries; i++) {
+		fs_dirent_t *entry = &dir->entries[i];
+		if (entry->name[0] == '\0')
+			continue;
+
+		char entry_path[MAX_NAME];
+		int len = snprintf(
+		        entry_path, MAX_NAME, "%s%s%s", dir->path, sep, entry->name);
+
+		if (len >= MAX_NAME || lookup_stat(fs, entry_path, &st) != 0)
+			continue;
+		if (filler(buf, entry->name, &st, entry->cookie) != 0)
+			break;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// ## Lectura de archivos
+//
+// Copia hasta size bytes del archivo a partir de offset en buffer. Los huecos
+// se leen como ceros.
+//
+// Devuelve la cantidad de bytes leídos (0 si offset está al final del archivo
+// o más allá), o un error negativo.
+//
+static int
+fs_read(fs_t *fs, const char *path, char *buffer, size_t size, off_t offset)
+{
+	if (offset < 0) {
+		fprintf(stderr, "Error: datos invalidos\n");
+		return -EINVAL;
+	}
+
+	fs_file_t *file = get_file(fs, path);
+	if (!file)
+		return -ENOENT;
+
+	if ((size_t) offset >= file->size)
+		return 0;
+
+	if (size > file->size - offset)
+		size = file->size - offset;
+
+	size_t done = 0;
+	while (done < size) {
+		size_t pos = offset + done;
+		size_t in_block = pos % TAM_BLOQUE;
+		size_t chunk = TAM_BLOQUE - in_block;
+		if (chunk > size - done)
+			chunk = size - done;
+
+		uint32_t backing = file->image[pos / TAM_BLOQUE];
+		const char *block;
+		if (fs->read_only) {
+			block = image_map_block(fs, backing);
+			if (!block && backing)
+				return -EIO;
+		} else {
+			if (file_load_block(fs, file, pos / TAM_BLOQUE) != 0) {
+				fs_trim_cache(fs);
+				return -EIO;
+			}
+			block = file_block(fs, file, pos / TAM_BLOQUE, 0);
+		}
+
+		if (block)
+			memcpy(buffer + done, block + in_block, chunk);
+		else
+			memset(buffer + done, 0, chunk);
+
+		done += chunk;
+	}
+
+	if (fs->read_only)
+		return (int) size;
+
+	fs_trim_cache(fs);
+	__atomic_store_n(&file->time_last_access, time(NULL), __ATOMIC_RELAXED);
+	return (int) size;
+}
+
+// ## Escritura de archivos
+//
+// Escribe size bytes de buffer en el archivo a partir de offset. Si offset
+// está más allá del final del archivo, el espacio intermedio queda como
+// hueco: sólo se reservan los bloques que efectivamente reciben datos.
+//
+// Devuelve la cantidad de bytes escritos, o un error negativo.
+//
+static int
+fs_write(fs_t *fs, const char *path, const char *buffer, size_t size, off_t offset)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (offset < 0) {
+		fprintf(stderr, "Error: datos invalidos\n");
+		return -EINVAL;
+	}
+
+	if ((size_t) offset + size > MAX_CONTENIDO) {
+		fprintf(stderr, "Error: el archivo supera el tamaño máximo\n");
+		return -EFBIG;
+	}
+
+	fs_file_t *file = get_file(fs, path);
+	if (!file)
+		return -ENOENT;
+
+	size_t done = 0;
+	while (done < size) {
+		size_t pos = offset + done;
+		size_t in_block = pos % TAM_BLOQUE;
+		size_t chunk = TAM_BLOQUE - in_block;
+		if (chunk > size - done)
+			chunk = size - done;
+
+		// Si falta memoria a mitad de camino, lo ya escrito queda
+		// escrito: el archivo crece hasta ahí, como con un write corto
+		char *block = file_block(fs, file, pos / TAM_BLOQUE, 1);
+		if (!block)
+			break;
+
+		memcpy(block + in_block, buffer + done, chunk);
+		done += chunk;
+	}
+
+	fs_trim_cache(fs);
+	if (done == 0 && size > 0)
+		return -EIO;
+
+	if ((size_t) offset + done > file->size)
+		file_set_size(fs, file, offset + done);
+
+	file->time_last_access = time(NULL);
+	file->time_last_modification = time(NULL);
+	file_touch(fs, file);
+	event_add(fs, EVENTO_WRITE, path);
+	return (int) done;
+}
+
+// ## file_take_reserved
+//
+// Toma un bloque en cero de la reserva de un archivo. Si la reserva está
+// vacía, la vuelve a llenar con el doble de bloques que la vez anterior (a
+// lo sumo MAX_RESERVA_COLA), así un archivo que crece de a poco no reserva
+// un bloque en cada escritura.
+//
+// Devuelve NULL si no hay memoria suficiente.
+//
+static fs_block_t *
+file_take_reserved(fs_file_t *file)
+{
+	if (file->n_reserve == 0) {
+		size_t chunk = file->reserve_chunk ? file->reserve_chunk * 2 : 1;
+		if (chunk > MAX_RESERVA_COLA)
+			chunk = MAX_RESERVA_COLA;
+		file->reserve_chunk = chunk;
+
+		while (file->n_reserve < chunk) {
+			fs_block_t *block = block_new();
+			if (!block)
+				break;
+			file->reserve[file->n_reserve++] = block;
+		}
+		if (file->n_reserve == 0)
+			return NULL;
+	}
+
+	return file->reserve[--file->n_reserve];
+}
+
+// ## file_append
+//
+// Escribe los buffers de iov (size bytes en total) al final de un archivo.
+// Se llama con fs->lock compartido y el lock de cola del archivo tomados.
+//
+// Los bloques que ya existen sólo se modifican si son privados y están en
+// memoria; los nuevos se toman de la reserva del archivo y, como todavía no
+// son visibles, se llenan antes de publicarlos junto con el tamaño nuevo.
+//
+// Devuelve la cantidad de bytes escritos, -EAGAIN si la escritura tiene que
+// hacerse con fs_write (offset no es el final del archivo, o alguno de los
+// bloques está compartido o sólo en la imagen), o un error negativo.
+//
+static int
+file_append(fs_t *fs,
+            fs_file_t *file,
+            const struct iovec *iov,
+            int iovcnt,
+            size_t size,
+            off_t offset,
+            int append)
+{
+	size_t start = file->size;
+	if (!append && (offset < 0 || (size_t) offset != start))
+		return -EAGAIN;
+
+	if (size > MAX_CONTENIDO - start) {
+		fprintf(stderr, "Error: el archivo supera el tamaño máximo\n");
+		return -EFBIG;
+	}
+
+	if (size == 0)
+		return 0;
+
+	size_t first = start / TAM_BLOQUE;
+	size_t last = (start + size - 1) / TAM_BLOQUE;
+	for (size_t i = first; i <= last; i++) {
+		if (file_has_block(file, i) &&
+		    (file->image[i] || file->blocks[i]->refs > 1))
+			return -EAGAIN;
+	}
+
+	fs_block_t *fresh[MAX_BLOQUES];
+	for (size_t i = first; i <= last; i++) {
+		fresh[i - first] = NULL;
+		if (file_has_block(file, i))
+			continue;
+
+		fresh[i - first] = file_take_reserved(file);
+		if (!fresh[i - first]) {
+			// Los bloques tomados siguen en cero
+			while (i-- > first) {
+				if (fresh[i - first])
+					file->reserve[file->n_reserve++] =
+					        fresh[i - first];
+			}
+			return -ENOMEM;
+		}
+	}
+
+	size_t pos = start;
+	for (int v = 0; v < iovcnt; v++) {
+		const char *src = iov[v].iov_base;
+		size_t left = iov[v].iov_len;
+		while (left > 0) {
+			size_t i = pos / TAM_BLOQUE;
+			size_t in_block = pos % TAM_BLOQUE;
+			size_t chunk = TAM_BLOQUE - in_block;
+			if (chunk > left)
+				chunk = left;
+
+			fs_block_t *block = fresh[i - first] ? fresh[i - first]
+			                                     : file->blocks[i];
+			memcpy(block->data + in_block, src, chunk);
+			block->crc_valid = 0;
+			src += chunk;
+			left -= chunk;
+			pos += chunk;
+		}
+	}
+
+	size_t n_fresh = 0;
+	pthread_mutex_lock(&fs->seq_lock);
+	seq_write_begin(fs);
+	for (size_t i = first; i <= last; i++) {
+		if (fresh[i - first]) {
+			file->blocks[i] = fresh[i - first];
+			n_fresh++;
+		}
+		file_touch_block(fs, file, i);
+	}
+	file_set_size(fs, file, start + size);
+	file->time_last_access = time(NULL);
+	file->time_last_modification = time(NULL);
+	seq_write_end(fs);
+	pthread_mutex_unlock(&fs->seq_lock);
+	usage_add(fs, 0, n_fresh, 0);
+
+	return (int) size;
+}
+
+// ## Escritura al final de un archivo
+//
+// Camino rápido para las escrituras al final de un archivo, como las de un
+// log: si append es distinto de 0 (O_APPEND) escribe al final sin importar
+// offset, y si no, sólo si offset es el final. Cuesta lo mismo que copiar
+// los datos, sin importar el tamaño del archivo.
+//
+// Se llama con fs_lock_shared: las escrituras al final de archivos
+// distintos no se esperan entre sí, y las de un mismo archivo se ordenan
+// con su lock de cola, por lo que cada una queda entera y a continuación
+// de la anterior.
+//
+// Devuelve la cantidad de bytes escritos, -EAGAIN si hay que escribir con
+// fs_write (con el lock exclusivo), o un error negativo.
+//
+static int
+fs_appendv(fs_t *fs,
+           const char *path,
+           const struct iovec *iov,
+           int iovcnt,
+           off_t offset,
+           int append)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > MAX_CONTENIDO - size) {
+			fprintf(stderr,
+			        "Error: el archivo supera el tamaño máximo\n");
+			return -EFBIG;
+		}
+		size += iov[i].iov_len;
+	}
+
+	fs_file_t *file = get_file(fs, path);
+	if (!file)
+		return -ENOENT;
+
+	pthread_mutex_t *tail = &fs->tail_locks[file - fs->files];
+	pthread_mutex_lock(tail);
+	int status = file_append(fs, file, iov, iovcnt, size, offset, append);
+	pthread_mutex_unlock(tail);
+	if (status > 0)
+		event_add(fs, EVENTO_WRITE, path);
+	return status;
+}
+
+static int
+fs_append(fs_t *fs,
+          const char *path,
+          const char *buffer,
+          size_t size,
+          off_t offset,
+          int append)
+{
+	struct iovec iov = { .iov_base = (void *) buffer, .iov_len = size };
+	return fs_appendv(fs, path, &iov, 1, offset, append);
+}
+
+// ## file_zero_range
+//
+// Pone en cero el rango [start, end) de los bloques reservados de un archivo,
+// liberando los bloques que quedan cubiertos por completo.
+//
+static void
+file_zero_range(fs_t *fs, fs_file_t *file, size_t start, size_t end)
+{
+	while (start < end) {
+		size_t i = start / TAM_BLOQUE;
+		size_t in_block = start % TAM_BLOQUE;
+		size_t chunk = TAM_BLOQUE - in_block;
+		if (chunk > end - start)
+			chunk = end - start;
+
+		if (chunk == TAM_BLOQUE) {
+			file_drop_block(fs, file, i);
+		} else if (file_has_block(file, i)) {
+			char *block = file_block(fs, file, i, 1);
+			if (block)
+				memset(block + in_block, 0, chunk);
+		}
+
+		start += chunk;
+	}
+}
+
+// ## Cambio de tamaño de un archivo
+//
+// Extender un archivo no reserva bloques: el espacio nuevo es un hueco.
+// Achicarlo libera los bloques que quedan fuera y limpia el resto del último
+// bloque, para que una extensión posterior vuelva a leer ceros.
+//
+static int
+fs_truncate(fs_t *fs, const char *path, off_t size)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (size < 0 || size > MAX_CONTENIDO) {
+		fprintf(stderr, "Error: tamaño invalido\n");
+		return -EINVAL;
+	}
+
+	fs_file_t *file = get_file(fs, path);
+	if (!file) {
+		fprintf(stderr, "Error: archivo no encontrado\n");
+		return -ENOENT;
+	}
+
+	if ((size_t) size < file->size) {
+		size_t first_free = (size + TAM_BLOQUE - 1) / TAM_BLOQUE;
+		file_zero_range(fs, file, size, first_free * TAM_BLOQUE);
+		file_free_blocks(fs, file, first_free);
+	}
+
+	file_set_size(fs, file, size);
+	file->time_last_modification = time(NULL);
+	file_touch(fs, file);
+	event_add(fs, EVENTO_WRITE, path);
+
+	return EXIT_SUCCESS;
+}
+
+// ## Reserva y liberación de espacio
+//
+// Sin flags, reserva los bloques que cubren [offset, offset + len) y extiende
+// el archivo si hace falta (salvo con FALLOC_FL_KEEP_SIZE). Con
+// FALLOC_FL_PUNCH_HOLE (siempre junto a FALLOC_FL_KEEP_SIZE) convierte el
+// rango en un hueco.
+//
+static int
+fs_fallocate(fs_t *fs, const char *path, int mode, off_t offset, off_t len)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+		return -EOPNOTSUPP;
+
+	if ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))
+		return -EOPNOTSUPP;
+
+	if (offset < 0 || len <= 0)
+		return -EINVAL;
+
+	if (offset > MAX_CONTENIDO || len > MAX_CONTENIDO - offset)
+		return -EFBIG;
+
+	fs_file_t *file = get_file(fs, path);
+	if (!file)
+		return -ENOENT;
+
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		file_zero_range(fs, file, offset, offset + len);
+	} else {
+		size_t last = (offset + len - 1) / TAM_BLOQUE;
+		for (size_t i = offset / TAM_BLOQUE; i <= last; i++) {
+			if (file_has_block(file, i))
+				continue;
+			if (!(file->blocks[i] = block_new()))
+				return -ENOSPC;
+			usage_add(fs, 0, 1, 0);
+			file_touch_block(fs, file, i);
+		}
+
+		if (!(mode & FALLOC_FL_KEEP_SIZE) &&
+		    (size_t) (offset + len) > file->size)
+			file_set_size(fs, file, offset + len);
+	}
+
+	file->time_last_modification = time(NULL);
+	file_touch(fs, file);
+	event_add(fs, EVENTO_WRITE, path);
+	return EXIT_SUCCESS;
+}
+
+// ## Búsqueda de datos y huecos
+//
+// Implementa SEEK_DATA y SEEK_HOLE de lseek(2) con granularidad de bloque: el
+// final del archivo cuenta siempre como un hueco.
+//
+// Alcanza con fs_lock_shared: lo único que puede cambiar con ese lock son
+// las escrituras al final (ver fs_appendv), y el lock de cola del archivo
+// evita ver una a medias.
+//
+// Devuelve el offset encontrado, o -ENXIO si offset está más allá del final
+// del archivo (o no hay más datos).
+//
+static off_t
+fs_lseek(fs_t *fs, const char *path, off_t offset, int whence)
+{
+	if (whence != SEEK_DATA && whence != SEEK_HOLE)
+		return -EINVAL;
+
+	fs_file_t *file = get_file(fs, path);
+	if (!file)
+		return -ENOENT;
+
+	pthread_mutex_t *tail = &fs->tail_locks[file - fs->files];
+	pthread_mutex_lock(tail);
+	off_t found = whence == SEEK_HOLE ? (off_t) file->size : -ENXIO;
+	if (offset < 0 || (size_t) offset >= file->size) {
+		found = -ENXIO;
+	} else {
+		size_t last = (file->size - 1) / TAM_BLOQUE;
+		for (size_t i = offset / TAM_BLOQUE; i <= last; i++) {
+			int is_data = file_has_block(file, i);
+			if (is_data == (whence == SEEK_DATA)) {
+				found = i * TAM_BLOQUE;
+				if (found < offset)
+					found = offset;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(tail);
+	return found;
+}
+
+// ## Copia de rangos entre archivos
+//
+// Copia len bytes de path_in (desde off_in) a path_out (desde off_out) sin
+// duplicar datos: los bloques que la copia cubre por completo pasan a estar
+// compartidos entre ambos archivos y sólo se copian cuando alguno de los dos
+// los modifica. Los huecos del origen siguen siendo huecos en el destino.
+//
+// Se comparte también el último bloque cuando la copia llega al final de
+// ambos archivos, ya que lo que queda después del final de un archivo en su
+// último bloque siempre son ceros.
+//
+// Devuelve la cantidad de bytes copiados (0 si off_in está al final del
+// origen o más allá), o un error negativo.
+//
+static ssize_t
+fs_copy_file_range(fs_t *fs,
+                   const char *path_in,
+                   off_t off_in,
+                   const char *path_out,
+                   off_t off_out,
+                   size_t len)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (off_in < 0 || off_out < 0)
+		return -EINVAL;
+
+	fs_file_t *in = get_file(fs, path_in);
+	fs_file_t *out = get_file(fs, path_out);
+	if (!in || !out)
+		return -ENOENT;
+
+	if ((size_t) off_in >= in->size)
+		return 0;
+
+	if (len > in->size - off_in)
+		len = in->size - off_in;
+
+	if ((size_t) off_out + len > MAX_CONTENIDO)
+		return -EFBIG;
+
+	if (in == out && off_in < off_out + (off_t) len &&
+	    off_out < off_in + (off_t) len)
+		return -EINVAL;
+
+	size_t out_end = off_out + len;
+	size_t new_size = out_end > out->size ? out_end : out->size;
+
+	size_t done = 0;
+	while (done < len) {
+		size_t pos_in = off_in + done;
+		size_t pos_out = off_out + done;
+		size_t in_block = pos_in % TAM_BLOQUE;
+		size_t out_block = pos_out % TAM_BLOQUE;
+		size_t chunk = TAM_BLOQUE - (in_block > out_block ? in_block
+		                                                  : out_block);
+		if (chunk > len - done)
+			chunk = len - done;
+
+		size_t bi = pos_in / TAM_BLOQUE;
+		size_t bo = pos_out / TAM_BLOQUE;
+
+		int whole = in_block == 0 && out_block == 0 &&
+		            (chunk == TAM_BLOQUE ||
+		             (pos_in + chunk == in->size && out_end == new_size));
+
+		if (whole) {
+			// Se comparte el bloque, esté o no en memoria
+			fs_block_t *src = in->blocks[bi];
+			uint32_t image = in->image[bi];
+			if (src)
+				src->refs++;
+			file_drop_block(fs, out, bo);
+			out->blocks[bo] = src;
+			out->image[bo] = image;
+			if (src && image)
+				fs->cached++;
+			if (src || image) {
+				usage_add(fs, 0, 1, 0);
+				file_touch_block(fs, out, bo);
+			}
+		} else if (file_has_block(in, bi) || file_has_block(out, bo)) {
+			fs_block_t *src = NULL;
+			char *data = NULL;
+			if (file_load_block(fs, in, bi) == 0) {
+				src = in->blocks[bi];
+				data = file_block(fs, out, bo, 1);
+			}
+			// Si falta memoria a mitad de camino, lo ya copiado
+			// queda copiado, como en fs_write
+			if (!data)
+				break;
+
+			if (src)
+				memcpy(data + out_block, src->data + in_block, chunk);
+			else
+				memset(data + out_block, 0, chunk);
+		}
+
+		done += chunk;
+	}
+
+	fs_trim_cache(fs);
+	if (done == 0 && len > 0)
+		return -EIO;
+
+	if ((size_t) off_out + done > out->size)
+		file_set_size(fs, out, off_out + done);
+	out->time_last_modification = time(NULL);
+	file_touch(fs, out);
+	__atomic_store_n(&in->time_last_access, time(NULL), __ATOMIC_RELAXED);
+	event_add(fs, EVENTO_WRITE, path_out);
+	return (ssize_t) done;
+}
+
+
+// # Bloqueos de rangos
+//
+// Los locks de fcntl (F_GETLK, F_SETLK, F_SETLKW) y de flock se guardan en
+// un árbol por archivo (fs_lock_tree_t), que se crea la primera vez que se
+// bloquea el archivo. Cada árbol tiene su propio mutex: bloquear rangos no
+// toma fs->lock más que para buscar el archivo, y un pedido que tiene que
+// esperar lo hace sobre la condición del árbol, sin ningún lock global.
+//
+// El árbol es un treap ordenado por el comienzo de cada rango, en el que
+// cada nodo guarda además el mayor final de su subárbol (max_end). Así,
+// buscar un rango que se superponga con otro descarta subárboles enteros y
+// cuesta O(log n) aunque el archivo tenga muchos locks.
+//
+// Los locks de flock cubren todo el archivo y no interactúan con los de
+// fcntl, como en Linux. No se detectan deadlocks entre dueños que se
+// esperan mutuamente.
+
+// Final de los rangos que llegan hasta el final del archivo (l_len == 0)
+#define FIN_DEL_ARCHIVO UINT64_MAX
+
+// Cada cuánto revisa un pedido que espera si se lo interrumpió
+#define ESPERA_LOCK_MS 100
+
+typedef struct fs_range_lock {
+	uint64_t start;
+	uint64_t end;      // exclusivo
+	uint64_t max_end;  // mayor end del subárbol
+	uint64_t owner;
+	pid_t pid;
+	short type;   // F_RDLCK o F_WRLCK
+	short flock;  // 1 si es un lock de flock
+	uint32_t priority;
+	struct fs_range_lock *left;
+	struct fs_range_lock *right;
+} fs_range_lock_t;
+
+typedef struct fs_lock_tree {
+	pthread_mutex_t mutex;
+	pthread_cond_t released;  // se quitó o se achicó algún lock
+	fs_range_lock_t *root;
+	size_t n_locks;
+	size_t waiting;  // pedidos esperando en released
+	int refs;        // el archivo y cada operación en curso
+	uint32_t seed;   // para las prioridades del treap
+} fs_lock_tree_t;
+
+static void
+range_update(fs_range_lock_t *node)
+{
+	node->max_end = node->end;
+	if (node->left && node->left->max_end > node->max_end)
+		node->max_end = node->left->max_end;
+	if (node->right && node->right->max_end > node->max_end)
+		node->max_end = node->right->max_end;
+}
+
+// Orden del treap: por comienzo y, a igual comienzo, por dirección
+static int
+range_before(const fs_range_lock_t *a, const fs_range_lock_t *b)
+{
+	if (a->start != b->start)
+		return a->start < b->start;
+	return (uintptr_t) a < (uintptr_t) b;
+}
+
+// ## range_split
+//
+// Divide el treap t entre los nodos anteriores a key (en left) y los demás
+// (en right).
+//
+static void
+range_split(fs_range_lock_t *t,
+            const fs_range_lock_t *key,
+            fs_range_lock_t **left,
+            fs_range_lock_t **right)
+{
+	if (!t) {
+		*left = *right = NULL;
+		return;
+	}
+
+	if (range_before(t, key)) {
+		range_split(t->right, key, &t->right, right);
+		*left = t;
+	} else {
+		range_split(t->left, key, left, &t->left);
+		*right = t;
+	}
+	range_update(t);
+}
+
+// ## range_merge
+//
+// Une dos treaps en los que todos los nodos de left van antes que los de
+// right.
+//
+static fs_range_lock_t *
+range_merge(fs_range_lock_t *left, fs_range_lock_t *right)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->priority > right->priority) {
+		left->right = range_merge(left->right, right);
+		range_update(left);
+		return left;
+	}
+	right->left = range_merge(left, right->left);
+	range_update(right);
+	return right;
+}
+
+static void
+range_insert(fs_lock_tree_t *tree, fs_range_lock_t *node)
+{
+	tree->seed ^= tree->seed << 13;
+	tree->seed ^= tree->seed >> 17;
+	tree->seed ^= tree->seed << 5;
+	node->priority = tree->seed;
+	node->left = node->right = NULL;
+	range_update(node);
+
+	fs_range_lock_t *left, *right;
+	range_split(tree->root, node, &left, &right);
+	tree->root = range_merge(range_merge(left, node), right);
+	tree->n_locks++;
+}
+
+// ## range_delete
+//
+// Quita node del treap t (node tiene que estar en t).
+//
+// Devuelve la nueva raíz.
+//
+static fs_range_lock_t *
+range_delete(fs_range_lock_t *t, fs_range_lock_t *node)
+{
+	if (t == node)
+		return range_merge(t->left, t->right);
+
+	if (range_before(node, t))
+		t->left = range_delete(t->left, node);
+	else
+		t->right = range_delete(t->right, node);
+	range_update(t);
+	return t;
+}
+
+static void
+range_free_all(fs_range_lock_t *t)
+{
+	if (!t)
+		return;
+	range_free_all(t->left);
+	range_free_all(t->right);
+	free(t);
+}
+
+// ## range_find
+//
+// Busca en t un lock del mismo tipo (fcntl o flock) que se superponga con
+// req. Si conflict es distinto de 0, busca uno de otro dueño que impida
+// tomar req; si no, uno del mismo dueño.
+//
+// Devuelve el lock, o NULL si no hay ninguno.
+//
+static fs_range_lock_t *
+range_find(fs_range_lock_t *t, const fs_range_lock_t *req, int conflict)
+{
+	if (!t || t->max_end <= req->start)
+		return NULL;
+
+	fs_range_lock_t *found = range_find(t->left, req, conflict);
+	if (found)
+		return found;
+
+	if (t->start >= req->end)
+		return NULL;
+
+	if (t->end > req->start && t->flock == req->flock) {
+		int same_owner = t->owner == req->owner;
+		if (conflict && !same_owner &&
+		    (t->type == F_WRLCK || req->type == F_WRLCK))
+			return t;
+		if (!conflict && same_owner)
+			return t;
+	}
+
+	return range_find(t->right, req, conflict);
+}
+
+// ## lock_tree_set
+//
+// Deja a req->owner con el lock req (o sin locks en su rango si req->type
+// es F_UNLCK), recortando los que ya tenía en ese rango. Se llama con el
+// mutex del árbol tomado y sin conflictos con otros dueños.
+//
+// Devuelve cuántos locks previos se quitaron o recortaron, o -ENOLCK si no
+// hay memoria suficiente (los locks quedan como estaban).
+//
+static int
+lock_tree_set(fs_lock_tree_t *tree, const fs_range_lock_t *req)
+{
+	// Como mucho hace falta un nodo para req y otro para partir en dos un
+	// lock que contiene a req
+	fs_range_lock_t *spare[2] = { malloc(sizeof(fs_range_lock_t)),
+		                      malloc(sizeof(fs_range_lock_t)) };
+	if (!spare[0] || !spare[1]) {
+		free(spare[0]);
+		free(spare[1]);
+		return -ENOLCK;
+	}
+	size_t n_spare = 2;
+
+	int changed = 0;
+	fs_range_lock_t *old;
+	fs_range_lock_t *kept[2];
+	size_t n_kept = 0;
+	while ((old = range_find(tree->root, req, 0))) {
+		tree->root = range_delete(tree->root, old);
+		tree->n_locks--;
+		changed++;
+
+		// Las partes de old fuera de req se conservan
+		fs_range_lock_t *after = NULL;
+		if (old->end > req->end) {
+			after = spare[--n_spare];
+			*after = *old;
+			after->start = req->end;
+		}
+		if (old->start < req->start) {
+			old->end = req->start;
+			kept[n_kept++] = old;
+		} else if (n_spare < 2) {
+			spare[n_spare++] = old;
+		} else {
+			free(old);
+		}
+		if (after)
+			kept[n_kept++] = after;
+	}
+	for (size_t i = 0; i < n_kept; i++)
+		range_insert(tree, kept[i]);
+
+	if (req->type != F_UNLCK) {
+		fs_range_lock_t *node = spare[--n_spare];
+		*node = *req;
+		range_insert(tree, node);
+	}
+
+	while (n_spare > 0)
+		free(spare[--n_spare]);
+	return changed;
+}
+
+static void
+lock_tree_put(fs_lock_tree_t *tree)
+{
+	if (__atomic_sub_fetch(&tree->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	range_free_all(tree->root);
+	pthread_mutex_destroy(&tree->mutex);
+	pthread_cond_destroy(&tree->released);
+	free(tree);
+}
+
+// ## file_lock_tree
+//
+// Obtiene el árbol de locks de file, creándolo si todavía no tiene, y toma
+// una referencia para el que llama (se suelta con lock_tree_put). Se llama
+// con fs->lock tomado, aunque sea compartido.
+//
+// Devuelve el árbol, o NULL si no hay memoria suficiente.
+//
+static fs_lock_tree_t *
+file_lock_tree(fs_file_t *file)
+{
+	fs_lock_tree_t *tree = __atomic_load_n(&file->locks, __ATOMIC_ACQUIRE);
+	if (!tree) {
+		fs_lock_tree_t *created = calloc(1, sizeof(fs_lock_tree_t));
+		if (!created)
+			return NULL;
+		pthread_mutex_init(&created->mutex, NULL);
+		pthread_cond_init(&created->released, NULL);
+		created->refs = 1;
+		created->seed = 2463534242u;
+
+		if (__atomic_compare_exchange_n(&file->locks,
+		                                &tree,
+		                                created,
+		                                0,
+		                                __ATOMIC_ACQ_REL,
+		                                __ATOMIC_ACQUIRE)) {
+			tree = created;
+		} else {
+			lock_tree_put(created);
+		}
+	}
+
+	__atomic_add_fetch(&tree->refs, 1, __ATOMIC_RELAXED);
+	return tree;
+}
+
+// ## file_drop_locks
+//
+// Suelta todos los locks de file al borrarlo. Los pedidos que estaban
+// esperando se despiertan y ven que ya no hay nada que los bloquee. Se
+// llama con el lock de modificación tomado.
+//
+static void
+file_drop_locks(fs_file_t *file)
+{
+	fs_lock_tree_t *tree = file->locks;
+	if (!tree)
+		return;
+	file->locks = NULL;
+
+	pthread_mutex_lock(&tree->mutex);
+	range_free_all(tree->root);
+	tree->root = NULL;
+	tree->n_locks = 0;
+	pthread_cond_broadcast(&tree->released);
+	pthread_mutex_unlock(&tree->mutex);
+	lock_tree_put(tree);
+}
+
+// ## lock_tree_acquire
+//
+// Aplica req al árbol. Si otro dueño tiene un lock incompatible y wait es
+// distinto de 0, espera a que lo suelte; mientras tanto, cada
+// ESPERA_LOCK_MS revisa si interrupted (que puede ser NULL) indica que se
+// interrumpió el pedido. Suelta la referencia a tree.
+//
+// Devuelve 0, -EAGAIN si hay un conflicto y no se espera, -EINTR o -ENOLCK.
+//
+static int
+lock_tree_acquire(fs_lock_tree_t *tree,
+                  const fs_range_lock_t *req,
+                  int wait,
+                  int (*interrupted)(void))
+{
+	int status = 0;
+
+	pthread_mutex_lock(&tree->mutex);
+	while (req->type != F_UNLCK && range_find(tree->root, req, 1)) {
+		if (!wait) {
+			status = -EAGAIN;
+			break;
+		}
+		if (interrupted && interrupted()) {
+			status = -EINTR;
+			break;
+		}
+
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += ESPERA_LOCK_MS * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		tree->waiting++;
+		pthread_cond_timedwait(&tree->released, &tree->mutex, &until);
+		tree->waiting--;
+	}
+
+	if (status == 0) {
+		int changed = lock_tree_set(tree, req);
+		if (changed > 0 && tree->waiting > 0)
+			pthread_cond_broadcast(&tree->released);
+		status = changed < 0 ? changed : 0;
+	}
+	pthread_mutex_unlock(&tree->mutex);
+
+	lock_tree_put(tree);
+	return status;
+}
+
+// ## find_lock_tree
+//
+// Busca el archivo path y obtiene su árbol de locks (ver file_lock_tree) y
+// su tamaño. Si create es 0 y el archivo nunca se bloqueó, tree queda en
+// NULL. Toma fs->lock compartido sólo mientras busca.
+//
+// Devuelve 0, -EISDIR, -ENOENT o -ENOLCK.
+//
+static int
+find_lock_tree(fs_t *fs,
+               const char *path,
+               int create,
+               fs_lock_tree_t **tree,
+               uint64_t *size)
+{
+	int status = 0;
+	*tree = NULL;
+
+	fs_lock_shared(fs);
+	fs_file_t *file = get_file(fs, path);
+	if (!file) {
+		status = get_dir(fs, path) ? -EISDIR : -ENOENT;
+	} else {
+		*size = __atomic_load_n(&file->size, __ATOMIC_RELAXED);
+		if (create || __atomic_load_n(&file->locks, __ATOMIC_ACQUIRE))
+			*tree = file_lock_tree(file);
+		if (create && !*tree)
+			status = -ENOLCK;
+	}
+	fs_unlock(fs);
+
+	return status;
+}
+
+// ## flock_range
+//
+// Calcula el rango [start, end) de lock, relativo a l_whence, en req.
+// Con l_whence == SEEK_END se usa size como final del archivo.
+//
+// Devuelve 0, o -EINVAL si el rango es inválido.
+//
+static int
+flock_range(const struct flock *lock, uint64_t size, fs_range_lock_t *req)
+{
+	int64_t start;
+	switch (lock->l_whence) {
+	case SEEK_SET:
+		start = lock->l_start;
+		break;
+	case SEEK_END:
+		start = (int64_t) size + lock->l_start;
+		break;
+	default:
+		// SEEK_CUR ya lo resuelve el kernel
+		return -EINVAL;
+	}
+
+	int64_t len = lock->l_len;
+	if (len < 0) {
+		start += len;
+		len = -len;
+	}
+	if (start < 0)
+		return -EINVAL;
+
+	req->start = start;
+	req->end = len == 0 ? FIN_DEL_ARCHIVO : (uint64_t) start + len;
+	return 0;
+}
+
+// ## fs_getlk
+//
+// Como fcntl(F_GETLK): busca un lock de otro dueño que impida a owner tomar
+// lock. Si lo hay, lo describe en lock; si no, deja lock->l_type en F_UNLCK.
+// Se llama sin ningún lock tomado.
+//
+// Devuelve 0 o un error negativo.
+//
+static int
+fs_getlk(fs_t *fs, const char *path, uint64_t owner, struct flock *lock)
+{
+	if (lock->l_type != F_RDLCK && lock->l_type != F_WRLCK)
+		return -EINVAL;
+
+	fs_lock_tree_t *tree;
+	uint64_t size;
+	int status = find_lock_tree(fs, path, 0, &tree, &size);
+	if (status < 0)
+		return status;
+
+	fs_range_lock_t req = { .owner = owner, .type = lock->l_type };
+	status = flock_range(lock, size, &req);
+	if (status < 0 || !tree) {
+		if (tree)
+			lock_tree_put(tree);
+		if (status == 0)
+			lock->l_type = F_UNLCK;
+		return status;
+	}
+
+	pthread_mutex_lock(&tree->mutex);
+	fs_range_lock_t *conflict = range_find(tree->root, &req, 1);
+	if (conflict) {
+		lock->l_type = conflict->type;
+		lock->l_whence = SEEK_SET;
+		lock->l_start = conflict->start;
+		lock->l_len = conflict->end == FIN_DEL_ARCHIVO
+		                      ? 0
+		                      : conflict->end - conflict->start;
+		lock->l_pid = conflict->pid;
+	} else {
+		lock->l_type = F_UNLCK;
+	}
+	pthread_mutex_unlock(&tree->mutex);
+
+	lock_tree_put(tree);
+	return 0;
+}
+
+// ## fs_setlk
+//
+// Como fcntl(F_SETLK) o, si wait es distinto de 0, fcntl(F_SETLKW): toma o
+// suelta (F_UNLCK) el lock de owner sobre el rango de lock. interrupted
+// indica si se interrumpió una espera (puede ser NULL). Se llama sin ningún
+// lock tomado.
+//
+// Devuelve 0, -EAGAIN si otro dueño tiene un lock incompatible y no se
+// espera, -EINTR o algún otro error negativo.
+//
+static int
+fs_setlk(fs_t *fs,
+         const char *path,
+         uint64_t owner,
+         const struct flock *lock,
+         int wait,
+         int (*interrupted)(void))
+{
+	if (lock->l_type != F_RDLCK && lock->l_type != F_WRLCK &&
+	    lock->l_type != F_UNLCK)
+		return -EINVAL;
+
+	fs_lock_tree_t *tree;
+	uint64_t size;
+	int status = find_lock_tree(fs, path, 1, &tree, &size);
+	if (status < 0)
+		return status;
+
+	fs_range_lock_t req = { .owner = owner,
+		                .pid = lock->l_pid,
+		                .type = lock->l_type };
+	status = flock_range(lock, size, &req);
+	if (status < 0) {
+		lock_tree_put(tree);
+		return status;
+	}
+
+	return lock_tree_acquire(tree, &req, wait, interrupted);
+}
+
+// ## fs_flock
+//
+// Como flock(2): op es LOCK_SH, LOCK_EX o LOCK_UN, opcionalmente con
+// LOCK_NB. Se llama sin ningún lock tomado.
+//
+// Devuelve 0, -EWOULDBLOCK si el archivo está bloqueado y se pidió
+// LOCK_NB, -EINTR o algún otro error negativo.
+//
+static int
+fs_flock(fs_t *fs,
+         const char *path,
+         uint64_t owner,
+         int op,
+         int (*interrupted)(void))
+{
+	fs_range_lock_t req = { .start = 0,
+		                .end = FIN_DEL_ARCHIVO,
+		                .owner = owner,
+		                .flock = 1 };
+	switch (op & ~LOCK_NB) {
+	case LOCK_SH:
+		req.type = F_RDLCK;
+		break;
+	case LOCK_EX:
+		req.type = F_WRLCK;
+		break;
+	case LOCK_UN:
+		req.type = F_UNLCK;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	fs_lock_tree_t *tree;
+	uint64_t size;
+	int status = find_lock_tree(fs, path, 1, &tree, &size);
+	if (status < 0)
+		return status;
+
+	status = lock_tree_acquire(tree, &req, !(op & LOCK_NB), interrupted);
+	return status == -EAGAIN ? -EWOULDBLOCK : status;
+}
+
+// ## fs_unlock_owner
+//
+// Suelta todos los locks (de fcntl y de flock) de owner sobre path, al
+// cerrar el archivo. Se llama sin ningún lock tomado.
+//
+static void
+fs_unlock_owner(fs_t *fs, const char *path, uint64_t owner)
+{
+	for (short flock = 0; flock <= 1; flock++) {
+		fs_lock_tree_t *tree;
+		uint64_t size;
+		if (find_lock_tree(fs, path, 0, &tree, &size) < 0 || !tree)
+			return;
+
+		fs_range_lock_t req = { .start = 0,
+			                .end = FIN_DEL_ARCHIVO,
+			                .owner = owner,
+			                .type = F_UNLCK,
+			                .flock = flock };
+		lock_tree_acquire(tree, &req, 0, NULL);
+	}
+}
+
+// # Liberación en segundo plano
+//
+// fs_rmtree quita las entradas de un árbol enseguida, pero deja los bloques
+// de sus archivos a un hilo aparte (reclaim_worker), para que borrar un
+// árbol grande no demore a las demás operaciones. Sólo se difieren los
+// bloques que eran exclusivos de los archivos borrados: como ya nadie más
+// los ve, el hilo los suelta sin tomar fs->lock. Los compartidos con otros
+// archivos se sueltan en el momento, con el lock tomado.
+
+typedef struct fs_reclaim {
+	struct fs_reclaim *next;
+	size_t n;
+	fs_block_t *blocks[MAX_BLOQUES + MAX_RESERVA_COLA];
+} fs_reclaim_t;
+
+// ## reclaim_worker
+//
+// Hilo que suelta los bloques pendientes de fs, hasta que se lo detiene con
+// fs_reclaim_stop (antes suelta los que queden).
+//
+static void *
+reclaim_worker(void *arg)
+{
+	fs_t *fs = arg;
+
+	pthread_mutex_lock(&fs->reclaim_lock);
+	for (;;) {
+		fs_reclaim_t *pending = fs->reclaim_pending;
+		if (!pending && fs->reclaim_stop)
+			break;
+		if (!pending) {
+			pthread_cond_wait(&fs->reclaim_wake, &fs->reclaim_lock);
+			continue;
+		}
+
+		fs->reclaim_pending = NULL;
+		fs->reclaim_busy = 1;
+		pthread_mutex_unlock(&fs->reclaim_lock);
+
+		size_t freed = 0;
+		while (pending) {
+			fs_reclaim_t *next = pending->next;
+			for (size_t i = 0; i < pending->n; i++)
+				block_put(pending->blocks[i]);
+			freed += pending->n;
+			free(pending);
+			pending = next;
+		}
+
+		pthread_mutex_lock(&fs->reclaim_lock);
+		fs->reclaimed += freed;
+		fs->reclaim_busy = 0;
+		pthread_cond_broadcast(&fs->reclaim_wake);
+	}
+	pthread_mutex_unlock(&fs->reclaim_lock);
+
+	return NULL;
+}
+
+// ## reclaim_push
+//
+// Deja batch para el hilo de liberación, creándolo si todavía no existe.
+//
+// Devuelve 0, o -1 si no se pudo crear el hilo (batch queda sin tocar).
+//
+static int
+reclaim_push(fs_t *fs, fs_reclaim_t *batch)
+{
+	pthread_mutex_lock(&fs->reclaim_lock);
+	if (!fs->reclaim_running) {
+		int status = pthread_create(
+		        &fs->reclaim_thread, NULL, reclaim_worker, fs);
+		if (status != 0) {
+			pthread_mutex_unlock(&fs->reclaim_lock);
+			return -1;
+		}
+		fs->reclaim_running = 1;
+	}
+
+	batch->next = fs->reclaim_pending;
+	fs->reclaim_pending = batch;
+	pthread_cond_broadcast(&fs->reclaim_wake);
+	pthread_mutex_unlock(&fs->reclaim_lock);
+	return 0;
+}
+
+// ## fs_reclaim_wait
+//
+// Espera a que el hilo de liberación suelte todos los bloques pendientes.
+//
+static void
+fs_reclaim_wait(fs_t *fs)
+{
+	pthread_mutex_lock(&fs->reclaim_lock);
+	while (fs->reclaim_pending || fs->reclaim_busy)
+		pthread_cond_wait(&fs->reclaim_wake, &fs->reclaim_lock);
+	pthread_mutex_unlock(&fs->reclaim_lock);
+}
+
+// ## fs_reclaim_stop
+//
+// Detiene el hilo de liberación, si existe, después de que suelte los
+// bloques pendientes.
+//
+static void
+fs_reclaim_stop(fs_t *fs)
+{
+	pthread_mutex_lock(&fs->reclaim_lock);
+	if (!fs->reclaim_running) {
+		pthread_mutex_unlock(&fs->reclaim_lock);
+		return;
+	}
+	fs->reclaim_stop = 1;
+	pthread_cond_broadcast(&fs->reclaim_wake);
+	pthread_mutex_unlock(&fs->reclaim_lock);
+
+	pthread_join(fs->reclaim_thread, NULL);
+	fs->reclaim_running = 0;
+	fs->reclaim_stop = 0;
+}
+
+// ## file_free_blocks_later
+//
+// Como file_free_blocks(fs, file, 0), pero los bloques exclusivos del
+// archivo (y su reserva) los suelta el hilo de liberación.
+//
+static void
+file_free_blocks_later(fs_t *fs, fs_file_t *file)
+{
+	fs_reclaim_t *batch = malloc(sizeof(fs_reclaim_t));
+	if (!batch) {
+		file_free_blocks(fs, file, 0);
+		return;
+	}
+
+	batch->n = 0;
+	for (size_t i = 0; i < MAX_BLOQUES; i++) {
+		fs_block_t *block = file->blocks[i];
+		if (!block || block->refs > 1)
+			continue;
+
+		if (file->image[i])
+			fs->cached--;
+		usage_add(fs, 0, -1, 0);
+		file_forget_image_block(fs, file, i);
+		file->blocks[i] = NULL;
+		file->image[i] = 0;
+		batch->blocks[batch->n++] = block;
+	}
+	while (file->n_reserve > 0)
+		batch->blocks[batch->n++] = file->reserve[--file->n_reserve];
+
+	if (batch->n == 0 || reclaim_push(fs, batch) != 0) {
+		for (size_t i = 0; i < batch->n; i++)
+			block_put(batch->blocks[i]);
+		free(batch);
+	}
+
+	file_free_blocks(fs, file, 0);
+}
+
+// # Eliminación de entradas
+//
+// Al quitar un directorio o un archivo, su lugar en el arreglo lo ocupa el
+// último, así que no se corre ningún otro: cada eliminación cuesta lo mismo
+// que buscar la entrada. Si el que se mueve es un directorio, se corrigen
+// los punteros de su contenido, que se encuentra con su índice.
+
+// ## remove_file
+//
+// Quita el archivo name. Si later es distinto de 0, sus bloques se liberan
+// en segundo plano (ver file_free_blocks_later).
+//
+// Devuelve 0, o -ENOENT si no existe.
+//
+static int
+remove_file(fs_t *fs, const char *name, int later)
+{
+	int index = get_file_index(fs, name);
+	if (index == -1) {
+		fprintf(stderr, "Error al eliminar el archivo.\n");
+		return -ENOENT;
+	}
+
+	fs_file_t *file = &fs->files[index];
+	file_drop_locks(file);
+	if (later)
+		file_free_blocks_later(fs, file);
+	else
+		file_free_blocks(fs, file, 0);
+	file_set_size(fs, file, 0);
+	dir_index_remove(file->entry, name);
+
+	size_t last = fs->f_size - 1;
+	fs->files[index] = fs->files[last];
+	fs->file_tags[index] = fs->file_tags[last];
+
+	fs->f_size--;
+	bloom_removal(fs);
+	usage_add(fs, -1, 0, 0);
+	txn_next(fs);
+	return 0;
+}
+
+// ## dir_adopt_children
+//
+// Apunta a dir los archivos y subdirectorios de su índice, después de
+// moverlo a otro lugar de fs->directories.
+//
+static void
+dir_adopt_children(fs_t *fs, fs_d_entry_t *dir)
+{
+	for (size_t i = 0; i < dir->n_entries; i++) {
+		const char *name = dir->entries[i].name;
+		if (name[0] == '\0')
+			continue;
+
+		char path[MAX_NAME];
+		int len = snprintf(path, MAX_NAME, "%s/%s", dir->path, name);
+		if (len >= MAX_NAME)
+			continue;
+
+		fs_d_entry_t *sub = get_dir(fs, path);
+		if (sub)
+			sub->d_parent = dir;
+		fs_file_t *file = get_file(fs, path);
+		if (file)
+			file->entry = dir;
+	}
+}
+
+// ## remove_dir
+//
+// Quita el directorio name, sin mirar si está vacío.
+//
+// Devuelve 0, o -ENOENT si no existe.
+//
+static int
+remove_dir(fs_t *fs, const char *name)
+{
+	int index = get_dir_index(fs, name);
+	if (index == -1) {
+		fprintf(stderr, "Error al eliminar el directorio.\n");
+		return -ENOENT;
+	}
+
+	fs_d_entry_t *removed = &fs->directories[index];
+	if (removed->d_parent)
+		dir_index_remove(removed->d_parent, name);
+	free(removed->entries);
+	free(removed->tags);
+
+	size_t last = fs->d_size - 1;
+	fs->directories[index] = fs->directories[last];
+	fs->dir_tags[index] = fs->dir_tags[last];
+	fs->d_size--;
+	if ((size_t) index != last)
+		dir_adopt_children(fs, removed);
+
+	bloom_removal(fs);
+	usage_add(fs, -1, 0, 0);
+	txn_next(fs);
+	return 0;
+}
+
+// ## Eliminación de archivos
+//
+static int
+fs_unlink(fs_t *fs, const char *path)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	fs_file_t *file = get_file(fs, path);
+	if (file) {
+		int status = remove_file(fs, path, 0);
+		if (status == 0)
+			event_add(fs, EVENTO_UNLINK, path);
+		return status;
+	}
+
+	fprintf(stderr, "Error al eliminar el archivo.\n");
+	return -ENOENT;
+}
+
+static int
+amount_subdirs_and_files(fs_t *fs, fs_d_entry_t *dir)
+{
+	return dir_children(dir);
+}
+
+// Eliminacion de un directorio
+//
+static int
+fs_rmdir(fs_t *fs, const char *path)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	fs_d_entry_t *dir = get_dir(fs, path);
+	if (!dir) {
+		fprintf(stderr, "Error al eliminar el directorio.\n");
+		return -ENOENT;
+	}
+
+	if (amount_subdirs_and_files(fs, dir) > 0) {
+		fprintf(stderr, "Error al eliminar el directorio. No se encuentra vacio.\n");
+		return -ENOTEMPTY;
+	}
+
+	int status = remove_dir(fs, path);
+	if (status == 0)
+		event_add(fs, EVENTO_RMDIR, path);
+	return status;
+}
+
+// ## Borrado de un árbol
+//
+// Borra el directorio path con todo su contenido en una sola operación: las
+// entradas se quitan enseguida y los bloques de los archivos se liberan en
+// segundo plano. No se puede borrar la raíz.
+//
+// Devuelve 0 o un error negativo.
+//
+static int
+fs_rmtree(fs_t *fs, const char *path)
+{
+	if (fs->read_only)
+		return -EROFS;
+
+	if (strcmp(path, ROOT) == 0)
+		return -EBUSY;
+	if (!get_dir(fs, path))
+		return get_file(fs, path) ? -ENOTDIR : -ENOENT;
+
+	// Paths del árbol, cada directorio antes que su contenido
+	size_t max = fs->d_size + fs->f_size;
+	char(*paths)[MAX_NAME] = malloc(max * MAX_NAME);
+	if (!paths)
+		return -ENOMEM;
+
+	size_t n = 0;
+	strcpy(paths[n++], path);
+	for (size_t i = 0; i < n; i++) {
+		fs_d_entry_t *dir = get_dir(fs, paths[i]);
+		for (size_t j = 0; dir && j < dir->n_entries && n < max; j++) {
+			const char *name = dir->entries[j].name;
+			if (name[0] == '\0')
+				continue;
+
+			int len = snprintf(
+			        paths[n], MAX_NAME, "%s/%s", paths[i], name);
+			if (len < MAX_NAME)
+				n++;
+		}
+	}
+
+	// Al revés, para vaciar cada directorio antes de quitarlo
+	while (n-- > 0) {
+		if (!get_dir(fs, paths[n])) {
+			if (remove_file(fs, paths[n], 1) == 0)
+				event_add(fs, EVENTO_UNLINK, paths[n]);
+		} else if (remove_dir(fs, paths[n]) == 0) {
+			event_add(fs, EVENTO_RMDIR, paths[n]);
+		}
+	}
+
+	free(paths);
+	return 0;
+}
+
+
+// ## fs_alloc
+//
+// Reserva un fs_t lleno de ceros en una arena propia, para que sus arreglos
+// de entradas queden en páginas enormes cuando son lo bastante grandes.
+//
+// Devuelve NULL si no hay memoria suficiente.
+//
+static fs_t *
+fs_alloc()
+{
+	arena_t arena;
+	if (arena_map(&arena, sizeof(fs_t)) != 0)
+		return NULL;
+
+	fs_t *fs = (fs_t *) arena.base;
+	fs->arena = arena;
+	__atomic_add_fetch(&arena_usage.used, sizeof(fs_t), __ATOMIC_RELAXED);
+	return fs;
+}
+
+// ## fs_build
+//
+// Construye un sistema de archivos vacío.
+//
+// Devuelve un puntero a una estructura fs_t con un directorio raíz.
+// Si no se pudo crear la estructura, devuelve NULL.
+//
+// Contiene un solo directorio llamado "/". (ROOT)
+// No contiene archivos.
+//
+static fs_t *
+fs_build()
+{
+	fs_t *fs = fs_alloc();
+	if (!fs) {
+		fprintf(stderr, "Error al crear el file system.\n");
+		return NULL;
+	}
+
+	strcpy(fs->directories[0].path, ROOT);
+	fs->directories[0].d_parent = NULL;
+	fs->d_size = 1;
+	fs->f_size = 0;
+	fs->image_fd = -1;
+	fs->max_cached = MAX_BLOQUES_EN_CACHE;
+	fs->capacity = CAPACIDAD_BLOQUES;
+	fs_init_locks(fs);
+
+	fs->directories[0].uid = 1717;
+	fs->directories[0].gid = getgid();
+	fs->directories[0].mode = __S_IFDIR | 0755;
+	fs->directories[0].time_creation = time(NULL);
+	fs->directories[0].time_last_access = time(NULL);
+	fs->directories[0].time_last_modification = time(NULL);
+	fs->directories[0].size = 0;
+	fs->id = txn_new_id();
+	dir_touch(fs, &fs->directories[0]);
+	fs->committed_txn = fs->txn;
+	fs->dir_tags[0] = path_tag(path_hash(ROOT));
+	bloom_add(fs, ROOT);
+	usage_add(fs, 1, 0, 0);
+
+	return fs;
+}
+
+// # Formato de la imagen
+//
+// La imagen persistida se divide en segmentos independientes, para poder
+// leerlos y verificarlos en paralelo:
+//
+//     [cabecera][tabla de segmentos][metadatos][nombres][sumas]
+//     [datos 0]...[datos n]
+//
+// * metadatos: un fs_dir_record_t por directorio y un fs_file_record_t por
+//   archivo. Los punteros se guardan como índices (padre) y números de bloque.
+//   También se guardan los números de transacción (ver txn_next), para
+//   seguir exportando cambios después de volver a montar.
+// * nombres: los paths de todas las entradas, terminados en '\0'.
+// * sumas: el CRC32C de cada bloque de datos, en orden.
+// * datos: los bloques de contenido, de a BLOQUES_POR_SEGMENTO por segmento.
+//   Un bloque compartido entre archivos se guarda una sola vez.
+//
+// Los segmentos de metadatos, nombres y sumas tienen su CRC32C en la tabla y
+// se verifican al montar; además cada registro de metadatos tiene el suyo,
+// para que fisopfs-fsck pueda señalar cuáles están dañados. Los segmentos
+// de datos no tienen CRC propio: cada bloque se verifica contra su suma la
+// primera vez que se lo lee, o antes si lo alcanza el verificador en
+// segundo plano.
+
+#define IMAGEN_MAGIC "FISOPFS"
+#define IMAGEN_VERSION 3
+
+#define SEGMENTO_METADATOS 0
+#define SEGMENTO_NOMBRES 1
+#define SEGMENTO_SUMAS 2
+#define SEGMENTO_DATOS 3
+
+#define BLOQUES_POR_SEGMENTO 64
+#define MAX_HILOS_CARGA 8
+
+typedef struct fs_image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_segments;
+	uint32_t d_size;
+	uint32_t f_size;
+	uint64_t n_blocks;
+	uint64_t txn;  // fs->txn y fs->id
+	uint64_t id;
+	uint32_t table_crc;
+	uint32_t header_crc;  // CRC de todos los campos anteriores
+} fs_image_header_t;
+
+typedef struct fs_segment {
+	uint32_t type;
+	uint32_t first_block;  // sólo para segmentos de datos
+	uint64_t offset;
+	uint64_t length;
+	uint32_t crc;  // 0 en los segmentos de datos
+	uint32_t padding;
+} fs_segment_t;
+
+typedef struct fs_dir_record {
+	uint32_t name;   // offset en el segmento de nombres
+	int32_t parent;  // índice del directorio padre, -1 para la raíz
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t crc;  // CRC del registro sin este campo (ver record_crc)
+	int64_t time_last_access;
+	int64_t time_last_modification;
+	int64_t time_creation;
+	uint64_t size;
+	uint64_t txn;
+} fs_dir_record_t;
+
+typedef struct fs_file_record {
+	uint32_t name;
+	int32_t parent;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t crc;
+	int64_t time_last_access;
+	int64_t time_last_modification;
+	int64_t time_creation;
+	uint64_t size;
+	uint64_t birth;
+	uint64_t txn;
+	uint32_t blocks[MAX_BLOQUES];  // 0 es un hueco; n es el bloque n - 1
+	uint64_t block_txn[MAX_BLOQUES];
+} fs_file_record_t;
+
+// ## CRC32C
+//
+// Las sumas son CRC32C (Castagnoli), que en x86-64 con SSE4.2 se calcula con
+// la instrucción crc32 de a 8 bytes. Como cada crc32 depende del resultado
+// del anterior, los buffers grandes se dividen en tres tramos de TRAMO_CRC
+// bytes que se calculan intercalados, y los tres CRC parciales se combinan
+// multiplicándolos (con PCLMULQDQ) por x^(8 * TRAMO_CRC) y x^(16 * TRAMO_CRC)
+// módulo el polinomio. Como con las etiquetas, la implementación se elige la
+// primera vez según lo que soporte la CPU, y en otras arquitecturas se usa
+// la versión con tabla.
+
+#define POLINOMIO_CRC32C 0x82F63B78
+#define TRAMO_CRC 1344
+
+typedef struct crc32c_kernel {
+	const char *name;
+	uint32_t (*update)(uint32_t crc, const void *buf, size_t len);
+} crc32c_kernel_t;
+
+static uint32_t crc32c_table[256];
+
+static uint32_t
+crc32c_update_table(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	crc = ~crc;
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#if defined(__x86_64__)
+// Constantes para combinar los tramos (ver crc32c_select)
+static uint32_t crc32c_shift_1;
+static uint32_t crc32c_shift_2;
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_update_sse42(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t c = ~crc;
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		c = _mm_crc32_u64(c, word);
+	}
+	while (len--)
+		c = _mm_crc32_u8(c, *p++);
+
+	return ~(uint32_t) c;
+}
+
+// Multiplica crc por k módulo el polinomio (k ya está corrido 33 bits)
+__attribute__((target("sse4.2,pclmul"))) static uint64_t
+crc32c_shift(uint64_t crc, uint32_t k)
+{
+	__m128i product = _mm_clmulepi64_si128(
+	        _mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t
+crc32c_update_pclmul(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t c = ~crc;
+	for (; len >= 3 * TRAMO_CRC; p += 3 * TRAMO_CRC, len -= 3 * TRAMO_CRC) {
+		uint64_t c1 = 0, c2 = 0;
+		for (size_t i = 0; i < TRAMO_CRC; i += 8) {
+			uint64_t w0, w1, w2;
+			memcpy(&w0, p + i, 8);
+			memcpy(&w1, p + TRAMO_CRC + i, 8);
+			memcpy(&w2, p + 2 * TRAMO_CRC + i, 8);
+			c = _mm_crc32_u64(c, w0);
+			c1 = _mm_crc32_u64(c1, w1);
+			c2 = _mm_crc32_u64(c2, w2);
+		}
+		c = crc32c_shift(c, crc32c_shift_2) ^
+		    crc32c_shift(c1, crc32c_shift_1) ^ c2;
+	}
+
+	return crc32c_update_sse42(~(uint32_t) c, p, len);
+}
+#endif
+
+// De la más lenta a la más rápida
+static const crc32c_kernel_t crc32c_kernels[] = {
+	{ "tabla", crc32c_update_table },
+#if defined(__x86_64__)
+	{ "sse4.2", crc32c_update_sse42 },
+	{ "pclmul", crc32c_update_pclmul },
+#endif
+};
+
+#define N_CRC32C_KERNELS (sizeof(crc32c_kernels) / sizeof(crc32c_kernels[0]))
+
+static const crc32c_kernel_t *crc32c_kernel;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// ## crc32c_kernel_supported
+//
+// Devuelve 1 si la CPU soporta las instrucciones que usa kernel, 0 si no.
+//
+static int
+crc32c_kernel_supported(const crc32c_kernel_t *kernel)
+{
+#if defined(__x86_64__)
+	if (kernel->update == crc32c_update_sse42)
+		return __builtin_cpu_supports("sse4.2");
+	if (kernel->update == crc32c_update_pclmul)
+		return __builtin_cpu_supports("sse4.2") &&
+		       __builtin_cpu_supports("pclmul");
+#endif
+	return 1;
+}
+
+#if defined(__x86_64__)
+// Devuelve x^n módulo el polinomio, con los bits invertidos como el CRC
+static uint32_t
+crc32c_x_pow(unsigned n)
+{
+	uint32_t r = 0x80000000;
+	while (n--)
+		r = (r >> 1) ^ (POLINOMIO_CRC32C & -(r & 1));
+	return r;
+}
+#endif
+
+static void
+crc32c_select(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (POLINOMIO_CRC32C & -(crc & 1));
+		crc32c_table[i] = crc;
+	}
+
+#if defined(__x86_64__)
+	// El producto sin acarreo y la reducción con crc32 agregan 33 grados
+	crc32c_shift_1 = crc32c_x_pow(8 * TRAMO_CRC - 33);
+	crc32c_shift_2 = crc32c_x_pow(16 * TRAMO_CRC - 33);
+#endif
+
+	for (size_t i = 0; i < N_CRC32C_KERNELS; i++) {
+		if (crc32c_kernel_supported(&crc32c_kernels[i]))
+			crc32c_kernel = &crc32c_kernels[i];
+	}
+}
+
+// ## crc32c
+//
+// Continúa el CRC32C crc con len bytes de buf. Para empezar un CRC nuevo se
+// pasa crc = 0.
+//
+static uint32_t
+crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc32c_once, crc32c_select);
+	return crc32c_kernel->update(crc, buf, len);
+}
+
+// ## record_crc
+//
+// Calcula el CRC de un registro de metadatos de len bytes salteando su
+// campo crc, que está en el offset crc_offset.
+//
+static uint32_t
+record_crc(const void *record, size_t len, size_t crc_offset)
+{
+	const char *p = record;
+	uint32_t crc = crc32c(0, p, crc_offset);
+	return crc32c(crc,
+	              p + crc_offset + sizeof(uint32_t),
+	              len - crc_offset - sizeof(uint32_t));
+}
+
+#define DIR_RECORD_CRC(r)                                                      \
+	record_crc((r), sizeof(fs_dir_record_t), offsetof(fs_dir_record_t, crc))
+#define FILE_RECORD_CRC(r)                                                     \
+	record_crc(                                                            \
+	        (r), sizeof(fs_file_record_t), offsetof(fs_file_record_t, crc))
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 +
+	       (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// ## run_workers
+//
+// Ejecuta worker(arg) en tantos hilos como procesadores haya (a lo sumo
+// MAX_HILOS_CARGA y max_threads) y espera a que terminen. Si no se puede
+// crear ningún hilo, lo ejecuta en el hilo actual.
+//
+// Devuelve la cantidad de hilos usados.
+//
+static size_t
+run_workers(void *(*worker)(void *), void *arg, size_t max_threads)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_threads = cpus > 0 ? cpus : 1;
+	if (n_threads > MAX_HILOS_CARGA)
+		n_threads = MAX_HILOS_CARGA;
+	if (n_threads > max_threads)
+		n_threads = max_threads;
+
+	pthread_t threads[MAX_HILOS_CARGA];
+	size_t started = 0;
+	for (; started < n_threads; started++) {
+		if (pthread_create(&threads[started], NULL, worker, arg) != 0)
+			break;
+	}
+	if (started == 0) {
+		worker(arg);
+		return 1;
 	}
+	for (size_t i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
 
-	fs_file_t *file = get_file(fs, path);
-	if (file) {
-		st->st_mode = __S_IFREG | 0644;
-		st->st_nlink = 1;
-		st->st_uid = file->uid;
-		st->st_gid = file->gid;
-		st->st_size = file->size;
-		st->st_atime = file->time_last_access;
-		st->st_mtime = file->time_last_modification;
-		st->st_ctime = file->time_creation;
-		st->st_dev = 0;
-		st->st_ino = get_file_index(fs, path);
-		return EXIT_SUCCESS;
+	return started;
+}
+
+// ## read_full
+//
+// Lee exactamente len bytes de fd a partir de offset.
+//
+// Devuelve 0 si pudo leerlos, -1 en caso contrario.
+//
+static int
+read_full(int fd, void *buf, size_t len, off_t offset)
+{
+	char *p = buf;
+	while (len > 0) {
+		ssize_t r = pread(fd, p, len, offset);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+		offset += r;
 	}
 
-	return -ENOENT;
+	return 0;
 }
 
-// ## create_file
+// ## fs_free
+//
+// Libera un sistema de archivos junto con los bloques de sus archivos.
+//
+static void
+fs_free(fs_t *fs)
+{
+	fs_scrub_stop(fs);
+	fs_reclaim_stop(fs);
+	fs_events_close(fs);
+
+	for (size_t i = 0; i < fs->f_size; i++) {
+		file_drop_locks(&fs->files[i]);
+		file_free_blocks(fs, &fs->files[i], 0);
+	}
+
+	for (size_t i = 0; i < fs->d_size; i++) {
+		free(fs->directories[i].entries);
+		free(fs->directories[i].tags);
+	}
+
+	if (fs->image_fd >= 0)
+		close(fs->image_fd);
+	if (fs->image_map)
+		munmap((void *) fs->image_map, fs->image_map_len);
+
+	free(fs->image_segments);
+	free(fs->image_crcs);
+	free(fs->image_verified);
+	free(fs->image_loaded);
+	if (fs->events) {
+		pthread_mutex_destroy(&fs->events->mutex);
+		pthread_cond_destroy(&fs->events->added);
+		pthread_cond_destroy(&fs->events->idle);
+		free(fs->events);
+	}
+	pthread_rwlock_destroy(&fs->lock);
+	pthread_mutex_destroy(&fs->seq_lock);
+	for (size_t i = 0; i < MAX_ARCHIVOS; i++)
+		pthread_mutex_destroy(&fs->tail_locks[i]);
+	pthread_mutex_destroy(&fs->commit_lock);
+	pthread_cond_destroy(&fs->commit_done);
+	pthread_mutex_destroy(&fs->scrub_lock);
+	pthread_cond_destroy(&fs->scrub_wake);
+	pthread_mutex_destroy(&fs->reclaim_lock);
+	pthread_cond_destroy(&fs->reclaim_wake);
+	__atomic_sub_fetch(&arena_usage.used, sizeof(fs_t), __ATOMIC_RELAXED);
+	arena_unmap(fs->arena);
+}
+
+// Estado de la verificación de un bloque de la imagen
+#define BLOQUE_SIN_VERIFICAR 0
+#define BLOQUE_VERIFICADO 1
+#define BLOQUE_CORRUPTO 2
+
+// Bloques que verifica el verificador en segundo plano entre pausas
+#define LOTE_VERIFICACION BLOQUES_POR_SEGMENTO
+#define PAUSA_VERIFICACION_MS 10
+
+// ## image_check_block
+//
+// Verifica que data sea el contenido del bloque número n (desde 1) de la
+// imagen, si todavía no se lo había verificado. El resultado queda en
+// image_verified: un bloque corrupto no se vuelve a leer. Puede llamarse
+// desde varios hilos a la vez.
+//
+// Devuelve 0 si el bloque es válido, -1 en caso contrario.
+//
+static int
+image_check_block(fs_t *fs, uint32_t n, const char *data)
+{
+	uint8_t *state = &fs->image_verified[n - 1];
+	if (__atomic_load_n(state, __ATOMIC_RELAXED) == BLOQUE_VERIFICADO)
+		return 0;
+
+	if (crc32c(0, data, TAM_BLOQUE) == fs->image_crcs[n - 1]) {
+		__atomic_store_n(state, BLOQUE_VERIFICADO, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	if (__atomic_exchange_n(state, BLOQUE_CORRUPTO, __ATOMIC_RELAXED) !=
+	    BLOQUE_CORRUPTO)
+		fprintf(stderr,
+		        "La imagen del file system está corrupta "
+		        "(bloque de datos %u).\n",
+		        n);
+	return -1;
+}
+
+// ## image_read_block
+//
+// Lee el bloque número n (desde 1) de la imagen en data. La primera vez que
+// se lee un bloque se lo verifica contra su suma.
+//
+// Devuelve 0 si pudo leer el bloque, -1 si no pudo o si está corrupto.
+//
+static int
+image_read_block(fs_t *fs, uint32_t n, char *data)
+{
+	size_t s = (n - 1) / BLOQUES_POR_SEGMENTO;
+	if (fs->image_fd < 0 || n == 0 || n > fs->image_n_blocks ||
+	    __atomic_load_n(&fs->image_verified[n - 1], __ATOMIC_RELAXED) ==
+	            BLOQUE_CORRUPTO)
+		return -1;
+
+	fs_segment_t *segment = &fs->image_segments[s];
+	off_t offset = segment->offset +
+	               (off_t) ((n - 1) % BLOQUES_POR_SEGMENTO) * TAM_BLOQUE;
+	if (read_full(fs->image_fd, data, TAM_BLOQUE, offset) != 0)
+		return -1;
+
+	return image_check_block(fs, n, data);
+}
+
+// ## image_map_block
+//
+// Devuelve el bloque número n (desde 1) de la imagen mapeada de un sistema
+// de archivos de sólo lectura. La primera vez que se usa un bloque se lo
+// verifica contra su suma.
+//
+// Devuelve NULL si n es 0 (un hueco) o si el bloque está corrupto.
+//
+static const char *
+image_map_block(fs_t *fs, uint32_t n)
+{
+	if (!fs->image_map || n == 0 || n > fs->image_n_blocks)
+		return NULL;
+
+	size_t s = (n - 1) / BLOQUES_POR_SEGMENTO;
+	size_t in_segment = (n - 1) % BLOQUES_POR_SEGMENTO;
+	const char *data = fs->image_map + fs->image_segments[s].offset +
+	                   in_segment * TAM_BLOQUE;
+	return image_check_block(fs, n, data) == 0 ? data : NULL;
+}
+
+// ## image_scrub
+//
+// Verifica hasta max bloques de la imagen a partir de fs->scrub_next,
+// salteando los que ya se verificaron al leerlos.
+//
+// Devuelve la cantidad de bloques corruptos encontrados.
+//
+static size_t
+image_scrub(fs_t *fs, size_t max)
+{
+	char data[TAM_BLOQUE];
+	size_t corrupt = 0;
+
+	for (; max > 0 && fs->scrub_next < fs->image_n_blocks; max--) {
+		uint32_t n = __atomic_add_fetch(
+		        &fs->scrub_next, 1, __ATOMIC_RELAXED);
+		uint8_t state = __atomic_load_n(&fs->image_verified[n - 1],
+		                                __ATOMIC_RELAXED);
+		if (state == BLOQUE_VERIFICADO)
+			continue;
+		if (fs->image_map ? !image_map_block(fs, n)
+		                  : image_read_block(fs, n, data) != 0)
+			corrupt++;
+	}
+
+	return corrupt;
+}
+
+// ## scrub_worker
+//
+// Hilo verificador: recorre los bloques de la imagen de a
+// LOTE_VERIFICACION, con una pausa entre lotes para no competir con las
+// operaciones, hasta terminar o hasta que lo detenga fs_scrub_stop.
+//
+static void *
+scrub_worker(void *arg)
+{
+	fs_t *fs = arg;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t corrupt = 0;
+
+	pthread_mutex_lock(&fs->scrub_lock);
+	while (!fs->scrub_stop && fs->scrub_next < fs->image_n_blocks) {
+		pthread_mutex_unlock(&fs->scrub_lock);
+		corrupt += image_scrub(fs, LOTE_VERIFICACION);
+		pthread_mutex_lock(&fs->scrub_lock);
+
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += PAUSA_VERIFICACION_MS * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		if (!fs->scrub_stop)
+			pthread_cond_timedwait(
+			        &fs->scrub_wake, &fs->scrub_lock, &until);
+	}
+	int finished = !fs->scrub_stop;
+	pthread_mutex_unlock(&fs->scrub_lock);
+
+	if (finished)
+		fs_debug("[debug] verificación de la imagen: %zu bloques, %zu "
+		         "corruptos (%.2f ms)\n",
+		         fs->image_n_blocks,
+		         corrupt,
+		         elapsed_ms(&start));
+	return NULL;
+}
+
+// ## fs_scrub_start
+//
+// Empieza a verificar en segundo plano los bloques de la imagen que respalda
+// al sistema de archivos, para encontrar los corruptos antes de que se los
+// lea. No hace nada si no hay imagen o si ya se empezó.
+//
+// Devuelve 0, o -1 si no se pudo crear el hilo.
+//
+static int
+fs_scrub_start(fs_t *fs)
+{
+	if (fs->image_fd < 0 || fs->scrub_running)
+		return 0;
+
+	if (pthread_create(&fs->scrub_thread, NULL, scrub_worker, fs) != 0)
+		return -1;
+
+	fs->scrub_running = 1;
+	return 0;
+}
+
+// ## fs_scrub_stop
+//
+// Detiene el verificador (si está corriendo) y espera a que termine.
+//
+static void
+fs_scrub_stop(fs_t *fs)
+{
+	if (!fs->scrub_running)
+		return;
+
+	pthread_mutex_lock(&fs->scrub_lock);
+	fs->scrub_stop = 1;
+	pthread_cond_signal(&fs->scrub_wake);
+	pthread_mutex_unlock(&fs->scrub_lock);
+
+	pthread_join(fs->scrub_thread, NULL);
+	fs->scrub_running = 0;
+}
+
+// Un bloque a guardar: o bien está en memoria, o bien sólo en la imagen
+typedef struct save_block {
+	fs_block_t *block;
+	uint32_t image;
+} save_block_t;
+
+// ## block_number
+//
+// Tabla de dispersión de bloque a número de bloque en la imagen nueva, para
+// guardar una sola vez los bloques compartidos. Los bloques respaldados por
+// la imagen actual se identifican por su número en ella, y el resto por su
+// dirección.
+//
+// Devuelve el número (desde 1) asignado al bloque; si el bloque todavía no
+// tenía número, lo agrega al final de blocks.
+//
+static uint32_t
+block_number(uintptr_t *keys,
+             uint32_t *values,
+             size_t capacity,
+             fs_block_t *block,
+             uint32_t image,
+             save_block_t *blocks,
+             size_t *n_blocks)
+{
+	uintptr_t key = image ? ((uintptr_t) image << 1) | 1 : (uintptr_t) block;
+	size_t i = (key * 0x9E3779B97F4A7C15ull >> 20) & (capacity - 1);
+	while (keys[i] && keys[i] != key)
+		i = (i + 1) & (capacity - 1);
+
+	if (!keys[i]) {
+		keys[i] = key;
+		blocks[*n_blocks].block = block;
+		blocks[*n_blocks].image = image;
+		values[i] = ++*n_blocks;
+	}
+
+	return values[i];
+}
+
+// ## sync_parent_dir
+//
+// Hace durable el directorio que contiene a path (por ejemplo, después de
+// renombrar un archivo dentro de él).
+//
+// Devuelve 0 en caso de éxito, -1 en caso contrario.
+//
+static int
+sync_parent_dir(const char *path)
+{
+	char temp_path[PATH_MAX];
+	snprintf(temp_path, sizeof(temp_path), "%s", path);
+	int fd = open(dirname(temp_path), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+
+	int status = fsync(fd);
+	close(fd);
+	return status;
+}
+
+// ## fs_save
+//
+// Guarda el sistema de archivos en path con el formato de imagen descripto
+// arriba. Los bloques que todavía no se leyeron de la imagen actual se
+// copian desde ella.
+//
+// La imagen se escribe primero en un archivo temporal que luego reemplaza a
+// path, de modo que un error a mitad de camino no pierde la imagen anterior.
+// Antes de reemplazarla se la lleva al disco con fsync, y después el
+// directorio, así que al volver la imagen nueva es durable.
+//
+// Devuelve 0 si pudo guardar los datos correctamente, -1 en caso contrario.
+//
+static int
+fs_save(const char *path, fs_t *fs)
+{
+	size_t names_len = 0;
+	for (size_t i = 0; i < fs->d_size; i++)
+		names_len += strlen(fs->directories[i].path) + 1;
+	for (size_t i = 0; i < fs->f_size; i++)
+		names_len += strlen(fs->files[i].path) + 1;
+
+	size_t max_blocks = fs->f_size * MAX_BLOQUES;
+	size_t capacity = 1;
+	while (capacity < 2 * max_blocks)
+		capacity <<= 1;
+
+	size_t meta_len = fs->d_size * sizeof(fs_dir_record_t) +
+	                  fs->f_size * sizeof(fs_file_record_t);
+	char *meta = calloc(1, meta_len + 1);
+	char *names = malloc(names_len + 1);
+	uintptr_t *keys = calloc(capacity, sizeof(uintptr_t));
+	uint32_t *values = calloc(capacity, sizeof(uint32_t));
+	save_block_t *blocks = calloc(max_blocks + 1, sizeof(save_block_t));
+	uint32_t *sums = calloc(max_blocks + 1, sizeof(uint32_t));
+	fs_segment_t *segments = NULL;
+	FILE *fd = NULL;
+	int status = -1;
+
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	if (!meta || !names || !keys || !values || !blocks || !sums)
+		goto out;
+
+	fs_dir_record_t *dirs = (fs_dir_record_t *) meta;
+	fs_file_record_t *files = (fs_file_record_t *) (dirs + fs->d_size);
+	size_t name = 0;
+	size_t n_blocks = 0;
+
+	for (size_t i = 0; i < fs->d_size; i++) {
+		fs_d_entry_t *dir = &fs->directories[i];
+		dirs[i].name = name;
+		dirs[i].parent = dir->d_parent ? dir->d_parent - fs->directories
+		                               : -1;
+		dirs[i].mode = dir->mode;
+		dirs[i].uid = dir->uid;
+		dirs[i].gid = dir->gid;
+		dirs[i].time_last_access = dir->time_last_access;
+		dirs[i].time_last_modification = dir->time_last_modification;
+		dirs[i].time_creation = dir->time_creation;
+		dirs[i].size = dir->size;
+		dirs[i].txn = dir->txn;
+		dirs[i].crc = DIR_RECORD_CRC(&dirs[i]);
+		strcpy(names + name, dir->path);
+		name += strlen(dir->path) + 1;
+	}
+
+	for (size_t i = 0; i < fs->f_size; i++) {
+		fs_file_t *file = &fs->files[i];
+		files[i].name = name;
+		files[i].parent = file->entry - fs->directories;
+		files[i].mode = file->mode;
+		files[i].uid = file->uid;
+		files[i].gid = file->gid;
+		files[i].time_last_access = file->time_last_access;
+		files[i].time_last_modification = file->time_last_modification;
+		files[i].time_creation = file->time_creation;
+		files[i].size = file->size;
+		files[i].birth = file->birth;
+		files[i].txn = file->txn;
+		memcpy(files[i].block_txn,
+		       file->block_txn,
+		       sizeof(file->block_txn));
+		for (size_t j = 0; j < MAX_BLOQUES; j++) {
+			if (file_has_block(file, j))
+				files[i].blocks[j] = block_number(keys,
+				                                  values,
+				                                  capacity,
+				                                  file->blocks[j],
+				                                  file->image[j],
+				                                  blocks,
+				                                  &n_blocks);
+		}
+		files[i].crc = FILE_RECORD_CRC(&files[i]);
+		strcpy(names + name, file->path);
+		name += strlen(file->path) + 1;
+	}
+
+	// Sólo se calcula la suma de los bloques modificados desde que se
+	// leyeron o se guardaron
+	for (size_t b = 0; b < n_blocks; b++) {
+		fs_block_t *block = blocks[b].block;
+		if (block && !block->crc_valid) {
+			block->crc = crc32c(0, block->data, TAM_BLOQUE);
+			block->crc_valid = 1;
+		}
+		sums[b] = block ? block->crc
+		                : fs->image_crcs[blocks[b].image - 1];
+	}
+	size_t sums_len = n_blocks * sizeof(uint32_t);
+
+	size_t n_data = (n_blocks + BLOQUES_POR_SEGMENTO - 1) /
+	                BLOQUES_POR_SEGMENTO;
+	size_t n_segments = SEGMENTO_DATOS + n_data;
+	segments = calloc(n_segments, sizeof(fs_segment_t));
+	if (!segments)
+		goto out;
+
+	uint64_t offset = sizeof(fs_image_header_t) +
+	                  n_segments * sizeof(fs_segment_t);
+
+	segments[SEGMENTO_METADATOS].type = SEGMENTO_METADATOS;
+	segments[SEGMENTO_METADATOS].offset = offset;
+	segments[SEGMENTO_METADATOS].length = meta_len;
+	segments[SEGMENTO_METADATOS].crc = crc32c(0, meta, meta_len);
+	offset += meta_len;
+
+	segments[SEGMENTO_NOMBRES].type = SEGMENTO_NOMBRES;
+	segments[SEGMENTO_NOMBRES].offset = offset;
+	segments[SEGMENTO_NOMBRES].length = names_len;
+	segments[SEGMENTO_NOMBRES].crc = crc32c(0, names, names_len);
+	offset += names_len;
+
+	segments[SEGMENTO_SUMAS].type = SEGMENTO_SUMAS;
+	segments[SEGMENTO_SUMAS].offset = offset;
+	segments[SEGMENTO_SUMAS].length = sums_len;
+	segments[SEGMENTO_SUMAS].crc = crc32c(0, sums, sums_len);
+	offset += sums_len;
+
+	fs_image_header_t header = { .magic = IMAGEN_MAGIC,
+		                     .version = IMAGEN_VERSION,
+		                     .n_segments = n_segments,
+		                     .d_size = fs->d_size,
+		                     .f_size = fs->f_size,
+		                     .n_blocks = n_blocks,
+		                     .txn = fs->txn,
+		                     .id = fs->id };
+
+	fd = fopen(tmp_path, "w");
+	if (!fd)
+		goto out;
+
+	// La cabecera y la tabla se reescriben al final, con los segmentos de
+	// datos
+	int failed = fwrite(&header, sizeof(header), 1, fd) != 1 ||
+	             fwrite(segments, sizeof(fs_segment_t), n_segments, fd) !=
+	                     n_segments ||
+	             fwrite(meta, 1, meta_len, fd) != meta_len ||
+	             fwrite(names, 1, names_len, fd) != names_len ||
+	             fwrite(sums, 1, sums_len, fd) != sums_len;
+
+	char data[TAM_BLOQUE];
+	for (size_t b = 0; b < n_blocks && !failed; b++) {
+		fs_segment_t *segment =
+		        &segments[SEGMENTO_DATOS + b / BLOQUES_POR_SEGMENTO];
+		if (b % BLOQUES_POR_SEGMENTO == 0) {
+			segment->type = SEGMENTO_DATOS;
+			segment->first_block = b;
+			segment->offset = offset;
+		}
+
+		char *block = blocks[b].block ? blocks[b].block->data : data;
+		if (!blocks[b].block &&
+		    image_read_block(fs, blocks[b].image, data) != 0) {
+			failed = 1;
+			break;
+		}
+
+		failed = fwrite(block, TAM_BLOQUE, 1, fd) != 1;
+		segment->length += TAM_BLOQUE;
+		offset += TAM_BLOQUE;
+	}
+
+	header.table_crc = crc32c(0, segments, n_segments * sizeof(fs_segment_t));
+	header.header_crc =
+	        crc32c(0, &header, offsetof(fs_image_header_t, header_crc));
+
+	if (!failed)
+		failed = fseek(fd, 0, SEEK_SET) != 0 ||
+		         fwrite(&header, sizeof(header), 1, fd) != 1 ||
+		         fwrite(segments, sizeof(fs_segment_t), n_segments, fd) !=
+		                 n_segments;
+
+	if (!failed)
+		failed = fflush(fd) != 0 || fsync(fileno(fd)) != 0;
+
+	if (fclose(fd) != 0)
+		failed = 1;
+
+	if (!failed && rename(tmp_path, path) == 0)
+		status = sync_parent_dir(path);
+	else
+		unlink(tmp_path);
+
+out:
+	if (status != 0)
+		fprintf(stderr, "Error al persistir el file system.\n");
+
+	free(meta);
+	free(names);
+	free(keys);
+	free(values);
+	free(blocks);
+	free(sums);
+	free(segments);
+	return status;
+}
+
+// ## Guardar datos en un archivo
+//
+// Recibe el path de un archivo y una estructura fs_t con los datos a guardar.
+// Si persist es distinto de 0 guarda la imagen con fs_save; en cualquier caso
+// libera el sistema de archivos. Un sistema de archivos de sólo lectura no
+// toca la imagen: otros procesos pueden tenerla mapeada.
+//
+static void
+fs_destroy(const char *path, fs_t *fs, int persist)
+{
+	// Vaciar la imagen haría fallar (SIGBUS) a quienes la leen mapeada
+	if (fs->read_only) {
+		fs_free(fs);
+		return;
+	}
+
+	if (persist == 0) {
+		FILE *fd = fopen(path, "w");
+		if (fd)
+			fclose(fd);
+	} else {
+		fs_save(path, fs);
+	}
+
+	fs_free(fs);
+}
+
+// ## Commit de los cambios
+//
+// Hace durables todos los cambios hechos hasta el momento guardando la
+// imagen en path (si hubo cambios desde el último commit).
+//
+// Los pedidos concurrentes se agrupan (group commit): el primero espera
+// commit_window_us para juntar otros pedidos y guarda una sola imagen que
+// los cubre a todos; los que llegan mientras se guarda esperan al siguiente
+// commit, que también se hace una sola vez para todos ellos.
+//
+// Devuelve 0 en caso de éxito, -EIO si no se pudo guardar la imagen.
+//
+static int
+fs_fsync(fs_t *fs, const char *path)
+{
+	if (fs->read_only)
+		return 0;
+
+	pthread_mutex_lock(&fs->commit_lock);
+	uint64_t ticket = ++fs->commit_requested;
+
+	while (fs->commit_durable < ticket) {
+		if (fs->commit_running) {
+			pthread_cond_wait(&fs->commit_done, &fs->commit_lock);
+			continue;
+		}
+
+		fs->commit_running = 1;
+		pthread_mutex_unlock(&fs->commit_lock);
+		if (fs->commit_window_us > 0)
+			usleep(fs->commit_window_us);
+
+		pthread_mutex_lock(&fs->commit_lock);
+		uint64_t batch = fs->commit_requested;
+		pthread_mutex_unlock(&fs->commit_lock);
+
+		// Todos los pedidos hasta batch son de cambios ya hechos: la
+		// imagen que se guarde con el lock tomado los incluye.
+		int status = 0;
+		fs_lock(fs);
+		uint64_t txn = fs->txn;
+		if (txn != fs->committed_txn) {
+			status = fs_save(path, fs);
+			if (status == 0)
+				fs->committed_txn = txn;
+			fs->commits++;
+		}
+		fs_unlock(fs);
+
+		pthread_mutex_lock(&fs->commit_lock);
+		fs->commit_durable = batch;
+		fs->commit_status = status;
+		fs->commit_running = 0;
+		pthread_cond_broadcast(&fs->commit_done);
+	}
+
+	int status = fs->commit_status;
+	pthread_mutex_unlock(&fs->commit_lock);
+	return status == 0 ? 0 : -EIO;
+}
+
+static int
+verify_empty_file(FILE *file)
+{
+	long savedOffset = ftell(file);
+	fseek(file, 0, SEEK_END);
+
+	if (ftell(file) == 0) {
+		return 1;
+	}
+
+	fseek(file, savedOffset, SEEK_SET);
+	return 0;
+}
+
+typedef struct fs_load {
+	int fd;
+	fs_image_header_t header;
+	fs_segment_t *segments;
+	char *meta;
+	char *names;
+	uint32_t *sums;
+	size_t next;
+	int failed;
+	pthread_mutex_t lock;
+} fs_load_t;
+
+// ## load_segment
+//
+// Lee y verifica el segmento de metadatos, el de nombres o el de sumas de
+// la imagen. El segmento queda en load aunque su CRC no coincida.
+//
+// Devuelve 0 si el segmento es válido, -1 en caso contrario.
+//
+static int
+load_segment(fs_load_t *load, fs_segment_t *segment)
+{
+	char *buf = malloc(segment->length + 1);
+	if (!buf || read_full(load->fd, buf, segment->length, segment->offset) != 0) {
+		free(buf);
+		return -1;
+	}
+
+	buf[segment->length] = '\0';
+	if (segment->type == SEGMENTO_METADATOS)
+		load->meta = buf;
+	else if (segment->type == SEGMENTO_NOMBRES)
+		load->names = buf;
+	else
+		load->sums = (uint32_t *) buf;
+
+	return crc32c(0, buf, segment->length) == segment->crc ? 0 : -1;
+}
+
+// ## load_worker
+//
+// Hilo de carga: toma segmentos de metadatos, nombres o sumas pendientes
+// hasta que no quede ninguno. Los segmentos de datos no se leen al montar.
+//
+static void *
+load_worker(void *arg)
+{
+	fs_load_t *load = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&load->lock);
+		size_t i = load->next++;
+		int failed = load->failed;
+		pthread_mutex_unlock(&load->lock);
+
+		if (failed || i >= SEGMENTO_DATOS)
+			return NULL;
+
+		if (load_segment(load, &load->segments[i]) != 0) {
+			pthread_mutex_lock(&load->lock);
+			load->failed = 1;
+			pthread_mutex_unlock(&load->lock);
+		}
+	}
+}
+
+// ## check_segments
 //
-// Crea un archivo con el nombre y directorio especificados.
+// Verifica que la tabla de segmentos sea coherente con la cabecera y con el
+// tamaño de la imagen.
 //
-// Devuelve 0 en caso de éxito, -1 en caso de error.
+// Devuelve 0 si es válida, -1 en caso contrario.
 //
 static int
-create_file(fs_t *fs, const char *path, mode_t mode)
+check_segments(fs_load_t *load, off_t image_size)
 {
-	if (fs == NULL || path == NULL)
-		return -1;
+	fs_image_header_t *h = &load->header;
+	size_t meta_len = h->d_size * sizeof(fs_dir_record_t) +
+	                  h->f_size * sizeof(fs_file_record_t);
+	size_t next_block = 0;
 
-	char temp_path[MAX_NAME];
-	strcpy(temp_path, path);
-	char parent_path[MAX_NAME];
-	strcpy(parent_path, dirname(temp_path));
-	fs_d_entry_t *dir = get_dir(fs, parent_path);
-	if (!dir) {
-		fprintf(stderr, "Error al crear el archivo.\n");
+	if (h->n_segments < SEGMENTO_DATOS)
 		return -1;
-	}
 
-	fs_file_t file;
+	for (size_t i = 0; i < h->n_segments; i++) {
+		fs_segment_t *s = &load->segments[i];
+		uint32_t type = i < SEGMENTO_DATOS ? i : SEGMENTO_DATOS;
 
-	strcpy(file.path, path);
-	strcpy(file.content, "");
+		if (s->type != type || s->offset > (uint64_t) image_size ||
+		    s->length > (uint64_t) image_size - s->offset)
+			return -1;
 
-	file.entry = dir;
+		if (type == SEGMENTO_METADATOS && s->length != meta_len)
+			return -1;
 
-	file.mode = mode;
-	file.uid = 1818;
-	file.gid = getgid();
-	file.size = 0;
-	file.time_last_access = time(NULL);
-	file.time_last_modification = time(NULL);
-	file.time_creation = time(NULL);
+		if (type == SEGMENTO_SUMAS &&
+		    s->length != h->n_blocks * sizeof(uint32_t))
+			return -1;
 
-	fs->files[fs->f_size] = file;
-	fs->f_size++;
+		if (type == SEGMENTO_DATOS) {
+			size_t count = s->length / TAM_BLOQUE;
+			if (s->first_block != next_block || count == 0 ||
+			    count > BLOQUES_POR_SEGMENTO ||
+			    s->length % TAM_BLOQUE != 0)
+				return -1;
+			next_block += count;
+		}
+	}
 
-	return 0;
+	return next_block == h->n_blocks ? 0 : -1;
 }
 
-// ## touch_file
+// ## record_name
 //
-// Actualiza la fecha de modificación de un archivo.
+// Copia en dest el nombre que empieza en offset del segmento de nombres.
 //
-// Devuelve 0 si pudo actualizar la fecha de modificación, -1 en caso contrario.
+// Devuelve 0 si el nombre es válido, -1 en caso contrario.
 //
 static int
-touch_file(fs_t *fs, fs_file_t *file)
+record_name(fs_load_t *load, uint32_t offset, char dest[MAX_NAME])
 {
-	if (fs == NULL || file == NULL)
+	size_t names_len = load->segments[SEGMENTO_NOMBRES].length;
+	if (offset >= names_len)
 		return -1;
 
-	file->time_last_modification = time(NULL);
+	size_t len = strnlen(load->names + offset, names_len - offset);
+	if (len == 0 || len >= MAX_NAME || offset + len >= names_len)
+		return -1;
+
+	memcpy(dest, load->names + offset, len + 1);
 	return 0;
 }
 
-// ## Creación de archivos
+// ## rebuild_fs
+//
+// Reconstruye las estructuras en memoria a partir de los segmentos ya
+// verificados: convierte los índices en punteros y asigna a cada archivo los
+// bloques de la imagen que le corresponden, sin leerlos.
+//
+// Devuelve 0 si los metadatos son coherentes, -1 en caso contrario.
 //
 static int
-fs_create(fs_t *fs, const char *path, mode_t mode)
+rebuild_fs(fs_load_t *load, fs_t *fs)
 {
-	if (strlen(path) < 2) {
-		fprintf(stderr, "Nombre de archivo inválido.\n");
-		return -1;
-	}
+	fs_image_header_t *h = &load->header;
+	fs_dir_record_t *dirs = (fs_dir_record_t *) load->meta;
+	fs_file_record_t *files = (fs_file_record_t *) (dirs + h->d_size);
 
-	if (strlen(path) - 1 == MAX_NAME) {
-		fprintf(stderr, "Nombre de archivo demasiado largo.\n");
-		return -ENAMETOOLONG;
-	}
+	fs->d_size = h->d_size;
+	fs->f_size = h->f_size;
+	fs->txn = fs->committed_txn = h->txn;
+	fs->id = h->id;
 
-	if (fs->f_size == MAX_ARCHIVOS) {
-		fprintf(stderr, "No se pueden crear más archivos.\n");
-		return -1;
+	for (size_t i = 0; i < h->d_size; i++) {
+		fs_d_entry_t *dir = &fs->directories[i];
+		if (dirs[i].crc != DIR_RECORD_CRC(&dirs[i]) ||
+		    record_name(load, dirs[i].name, dir->path) != 0)
+			return -1;
+
+		if ((i == 0) != (dirs[i].parent == -1) ||
+		    dirs[i].parent >= (int32_t) h->d_size)
+			return -1;
+
+		dir->d_parent = i == 0 ? NULL : &fs->directories[dirs[i].parent];
+		dir->mode = dirs[i].mode;
+		dir->uid = dirs[i].uid;
+		dir->gid = dirs[i].gid;
+		dir->time_last_access = dirs[i].time_last_access;
+		dir->time_last_modification = dirs[i].time_last_modification;
+		dir->time_creation = dirs[i].time_creation;
+		dir->size = dirs[i].size;
+		dir->txn = dirs[i].txn;
+		fs->dir_tags[i] = path_tag(path_hash(dir->path));
+		bloom_add(fs, dir->path);
 	}
 
-	fs_file_t *file = get_file(fs, path);
+	// Los índices se arman cuando ya se conocen todos los nombres
+	for (size_t i = 1; i < h->d_size; i++) {
+		fs_d_entry_t *dir = &fs->directories[i];
+		if (dir_index_add(dir->d_parent, dir->path) != 0)
+			return -1;
+	}
 
-	if (!file) {
-		int status = create_file(fs, path, mode);
-		if (status == -1)
+	for (size_t i = 0; i < h->f_size; i++) {
+		fs_file_t *file = &fs->files[i];
+		if (files[i].crc != FILE_RECORD_CRC(&files[i]) ||
+		    record_name(load, files[i].name, file->path) != 0)
 			return -1;
-	} else {
-		int status = touch_file(fs, file);
-		if (status == -1)
+
+		if (files[i].parent < 0 || files[i].parent >= (int32_t) h->d_size ||
+		    files[i].size > MAX_CONTENIDO)
 			return -1;
-	}
 
-	return EXIT_SUCCESS;
-}
+		file->entry = &fs->directories[files[i].parent];
+		file->mode = files[i].mode;
+		file->uid = files[i].uid;
+		file->gid = files[i].gid;
+		file->time_last_access = files[i].time_last_access;
+		file->time_last_modification = files[i].time_last_modification;
+		file->time_creation = files[i].time_creation;
+		file_set_size(fs, file, files[i].size);
+		file->birth = files[i].birth;
+		file->txn = files[i].txn;
+		memcpy(file->block_txn,
+		       files[i].block_txn,
+		       sizeof(file->block_txn));
+		fs->file_tags[i] = path_tag(path_hash(file->path));
+		bloom_add(fs, file->path);
+		if (dir_index_add(file->entry, file->path) != 0)
+			return -1;
 
+		for (size_t j = 0; j < MAX_BLOQUES; j++) {
+			uint32_t n = files[i].blocks[j];
+			if (n == 0)
+				continue;
+			if (n > h->n_blocks)
+				return -1;
 
-static int
-remove_file(fs_t *fs, const char *name)
-{
-	int index = get_file_index(fs, name);
-	if (index == -1) {
-		fprintf(stderr, "Error al eliminar el archivo.\n");
-		return -ENOENT;
+			file->image[j] = n;
+			usage_add(fs, 0, 1, 0);
+		}
 	}
 
-	for (size_t i = index; i < fs->f_size - 1; i++)
-		fs->files[i] = fs->files[i + 1];
-
-	fs->f_size--;
+	usage_add(fs, h->d_size + h->f_size, 0, 0);
 	return 0;
 }
 
-static int
-remove_dir(fs_t *fs, const char *name)
+// ## load_image
+//
+// Carga una imagen con el formato descripto arriba: valida la cabecera y la
+// tabla de segmentos, lee y verifica en paralelo los metadatos, los nombres
+// y las sumas y reconstruye las estructuras en memoria. Informa cuánto tardó
+// cada etapa.
+//
+// Los bloques de datos no se leen: quedan respaldados por la imagen (a la que
+// el sistema de archivos conserva un descriptor propio) y se leen y
+// verifican la primera vez que se los usa (o cuando los alcanza
+// fs_scrub_start).
+//
+// Devuelve el sistema de archivos cargado, o NULL si la imagen es inválida.
+//
+static fs_t *
+load_image(int fd, off_t image_size)
 {
-	int index = get_dir_index(fs, name);
-	if (index == -1) {
-		fprintf(stderr, "Error al eliminar el directorio.\n");
-		return -ENOENT;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fs_load_t load = { .fd = fd };
+	pthread_mutex_init(&load.lock, NULL);
+	fs_t *fs = NULL;
+	fs_image_header_t *h = &load.header;
+
+	if (read_full(fd, h, sizeof(*h), 0) != 0 ||
+	    memcmp(h->magic, IMAGEN_MAGIC, sizeof(IMAGEN_MAGIC)) != 0 ||
+	    h->version != IMAGEN_VERSION ||
+	    h->header_crc != crc32c(0, h, offsetof(fs_image_header_t, header_crc))) {
+		fprintf(stderr, "Formato de imagen desconocido.\n");
+		goto out;
 	}
 
-	for (size_t i = index; i < fs->d_size - 1; i++)
-		fs->directories[i] = fs->directories[i + 1];
+	size_t max_segments =
+	        SEGMENTO_DATOS + (MAX_ARCHIVOS * MAX_BLOQUES) / BLOQUES_POR_SEGMENTO;
+	if (h->d_size == 0 || h->d_size > MAX_DIRECTORIOS ||
+	    h->f_size > MAX_ARCHIVOS || h->n_blocks > MAX_ARCHIVOS * MAX_BLOQUES ||
+	    h->n_segments > max_segments)
+		goto corrupt;
 
-	fs->d_size--;
-	return 0;
-}
+	size_t table_len = h->n_segments * sizeof(fs_segment_t);
+	load.segments = malloc(table_len);
+	if (!load.segments ||
+	    read_full(fd, load.segments, table_len, sizeof(*h)) != 0 ||
+	    h->table_crc != crc32c(0, load.segments, table_len) ||
+	    check_segments(&load, image_size) != 0)
+		goto corrupt;
 
-// ## Eliminación de archivos
-//
-static int
-fs_unlink(fs_t *fs, const char *path)
-{
-	fs_file_t *file = get_file(fs, path);
-	if (file)
-		return remove_file(fs, path);
+	double header_ms = elapsed_ms(&start);
 
-	fprintf(stderr, "Error al eliminar el archivo.\n");
-	return -ENOENT;
-}
+	size_t started = run_workers(load_worker, &load, SEGMENTO_DATOS);
 
-static int
-amount_subdirs_and_files(fs_t *fs, fs_d_entry_t *dir)
-{
-	int amount = 0;
+	double verify_ms = elapsed_ms(&start) - header_ms;
+	if (load.failed)
+		goto corrupt;
 
-	for (size_t i = 0; i < fs->f_size; i++) {
-		if (fs->files[i].entry == dir)
-			amount++;
+	fs = fs_alloc();
+	if (!fs)
+		goto out;
+
+	size_t n_data = h->n_segments - SEGMENTO_DATOS;
+	fs_init_locks(fs);
+	fs->image_fd = dup(fd);
+	fs->image_n_segments = n_data;
+	fs->image_segments = malloc((n_data + 1) * sizeof(fs_segment_t));
+	fs->image_n_blocks = h->n_blocks;
+	fs->image_crcs = load.sums;
+	load.sums = NULL;
+	fs->image_verified = calloc(h->n_blocks + 1, 1);
+	fs->image_loaded = calloc(h->n_blocks + 1, sizeof(fs_block_t *));
+	fs->max_cached = MAX_BLOQUES_EN_CACHE;
+	fs->capacity = CAPACIDAD_BLOQUES;
+	if (fs->image_fd < 0 || !fs->image_segments || !fs->image_verified ||
+	    !fs->image_loaded) {
+		fs_free(fs);
+		fs = NULL;
+		goto out;
 	}
+	memcpy(fs->image_segments,
+	       load.segments + SEGMENTO_DATOS,
+	       n_data * sizeof(fs_segment_t));
 
-	for (size_t i = 0; i < fs->d_size; i++) {
-		if (fs->directories[i].d_parent &&
-		    fs->directories[i].d_parent == dir)
-			amount++;
+	if (rebuild_fs(&load, fs) != 0) {
+		fs_free(fs);
+		fs = NULL;
+		goto corrupt;
 	}
 
-	return amount;
+	double total_ms = elapsed_ms(&start);
+	fs_debug("[debug] fs_init - cabecera: %.2f ms, lectura y verificación: "
+	         "%.2f ms (%zu hilos), reconstrucción: %.2f ms, %zu bloques "
+	         "bajo demanda\n",
+	         header_ms,
+	         verify_ms,
+	         started,
+	         total_ms - header_ms - verify_ms,
+	         (size_t) h->n_blocks);
+	goto out;
+
+corrupt:
+	fprintf(stderr, "La imagen del file system está corrupta.\n");
+
+out:
+	pthread_mutex_destroy(&load.lock);
+	free(load.segments);
+	free(load.meta);
+	free(load.names);
+	free(load.sums);
+	return fs;
 }
 
-// Eliminacion de un directorio
+// ## Recuperar datos de un archivo
 //
-static int
-fs_rmdir(fs_t *fs, const char *path)
+// Recibe el path de un archivo serializado y devuelve un puntero a una estructura
+// fs_t con los datos recuperados. Si el archivo no existe o está vacío,
+// devuelve un sistema de archivos nuevo; si la imagen es inválida, devuelve
+// NULL.
+//
+static fs_t *
+fs_init(const char *path)
 {
-	fs_d_entry_t *dir = get_dir(fs, path);
-	if (!dir) {
-		fprintf(stderr, "Error al eliminar el directorio.\n");
-		return -ENOENT;
+	FILE *fd = fopen(path, "r");
+
+	if (fd == NULL) {
+		fs_debug("[debug] Initializing new File System (fs.fisopfs)\n");
+		return fs_build();
 	}
 
-	if (amount_subdirs_and_files(fs, dir) > 0) {
-		fprintf(stderr, "Error al eliminar el directorio. No se encuentra vacio.\n");
-		return -ENOTEMPTY;
+	if (verify_empty_file(fd) == 1) {
+		fs_t *fs = fs_build();
+		fclose(fd);
+		return fs;
 	}
 
-	return remove_dir(fs, path);
-}
+	struct stat st;
+	fs_t *fs = NULL;
+	if (fstat(fileno(fd), &st) == 0)
+		fs = load_image(fileno(fd), st.st_size);
+	if (!fs)
+		fprintf(stderr, "Error al leer el archivo de persistencia del file system.\n");
 
+	fclose(fd);
+	return fs;
+}
 
-// ## fs_build
-//
-// Construye un sistema de archivos vacío.
+// ## fs_init_read_only
 //
-// Devuelve un puntero a una estructura fs_t con un directorio raíz.
-// Si no se pudo crear la estructura, devuelve NULL.
+// Como fs_init, pero el sistema de archivos queda de sólo lectura: las
+// operaciones que lo modifican devuelven -EROFS y las lecturas no toman
+// locks ni actualizan los tiempos de acceso. La imagen se mapea entera con
+// MAP_SHARED y las lecturas copian directo desde el mapeo, así que varios
+// procesos que montan la misma imagen comparten sus páginas en el page
+// cache en lugar de tener cada uno su copia de los bloques.
 //
-// Contiene un solo directorio llamado "/". (ROOT)
-// No contiene archivos.
+// Devuelve NULL si la imagen es inválida o no se pudo mapear.
 //
 static fs_t *
-fs_build()
+fs_init_read_only(const char *path)
 {
-	fs_t *fs = calloc(1, sizeof(fs_t));
-	if (!fs) {
-		fprintf(stderr, "Error al crear el file system.\n");
-		return NULL;
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+		// Sin imagen, un sistema de archivos vacío
+		if (fd >= 0)
+			close(fd);
+		fs_t *fs = fs_build();
+		if (fs)
+			fs->read_only = 1;
+		return fs;
 	}
 
-	strcpy(fs->directories[0].path, ROOT);
-	fs->directories[0].d_parent = NULL;
-	fs->d_size = 1;
-	fs->f_size = 0;
+	fs_t *fs = load_image(fd, st.st_size);
+	void *map = MAP_FAILED;
+	if (fs)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
 
-	fs->directories[0].uid = 1717;
-	fs->directories[0].gid = getgid();
-	fs->directories[0].mode = __S_IFDIR | 0755;
-	fs->directories[0].time_creation = time(NULL);
-	fs->directories[0].time_last_access = time(NULL);
-	fs->directories[0].time_last_modification = time(NULL);
-	fs->directories[0].size = 0;
+	if (!fs) {
+		fprintf(stderr,
+		        "Error al leer el archivo de persistencia del file "
+		        "system.\n");
+		return NULL;
+	}
+	if (map == MAP_FAILED) {
+		perror(path);
+		fs_free(fs);
+		return NULL;
+	}
 
+	fs->image_map = map;
+	fs->image_map_len = st.st_size;
+	fs->read_only = 1;
 	return fs;
 }
 
-// ## Guardar datos en un archivo
+// # Importación de un directorio del host
 //
-// Recibe el path de un archivo y una estructura fs_t con los datos a guardar.
-// Devuelve 0 si pudo guardar los datos correctamente, -1 en caso contrario.
+// Puebla el sistema de archivos con el contenido de un directorio del host
+// sin pasar por fs_mkdir/fs_create: se recorre el árbol en un solo hilo
+// creando las entradas directamente (el directorio padre ya se conoce, así
+// que no se busca por path) y luego un grupo de hilos lee el contenido de los
+// archivos, cada uno en sus propios bloques. Los bloques en cero no se
+// guardan: quedan como huecos.
 //
-static void
-fs_destroy(const char *path, fs_t *fs, int persist)
-{
-	FILE *fd = fopen(path, "w");
+// Sólo se importan directorios y archivos regulares; el resto (enlaces
+// simbólicos, dispositivos, etc.) se ignora.
 
-	if (fd == NULL) {
-		fprintf(stderr, "Error al persistir el file system.\n");
-		free(fs);
-		fclose(fd);
-		return;
+typedef struct fs_import_job {
+	fs_file_t *file;
+	char host_path[PATH_MAX];
+} fs_import_job_t;
+
+typedef struct fs_import {
+	fs_t *fs;
+	int check_existing;  // si el fs no estaba vacío hay que buscar colisiones
+	fs_import_job_t jobs[MAX_ARCHIVOS];
+	size_t n_jobs;
+	size_t n_dirs;
+	size_t next;
+	size_t bytes;
+	int error;
+	pthread_mutex_t lock;
+} fs_import_t;
+
+// ## import_entry_path
+//
+// Arma el path dentro del sistema de archivos de la entrada name de parent.
+//
+// Devuelve 0 si entra en MAX_NAME, -ENAMETOOLONG en caso contrario.
+//
+static int
+import_entry_path(fs_d_entry_t *parent, const char *name, char dest[MAX_NAME])
+{
+	const char *sep = strcmp(parent->path, ROOT) == 0 ? "" : "/";
+	int len = snprintf(dest, MAX_NAME, "%s%s%s", parent->path, sep, name);
+	if (len < 0 || len >= MAX_NAME) {
+		fprintf(stderr, "Nombre demasiado largo: %s%s%s\n", parent->path, sep, name);
+		return -ENAMETOOLONG;
 	}
+	return 0;
+}
 
-	if (persist == 0) {
-		free(fs);
-		fclose(fd);
-		return;
+// ## import_tree
+//
+// Recorre recursivamente host_dir creando sus subdirectorios y archivos
+// dentro de parent. Los archivos quedan vacíos y se encola su contenido para
+// leerlo después.
+//
+// Devuelve 0 en caso de éxito o un error negativo.
+//
+static int
+import_tree(fs_import_t *imp, const char *host_dir, fs_d_entry_t *parent)
+{
+	fs_t *fs = imp->fs;
+	DIR *dir = opendir(host_dir);
+	if (!dir) {
+		perror(host_dir);
+		return -errno;
 	}
 
-	int w1 = fwrite(&fs->d_size, sizeof(size_t), 1, fd);
-	int w2 = fwrite(fs->directories, sizeof(fs_d_entry_t), fs->d_size, fd);
-	int w3 = fwrite(&fs->f_size, sizeof(size_t), 1, fd);
-	int w4 = fwrite(fs->files, sizeof(fs_file_t), fs->f_size, fd);
+	int status = 0;
+	struct dirent *ent;
+	while (status == 0 && (ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
 
-	if (w1 == -1 || w2 == -1 || w3 == -1 || w4 == -1) {
-		fprintf(stderr, "Error al persistir el file system.\n");
-		free(fs);
-		fclose(fd);
-		return;
+		char host_path[PATH_MAX];
+		char path[MAX_NAME];
+		struct stat st;
+		int len = snprintf(host_path, PATH_MAX, "%s/%s", host_dir, ent->d_name);
+		if (len < 0 || len >= PATH_MAX) {
+			status = -ENAMETOOLONG;
+			break;
+		}
+		if ((status = import_entry_path(parent, ent->d_name, path)) != 0)
+			break;
+		if (lstat(host_path, &st) != 0) {
+			perror(host_path);
+			status = -errno;
+			break;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			fs_d_entry_t *sub = imp->check_existing ? get_dir(fs, path) : NULL;
+			if (!sub) {
+				if (fs->d_size == MAX_DIRECTORIOS) {
+					fprintf(stderr, "No se pueden crear más directorios.\n");
+					status = -ENOSPC;
+					break;
+				}
+				sub = fs_create_dir(fs, path, parent, st.st_mode);
+				if (!sub) {
+					status = -ENOMEM;
+					break;
+				}
+				sub->time_last_access = st.st_atime;
+				sub->time_last_modification = st.st_mtime;
+				imp->n_dirs++;
+			}
+			status = import_tree(imp, host_path, sub);
+		} else if (S_ISREG(st.st_mode)) {
+			if (imp->check_existing &&
+			    (get_file(fs, path) || get_dir(fs, path))) {
+				fprintf(stderr, "%s ya existe.\n", path);
+				status = -EEXIST;
+			} else if (fs->f_size == MAX_ARCHIVOS) {
+				fprintf(stderr, "No se pueden crear más archivos.\n");
+				status = -ENOSPC;
+			} else if (st.st_size > MAX_CONTENIDO) {
+				fprintf(stderr, "%s supera el tamaño máximo.\n", host_path);
+				status = -EFBIG;
+			} else {
+				fs_file_t *file = fs_create_file(fs, path, parent, st.st_mode);
+				if (!file) {
+					status = -ENOMEM;
+					break;
+				}
+				file_set_size(fs, file, st.st_size);
+				file->time_last_access = st.st_atime;
+				file->time_last_modification = st.st_mtime;
+
+				fs_import_job_t *job = &imp->jobs[imp->n_jobs++];
+				job->file = file;
+				strcpy(job->host_path, host_path);
+			}
+		}
 	}
 
-	fclose(fd);
-	free(fs);
+	closedir(dir);
+	return status;
 }
 
-static int
-verify_empty_file(FILE *file)
+// ## import_file
+//
+// Lee el contenido de un archivo del host en los bloques de file. Los bloques
+// que son todos cero no se guardan.
+//
+// Devuelve la cantidad de bytes leídos o un error negativo.
+//
+static ssize_t
+import_file(fs_t *fs, fs_import_job_t *job)
 {
-	long savedOffset = ftell(file);
-	fseek(file, 0, SEEK_END);
+	fs_file_t *file = job->file;
+	int fd = open(job->host_path, O_RDONLY);
+	if (fd < 0) {
+		perror(job->host_path);
+		return -errno;
+	}
 
-	if (ftell(file) == 0) {
-		return 1;
+	char data[TAM_BLOQUE];
+	size_t n_blocks = (file->size + TAM_BLOQUE - 1) / TAM_BLOQUE;
+	ssize_t status = file->size;
+	for (size_t i = 0; i < n_blocks; i++) {
+		size_t len = file->size - i * TAM_BLOQUE;
+		if (len > TAM_BLOQUE)
+			len = TAM_BLOQUE;
+		if (read_full(fd, data, len, i * TAM_BLOQUE) != 0) {
+			fprintf(stderr, "Error al leer %s.\n", job->host_path);
+			status = -EIO;
+			break;
+		}
+
+		if (data[0] == 0 && memcmp(data, data + 1, len - 1) == 0)
+			continue;
+
+		file->blocks[i] = block_new();
+		if (!file->blocks[i]) {
+			status = -ENOMEM;
+			break;
+		}
+		memcpy(file->blocks[i]->data, data, len);
+		file->block_txn[i] = file->txn;
+		usage_add(fs, 0, 1, 0);
 	}
 
-	fseek(file, savedOffset, SEEK_SET);
-	return 0;
+	close(fd);
+	return status;
 }
 
-// ## Recuperar datos de un archivo
+// ## import_worker
 //
-// Recibe el path de un archivo serializado y devuelve un puntero a una estructura
-// fs_t con los datos recuperados. Si el archivo no existe, devuelve NULL.
+// Hilo de importación: toma archivos pendientes hasta que no quede ninguno.
+// Cada archivo es de un solo hilo, así que sus bloques se llenan sin lock.
 //
-static fs_t *
-fs_init(const char *path)
+static void *
+import_worker(void *arg)
 {
-	FILE *fd = fopen(path, "r");
+	fs_import_t *imp = arg;
 
-	if (fd == NULL) {
-		printf("[debug] Initializing new File System (fs.fisopfs)\n");
-		return fs_build();
-	}
+	for (;;) {
+		pthread_mutex_lock(&imp->lock);
+		size_t i = imp->next++;
+		int failed = imp->error;
+		pthread_mutex_unlock(&imp->lock);
 
-	if (verify_empty_file(fd) == 1) {
-		fs_t *fs = fs_build();
-		fclose(fd);
-		return fs;
-	}
+		if (failed || i >= imp->n_jobs)
+			return NULL;
 
-	fs_t *fs = calloc(1, sizeof(fs_t));
-	if (!fs) {
-		fprintf(stderr, "Error al leer el archivo de persistencia del file system.\n");
-		fclose(fd);
-		return NULL;
+		ssize_t len = import_file(imp->fs, &imp->jobs[i]);
+
+		pthread_mutex_lock(&imp->lock);
+		if (len < 0)
+			imp->error = len;
+		else
+			imp->bytes += len;
+		pthread_mutex_unlock(&imp->lock);
 	}
+}
+
+// ## Importación de un directorio del host
+//
+// Copia el árbol de host_dir a la raíz del sistema de archivos. Si el
+// sistema de archivos ya tiene contenido, los directorios que ya existen se
+// combinan y un archivo que ya existe es un error. Informa cuánto tardó cada
+// etapa.
+//
+// Si falla, lo importado hasta ese momento queda en el sistema de archivos.
+//
+// Devuelve 0 en caso de éxito o un error negativo.
+//
+static int
+fs_import(fs_t *fs, const char *host_dir)
+{
+	if (fs == NULL || host_dir == NULL)
+		return -EINVAL;
 
-	int r1 = fread(&fs->d_size, sizeof(size_t), 1, fd);
-	int r2 = fread(fs->directories, sizeof(fs_d_entry_t), fs->d_size, fd);
-	int r3 = fread(&fs->f_size, sizeof(size_t), 1, fd);
-	int r4 = fread(fs->files, sizeof(fs_file_t), fs->f_size, fd);
+	if (fs->read_only)
+		return -EROFS;
 
-	if (r1 == -1 || r2 == -1 || r3 == -1 || r4 == -1) {
-		fprintf(stderr, "Error al leer el archivo de persistencia del file system.\n");
-		free(fs);
-		fclose(fd);
-		return NULL;
-	}
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	fclose(fd);
-	return fs;
+	fs_import_t *imp = calloc(1, sizeof(fs_import_t));
+	if (!imp)
+		return -ENOMEM;
+	imp->fs = fs;
+	imp->check_existing = fs->d_size > 1 || fs->f_size > 0;
+	pthread_mutex_init(&imp->lock, NULL);
+
+	int status = import_tree(imp, host_dir, &fs->directories[0]);
+	double walk_ms = elapsed_ms(&start);
+
+	size_t threads = 0;
+	if (imp->n_jobs > 0)
+		threads = run_workers(import_worker, imp, imp->n_jobs);
+	if (status == 0)
+		status = imp->error;
+
+	fs_debug("[debug] fs_import - %s: %zu directorios, %zu archivos, %zu "
+	         "bytes; recorrido: %.2f ms, contenido: %.2f ms (%zu hilos)\n",
+	         host_dir,
+	         imp->n_dirs,
+	         imp->n_jobs,
+	         imp->bytes,
+	         walk_ms,
+	         elapsed_ms(&start) - walk_ms,
+	         threads);
+
+	pthread_mutex_destroy(&imp->lock);
+	free(imp);
+	return status;
 }
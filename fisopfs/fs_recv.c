@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_lib.c"
+#include "fs_delta.c"
+
+// # fisopfs-recv
+//
+// Aplica a una réplica el delta que lee de la entrada estándar (ver
+// fs_delta.c) y la guarda. Si la réplica no existe o está vacía, sólo se
+// le puede aplicar un delta desde la transacción 0.
+//
+// Uso: fisopfs-send [-s transacción] imagen | fisopfs-recv réplica
+//
+// Si el delta no se puede aplicar, la réplica no se modifica. Al terminar
+// se informa en qué transacción quedó, para pedir el próximo delta desde
+// ahí.
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Uso: %s réplica < delta\n", argv[0]);
+		return 2;
+	}
+
+	const char *replica = argv[1];
+	fs_t *fs = fs_init(replica);
+	if (!fs)
+		return EXIT_FAILURE;
+
+	fs_delta_stats_t stats;
+	int status = delta_recv(fs, stdin, &stats);
+	if (status == -ESTALE)
+		fprintf(stderr,
+		        "%s: la réplica (transacción %lu) no corresponde al "
+		        "origen del delta\n",
+		        replica,
+		        (unsigned long) fs->txn);
+	else if (status == -EINVAL)
+		fprintf(stderr, "El delta está incompleto o dañado.\n");
+	else if (status != 0)
+		fprintf(stderr, "%s: %s\n", replica, strerror(-status));
+
+	if (status == 0 && fs_save(replica, fs) != 0) {
+		fprintf(stderr, "%s: no se pudo guardar la réplica\n", replica);
+		status = -EIO;
+	}
+
+	if (status == 0)
+		printf("%s: %zu entradas y %zu bloques aplicados, réplica "
+		       "en la transacción %lu\n",
+		       replica,
+		       stats.entries,
+		       stats.blocks,
+		       (unsigned long) fs->txn);
+
+	fs_free(fs);
+	return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_lib.c"
+#include "fs_trace.c"
+
+// # fs_replay
+//
+// Reproduce una traza registrada con --trace directamente contra fs_lib e
+// informa la latencia de cada tipo de operación.
+//
+// Uso: fs_replay [-t] [-i imagen] [-s destino] traza
+//
+// Por defecto las operaciones se reproducen una detrás de otra, lo más
+// rápido posible; con -t se respetan los tiempos originales. Con -i se parte
+// de una imagen (la que estaba montada al registrar la traza), así la
+// reproducción es determinística. Con -s los fsync guardan la imagen en
+// destino (si no, no hacen nada). Se informa además cuántas operaciones
+// tuvieron un resultado distinto al registrado.
+
+static const char *op_names[TRAZA_OPERACIONES] = {
+	"getattr", "readdir",  "read",   "write", "mkdir",     "create",
+	"utimens", "truncate", "unlink", "rmdir", "fallocate", "fsync",
+	"rmtree",
+};
+
+typedef struct latencies {
+	uint32_t *ns;
+	size_t n;
+	size_t cap;
+	uint64_t recorded_ns;  // suma de las duraciones registradas
+	size_t mismatches;
+} latencies_t;
+
+static int
+compare_ns(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+	return (x > y) - (x < y);
+}
+
+static int
+latencies_add(latencies_t *l, uint64_t ns)
+{
+	if (l->n == l->cap) {
+		size_t cap = l->cap ? l->cap * 2 : 1024;
+		uint32_t *p = realloc(l->ns, cap * sizeof(uint32_t));
+		if (!p)
+			return -1;
+		l->ns = p;
+		l->cap = cap;
+	}
+	l->ns[l->n++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+	return 0;
+}
+
+static void
+report(latencies_t stats[TRAZA_OPERACIONES], size_t total, double total_ms)
+{
+	printf("%-10s %9s %10s %10s %10s %10s %12s %8s\n",
+	       "operación",
+	       "cantidad",
+	       "media (us)",
+	       "p50 (us)",
+	       "p99 (us)",
+	       "máx (us)",
+	       "orig. (us)",
+	       "difieren");
+
+	for (int op = 0; op < TRAZA_OPERACIONES; op++) {
+		latencies_t *l = &stats[op];
+		if (l->n == 0)
+			continue;
+
+		qsort(l->ns, l->n, sizeof(uint32_t), compare_ns);
+		uint64_t sum = 0;
+		for (size_t i = 0; i < l->n; i++)
+			sum += l->ns[i];
+
+		printf("%-10s %9zu %10.2f %10.2f %10.2f %10.2f %12.2f %8zu\n",
+		       op_names[op],
+		       l->n,
+		       sum / 1e3 / l->n,
+		       l->ns[l->n / 2] / 1e3,
+		       l->ns[l->n * 99 / 100] / 1e3,
+		       l->ns[l->n - 1] / 1e3,
+		       l->recorded_ns / 1e3 / l->n,
+		       l->mismatches);
+	}
+
+	printf("%zu operaciones en %.2f ms (%.0f por segundo)\n",
+	       total,
+	       total_ms,
+	       total_ms > 0 ? total / total_ms * 1e3 : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *image = NULL;
+	const char *dest = NULL;
+	int timed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ti:s:")) != -1) {
+		if (opt == 't') {
+			timed = 1;
+		} else if (opt == 'i') {
+			image = optarg;
+		} else if (opt == 's') {
+			dest = optarg;
+		} else {
+			fprintf(stderr,
+			        "Uso: %s [-t] [-i imagen] [-s destino] traza\n",
+			        argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "Uso: %s [-t] [-i imagen] [-s destino] traza\n", argv[0]);
+		return 2;
+	}
+
+	FILE *file = fopen(argv[optind], "rb");
+	if (!file) {
+		perror(argv[optind]);
+		return 2;
+	}
+
+	fs_trace_header_t header;
+	if (trace_read_header(file, &header) != 0) {
+		fprintf(stderr, "%s: no es una traza de fisopfs\n", argv[optind]);
+		fclose(file);
+		return 2;
+	}
+
+	fs_t *fs = image ? fs_init(image) : fs_build();
+	char *buf = malloc(MAX_CONTENIDO);
+	if (!fs || !buf) {
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
+	latencies_t stats[TRAZA_OPERACIONES] = { 0 };
+	fs_trace_record_t record;
+	char path[UINT8_MAX + 1];
+	size_t total = 0;
+	int status;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((status = trace_read(file, &record, path)) == 1) {
+		if (record.size > MAX_CONTENIDO &&
+		    (record.op == TRAZA_READ || record.op == TRAZA_WRITE))
+			record.size = MAX_CONTENIDO;
+
+		if (timed) {
+			uint64_t now = trace_elapsed_ns(&start);
+			if (record.start_ns > now)
+				usleep((record.start_ns - now) / 1000);
+		}
+
+		struct timespec op_start;
+		clock_gettime(CLOCK_MONOTONIC, &op_start);
+		int result = trace_replay(fs, &record, path, buf, dest);
+		uint64_t ns = trace_elapsed_ns(&op_start);
+
+		latencies_t *l = &stats[record.op];
+		if (latencies_add(l, ns) != 0) {
+			fprintf(stderr, "No hay memoria suficiente.\n");
+			break;
+		}
+		l->recorded_ns += record.duration_ns;
+		if (result != record.status)
+			l->mismatches++;
+		total++;
+	}
+
+	if (status < 0)
+		fprintf(stderr, "%s: traza incompleta o dañada\n", argv[optind]);
+
+	report(stats, total, trace_elapsed_ns(&start) / 1e6);
+
+	for (int op = 0; op < TRAZA_OPERACIONES; op++)
+		free(stats[op].ns);
+	free(buf);
+	fs_free(fs);
+	fclose(file);
+	return status < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs_lib.c"
+#include "fs_delta.c"
+
+// # fisopfs-send
+//
+// Escribe en la salida estándar el delta de una imagen desde una
+// transacción (ver fs_delta.c), para aplicarlo con fisopfs-recv.
+//
+// Uso: fisopfs-send [-s transacción] imagen > delta
+//
+// Sin -s se parte de la transacción 0, es decir, se manda todo el
+// contenido. fisopfs-recv informa en qué transacción quedó la réplica, que
+// es la que se pasa con -s la próxima vez.
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t since = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		char *end;
+		if (opt == 's')
+			since = strtoull(optarg, &end, 10);
+		if (opt != 's' || *optarg == '\0' || *end != '\0') {
+			fprintf(stderr,
+			        "Uso: %s [-s transacción] imagen\n",
+			        argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "Uso: %s [-s transacción] imagen\n", argv[0]);
+		return 2;
+	}
+
+	const char *image = argv[optind];
+	if (access(image, R_OK) != 0) {
+		perror(image);
+		return 2;
+	}
+
+	// El delta sale por la salida estándar original; los mensajes de
+	// fs_lib que van a la salida estándar pasan a la de errores
+	int fd = dup(STDOUT_FILENO);
+	FILE *out = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		perror("stdout");
+		return 2;
+	}
+
+	fs_t *fs = fs_init(image);
+	if (!fs) {
+		fclose(out);
+		return EXIT_FAILURE;
+	}
+
+	fs_delta_stats_t stats;
+	int status = delta_send(fs, since, out, &stats);
+	if (status == -EINVAL)
+		fprintf(stderr,
+		        "%s: la última transacción es %lu, anterior a %lu\n",
+		        image,
+		        (unsigned long) fs->txn,
+		        (unsigned long) since);
+	else if (status != 0)
+		fprintf(stderr, "%s: %s\n", image, strerror(-status));
+	else
+		fprintf(stderr,
+		        "%s: transacciones %lu a %lu, %zu entradas y %zu "
+		        "bloques modificados\n",
+		        image,
+		        (unsigned long) since,
+		        (unsigned long) fs->txn,
+		        stats.entries,
+		        stats.blocks);
+
+	fs_free(fs);
+	if (fclose(out) != 0 && status == 0) {
+		perror("stdout");
+		status = -EIO;
+	}
+	return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
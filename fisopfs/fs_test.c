@@ -1,5 +1,7 @@
 #include "testing.c"
-#include "fs_lib.c"
+#include "libfisopfs.c"
+#include "fs_trace.c"
+#include "fs_delta.c"
 #include <libgen.h>
 
 void
@@ -40,7 +42,7 @@ prueba_crear_file_system()
 	test_afirmar(fs->f_size == 0, "El file system no tiene archivos");
 	test_afirmar(!strcmp(fs->directories[0].path, ROOT),
 	             "El file system no tiene directorios");
-	free(fs);
+	fs_free(fs);
 }
 
 void
@@ -75,7 +77,7 @@ prueba_crear_un_directorio()
 	test_afirmar(!strcmp(fs->directories[2].d_parent->path, "/dir1"),
 	             "El directorio 'dir2' es hijo de 'dir1'");
 
-	free(fs);
+	fs_free(fs);
 }
 
 void
@@ -132,7 +134,7 @@ prueba_crear_o_modificar_un_archivo()
 	test_afirmar(!strcmp(fs->files[1].entry->path, dir1),
 	             "El archivo 'archivo1.txt' esta en 'dir1'");
 
-	free(fs);
+	fs_free(fs);
 }
 
 void
@@ -156,7 +158,7 @@ prueba_comparacion_y_verificacion_de_atributos()
 	             "El archivo tiene fecha de acceso");
 	test_afirmar(file1->time_last_modification > 0,
 	             "El archivo tiene fecha de modificación");
-	test_afirmar(!strcmp(file1->content, ""),
+	test_afirmar(file_allocated_blocks(file1) == 0,
 	             "El archivo tiene contenido vacio");
 	test_afirmar(
 	        fs->f_size == 1,
@@ -183,7 +185,7 @@ prueba_comparacion_y_verificacion_de_atributos()
 	test_afirmar(file2->time_last_modification > file1->time_last_modification,
 	             "El archivo 2 tiene fecha de modificación mas reciente al "
 	             "archivo 1");
-	test_afirmar(!strcmp(file2->content, ""),
+	test_afirmar(file_allocated_blocks(file2) == 0,
 	             "El archivo tiene contenido vacio");
 	test_afirmar(
 	        fs->f_size == 2,
@@ -197,7 +199,7 @@ prueba_comparacion_y_verificacion_de_atributos()
 	             "El archivo 1 tiene fecha de modificación mas reciente al "
 	             "archivo 2");
 
-	free(fs);
+	fs_free(fs);
 }
 
 void
@@ -235,7 +237,7 @@ prueba_eliminacion_de_archivos_y_directorios()
 	             "Se elimina un archivo dentro de un directorio");
 	test_afirmar(fs->d_size == 3 && fs->f_size == 0, "El file system actualizo la cantidad de directorios y archivos");
 
-	free(fs);
+	fs_free(fs);
 }
 
 void
@@ -304,7 +306,209 @@ prueba_de_no_eliminacion_de_directorios()
 	             "Se elimina un directorio con subdirectorios");
 	test_afirmar(fs->d_size == 1 && fs->f_size == 0, "El file system ha borrado correctamente los directorios y archivos");
 
-	free(fs);
+	fs_free(fs);
+}
+
+void
+prueba_archivos_dispersos()
+{
+	fs_t *fs = fs_build();
+	char path[] = "/disperso.img";
+	char buffer[TAM_BLOQUE];
+	fs_create(fs, path, 1);
+	fs_file_t *file = get_file(fs, path);
+
+	test_nuevo_sub_grupo("Escritura más allá del final del archivo");
+	test_afirmar(fs_write(fs, path, "hola", 4, 3 * TAM_BLOQUE) == 4,
+	             "Se escribe lejos del final del archivo");
+	test_afirmar(file->size == 3 * TAM_BLOQUE + 4,
+	             "El tamaño incluye el hueco");
+	test_afirmar(file_allocated_blocks(file) == 1,
+	             "Sólo se reserva el bloque escrito");
+	buffer[0] = 'x';
+	test_afirmar(fs_read(fs, path, buffer, 8, TAM_BLOQUE) == 8 &&
+	                     buffer[0] == 0 && buffer[7] == 0,
+	             "El hueco se lee como ceros");
+	test_afirmar(fs_read(fs, path, buffer, 8, 3 * TAM_BLOQUE) == 4 &&
+	                     !strncmp(buffer, "hola", 4),
+	             "Se leen los datos escritos");
+
+	test_nuevo_sub_grupo("Truncado y reserva de espacio");
+	test_afirmar(fs_truncate(fs, path, MAX_CONTENIDO) == 0 &&
+	                     file->size == MAX_CONTENIDO,
+	             "Se extiende el archivo al tamaño máximo");
+	test_afirmar(file_allocated_blocks(file) == 1,
+	             "Extender el archivo no reserva bloques");
+	test_afirmar(fs_fallocate(fs, path, 0, 0, 2 * TAM_BLOQUE) == 0 &&
+	                     file_allocated_blocks(file) == 3,
+	             "fallocate reserva los bloques del rango");
+	test_afirmar(fs_fallocate(fs,
+	                          path,
+	                          FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	                          0,
+	                          TAM_BLOQUE) == 0 &&
+	                     file_allocated_blocks(file) == 2,
+	             "Se perfora un hueco en el primer bloque");
+	test_afirmar(fs_fallocate(fs, path, FALLOC_FL_PUNCH_HOLE, 0, 1) ==
+	                     -EOPNOTSUPP,
+	             "No se perfora un hueco sin FALLOC_FL_KEEP_SIZE");
+	test_afirmar(fs_fallocate(fs, path, 0, TAM_BLOQUE, INT64_MAX) == -EFBIG,
+	             "Un rango que desborda el offset es demasiado grande");
+
+	test_nuevo_sub_grupo("Búsqueda de datos y huecos");
+	test_afirmar(fs_lseek(fs, path, 0, SEEK_DATA) == TAM_BLOQUE,
+	             "SEEK_DATA saltea el hueco inicial");
+	test_afirmar(fs_lseek(fs, path, TAM_BLOQUE, SEEK_HOLE) == 2 * TAM_BLOQUE,
+	             "SEEK_HOLE encuentra el hueco siguiente");
+	test_afirmar(fs_lseek(fs, path, 4 * TAM_BLOQUE, SEEK_DATA) == -ENXIO,
+	             "SEEK_DATA no encuentra datos después del último bloque");
+	test_afirmar(fs_lseek(fs, path, MAX_CONTENIDO, SEEK_HOLE) == -ENXIO,
+	             "No se busca más allá del final del archivo");
+
+	test_afirmar(fs_truncate(fs, path, 3 * TAM_BLOQUE + 2) == 0 &&
+	                     file_allocated_blocks(file) == 2,
+	             "Achicar el archivo libera los bloques sobrantes");
+	test_afirmar(fs_truncate(fs, path, 3 * TAM_BLOQUE + 4) == 0 &&
+	                     fs_read(fs, path, buffer, 4, 3 * TAM_BLOQUE) == 4 &&
+	                     !strncmp(buffer, "ho\0\0", 4),
+	             "Los bytes truncados se leen como ceros");
+
+	fs_free(fs);
+}
+
+void
+prueba_copia_con_bloques_compartidos()
+{
+	fs_t *fs = fs_build();
+	char origen[] = "/origen.img";
+	char copia[] = "/copia.img";
+	char buffer[8];
+	fs_create(fs, origen, 1);
+	fs_create(fs, copia, 1);
+	fs_file_t *in = get_file(fs, origen);
+	fs_file_t *out = get_file(fs, copia);
+
+	fs_write(fs, origen, "bloque0", 7, 0);
+	fs_write(fs, origen, "bloque2", 7, 2 * TAM_BLOQUE);
+
+	test_nuevo_sub_grupo("Copia de un archivo completo");
+	test_afirmar(fs_copy_file_range(fs, origen, 0, copia, 0, MAX_CONTENIDO) ==
+	                     2 * TAM_BLOQUE + 7,
+	             "Se copia hasta el final del origen");
+	test_afirmar(out->size == in->size,
+	             "La copia tiene el tamaño del origen");
+	test_afirmar(out->blocks[0] == in->blocks[0] &&
+	                     out->blocks[2] == in->blocks[2],
+	             "Los bloques se comparten en lugar de copiarse");
+	test_afirmar(in->blocks[0]->refs == 2, "El bloque compartido tiene dos referencias");
+	test_afirmar(out->blocks[1] == NULL, "El hueco del origen sigue siendo un hueco");
+
+	test_nuevo_sub_grupo("Copy-on-write de bloques compartidos");
+	test_afirmar(fs_write(fs, copia, "B", 1, 0) == 1,
+	             "Se modifica la copia");
+	test_afirmar(out->blocks[0] != in->blocks[0] && in->blocks[0]->refs == 1,
+	             "La copia deja de compartir el bloque modificado");
+	test_afirmar(fs_read(fs, origen, buffer, 7, 0) == 7 &&
+	                     !strncmp(buffer, "bloque0", 7),
+	             "El origen no ve el cambio");
+	test_afirmar(fs_read(fs, copia, buffer, 7, 0) == 7 &&
+	                     !strncmp(buffer, "Bloque0", 7),
+	             "La copia ve el cambio");
+
+	test_nuevo_sub_grupo("Copia de rangos parciales");
+	test_afirmar(fs_copy_file_range(fs, origen, 2, copia, TAM_BLOQUE + 1, 5) == 5,
+	             "Se copia un rango desalineado");
+	test_afirmar(fs_read(fs, copia, buffer, 5, TAM_BLOQUE + 1) == 5 &&
+	                     !strncmp(buffer, "oque0", 5),
+	             "El rango desalineado se copia byte a byte");
+	test_afirmar(fs_copy_file_range(fs, origen, 0, origen, 2, 4) == -EINVAL,
+	             "No se copian rangos superpuestos de un mismo archivo");
+
+	test_nuevo_sub_grupo("Los bloques compartidos sobreviven a la imagen");
+	fs_save("./fs.dat", fs);
+	fs_free(fs);
+	fs = fs_init("./fs.dat");
+	test_afirmar(fs && fs->image_n_blocks == 4,
+	             "El bloque compartido se guarda una sola vez");
+	if (!fs)
+		return;
+	in = get_file(fs, origen);
+	out = get_file(fs, copia);
+	fs_read(fs, origen, buffer, 7, 2 * TAM_BLOQUE);
+	test_afirmar(fs_read(fs, copia, buffer, 7, 2 * TAM_BLOQUE) == 7 &&
+	                     out->blocks[2] == in->blocks[2] &&
+	                     in->blocks[2]->refs == 2,
+	             "Al leerlo desde los dos archivos se comparte en memoria");
+	fs_write(fs, copia, "B", 1, 2 * TAM_BLOQUE);
+	fs_read(fs, origen, buffer, 7, 2 * TAM_BLOQUE);
+	test_afirmar(out->blocks[2] != in->blocks[2] &&
+	                     !strncmp(buffer, "bloque2", 7),
+	             "Modificarlo lo copia, y el origen no ve el cambio");
+	uint32_t n = in->image[2];
+	test_afirmar(fs->image_loaded[n - 1] == in->blocks[2],
+	             "El origen sigue teniendo el bloque leído de la imagen");
+	fs_write(fs, origen, "X", 1, 2 * TAM_BLOQUE);
+	test_afirmar(fs->image_loaded[n - 1] == NULL,
+	             "Al modificarlo deja de ser el bloque leído de la imagen");
+
+	fs_free(fs);
+}
+
+void
+prueba_carga_bajo_demanda()
+{
+	fs_t *fs_w = fs_build();
+	char path[] = "/datos.bin";
+	char buffer[TAM_BLOQUE];
+	fs_create(fs_w, path, 1);
+	for (int i = 0; i < 8; i++) {
+		memset(buffer, 'a' + i, TAM_BLOQUE);
+		fs_write(fs_w, path, buffer, TAM_BLOQUE, i * TAM_BLOQUE);
+	}
+	fs_destroy("./fs.dat", fs_w, 1);
+
+	fs_t *fs = fs_init("./fs.dat");
+	test_afirmar(fs != NULL, "Se recupera el file system");
+	if (fs == NULL)
+		return;
+	fs_file_t *file = get_file(fs, path);
+
+	test_nuevo_sub_grupo("Los bloques se leen de la imagen al usarlos");
+	test_afirmar(fs->cached == 0 && file_allocated_blocks(file) == 8,
+	             "Al montar no hay bloques en memoria");
+	test_afirmar(fs_read(fs, path, buffer, 1, 3 * TAM_BLOQUE) == 1 &&
+	                     buffer[0] == 'd',
+	             "Se lee un bloque de la imagen");
+	test_afirmar(fs->cached == 1 && file->blocks[3] != NULL,
+	             "Sólo queda en memoria el bloque leído");
+
+	test_nuevo_sub_grupo("Se descartan bloques ante falta de memoria");
+	fs->max_cached = 4;
+	for (int i = 0; i < 8; i++)
+		fs_read(fs, path, buffer, 1, i * TAM_BLOQUE);
+	test_afirmar(fs->cached <= 4, "No se supera el máximo de bloques en memoria");
+	test_afirmar(fs_read(fs, path, buffer, 1, 0) == 1 && buffer[0] == 'a',
+	             "Un bloque descartado se vuelve a leer de la imagen");
+
+	test_afirmar(fs_write(fs, path, "z", 1, 5 * TAM_BLOQUE) == 1 &&
+	                     file->image[5] == 0,
+	             "Un bloque modificado deja de estar respaldado por la imagen");
+	for (int i = 0; i < 8; i++)
+		fs_read(fs, path, buffer, 1, i * TAM_BLOQUE);
+	test_afirmar(file->blocks[5] != NULL && file->blocks[5]->data[0] == 'z',
+	             "Un bloque modificado no se descarta");
+
+	test_nuevo_sub_grupo("Se guardan los bloques que no se leyeron");
+	fs_destroy("./fs.dat", fs, 1);
+	fs = fs_init("./fs.dat");
+	test_afirmar(fs && fs_read(fs, path, buffer, 1, 7 * TAM_BLOQUE) == 1 &&
+	                     buffer[0] == 'h',
+	             "Se conserva un bloque que nunca se leyó");
+	test_afirmar(fs && fs_read(fs, path, buffer, 1, 5 * TAM_BLOQUE) == 1 &&
+	                     buffer[0] == 'z',
+	             "Se conserva un bloque modificado");
+	if (fs)
+		fs_free(fs);
 }
 
 void
@@ -312,10 +516,11 @@ prueba_persistencia()
 {
 	fs_t *fs_w = fs_build();
 
-	fs_file_t file_w;
+	fs_file_t file_w = { 0 };
 	strcpy(file_w.path, "archivo1.txt");
 	file_w.size = 8;
-	strcpy(file_w.content, "archivo");
+	file_w.blocks[0] = block_new();
+	strcpy(file_w.blocks[0]->data, "archivo");
 	file_w.entry = &fs_w->directories[0];
 
 	fs_w->files[0] = file_w;
@@ -334,10 +539,1793 @@ prueba_persistencia()
 	             "Se recupera el nombre del archivo");
 	test_afirmar(fs_r->files[0].size == 8,
 	             "Se recupera el tamaño del archivo");
-	test_afirmar(strcmp(fs_r->files[0].content, "archivo") == 0,
+	char content[8];
+	test_afirmar(fs_r->files[0].blocks[0] == NULL,
+	             "El contenido no se lee al recuperar el file system");
+	test_afirmar(fs_read(fs_r, "archivo1.txt", content, 8, 0) == 8 &&
+	                     strcmp(content, "archivo") == 0,
 	             "Se recupera el contenido del archivo");
+	test_afirmar(file_allocated_blocks(&fs_r->files[0]) == 1,
+	             "Los huecos no se guardan como bloques");
+
+	fs_free(fs_r);
+}
+
+void
+prueba_verificacion_de_la_imagen()
+{
+	fs_t *fs_w = fs_build();
+	char origen[] = "/origen.txt";
+	char copia[] = "/copia.txt";
+	fs_create(fs_w, origen, 1);
+	fs_create(fs_w, copia, 1);
+	fs_write(fs_w, origen, "compartido", 10, 0);
+	fs_copy_file_range(fs_w, origen, 0, copia, 0, 10);
+	fs_destroy("./fs.dat", fs_w, 1);
+
+	test_nuevo_sub_grupo("Se guardan una sola vez los bloques compartidos");
+	fs_t *fs_r = fs_init("./fs.dat");
+	test_afirmar(fs_r != NULL, "Se recupera el file system");
+	if (fs_r == NULL)
+		return;
+	fs_file_t *in = get_file(fs_r, origen);
+	fs_file_t *out = get_file(fs_r, copia);
+	test_afirmar(in && out && in->image[0] != 0 &&
+	                     in->image[0] == out->image[0],
+	             "Los archivos siguen compartiendo el bloque");
+	test_afirmar(out->entry == &fs_r->directories[0],
+	             "El directorio del archivo apunta a la raíz recuperada");
+	fs_free(fs_r);
+
+	test_nuevo_sub_grupo("Se detectan imágenes corruptas");
+	FILE *fd = fopen("./fs.dat", "r+");
+	fseek(fd, -1, SEEK_END);
+	fputc('X', fd);
+	fclose(fd);
+	char buffer[10];
+	fs_r = fs_init("./fs.dat");
+	test_afirmar(fs_r != NULL,
+	             "Los bloques de datos no se verifican al montar");
+	test_afirmar(fs_r && fs_read(fs_r, origen, buffer, 10, 0) == -EIO,
+	             "Se detecta el bloque alterado al leerlo");
+	if (fs_r)
+		fs_free(fs_r);
+
+	fd = fopen("./fs.dat", "r+");
+	fseek(fd, sizeof(fs_image_header_t), SEEK_SET);
+	fputc('X', fd);
+	fclose(fd);
+	test_afirmar(fs_init("./fs.dat") == NULL,
+	             "No se carga una imagen con la tabla de segmentos alterada");
+
+	fd = fopen("./fs.dat", "w");
+	fputs("no es una imagen de fisopfs", fd);
+	fclose(fd);
+	test_afirmar(fs_init("./fs.dat") == NULL,
+	             "No se carga un archivo que no es una imagen");
+}
+
+void
+prueba_sumas_de_verificacion()
+{
+	test_nuevo_sub_grupo("Todas las implementaciones del CRC32C coinciden");
+	static char datos[3 * TRAMO_CRC * 2 + 100];
+	for (size_t i = 0; i < sizeof(datos); i++)
+		datos[i] = (i * 131) ^ (i >> 7);
+
+	test_afirmar(crc32c(0, "123456789", 9) == 0xE3069283,
+	             "Se obtiene el valor de referencia del CRC32C");
+	for (size_t k = 0; k < N_CRC32C_KERNELS; k++) {
+		const crc32c_kernel_t *kernel = &crc32c_kernels[k];
+		if (!crc32c_kernel_supported(kernel))
+			continue;
+
+		int same = 1;
+		for (size_t len = 0; len < sizeof(datos); len += 97)
+			same &= kernel->update(7, datos + 3, len) ==
+			        crc32c_update_table(7, datos + 3, len);
+		char message[64];
+		snprintf(message,
+		         sizeof(message),
+		         "La versión %s coincide con la de tabla",
+		         kernel->name);
+		test_afirmar(same, message);
+	}
+
+	test_nuevo_sub_grupo("Cada bloque y cada registro tiene su suma");
+	fs_t *fs = fs_build();
+	char path[] = "/sumas.bin";
+	char buffer[TAM_BLOQUE];
+	fs_create(fs, path, 1);
+	for (int i = 0; i < 4; i++) {
+		memset(buffer, 'a' + i, TAM_BLOQUE);
+		fs_write(fs, path, buffer, TAM_BLOQUE, i * TAM_BLOQUE);
+	}
+	fs_file_t *file = get_file(fs, path);
+	test_afirmar(!file->blocks[0]->crc_valid,
+	             "La suma de un bloque escrito se calcula al guardarlo");
+	fs_save("./fs.dat", fs);
+	fs_block_t *block = file->blocks[0];
+	test_afirmar(block->crc_valid &&
+	                     block->crc == crc32c(0, block->data, TAM_BLOQUE),
+	             "Al guardar se calcula la suma del bloque");
+	fs_write(fs, path, "z", 1, 0);
+	test_afirmar(!file->blocks[0]->crc_valid && file->blocks[1]->crc_valid,
+	             "Modificar un bloque sólo invalida su suma");
+	fs_free(fs);
+
+	fs = fs_init("./fs.dat");
+	test_afirmar(fs && fs->image_n_blocks == 4,
+	             "Se recupera el file system");
+	if (!fs)
+		return;
+	file = get_file(fs, path);
+	uint32_t n = file->image[1];
+	test_afirmar(fs_read(fs, path, buffer, 1, TAM_BLOQUE) == 1 &&
+	                     file->blocks[1]->crc_valid &&
+	                     file->blocks[1]->crc == fs->image_crcs[n - 1],
+	             "Un bloque leído de la imagen conserva su suma");
+	test_afirmar(fs->image_verified[n - 1] == BLOQUE_VERIFICADO &&
+	                     fs->image_verified[file->image[2] - 1] ==
+	                             BLOQUE_SIN_VERIFICAR,
+	             "Sólo se verifica el bloque leído");
+	fs_free(fs);
+
+	test_nuevo_sub_grupo("El verificador encuentra los bloques corruptos");
+	FILE *fd = fopen("./fs.dat", "r+");
+	fseek(fd, -TAM_BLOQUE, SEEK_END);
+	fputc('X', fd);
+	fclose(fd);
+	fs = fs_init("./fs.dat");
+	test_afirmar(fs != NULL, "Se monta la imagen con un bloque alterado");
+	if (!fs)
+		return;
+	test_afirmar(image_scrub(fs, fs->image_n_blocks) == 1 &&
+	                     fs->image_verified[3] == BLOQUE_CORRUPTO,
+	             "Se encuentra el bloque alterado sin leerlo");
+	test_afirmar(fs_read(fs, path, buffer, 1, 3 * TAM_BLOQUE) == -EIO,
+	             "Leer el bloque alterado es un error");
+	test_afirmar(fs_read(fs, path, buffer, 1, 0) == 1,
+	             "Los demás bloques se leen normalmente");
+	uint64_t txn = get_file(fs, path)->txn;
+	memset(buffer, 'w', 20);
+	test_afirmar(fs_write(fs, path, buffer, 20, 3 * TAM_BLOQUE - 10) == 10 &&
+	                     get_file(fs, path)->txn > txn,
+	             "Una escritura que llega al bloque alterado es parcial");
+	test_afirmar(fs_read(fs, path, buffer + 20, 10, 3 * TAM_BLOQUE - 10) ==
+	                     10 &&
+	                     memcmp(buffer + 20, buffer, 10) == 0,
+	             "Lo escrito antes del bloque alterado se lee");
+	fs_create(fs, "/copia.bin", 1);
+	fs_file_t *copy = get_file(fs, "/copia.bin");
+	txn = copy->txn;
+	ssize_t copied = fs_copy_file_range(
+	        fs, path, 3 * TAM_BLOQUE - 10, "/copia.bin", 0, 20);
+	test_afirmar(copied == 10 && copy->size == 10 && copy->txn > txn,
+	             "Una copia que llega al bloque alterado es parcial");
+	test_afirmar(fs_read(fs, "/copia.bin", buffer + 20, 20, 0) == 10 &&
+	                     memcmp(buffer + 20, buffer, 10) == 0,
+	             "Lo copiado antes del bloque alterado se lee");
+	fs_free(fs);
+
+	fs = fs_init("./fs.dat");
+	int started = fs && fs_scrub_start(fs) == 0;
+	for (int i = 0; started && i < 200 &&
+	                __atomic_load_n(&fs->scrub_next, __ATOMIC_RELAXED) < 4;
+	     i++)
+		usleep(10000);
+	test_afirmar(started && fs->scrub_next == 4,
+	             "El verificador en segundo plano recorre toda la imagen");
+	if (fs) {
+		fs_scrub_stop(fs);
+		test_afirmar(fs->image_verified[3] == BLOQUE_CORRUPTO &&
+		                     fs->image_verified[0] == BLOQUE_VERIFICADO,
+		             "El verificador marca cada bloque");
+		fs_free(fs);
+	}
+
+	test_nuevo_sub_grupo("Se detectan registros de metadatos alterados");
+	fs = fs_build();
+	fs_create(fs, path, 1);
+	fs_save("./fs.dat", fs);
+	fs_free(fs);
+	fs_image_header_t header;
+	fs_segment_t segments[SEGMENTO_DATOS];
+	fd = fopen("./fs.dat", "r+");
+	fread(&header, sizeof(header), 1, fd);
+	fread(segments, sizeof(fs_segment_t), SEGMENTO_DATOS, fd);
+	// Se altera un registro y se corrigen los CRC del segmento, de la tabla
+	// y de la cabecera, para que sólo lo detecte el CRC del registro
+	fs_segment_t *meta = &segments[SEGMENTO_METADATOS];
+	char *records = malloc(meta->length);
+	fseek(fd, meta->offset, SEEK_SET);
+	fread(records, 1, meta->length, fd);
+	((fs_file_record_t *) (records + sizeof(fs_dir_record_t)))->size = 10;
+	meta->crc = crc32c(0, records, meta->length);
+	header.table_crc = crc32c(0, segments, sizeof(segments));
+	header.header_crc =
+	        crc32c(0, &header, offsetof(fs_image_header_t, header_crc));
+	fseek(fd, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, fd);
+	fwrite(segments, sizeof(fs_segment_t), SEGMENTO_DATOS, fd);
+	fseek(fd, meta->offset, SEEK_SET);
+	fwrite(records, 1, meta->length, fd);
+	fclose(fd);
+	free(records);
+	test_afirmar(fs_init("./fs.dat") == NULL,
+	             "No se carga una imagen con un registro alterado");
+}
+
+void
+prueba_importacion()
+{
+	char host[] = "/tmp/fisopfs_import_XXXXXX";
+	char path[PATH_MAX];
+	char buffer[TAM_BLOQUE];
+	if (!mkdtemp(host))
+		return;
+
+	snprintf(path, sizeof(path), "%s/docs", host);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/a.txt", host);
+	FILE *f = fopen(path, "w");
+	fputs("hola", f);
+	fclose(f);
+	snprintf(path, sizeof(path), "%s/docs/b.bin", host);
+	f = fopen(path, "w");
+	fseek(f, TAM_BLOQUE, SEEK_SET);
+	fputs("datos", f);
+	fclose(f);
+	snprintf(path, sizeof(path), "%s/enlace", host);
+	symlink("a.txt", path);
+
+	fs_t *fs = fs_build();
+	test_nuevo_sub_grupo("Se importa un directorio del host");
+	test_afirmar(fs_import(fs, host) == 0, "Se importa el directorio");
+	test_afirmar(get_dir(fs, "/docs") != NULL, "Se crea el subdirectorio");
+	test_afirmar(fs_read(fs, "/a.txt", buffer, sizeof(buffer), 0) == 4 &&
+	                     memcmp(buffer, "hola", 4) == 0,
+	             "Se importa el contenido de un archivo");
+	fs_file_t *file = get_file(fs, "/docs/b.bin");
+	test_afirmar(file && file->entry == get_dir(fs, "/docs") &&
+	                     file->size == TAM_BLOQUE + 5,
+	             "Se importa un archivo de un subdirectorio");
+	test_afirmar(file && file->blocks[0] == NULL && file->blocks[1] != NULL,
+	             "Los bloques en cero quedan como huecos");
+	test_afirmar(fs_read(fs, "/docs/b.bin", buffer, 5, TAM_BLOQUE) == 5 &&
+	                     memcmp(buffer, "datos", 5) == 0,
+	             "Se lee el contenido después del hueco");
+	test_afirmar(get_file(fs, "/enlace") == NULL,
+	             "Se ignoran los enlaces simbólicos");
+
+	test_nuevo_sub_grupo("No se pisan archivos existentes");
+	test_afirmar(fs_import(fs, host) == -EEXIST,
+	             "Importar un archivo que ya existe es un error");
+	test_afirmar(fs_import(fs, "/tmp/fisopfs_no_existe") < 0,
+	             "Importar un directorio inexistente es un error");
+	fs_free(fs);
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/docs/b.bin", host);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/docs", host);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/a.txt", host);
+	unlink(path);
+	rmdir(host);
+}
+
+typedef struct listado {
+	char names[8][MAX_NAME];
+	off_t cookies[8];
+	struct stat stats[8];
+	size_t n;
+	size_t cap;
+} listado_t;
+
+static int
+llenar_listado(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	listado_t *l = buf;
+	if (l->n == l->cap)
+		return 1;
+	strcpy(l->names[l->n], name);
+	if (st)
+		l->stats[l->n] = *st;
+	l->cookies[l->n++] = off;
+	return 0;
+}
+
+void
+prueba_lectura_de_directorios_por_partes()
+{
+	fs_t *fs = fs_build();
+	fs_mkdir(fs, "/dir", 0755);
+	fs_create(fs, "/dir/a", 0644);
+	fs_create(fs, "/dir/b", 0644);
+	fs_create(fs, "/dir/c", 0644);
+	fs_create(fs, "/dir/d", 0644);
+
+	test_nuevo_sub_grupo("Se lista un directorio de a partes");
+	listado_t l = { .cap = 3 };
+	fs_readdir(fs, "/dir", &l, llenar_listado, 0);
+	test_afirmar(l.n == 3 && strcmp(l.names[0], ".") == 0 &&
+	                     strcmp(l.names[1], "..") == 0 &&
+	                     strcmp(l.names[2], "a") == 0,
+	             "La primera parte llena el buffer");
+	off_t last = l.cookies[2];
+
+	fs_unlink(fs, "/dir/a");
+	fs_unlink(fs, "/dir/c");
+	fs_create(fs, "/dir/e", 0644);
+
+	listado_t rest = { .cap = 8 };
+	fs_readdir(fs, "/dir", &rest, llenar_listado, last);
+	test_afirmar(rest.n == 3 && strcmp(rest.names[0], "b") == 0 &&
+	                     strcmp(rest.names[1], "d") == 0 &&
+	                     strcmp(rest.names[2], "e") == 0,
+	             "Se retoma desde la cookie aunque se creen y borren entradas");
+	test_afirmar(rest.cookies[0] > last && rest.cookies[1] > rest.cookies[0] &&
+	                     rest.cookies[2] > rest.cookies[1],
+	             "Las cookies son crecientes");
+
+	listado_t again = { .cap = 8 };
+	fs_readdir(fs, "/dir", &again, llenar_listado, rest.cookies[0]);
+	test_afirmar(again.n == 2 && again.cookies[0] == rest.cookies[1],
+	             "Las cookies de una entrada no cambian");
+	test_afirmar(fs_readdir(fs, "/otro", &again, llenar_listado, 0) == -ENOENT,
+	             "No se lista un directorio inexistente");
+
+	test_nuevo_sub_grupo("Se borra un directorio anterior a otros");
+	fs_mkdir(fs, "/otro", 0755);
+	fs_create(fs, "/otro/f", 0644);
+	fs_unlink(fs, "/dir/b");
+	fs_unlink(fs, "/dir/d");
+	fs_unlink(fs, "/dir/e");
+	test_afirmar(fs_rmdir(fs, "/dir") == 0, "Se borra el directorio vacío");
+	test_afirmar(get_file(fs, "/otro/f")->entry == get_dir(fs, "/otro"),
+	             "Los archivos siguen apuntando a su directorio");
+	test_afirmar(fs_rmdir(fs, "/otro") == -ENOTEMPTY,
+	             "No se borra un directorio con archivos");
+	fs_free(fs);
+}
+
+void
+prueba_atributos_al_listar_directorios()
+{
+	fs_t *fs = fs_build();
+	fs_mkdir(fs, "/dir", 0755);
+	fs_mkdir(fs, "/dir/sub", 0755);
+	fs_create(fs, "/dir/archivo", 0644);
+	fs_write(fs, "/dir/archivo", "hola", 4, 0);
+
+	listado_t l = { .cap = 8 };
+	fs_readdir(fs, "/dir", &l, llenar_listado, 0);
+
+	test_nuevo_sub_grupo("Se listan las entradas con sus atributos");
+	test_afirmar(l.n == 4, "Se listan todas las entradas");
+	test_afirmar(S_ISDIR(l.stats[0].st_mode) && S_ISDIR(l.stats[1].st_mode),
+	             "'.' y '..' son directorios");
+	test_afirmar(S_ISDIR(l.stats[2].st_mode), "El subdirectorio es un directorio");
+	test_afirmar(S_ISREG(l.stats[3].st_mode) && l.stats[3].st_size == 4,
+	             "El archivo tiene su tipo y su tamaño");
+
+	struct stat st;
+	fs_getattr(fs, "/dir/archivo", &st);
+	test_afirmar(memcmp(&st, &l.stats[3], sizeof(st)) == 0,
+	             "Los atributos coinciden con los de getattr");
+	fs_free(fs);
+}
+
+void
+prueba_busquedas_de_paths_inexistentes()
+{
+	fs_t *fs = fs_build();
+	struct stat st;
+
+	test_nuevo_sub_grupo("Un path inexistente no pasa el filtro");
+	test_afirmar(!bloom_may_contain(fs, "/no_existe"),
+	             "El filtro descarta un path que nunca se creó");
+	test_afirmar(fs_getattr(fs, "/no_existe", &st) == -ENOENT,
+	             "getattr devuelve -ENOENT");
+
+	test_nuevo_sub_grupo("Crear una entrada la agrega al filtro");
+	fs_mkdir(fs, "/dir", 0755);
+	fs_create(fs, "/dir/archivo", 0644);
+	test_afirmar(bloom_may_contain(fs, "/dir") &&
+	                     bloom_may_contain(fs, "/dir/archivo"),
+	             "El filtro no descarta las entradas creadas");
+	test_afirmar(fs_getattr(fs, "/dir/archivo", &st) == 0,
+	             "Se encuentra el archivo creado");
+
+	test_nuevo_sub_grupo("El filtro se rearma después de muchos borrados");
+	fs_unlink(fs, "/dir/archivo");
+	test_afirmar(fs_getattr(fs, "/dir/archivo", &st) == -ENOENT,
+	             "Un archivo borrado no se encuentra");
+	fs_rmdir(fs, "/dir");
+	test_afirmar(fs->bloom_removed == 0 && !bloom_may_contain(fs, "/dir/archivo"),
+	             "Los paths borrados dejan de pasar el filtro");
+	test_afirmar(bloom_may_contain(fs, ROOT), "La raíz sigue en el filtro");
+	fs_free(fs);
+}
+
+typedef struct lectura_concurrente {
+	fs_t *fs;
+	int stop;
+	size_t lecturas;
+	size_t fallidas;
+} lectura_concurrente_t;
+
+static void *
+leer_atributos(void *arg)
+{
+	lectura_concurrente_t *l = arg;
+	struct stat st;
+	size_t lecturas = 0;
+	size_t fallidas = 0;
+
+	while (!__atomic_load_n(&l->stop, __ATOMIC_RELAXED) || lecturas < 1000) {
+		if (fs_getattr(l->fs, "/fijo", &st) != 0 || !S_ISREG(st.st_mode))
+			fallidas++;
+		lecturas++;
+	}
+
+	__atomic_add_fetch(&l->lecturas, lecturas, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&l->fallidas, fallidas, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+void
+prueba_comparacion_de_etiquetas()
+{
+	test_nuevo_sub_grupo("Todas las implementaciones dan el mismo resultado");
+	uint8_t tags[4 * GRUPO_ETIQUETAS];
+	for (size_t i = 0; i < sizeof(tags); i++)
+		tags[i] = (i * 37) % 7;
+
+	for (size_t k = 0; k < N_TAG_KERNELS; k++) {
+		const tag_kernel_t *kernel = &tag_kernels[k];
+		if (!tag_kernel_supported(kernel))
+			continue;
+
+		int same = 1;
+		for (size_t g = 0; g < sizeof(tags); g += GRUPO_ETIQUETAS) {
+			for (int tag = 0; tag < 8; tag++)
+				same &= kernel->match(tags + g, tag) ==
+				        tag_match_scalar(tags + g, tag);
+		}
+		char message[64];
+		snprintf(message,
+		         sizeof(message),
+		         "La versión %s coincide con la escalar",
+		         kernel->name);
+		test_afirmar(same, message);
+	}
+
+	test_nuevo_sub_grupo("Se respetan el comienzo y el final de la búsqueda");
+	memset(tags, 0, sizeof(tags));
+	tags[3] = tags[40] = tags[70] = 9;
+	test_afirmar(tags_next(tags, 100, 9, 0) == 3, "Se encuentra la primera");
+	test_afirmar(tags_next(tags, 100, 9, 4) == 40,
+	             "Se sigue desde la posición pedida");
+	test_afirmar(tags_next(tags, 70, 9, 41) == 70,
+	             "No se miran etiquetas fuera del arreglo");
+	test_afirmar(tags_next(tags, 100, 8, 0) == 100,
+	             "Sin coincidencias devuelve n");
+
+	test_nuevo_sub_grupo("Búsqueda en un directorio con muchas entradas");
+	fs_d_entry_t dir = { .path = "/dir" };
+	char path[MAX_NAME];
+	int added = 1;
+	for (int i = 0; i < 1000; i++) {
+		snprintf(path, MAX_NAME, "/dir/entrada%d", i);
+		added &= dir_index_add(&dir, path) == 0;
+	}
+	test_afirmar(added && dir.cap_entries % GRUPO_ETIQUETAS == 0,
+	             "Se agregan 1000 entradas");
+	int found = 1;
+	for (int i = 0; i < 1000; i++) {
+		snprintf(path, MAX_NAME, "entrada%d", i);
+		found &= dir_index_find(&dir, path) == i;
+	}
+	test_afirmar(found, "Se encuentra cada entrada en su posición");
+	test_afirmar(dir_index_find(&dir, "entrada1000") == -1,
+	             "No se encuentra una entrada inexistente");
+	dir_index_remove(&dir, "/dir/entrada0");
+	test_afirmar(dir_children(&dir) == 999 &&
+	                     dir_index_find(&dir, "entrada0") == -1 &&
+	                     dir_index_find(&dir, "entrada999") == 999,
+	             "Al quitar una entrada no se corren las demás");
+	for (int i = 1; i < 600; i++) {
+		snprintf(path, MAX_NAME, "/dir/entrada%d", i);
+		dir_index_remove(&dir, path);
+	}
+	test_afirmar(dir_children(&dir) == 400 && dir.n_entries < 1000 &&
+	                     dir_index_find(&dir, "entrada999") ==
+	                             (ssize_t) dir.n_entries - 1 &&
+	                     dir.entries[0].cookie < dir.entries[1].cookie,
+	             "Las entradas quitadas se compactan en orden");
+	free(dir.entries);
+	free(dir.tags);
+}
+
+void
+prueba_atributos_sin_lock()
+{
+	lectura_concurrente_t l = { .fs = fs_build() };
+	fs_create(l.fs, "/fijo", 0644);
+
+	pthread_t threads[4];
+	for (int i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, leer_atributos, &l);
+
+	// Cada modificación borra y vuelve a crear el archivo, que además se
+	// mueve de lugar en el arreglo: un lector nunca debe verlo faltar.
+	for (int i = 0; i < 20000; i++) {
+		fs_begin_update(l.fs);
+		fs_create(l.fs, "/otro", 0644);
+		fs_unlink(l.fs, "/fijo");
+		fs_create(l.fs, "/fijo", 0644);
+		fs_unlink(l.fs, "/otro");
+		fs_end_update(l.fs);
+	}
+	__atomic_store_n(&l.stop, 1, __ATOMIC_RELAXED);
+
+	for (int i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	test_nuevo_sub_grupo("getattr concurrente con modificaciones");
+	test_afirmar(l.lecturas >= 4000, "Los lectores leen mientras se modifica");
+	test_afirmar(l.fallidas == 0,
+	             "Ningún lector ve un estado intermedio de una modificación");
+	test_afirmar(l.fs->seq % 2 == 0, "No queda ninguna modificación abierta");
+	fs_free(l.fs);
+}
+
+static void *
+reservar_y_liberar_bloques(void *arg)
+{
+	fs_block_t *blocks[3];
+	for (int i = 0; i < 3; i++)
+		blocks[i] = block_new();
+	for (int i = 0; i < 3; i++)
+		block_put(blocks[i]);
+	return NULL;
+}
+
+typedef struct escritura_al_final {
+	fs_t *fs;
+	int id;
+	int fallidas;
+} escritura_al_final_t;
+
+#define REGISTROS_POR_HILO 500
+#define TAM_REGISTRO 32
+
+static void *
+agregar_registros(void *arg)
+{
+	escritura_al_final_t *e = arg;
+	char record[TAM_REGISTRO + 1];
+
+	for (int i = 0; i < REGISTROS_POR_HILO; i++) {
+		memset(record, ' ', TAM_REGISTRO);
+		int len = snprintf(
+		        record, TAM_REGISTRO, "hilo %d registro %04d", e->id, i);
+		record[len] = ' ';
+		record[TAM_REGISTRO - 1] = '\n';
+		fs_lock_shared(e->fs);
+		int status =
+		        fs_append(e->fs, "/log", record, TAM_REGISTRO, 0, 1);
+		fs_unlock(e->fs);
+		if (status != TAM_REGISTRO)
+			e->fallidas++;
+	}
+
+	return NULL;
+}
+
+void
+prueba_escrituras_al_final()
+{
+	fs_t *fs = fs_build();
+	char path[] = "/log";
+	char buffer[3 * TAM_BLOQUE];
+	fs_create(fs, path, 0644);
+	fs_file_t *file = get_file(fs, path);
+
+	test_nuevo_sub_grupo("Se agrega al final de un archivo");
+	int written = 1;
+	for (int i = 0; i < 3 * TAM_BLOQUE / 64; i++) {
+		memset(buffer, 'a' + i % 26, 64);
+		written &= fs_append(fs, path, buffer, 64, i * 64, 0) == 64;
+	}
+	test_afirmar(written && file->size == 3 * TAM_BLOQUE,
+	             "Se escribe en el final del archivo");
+	char expected = 'a' + 70 % 26;
+	test_afirmar(fs_read(fs, path, buffer, 64, 64 * 70) == 64 &&
+	                     buffer[0] == expected && buffer[63] == expected,
+	             "Se lee lo escrito al final");
+	test_afirmar(file_allocated_blocks(file) == 3,
+	             "Sólo se usan los bloques que reciben datos");
+	test_afirmar(fs_append(fs, path, "x", 1, 10, 0) == -EAGAIN,
+	             "Una escritura que no es al final usa el camino general");
+	test_afirmar(fs_append(fs, path, "x", 1, 10, 1) == 1 &&
+	                     file->size == 3 * TAM_BLOQUE + 1,
+	             "Con O_APPEND se escribe al final sin importar el offset");
+	test_afirmar(file->reserve_chunk == 4 && file->n_reserve == 3,
+	             "Los bloques se reservan de a cantidades crecientes");
+
+	test_nuevo_sub_grupo("Los bloques compartidos usan el camino general");
+	fs_create(fs, "/copia", 0644);
+	fs_copy_file_range(fs, path, 0, "/copia", 0, 3 * TAM_BLOQUE + 1);
+	test_afirmar(fs_append(fs, path, "y", 1, 0, 1) == -EAGAIN,
+	             "No se escribe al final en un bloque compartido");
+	test_afirmar(fs_write(fs, path, "y", 1, 3 * TAM_BLOQUE + 1) == 1 &&
+	                     fs_append(fs, path, "z", 1, 0, 1) == 1,
+	             "Al copiar el bloque se vuelve a usar el camino rápido");
+	test_afirmar(fs_read(fs, "/copia", buffer, 2, 3 * TAM_BLOQUE) == 1,
+	             "La copia no cambia");
+
+	test_nuevo_sub_grupo("Se agrega después de un hueco");
+	fs_truncate(fs, path, 0);
+	test_afirmar(file->n_reserve == 0 && file->reserve_chunk == 0,
+	             "Vaciar el archivo libera la reserva");
+	fs_truncate(fs, path, 10);
+	test_afirmar(fs_append(fs, path, "z", 1, 10, 0) == 1 &&
+	                     fs_read(fs, path, buffer, 11, 0) == 11 &&
+	                     buffer[0] == '\0' && buffer[9] == '\0' &&
+	                     buffer[10] == 'z',
+	             "El hueco se lee como ceros");
+	fs_truncate(fs, path, 0);
+
+	test_nuevo_sub_grupo("Escrituras concurrentes al final");
+	escritura_al_final_t hilos[4];
+	pthread_t threads[4];
+	for (int i = 0; i < 4; i++) {
+		hilos[i] = (escritura_al_final_t) { .fs = fs, .id = i };
+		pthread_create(&threads[i], NULL, agregar_registros, &hilos[i]);
+	}
+	int fallidas = 0;
+	for (int i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+		fallidas += hilos[i].fallidas;
+	}
+	size_t total = 4 * REGISTROS_POR_HILO * TAM_REGISTRO;
+	test_afirmar(fallidas == 0 && file->size == total,
+	             "Se escriben todos los registros");
+
+	// Cada registro queda entero y los de cada hilo, en orden
+	int next[4] = { 0 };
+	int ordered = 1;
+	char record[TAM_REGISTRO + 1] = { 0 };
+	for (size_t off = 0; off < file->size; off += TAM_REGISTRO) {
+		int id, n;
+		fs_read(fs, path, record, TAM_REGISTRO, off);
+		int parsed = sscanf(record, "hilo %d registro %d", &id, &n) == 2;
+		if (!parsed || id < 0 || id > 3 || n != next[id]++ ||
+		    record[TAM_REGISTRO - 1] != '\n')
+			ordered = 0;
+	}
+	test_afirmar(ordered, "Los registros no se mezclan ni se desordenan");
+	test_afirmar(fs->seq % 2 == 0, "No queda ninguna modificación abierta");
+	fs_free(fs);
+}
+
+// Uso calculado recorriendo todos los archivos, para comparar con los
+// contadores
+static void
+uso_recorriendo(fs_t *fs, fs_usage_t *usage)
+{
+	usage->inodes = fs->d_size + fs->f_size;
+	usage->blocks = 0;
+	usage->bytes = 0;
+	for (size_t i = 0; i < fs->f_size; i++) {
+		usage->blocks += file_allocated_blocks(&fs->files[i]);
+		usage->bytes += fs->files[i].size;
+	}
+}
+
+static int
+uso_coincide(fs_t *fs)
+{
+	fs_usage_t counted, walked;
+	fs_usage(fs, &counted);
+	uso_recorriendo(fs, &walked);
+	return counted.inodes == walked.inodes &&
+	       counted.blocks == walked.blocks && counted.bytes == walked.bytes;
+}
+
+void
+prueba_contadores_de_uso()
+{
+	fs_t *fs = fs_build();
+	struct statvfs st;
+	fs_usage_t usage;
+
+	test_nuevo_sub_grupo("Sistema de archivos vacío");
+	test_afirmar(fs_statfs(fs, &st) == 0 && st.f_bsize == TAM_BLOQUE &&
+	                     st.f_blocks == CAPACIDAD_BLOQUES &&
+	                     st.f_bfree == CAPACIDAD_BLOQUES,
+	             "Todos los bloques están libres");
+	test_afirmar(st.f_files == MAX_DIRECTORIOS + MAX_ARCHIVOS &&
+	                     st.f_ffree == st.f_files - 1,
+	             "Sólo el directorio raíz ocupa un inodo");
+
+	test_nuevo_sub_grupo("Los contadores siguen a las operaciones");
+	fs_mkdir(fs, "/dir", 0755);
+	fs_create(fs, "/dir/a", 0644);
+	fs_write(fs, "/dir/a", "hola", 4, 0);
+	fs_write(fs, "/dir/a", "chau", 4, 3 * TAM_BLOQUE);
+	fs_usage(fs, &usage);
+	test_afirmar(usage.inodes == 3 && usage.blocks == 2 &&
+	                     usage.bytes == 3 * TAM_BLOQUE + 4,
+	             "Las escrituras suman los bloques con datos y el tamaño");
+	fs_truncate(fs, "/dir/a", TAM_BLOQUE);
+	fs_usage(fs, &usage);
+	test_afirmar(usage.blocks == 1 && usage.bytes == TAM_BLOQUE,
+	             "Achicar un archivo libera sus bloques");
+	fs_fallocate(fs, "/dir/a", 0, 0, 4 * TAM_BLOQUE);
+	fs_fallocate(fs,
+	             "/dir/a",
+	             FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	             TAM_BLOQUE,
+	             TAM_BLOQUE);
+	fs_usage(fs, &usage);
+	test_afirmar(usage.blocks == 3 && usage.bytes == 4 * TAM_BLOQUE,
+	             "Se cuentan los bloques reservados y los huecos abiertos");
+	fs_create(fs, "/b", 0644);
+	fs_copy_file_range(fs, "/dir/a", 0, "/b", 0, 4 * TAM_BLOQUE);
+	fs_append(fs, "/b", "x", 1, 0, 1);
+	test_afirmar(uso_coincide(fs),
+	             "Los bloques compartidos cuentan una vez por archivo");
+	fs_statfs(fs, &st);
+	fs_usage(fs, &usage);
+	test_afirmar(st.f_bfree == CAPACIDAD_BLOQUES - usage.blocks &&
+	                     st.f_ffree == st.f_files - 4,
+	             "statfs informa lo que queda libre");
+	fs_unlink(fs, "/dir/a");
+	fs_rmdir(fs, "/dir");
+	fs_usage(fs, &usage);
+	test_afirmar(uso_coincide(fs) && usage.inodes == 2 &&
+	                     usage.bytes == 4 * TAM_BLOQUE + 1,
+	             "Borrar un archivo descuenta su tamaño y sus bloques");
 
-	free(fs_r);
+	test_nuevo_sub_grupo("Escrituras concurrentes al final");
+	fs_create(fs, "/log", 0644);
+	escritura_al_final_t hilos[4];
+	pthread_t threads[4];
+	for (int i = 0; i < 4; i++) {
+		hilos[i] = (escritura_al_final_t) { .fs = fs, .id = i };
+		pthread_create(&threads[i], NULL, agregar_registros, &hilos[i]);
+	}
+	for (int i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+	test_afirmar(uso_coincide(fs), "Los contadores no pierden sumas");
+
+	test_nuevo_sub_grupo("Los contadores se recuperan de la imagen");
+	fs_usage_t before;
+	fs_usage(fs, &before);
+	fs_destroy("./fs.dat", fs, 1);
+	fs = fs_init("./fs.dat");
+	test_afirmar(fs != NULL, "Se recupera el file system");
+	if (fs == NULL)
+		return;
+	fs_usage(fs, &usage);
+	test_afirmar(usage.inodes == before.inodes &&
+	                     usage.blocks == before.blocks &&
+	                     usage.bytes == before.bytes,
+	             "Se recupera el uso sin leer los bloques");
+	fs->capacity = 1;
+	test_afirmar(fs_statfs(fs, &st) == 0 && st.f_blocks == 1 &&
+	                     st.f_bfree == 0,
+	             "Con una capacidad menor al uso no quedan bloques libres");
+	fs_free(fs);
+}
+
+// Cantidad de entradas que lista un directorio, sin '.' ni '..'
+static int
+contar_listado(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+		(*(int *) buf)++;
+	return 0;
+}
+
+void
+prueba_borrado_de_arboles()
+{
+	fs_t *fs = fs_build();
+	char buffer[TAM_BLOQUE];
+	memset(buffer, 'a', TAM_BLOQUE);
+
+	test_nuevo_sub_grupo("Borrar no corre las demás entradas");
+	fs_create(fs, "/a", 0644);
+	fs_create(fs, "/b", 0644);
+	fs_create(fs, "/c", 0644);
+	fs_unlink(fs, "/a");
+	test_afirmar(fs->f_size == 2 && strcmp(fs->files[0].path, "/c") == 0,
+	             "El último archivo ocupa el lugar del borrado");
+	test_afirmar(get_file(fs, "/b") && get_file(fs, "/c") &&
+	                     !get_file(fs, "/a"),
+	             "Se siguen encontrando los demás archivos");
+	fs_mkdir(fs, "/d1", 0755);
+	fs_mkdir(fs, "/d2", 0755);
+	fs_mkdir(fs, "/d2/sub", 0755);
+	fs_create(fs, "/d2/f", 0644);
+	fs_create(fs, "/d2/sub/g", 0644);
+	fs_rmdir(fs, "/d1");
+	fs_rmdir(fs, "/d2/sub");
+	fs_d_entry_t *d2 = get_dir(fs, "/d2");
+	test_afirmar(d2 && get_file(fs, "/d2/f")->entry == d2,
+	             "El contenido de un directorio movido apunta a su lugar");
+	int listed = 0;
+	fs_readdir(fs, "/d2", &listed, contar_listado, 0);
+	test_afirmar(listed == 2, "Se listan las entradas que quedan");
+
+	test_nuevo_sub_grupo("Borrado de un árbol en una sola operación");
+	fs_mkdir(fs, "/arbol", 0755);
+	fs_mkdir(fs, "/arbol/sub", 0755);
+	fs_create(fs, "/arbol/x", 0644);
+	fs_create(fs, "/arbol/sub/y", 0644);
+	fs_create(fs, "/fuera", 0644);
+	fs_write(fs, "/arbol/x", buffer, TAM_BLOQUE, 0);
+	fs_write(fs, "/arbol/x", buffer, TAM_BLOQUE, TAM_BLOQUE);
+	fs_write(fs, "/arbol/sub/y", buffer, TAM_BLOQUE, 0);
+	fs_copy_file_range(fs, "/arbol/x", 0, "/fuera", 0, TAM_BLOQUE);
+	size_t dirs = fs->d_size;
+	size_t files = fs->f_size;
+	test_afirmar(fs_rmtree(fs, "/arbol") == 0, "Se borra el árbol");
+	test_afirmar(fs->d_size == dirs - 2 && fs->f_size == files - 2 &&
+	                     !get_dir(fs, "/arbol") &&
+	                     !get_dir(fs, "/arbol/sub") &&
+	                     !get_file(fs, "/arbol/sub/y"),
+	             "Se quitan todas sus entradas");
+	test_afirmar(uso_coincide(fs),
+	             "Los contadores de uso descuentan sus bloques");
+	fs_reclaim_wait(fs);
+	test_afirmar(fs->reclaimed == 2,
+	             "Los bloques exclusivos se liberan en segundo plano");
+	int n = fs_read(fs, "/fuera", buffer, TAM_BLOQUE, 0);
+	test_afirmar(n == TAM_BLOQUE && buffer[0] == 'a' &&
+	                     buffer[TAM_BLOQUE - 1] == 'a',
+	             "Un bloque compartido con otro archivo se conserva");
+	listed = 0;
+	fs_mkdir(fs, "/arbol", 0755);
+	test_afirmar(fs_readdir(fs, "/arbol", &listed, contar_listado, 0) == 0 &&
+	                     listed == 0,
+	             "Se puede volver a crear el directorio, vacío");
+
+	test_nuevo_sub_grupo("Errores al borrar un árbol");
+	test_afirmar(fs_rmtree(fs, ROOT) == -EBUSY, "No se borra la raíz");
+	test_afirmar(fs_rmtree(fs, "/fuera") == -ENOTDIR,
+	             "No se borra un archivo");
+	test_afirmar(fs_rmtree(fs, "/nada") == -ENOENT,
+	             "No se borra un directorio inexistente");
+	fs_free(fs);
+}
+
+void
+prueba_reserva_de_bloques()
+{
+	test_nuevo_sub_grupo("Los bloques liberados se reutilizan");
+	fs_block_t *block = block_new();
+	memset(block->data, 'x', TAM_BLOQUE);
+	block_put(block);
+	fs_block_t *again = block_new();
+	test_afirmar(again == block, "Se reutiliza el último bloque liberado del hilo");
+	test_afirmar(again->refs == 1 && again->data[0] == 0 &&
+	                     again->data[TAM_BLOQUE - 1] == 0,
+	             "El bloque reutilizado está lleno de ceros");
+	block_put(again);
+
+	test_nuevo_sub_grupo("Los bloques de un hilo vuelven a la reserva global");
+	// Se vacía la reserva global (la pueden haber llenado hilos de pruebas
+	// anteriores), para que el hilo tenga que pedir bloques nuevos
+	pthread_mutex_lock(&block_pool.lock);
+	block_list_move(&block_pool.free, block_cache_get(), block_pool.free.n);
+	pthread_mutex_unlock(&block_pool.lock);
+	size_t before = block_pool.free.n;
+	pthread_t thread;
+	pthread_create(&thread, NULL, reservar_y_liberar_bloques, NULL);
+	pthread_join(thread, NULL);
+	test_afirmar(block_pool.free.n >= before + LOTE_BLOQUES,
+	             "Al terminar el hilo sus bloques libres pasan a la reserva");
+
+	fs_block_t *many[3 * LOTE_BLOQUES];
+	for (int i = 0; i < 3 * LOTE_BLOQUES; i++)
+		many[i] = block_new();
+	for (int i = 0; i < 3 * LOTE_BLOQUES; i++)
+		block_put(many[i]);
+	test_afirmar(block_cache.n <= 2 * LOTE_BLOQUES,
+	             "La lista de un hilo no crece sin límite");
+}
+
+void
+prueba_arenas()
+{
+	test_nuevo_sub_grupo("Los bloques se cortan de arenas alineadas");
+	fs_block_t *blocks[2 * LOTE_BLOQUES];
+	for (int i = 0; i < 2 * LOTE_BLOQUES; i++)
+		blocks[i] = block_new();
+	arena_t *arena = &block_pool.arena;
+	test_afirmar(arena->base != NULL &&
+	                     ((uintptr_t) arena->base & (TAM_PAGINA_ENORME - 1)) == 0,
+	             "La arena de bloques está alineada a páginas enormes");
+	int distinct = 1;
+	for (int i = 0; i < 2 * LOTE_BLOQUES; i++) {
+		distinct &= blocks[i] != NULL;
+		for (int j = 0; j < i; j++)
+			distinct &= blocks[i] != blocks[j];
+	}
+	test_afirmar(distinct, "Se entregan bloques distintos");
+	for (int i = 0; i < 2 * LOTE_BLOQUES; i++)
+		block_put(blocks[i]);
+
+	test_nuevo_sub_grupo("Se informa el uso de las arenas");
+	arena_usage_t before = fs_arena_usage();
+	fs_t *fs = fs_build();
+	arena_usage_t during = fs_arena_usage();
+	size_t page = sysconf(_SC_PAGESIZE);
+	test_afirmar(fs != NULL && ((uintptr_t) fs & (page - 1)) == 0,
+	             "El fs_t se reserva en una región propia");
+	test_afirmar(during.regions == before.regions + 1 &&
+	                     during.used == before.used + sizeof(fs_t) &&
+	                     during.mapped >= before.mapped + sizeof(fs_t),
+	             "La región del fs_t se cuenta en el uso");
+	test_afirmar(during.mapped >= during.used && during.hugetlb <= during.mapped,
+	             "Lo usado no supera lo mapeado");
+	fs_free(fs);
+	arena_usage_t after = fs_arena_usage();
+	test_afirmar(after.regions == before.regions &&
+	                     after.mapped == before.mapped &&
+	                     after.used == before.used,
+	             "Al liberar el fs_t su región se devuelve al sistema");
+}
+
+static int
+contar_entradas(const char *name, const struct stat *st, void *arg)
+{
+	(*(int *) arg)++;
+	return 0;
+}
+
+typedef struct espera_de_lock {
+	fs_t *fs;
+	uint64_t owner;
+	struct flock lock;
+	int status;
+	int done;
+} espera_de_lock_t;
+
+static void *
+esperar_lock(void *arg)
+{
+	espera_de_lock_t *espera = arg;
+	espera->status = fs_setlk(
+	        espera->fs, "/f", espera->owner, &espera->lock, 1, NULL);
+	__atomic_store_n(&espera->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int
+siempre_interrumpido(void)
+{
+	return 1;
+}
+
+static int
+bloquear(fs_t *fs, uint64_t owner, short type, off_t start, off_t len)
+{
+	struct flock lock = { .l_type = type,
+		              .l_whence = SEEK_SET,
+		              .l_start = start,
+		              .l_len = len };
+	return fs_setlk(fs, "/f", owner, &lock, 0, NULL);
+}
+
+void
+prueba_bloqueo_de_rangos()
+{
+	fs_t *fs = fs_build();
+	fs_create(fs, "/f", __S_IFREG | 0644);
+	fs_lock_tree_t *tree;
+
+	test_nuevo_sub_grupo("Conflictos entre dueños");
+	test_afirmar(bloquear(fs, 1, F_WRLCK, 0, 10) == 0,
+	             "Se bloquea un rango para escritura");
+	test_afirmar(bloquear(fs, 2, F_RDLCK, 5, 10) == -EAGAIN,
+	             "Otro dueño no puede bloquear un rango superpuesto");
+	test_afirmar(bloquear(fs, 2, F_WRLCK, 10, 10) == 0,
+	             "Otro dueño bloquea un rango contiguo");
+	struct flock query = { .l_type = F_WRLCK,
+		               .l_whence = SEEK_SET,
+		               .l_start = 0,
+		               .l_len = 5 };
+	test_afirmar(fs_getlk(fs, "/f", 2, &query) == 0 &&
+	                     query.l_type == F_WRLCK && query.l_start == 0 &&
+	                     query.l_len == 10,
+	             "F_GETLK describe el lock que impide el pedido");
+	query = (struct flock) { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+	query.l_start = 30;
+	test_afirmar(fs_getlk(fs, "/f", 2, &query) == 0 &&
+	                     query.l_type == F_UNLCK,
+	             "F_GETLK indica F_UNLCK si no hay conflicto");
+	test_afirmar(bloquear(fs, 1, F_WRLCK, 100, 0) == 0 &&
+	                     bloquear(fs, 2, F_RDLCK, 1000000, 1) == -EAGAIN,
+	             "Con l_len 0 se bloquea hasta el final del archivo");
+	bloquear(fs, 1, F_UNLCK, 100, 0);
+	struct flock end = { .l_type = F_RDLCK,
+		             .l_whence = SEEK_END,
+		             .l_start = 0,
+		             .l_len = -5 };
+	fs_write(fs, "/f", "0123456789", 10, 0);
+	test_afirmar(fs_setlk(fs, "/f", 2, &end, 0, NULL) == -EAGAIN,
+	             "Se bloquea relativo al final con un largo negativo");
+	test_afirmar(bloquear(fs, 2, F_RDLCK, -1, 1) == -EINVAL,
+	             "Un rango que empieza antes del archivo es inválido");
+
+	test_nuevo_sub_grupo("Locks de lectura compartidos");
+	test_afirmar(bloquear(fs, 3, F_RDLCK, 100, 10) == 0 &&
+	                     bloquear(fs, 4, F_RDLCK, 105, 10) == 0,
+	             "Dos dueños leen el mismo rango");
+	test_afirmar(bloquear(fs, 5, F_WRLCK, 109, 1) == -EAGAIN,
+	             "Nadie escribe mientras otros leen");
+	test_afirmar(bloquear(fs, 3, F_WRLCK, 100, 5) == 0,
+	             "Un dueño cambia el tipo de la parte que sólo lee él");
+
+	test_nuevo_sub_grupo("Recorte de locks");
+	test_afirmar(bloquear(fs, 1, F_UNLCK, 3, 3) == 0 &&
+	                     bloquear(fs, 2, F_WRLCK, 3, 3) == 0,
+	             "Soltar el medio de un lock libera ese rango");
+	test_afirmar(bloquear(fs, 2, F_WRLCK, 2, 1) == -EAGAIN &&
+	                     bloquear(fs, 2, F_WRLCK, 6, 1) == -EAGAIN,
+	             "Los extremos siguen bloqueados");
+	tree = get_file(fs, "/f")->locks;
+	test_afirmar(tree->n_locks == 7, "El lock queda partido en dos");
+	test_afirmar(bloquear(fs, 3, F_UNLCK, 0, 0) == 0 && tree->n_locks == 5,
+	             "Se sueltan todos los locks de un dueño");
+
+	test_nuevo_sub_grupo("Locks de flock");
+	test_afirmar(fs_flock(fs, "/f", 7, LOCK_EX, NULL) == 0,
+	             "flock no choca con los locks de fcntl");
+	int op = LOCK_SH | LOCK_NB;
+	test_afirmar(fs_flock(fs, "/f", 8, op, NULL) == -EWOULDBLOCK,
+	             "Con LOCK_NB no se espera");
+	test_afirmar(fs_flock(fs, "/f", 7, LOCK_UN, NULL) == 0 &&
+	                     fs_flock(fs, "/f", 8, op, NULL) == 0,
+	             "Al soltarlo otro dueño lo toma");
+	test_afirmar(fs_flock(fs, "/", 8, LOCK_SH, NULL) == -EISDIR,
+	             "Los directorios no se bloquean");
+
+	test_nuevo_sub_grupo("Esperas");
+	struct flock first = { .l_type = F_WRLCK,
+		               .l_whence = SEEK_SET,
+		               .l_start = 0,
+		               .l_len = 1 };
+	test_afirmar(fs_setlk(fs, "/f", 9, &first, 1, siempre_interrumpido) ==
+	                     -EINTR,
+	             "Una espera interrumpida termina con -EINTR");
+
+	espera_de_lock_t espera = { .fs = fs, .owner = 9, .lock = first };
+	pthread_t thread;
+	pthread_create(&thread, NULL, esperar_lock, &espera);
+	usleep(20000);
+	test_afirmar(!__atomic_load_n(&espera.done, __ATOMIC_ACQUIRE),
+	             "F_SETLKW espera mientras el rango está bloqueado");
+	test_afirmar(fs_getattr(fs, "/f", &(struct stat) { 0 }) == 0 &&
+	                     bloquear(fs, 10, F_WRLCK, 50, 1) == 0,
+	             "Mientras tanto se usa el resto del sistema de archivos");
+	fs_unlock_owner(fs, "/f", 1);
+	pthread_join(thread, NULL);
+	test_afirmar(espera.status == 0,
+	             "Al cerrar el dueño la espera termina");
+	test_afirmar(bloquear(fs, 10, F_WRLCK, 6, 4) == 0,
+	             "Se sueltan todos los locks del dueño que cierra");
+
+	espera = (espera_de_lock_t) { .fs = fs, .owner = 11, .lock = first };
+	pthread_create(&thread, NULL, esperar_lock, &espera);
+	usleep(20000);
+	fs_begin_update(fs);
+	fs_unlink(fs, "/f");
+	fs_end_update(fs);
+	pthread_join(thread, NULL);
+	test_afirmar(espera.status == 0 && espera.done,
+	             "Borrar el archivo despierta a los que esperan");
+	test_afirmar(bloquear(fs, 1, F_WRLCK, 0, 1) == -ENOENT,
+	             "Un archivo borrado no se bloquea");
+
+	fs_free(fs);
+}
+
+typedef struct espera_de_eventos {
+	fs_t *fs;
+	uint64_t pos;
+	char buffer[128];
+	int status;
+	int done;
+} espera_de_eventos_t;
+
+static void *
+esperar_eventos(void *arg)
+{
+	espera_de_eventos_t *espera = arg;
+	espera->status = fs_events_read(espera->fs,
+	                                &espera->pos,
+	                                espera->buffer,
+	                                sizeof(espera->buffer) - 1,
+	                                1,
+	                                NULL);
+	__atomic_store_n(&espera->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void
+contar_avisos(void *arg)
+{
+	__atomic_add_fetch((int *) arg, 1, __ATOMIC_RELAXED);
+}
+
+// Lee sin esperar los eventos desde pos y los deja en buffer como string.
+static int
+leer_eventos(fs_t *fs, uint64_t *pos, char *buffer, size_t size)
+{
+	int status = fs_events_read(fs, pos, buffer, size - 1, 0, NULL);
+	buffer[status > 0 ? status : 0] = '\0';
+	return status;
+}
+
+void
+prueba_eventos()
+{
+	fs_t *fs = fs_build();
+	char buffer[512];
+	uint64_t pos, late;
+
+	test_nuevo_sub_grupo("Eventos de cada operación");
+	fs_mkdir(fs, "/antes", __S_IFDIR | 0755);
+	test_afirmar(fs->events == NULL,
+	             "Sin lectores no se guardan eventos");
+	test_afirmar(fs_events_open(fs, &pos) == 0 && pos == 0,
+	             "Un lector empieza en el próximo evento");
+	int avisos = 0;
+	fs->event_notify = contar_avisos;
+	fs->event_notify_arg = &avisos;
+	fs_mkdir(fs, "/d", __S_IFDIR | 0755);
+	fs_create(fs, "/f", __S_IFREG | 0644);
+	fs_write(fs, "/f", "hola", 4, 0);
+	fs_append(fs, "/f", "chau", 4, 4, 0);
+	fs_truncate(fs, "/f", 2);
+	fs_unlink(fs, "/f");
+	fs_rmdir(fs, "/d");
+	test_afirmar(leer_eventos(fs, &pos, buffer, sizeof(buffer)) > 0 &&
+	                     strcmp(buffer,
+	                            "0 mkdir /d\n1 create /f\n2 write /f\n"
+	                            "3 unlink /f\n4 rmdir /d\n") == 0,
+	             "Se lee una línea por cada cambio, en orden");
+	test_afirmar(avisos == 5, "Se avisa de cada evento nuevo");
+	test_afirmar(pos == 5 && !fs_events_ready(fs, &pos),
+	             "La posición avanza hasta el último evento");
+	test_afirmar(leer_eventos(fs, &pos, buffer, sizeof(buffer)) == -EAGAIN,
+	             "Sin eventos nuevos y sin esperar se obtiene -EAGAIN");
+
+	test_nuevo_sub_grupo("Escrituras seguidas");
+	fs_create(fs, "/g", __S_IFREG | 0644);
+	fs_write(fs, "/g", "a", 1, 0);
+	leer_eventos(fs, &pos, buffer, sizeof(buffer));
+	fs_write(fs, "/g", "b", 1, 1);
+	fs_write(fs, "/g", "c", 1, 2);
+	test_afirmar(leer_eventos(fs, &pos, buffer, sizeof(buffer)) > 0 &&
+	                     strcmp(buffer, "7 write /g\n") == 0,
+	             "Una escritura ya leída se vuelve a informar una vez");
+	test_afirmar(fs_events_open(fs, &late) == 0 && late == 8,
+	             "Un lector nuevo no ve los eventos anteriores");
+
+	test_nuevo_sub_grupo("Lecturas parciales");
+	fs_create(fs, "/h", __S_IFREG | 0644);
+	fs_unlink(fs, "/h");
+	test_afirmar(fs_events_read(fs, &pos, buffer, 5, 0, NULL) == -EINVAL &&
+	                     pos == 8,
+	             "Si no entra ningún evento no se avanza");
+	test_afirmar(leer_eventos(fs, &pos, buffer, 14) > 0 &&
+	                     strcmp(buffer, "8 create /h\n") == 0,
+	             "Se leen sólo los eventos que entran completos");
+	test_afirmar(leer_eventos(fs, &pos, buffer, sizeof(buffer)) > 0 &&
+	                     strcmp(buffer, "9 unlink /h\n") == 0,
+	             "El resto se lee después");
+
+	test_nuevo_sub_grupo("Lectores atrasados");
+	fs_create(fs, "/x", __S_IFREG | 0644);
+	fs_create(fs, "/y", __S_IFREG | 0644);
+	for (size_t i = 0; i < MAX_EVENTOS; i++)
+		fs_write(fs, i % 2 ? "/x" : "/y", "z", 1, 0);
+	test_afirmar(leer_eventos(fs, &late, buffer, 20) > 0 &&
+	                     strcmp(buffer, "8 overflow 4\n") == 0,
+	             "Se informa cuántos eventos se perdieron");
+	const char *oldest = "12 write /y\n13 write /x\n";
+	test_afirmar(leer_eventos(fs, &late, buffer, sizeof(buffer)) > 0 &&
+	                     strncmp(buffer, oldest, strlen(oldest)) == 0,
+	             "Se sigue desde el evento más viejo que queda");
+
+	test_nuevo_sub_grupo("Esperas");
+	pos = __atomic_load_n(&fs->events->next, __ATOMIC_RELAXED);
+	test_afirmar(fs_events_read(
+	                     fs, &pos, buffer, 64, 1, siempre_interrumpido) ==
+	                     -EINTR,
+	             "Una espera interrumpida termina con -EINTR");
+
+	espera_de_eventos_t espera = { .fs = fs, .pos = pos };
+	pthread_t thread;
+	pthread_create(&thread, NULL, esperar_eventos, &espera);
+	usleep(20000);
+	test_afirmar(!__atomic_load_n(&espera.done, __ATOMIC_ACQUIRE),
+	             "Sin eventos nuevos la lectura espera");
+	fs_begin_update(fs);
+	fs_rmtree(fs, "/antes");
+	fs_end_update(fs);
+	pthread_join(thread, NULL);
+	test_afirmar(espera.status > 0 &&
+	                     strstr(espera.buffer, " rmdir /antes\n"),
+	             "Un evento nuevo despierta a los que esperan");
+
+	espera = (espera_de_eventos_t) { .fs = fs, .pos = espera.pos };
+	pthread_create(&thread, NULL, esperar_eventos, &espera);
+	usleep(20000);
+	fs_free(fs);
+	pthread_join(thread, NULL);
+	test_afirmar(espera.status == 0,
+	             "Al cerrar el sistema de archivos la espera termina");
+}
+
+typedef struct busqueda {
+	fisopfs_file_t *file;
+	off_t found;
+	int done;
+} busqueda_t;
+
+static void *
+buscar_hueco(void *arg)
+{
+	busqueda_t *busqueda = arg;
+	busqueda->found = fisopfs_lseek(busqueda->file, 0, SEEK_HOLE);
+	__atomic_store_n(&busqueda->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void
+prueba_biblioteca()
+{
+	fisopfs_t *fs = fisopfs_mount("./biblioteca.dat");
+	test_afirmar(fs != NULL, "Se abre un sistema de archivos sin imagen previa");
+	if (!fs)
+		return;
+
+	test_nuevo_sub_grupo("Apertura de archivos");
+	fisopfs_file_t *file;
+	test_afirmar(fisopfs_open(fs, "/log", O_RDWR, 0644, &file) == -ENOENT,
+	             "Sin O_CREAT no se crea el archivo");
+	test_afirmar(fisopfs_open(fs, "/log", O_RDWR | O_CREAT, 0644, &file) == 0,
+	             "Con O_CREAT se crea el archivo");
+	fisopfs_file_t *other;
+	test_afirmar(fisopfs_open(fs, "/log", O_CREAT | O_EXCL, 0644, &other) ==
+	                     -EEXIST,
+	             "Con O_EXCL falla si el archivo existe");
+	test_afirmar(fisopfs_open(fs, ROOT, O_RDONLY, 0, &other) == -EISDIR,
+	             "No se abre un directorio como archivo");
+
+	test_nuevo_sub_grupo("Lectura y escritura vectorizadas");
+	struct iovec iov[3] = { { "uno ", 4 }, { "dos ", 4 }, { "tres", 4 } };
+	test_afirmar(fisopfs_pwritev(file, iov, 3, 0) == 12,
+	             "Se escriben los tres buffers");
+	char a[6] = { 0 }, b[6] = { 0 }, c[6] = { 0 };
+	struct iovec out[3] = { { a, 5 }, { b, 5 }, { c, 5 } };
+	test_afirmar(fisopfs_preadv(file, out, 3, 0) == 12, "Se leen 12 bytes");
+	test_afirmar(strcmp(a, "uno d") == 0 && strcmp(b, "os tr") == 0 &&
+	                     strcmp(c, "es") == 0,
+	             "Los datos se reparten entre los buffers en orden");
+
+	fisopfs_file_t *append;
+	fisopfs_open(fs, "/log", O_WRONLY | O_APPEND, 0, &append);
+	test_afirmar(fisopfs_pwrite(append, "!", 1, 0) == 1,
+	             "Se escribe con O_APPEND");
+	test_afirmar(fisopfs_pread(append, a, 1, 0) == -EBADF,
+	             "No se lee de un archivo abierto sólo para escritura");
+	struct stat st;
+	test_afirmar(fisopfs_fstat(file, &st) == 0 && st.st_size == 13,
+	             "Con O_APPEND se escribe al final");
+	fisopfs_close(append);
+	fisopfs_ftruncate(file, 3 * TAM_BLOQUE);
+	fisopfs_pwrite(file, "x", 1, 2 * TAM_BLOQUE);
+	test_afirmar(fisopfs_lseek(file, 100, SEEK_DATA) == 100 &&
+	                     fisopfs_lseek(file, 0, SEEK_HOLE) == TAM_BLOQUE &&
+	                     fisopfs_lseek(file, TAM_BLOQUE, SEEK_DATA) ==
+	                             2 * TAM_BLOQUE,
+	             "Se buscan datos y huecos");
+	test_afirmar(fisopfs_lseek(file, 0, SEEK_SET) == -EINVAL,
+	             "Sólo se aceptan SEEK_DATA y SEEK_HOLE");
+
+	// Como una escritura al final en curso, que toma el lock compartido
+	busqueda_t busqueda = { .file = file };
+	pthread_t thread;
+	fs_lock_shared(fs->fs);
+	pthread_create(&thread, NULL, buscar_hueco, &busqueda);
+	usleep(20000);
+	test_afirmar(__atomic_load_n(&busqueda.done, __ATOMIC_ACQUIRE) &&
+	                     busqueda.found == TAM_BLOQUE,
+	             "La búsqueda no espera a las escrituras al final");
+	fs_unlock(fs->fs);
+	pthread_join(thread, NULL);
+
+	fisopfs_file_t *copy;
+	fisopfs_open(fs, "/copia", O_WRONLY | O_CREAT, 0644, &copy);
+	size_t all = 4 * TAM_BLOQUE;
+	test_afirmar(fisopfs_copy_file_range(file, 0, copy, 0, all) ==
+	                     3 * TAM_BLOQUE,
+	             "Se copia un archivo entero");
+	test_afirmar(fisopfs_stat(fs, "/copia", &st) == 0 &&
+	                     st.st_size == 3 * TAM_BLOQUE &&
+	                     fisopfs_pread(file, a, 4, 0) == 4 &&
+	                     strncmp(a, "uno ", 4) == 0,
+	             "La copia tiene el tamaño del original");
+	test_afirmar(fisopfs_copy_file_range(copy, 0, file, 0, 1) == -EBADF,
+	             "No se copia desde un archivo sólo de escritura");
+	fisopfs_close(copy);
+	fisopfs_unlink(fs, "/copia");
+	fisopfs_ftruncate(file, 13);
+
+	test_nuevo_sub_grupo("Atributos de varios paths a la vez");
+	fisopfs_mkdir(fs, "/dir", 0755);
+	const char *paths[] = { "/log", "/no_existe", "/dir" };
+	struct stat sts[3];
+	int results[3];
+	test_afirmar(fisopfs_stat_batch(fs, paths, 3, sts, results) == 2,
+	             "Se encuentran los paths que existen");
+	test_afirmar(results[0] == 0 && results[1] == -ENOENT && results[2] == 0 &&
+	                     S_ISREG(sts[0].st_mode) && S_ISDIR(sts[2].st_mode),
+	             "Cada path tiene su resultado y sus atributos");
+
+	int entries = 0;
+	test_afirmar(fisopfs_readdir(fs, ROOT, contar_entradas, &entries) == 0 &&
+	                     entries == 4,
+	             "Se listan \".\", \"..\", el archivo y el directorio");
+	fisopfs_mkdir(fs, "/dir/sub", 0755);
+	test_afirmar(fisopfs_rmtree(fs, "/dir") == 0 &&
+	                     fisopfs_stat(fs, "/dir/sub", &st) == -ENOENT,
+	             "Se borra un directorio con su contenido");
+
+	test_nuevo_sub_grupo("Locks");
+	fisopfs_open(fs, "/log", O_RDONLY, 0, &other);
+	test_afirmar(fisopfs_flock(file, LOCK_EX) == 0 &&
+	                     fisopfs_flock(other, LOCK_SH | LOCK_NB) ==
+	                             -EWOULDBLOCK,
+	             "Cada archivo abierto tiene sus propios locks");
+	struct flock lock = { .l_type = F_RDLCK, .l_whence = SEEK_SET };
+	test_afirmar(fisopfs_setlk(other, &lock, 0) == 0,
+	             "Se bloquea un rango");
+	fisopfs_close(other);
+	fisopfs_open(fs, "/log", O_RDONLY, 0, &other);
+	lock.l_type = F_WRLCK;
+	test_afirmar(fisopfs_getlk(file, &lock) == 0 && lock.l_type == F_UNLCK,
+	             "Al cerrar un archivo se sueltan sus locks");
+	fisopfs_close(other);
+
+	test_nuevo_sub_grupo("Persistencia");
+	fisopfs_close(file);
+	test_afirmar(fisopfs_sync(fs) == 0, "Se guarda la imagen");
+	test_afirmar(fisopfs_unmount(fs, 0) == 0, "Se cierra");
+	fs = fisopfs_mount("./biblioteca.dat");
+	test_afirmar(fs && fisopfs_stat(fs, "/log", &st) == 0 && st.st_size == 13,
+	             "Al volver a abrirlo está el archivo");
+	if (fs) {
+		fisopfs_open(fs, "/log", O_RDWR | O_TRUNC, 0, &file);
+		test_afirmar(fisopfs_fstat(file, &st) == 0 && st.st_size == 0,
+		             "O_TRUNC vacía el archivo");
+		fisopfs_close(file);
+		fisopfs_unmount(fs, 0);
+	}
+	remove("./biblioteca.dat");
+}
+
+void
+prueba_trazas()
+{
+	fs_trace_t *trace = trace_open("./traza.dat");
+	test_afirmar(trace != NULL, "Se crea la traza");
+	if (!trace)
+		return;
+
+	uint64_t start = trace_start(trace);
+	trace_record(trace, TRAZA_MKDIR, "/dir", 0, 0, 0755, 0, start);
+	trace_record(trace, TRAZA_CREATE, "/dir/archivo", 0, 0, 0644, 0, start);
+	trace_record(trace, TRAZA_WRITE, "/dir/archivo", 100, 10, 0, 10, start);
+	trace_record(trace, TRAZA_GETATTR, "/no_existe", 0, 0, 0, -ENOENT, start);
+	trace_close(trace);
+
+	test_nuevo_sub_grupo("Se lee la traza registrada");
+	FILE *file = fopen("./traza.dat", "rb");
+	fs_trace_header_t header;
+	fs_trace_record_t records[4];
+	char paths[4][UINT8_MAX + 1];
+	test_afirmar(trace_read_header(file, &header) == 0, "La cabecera es válida");
+	int n = 0;
+	while (n < 4 && trace_read(file, &records[n], paths[n]) == 1)
+		n++;
+	test_afirmar(n == 4 && trace_read(file, &records[0], paths[0]) == 0,
+	             "Se leen todos los registros");
+	fclose(file);
+	unlink("./traza.dat");
+	if (n != 4)
+		return;
+	test_afirmar(records[2].op == TRAZA_WRITE && records[2].offset == 100 &&
+	                     records[2].size == 10 &&
+	                     strcmp(paths[2], "/dir/archivo") == 0,
+	             "Se conservan la operación, sus argumentos y el path");
+	test_afirmar(records[3].status == -ENOENT, "Se conserva el resultado");
+
+	test_nuevo_sub_grupo("Se reproduce la traza contra fs_lib");
+	fs_t *fs = fs_build();
+	char buf[16];
+	int same = 1;
+	for (int i = 0; i < n; i++)
+		same &= trace_replay(fs, &records[i], paths[i], buf, NULL) ==
+		        records[i].status;
+	test_afirmar(same, "Cada operación da el resultado registrado");
+	test_afirmar(get_file(fs, "/dir/archivo") &&
+	                     get_file(fs, "/dir/archivo")->size == 110,
+	             "La reproducción deja el mismo estado");
+	fs_free(fs);
+}
+
+typedef struct commit_concurrente {
+	fs_t *fs;
+	int id;
+	int status;
+} commit_concurrente_t;
+
+static void *
+escribir_y_sincronizar(void *arg)
+{
+	commit_concurrente_t *c = arg;
+	char path[MAX_NAME];
+	snprintf(path, MAX_NAME, "/archivo%d", c->id);
+
+	fs_begin_update(c->fs);
+	fs_create(c->fs, path, 0644);
+	fs_write(c->fs, path, "datos", 5, 0);
+	fs_end_update(c->fs);
+
+	c->status = fs_fsync(c->fs, "./fs.dat");
+	return NULL;
+}
+
+typedef struct lectura_sin_lock {
+	fs_t *fs;
+	int fallidas;
+} lectura_sin_lock_t;
+
+static void *
+leer_sin_lock(void *arg)
+{
+	lectura_sin_lock_t *l = arg;
+	char buffer[TAM_BLOQUE];
+
+	for (int i = 0; i < 2000; i++) {
+		size_t block = i % 4;
+		fs_lock(l->fs);
+		off_t offset = block * TAM_BLOQUE;
+		int n = fs_read(l->fs, "/dir/datos", buffer, 1, offset);
+		fs_unlock(l->fs);
+		if (n != 1 || buffer[0] != (char) ('a' + block))
+			l->fallidas++;
+	}
+
+	return NULL;
+}
+
+void
+prueba_solo_lectura()
+{
+	fs_t *fs = fs_build();
+	char buffer[TAM_BLOQUE];
+	struct timespec ts[2] = { { .tv_sec = 1000 }, { .tv_sec = 2000 } };
+	fs_mkdir(fs, "/dir", __S_IFDIR | 0755);
+	fs_create(fs, "/dir/datos", __S_IFREG | 0644);
+	for (int i = 0; i < 4; i++) {
+		memset(buffer, 'a' + i, TAM_BLOQUE);
+		fs_write(fs, "/dir/datos", buffer, TAM_BLOQUE, i * TAM_BLOQUE);
+	}
+	fs_utimens(fs, "/dir", ts);
+	fs_utimens(fs, "/dir/datos", ts);
+	fs_destroy("./fs.dat", fs, 1);
+
+	fs = fs_init_read_only("./fs.dat");
+	test_afirmar(fs != NULL && fs->read_only && fs->image_map != NULL,
+	             "Se monta la imagen mapeada");
+	if (!fs)
+		return;
+
+	test_nuevo_sub_grupo("Lecturas");
+	test_afirmar(fs_read(fs, "/dir/datos", buffer, 2, 3 * TAM_BLOQUE - 1) ==
+	                             2 &&
+	                     buffer[0] == 'c' && buffer[1] == 'd',
+	             "Se lee el contenido de la imagen");
+	test_afirmar(fs->cached == 0 && get_file(fs, "/dir/datos")->blocks[2] ==
+	                                        NULL,
+	             "Los bloques no se copian a memoria propia");
+	int entries = 0;
+	fs_readdir(fs, "/dir", &entries, contar_listado, 0);
+	struct stat st_dir, st_file;
+	fs_getattr(fs, "/dir", &st_dir);
+	fs_getattr(fs, "/dir/datos", &st_file);
+	test_afirmar(entries == 1 && st_dir.st_atime == 1000 &&
+	                     st_file.st_atime == 1000,
+	             "Leer no actualiza los tiempos de acceso");
+	test_afirmar(fs->seq == 0, "Leer no modifica nada compartido");
+
+	lectura_sin_lock_t l = { .fs = fs };
+	pthread_t threads[4];
+	pthread_rwlock_wrlock(&fs->lock);
+	for (int i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, leer_sin_lock, &l);
+	for (int i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+	pthread_rwlock_unlock(&fs->lock);
+	test_afirmar(l.fallidas == 0, "Las lecturas no toman el lock");
+
+	test_nuevo_sub_grupo("Modificaciones");
+	test_afirmar(fs_mkdir(fs, "/otro", __S_IFDIR | 0755) == -EROFS &&
+	                     fs_create(fs, "/nuevo", 0644) == -EROFS,
+	             "No se crean entradas");
+	test_afirmar(fs_write(fs, "/dir/datos", "x", 1, 0) == -EROFS &&
+	                     fs_append(fs, "/dir/datos", "x", 1, 0, 1) ==
+	                             -EROFS &&
+	                     fs_truncate(fs, "/dir/datos", 0) == -EROFS &&
+	                     fs_fallocate(fs, "/dir/datos", 0, 0, 1) == -EROFS,
+	             "No se modifica el contenido");
+	test_afirmar(fs_utimens(fs, "/dir", ts) == -EROFS &&
+	                     fs_unlink(fs, "/dir/datos") == -EROFS &&
+	                     fs_rmtree(fs, "/dir") == -EROFS,
+	             "No se modifican ni se borran entradas");
+	test_afirmar(fs_read(fs, "/dir/datos", buffer, 1, 0) == 1 &&
+	                     buffer[0] == 'a',
+	             "El contenido sigue igual");
+	struct statvfs sv;
+	test_afirmar(fs_statfs(fs, &sv) == 0 && (sv.f_flag & ST_RDONLY),
+	             "statfs informa que es de sólo lectura");
+
+	test_nuevo_sub_grupo("Varios montajes de la misma imagen");
+	fs_t *other = fs_init_read_only("./fs.dat");
+	test_afirmar(other && fs_read(other, "/dir/datos", buffer, 1, 0) == 1 &&
+	                     buffer[0] == 'a',
+	             "Otro montaje lee la misma imagen");
+	struct stat image_st;
+	stat("./fs.dat", &image_st);
+	if (other)
+		fs_destroy("./fs.dat", other, 0);
+	struct stat image_after;
+	test_afirmar(stat("./fs.dat", &image_after) == 0 &&
+	                     image_after.st_size == image_st.st_size,
+	             "Desmontar un montaje no toca la imagen");
+	test_afirmar(fs_read(fs, "/dir/datos", buffer, 1, 3 * TAM_BLOQUE) ==
+	                             1 &&
+	                     buffer[0] == 'd',
+	             "El otro montaje sigue leyendo la imagen");
+	fs_free(fs);
+	remove("./fs.dat");
+
+	fs = fs_init_read_only("./fs.dat");
+	test_afirmar(fs && fs_mkdir(fs, "/dir", __S_IFDIR | 0755) == -EROFS,
+	             "Sin imagen se monta un sistema de archivos vacío");
+	if (fs)
+		fs_free(fs);
+}
+
+// ## mismo_contenido
+//
+// Devuelve 1 si a y b tienen los mismos directorios y archivos, con los
+// mismos atributos, contenido y huecos.
+//
+static int
+mismo_contenido(fs_t *a, fs_t *b)
+{
+	if (a->d_size != b->d_size || a->f_size != b->f_size)
+		return 0;
+
+	for (size_t i = 0; i < a->d_size; i++) {
+		fs_d_entry_t *da = &a->directories[i];
+		fs_d_entry_t *db = get_dir(b, da->path);
+		if (!db || db->mode != da->mode ||
+		    db->time_last_modification != da->time_last_modification)
+			return 0;
+	}
+
+	char *ca = malloc(MAX_CONTENIDO);
+	char *cb = malloc(MAX_CONTENIDO);
+	int same = ca && cb;
+	for (size_t i = 0; same && i < a->f_size; i++) {
+		fs_file_t *fa = &a->files[i];
+		fs_file_t *fb = get_file(b, fa->path);
+		int size = fa->size;
+		same = fb && fb->size == fa->size && fb->mode == fa->mode &&
+		       fb->time_last_modification ==
+		               fa->time_last_modification &&
+		       file_allocated_blocks(fb) == file_allocated_blocks(fa) &&
+		       fs_read(a, fa->path, ca, size, 0) == size &&
+		       fs_read(b, fb->path, cb, size, 0) == size &&
+		       memcmp(ca, cb, size) == 0;
+	}
+
+	free(ca);
+	free(cb);
+	return same;
+}
+
+void
+prueba_exportacion_de_cambios()
+{
+	fs_t *fs = fs_build();
+	char buffer[TAM_BLOQUE];
+	fs_mkdir(fs, "/dir", __S_IFDIR | 0755);
+	fs_create(fs, "/dir/datos", __S_IFREG | 0644);
+	fs_create(fs, "/borrado", __S_IFREG | 0644);
+	for (int i = 0; i < 8; i++) {
+		memset(buffer, 'a' + i, TAM_BLOQUE);
+		fs_write(fs, "/dir/datos", buffer, TAM_BLOQUE, i * TAM_BLOQUE);
+	}
+	fs_write(fs, "/borrado", "x", 1, 0);
+
+	test_nuevo_sub_grupo("Números de transacción");
+	fs_file_t *file = get_file(fs, "/dir/datos");
+	test_afirmar(file->birth > get_dir(fs, "/dir")->txn &&
+	                     file->block_txn[0] > file->birth &&
+	                     file->block_txn[7] > file->block_txn[0] &&
+	                     file->txn > file->block_txn[7] &&
+	                     fs->txn >= file->txn,
+	             "Cada cambio tiene un número mayor al anterior");
+	uint64_t txn = fs->txn;
+	fs_read(fs, "/dir/datos", buffer, 10, 0);
+	test_afirmar(fs->txn == txn, "Leer no cuenta como cambio");
+
+	fs_save("./fs.dat", fs);
+	fs_t *fs_r = fs_init("./fs.dat");
+	test_afirmar(fs_r && fs_r->txn == fs->txn && fs_r->id == fs->id &&
+	                     get_file(fs_r, "/dir/datos")->block_txn[3] ==
+	                             file->block_txn[3],
+	             "Los números se conservan en la imagen");
+	if (fs_r)
+		fs_free(fs_r);
+	remove("./fs.dat");
+
+	test_nuevo_sub_grupo("Delta completo");
+	fs_t *replica = fs_build();
+	fs_create(replica, "/viejo", __S_IFREG | 0644);
+	FILE *delta = tmpfile();
+	fs_delta_stats_t stats;
+	test_afirmar(delta_send(fs, 0, delta, &stats) == 0 && stats.blocks == 9,
+	             "Desde la transacción 0 se manda todo el contenido");
+	rewind(delta);
+	test_afirmar(delta_recv(replica, delta, &stats) == 0 &&
+	                     mismo_contenido(fs, replica) &&
+	                     replica->txn == fs->txn && replica->id == fs->id,
+	             "La réplica queda igual al origen");
+	fclose(delta);
+
+	test_nuevo_sub_grupo("Delta incremental");
+	uint64_t since = fs->txn;
+	memset(buffer, 'z', TAM_BLOQUE);
+	fs_write(fs, "/dir/datos", buffer, 10, 2 * TAM_BLOQUE + 5);
+	fs_fallocate(fs,
+	             "/dir/datos",
+	             FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	             5 * TAM_BLOQUE,
+	             TAM_BLOQUE);
+	fs_unlink(fs, "/borrado");
+	fs_mkdir(fs, "/nuevo", __S_IFDIR | 0755);
+	fs_create(fs, "/nuevo/archivo", __S_IFREG | 0644);
+	fs_write(fs, "/nuevo/archivo", "hola", 4, 0);
+	delta = tmpfile();
+	test_afirmar(delta_send(fs, since, delta, &stats) == 0 &&
+	                     stats.entries == 3 && stats.blocks == 3,
+	             "Sólo se mandan las entradas y los bloques modificados");
+	test_afirmar(ftell(delta) < 3 * TAM_BLOQUE,
+	             "El delta ocupa según lo que se modificó");
+	rewind(delta);
+	test_afirmar(delta_recv(replica, delta, &stats) == 0 &&
+	                     mismo_contenido(fs, replica) &&
+	                     !get_file(replica, "/borrado"),
+	             "La réplica queda igual al origen");
+	rewind(delta);
+	test_afirmar(delta_recv(replica, delta, &stats) == 0 &&
+	                     mismo_contenido(fs, replica),
+	             "Volver a aplicar el delta no cambia nada");
+
+	test_nuevo_sub_grupo("Réplicas que no corresponden");
+	fs_t *other = fs_build();
+	rewind(delta);
+	test_afirmar(delta_recv(other, delta, &stats) == -ESTALE,
+	             "No se aplica a una réplica de otro origen");
+	fclose(delta);
+
+	fs_write(fs, "/nuevo/archivo", "chau", 4, 0);
+	since = fs->txn;
+	fs_write(fs, "/nuevo/archivo", "hola", 4, 0);
+	delta = tmpfile();
+	delta_send(fs, since, delta, &stats);
+	rewind(delta);
+	test_afirmar(delta_recv(replica, delta, &stats) == -ESTALE,
+	             "No se aplica a una réplica atrasada");
+	fclose(delta);
+
+	delta = tmpfile();
+	delta_send(fs, 0, delta, &stats);
+	fflush(delta);
+	test_afirmar(ftruncate(fileno(delta), ftell(delta) - 100) == 0,
+	             "Se corta el final de un delta");
+	rewind(delta);
+	test_afirmar(delta_recv(other, delta, &stats) == -EINVAL,
+	             "Un delta incompleto no se aplica");
+	fclose(delta);
+
+	fs_free(other);
+	fs_free(replica);
+	fs_free(fs);
+}
+
+void
+prueba_commits_agrupados()
+{
+	fs_t *fs = fs_build();
+	fs->commit_window_us = 20000;
+
+	pthread_t threads[8];
+	commit_concurrente_t args[8];
+	for (int i = 0; i < 8; i++) {
+		args[i] = (commit_concurrente_t){ .fs = fs, .id = i };
+		pthread_create(&threads[i], NULL, escribir_y_sincronizar, &args[i]);
+	}
+	int ok = 1;
+	for (int i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+		ok &= args[i].status == 0;
+	}
+
+	test_nuevo_sub_grupo("Los fsync concurrentes comparten commits");
+	test_afirmar(ok, "Todos los fsync terminan bien");
+	test_afirmar(fs->commits > 0 && fs->commits < 8,
+	             "Se guardan menos imágenes que pedidos de fsync");
+
+	size_t commits = fs->commits;
+	test_afirmar(fs_fsync(fs, "./fs.dat") == 0 && fs->commits == commits,
+	             "Sin cambios nuevos no se vuelve a guardar la imagen");
+	unsigned seq = fs->seq;
+	fs_read(fs, "/archivo0", (char[5]) { 0 }, 5, 0);
+	int entries = 0;
+	fs_readdir(fs, ROOT, &entries, contar_listado, 0);
+	test_afirmar(fs->seq == seq,
+	             "Leer no obliga a repetir los getattr concurrentes");
+	test_afirmar(fs_fsync(fs, "./fs.dat") == 0 && fs->commits == commits,
+	             "Leer no obliga a guardar la imagen");
+	fs_unlink(fs, "/archivo0");
+	test_afirmar(fs_fsync(fs, "./fs.dat") == 0 && fs->commits > commits,
+	             "Un borrado sí se guarda");
+	fs_create(fs, "/archivo0", __S_IFREG | 0644);
+	fs_write(fs, "/archivo0", "datos", 5, 0);
+	fs_fsync(fs, "./fs.dat");
+
+	test_nuevo_sub_grupo("Lo sincronizado es durable");
+	fs_t *fs_r = fs_init("./fs.dat");
+	int all = fs_r != NULL;
+	char buffer[5];
+	for (int i = 0; all && i < 8; i++) {
+		char path[MAX_NAME];
+		snprintf(path, MAX_NAME, "/archivo%d", i);
+		all = fs_read(fs_r, path, buffer, 5, 0) == 5 &&
+		      memcmp(buffer, "datos", 5) == 0;
+	}
+	test_afirmar(all, "La imagen tiene los cambios de todos los hilos");
+	if (fs_r)
+		fs_free(fs_r);
+	fs_free(fs);
 }
 
 int
@@ -358,9 +2346,50 @@ main()
 	prueba_eliminacion_de_archivos_y_directorios();
 	prueba_de_eliminacion_de_subdirectorios_y_archivos();
 	prueba_de_no_eliminacion_de_directorios();
+	prueba_borrado_de_arboles();
+	test_nuevo_grupo("Lectura de directorios");
+	prueba_lectura_de_directorios_por_partes();
+	prueba_atributos_al_listar_directorios();
+	test_nuevo_grupo("Búsqueda de paths inexistentes");
+	prueba_busquedas_de_paths_inexistentes();
+	test_nuevo_grupo("Comparación de nombres");
+	prueba_comparacion_de_etiquetas();
+	test_nuevo_grupo("Acceso concurrente");
+	prueba_atributos_sin_lock();
+	prueba_reserva_de_bloques();
+	prueba_arenas();
+	test_nuevo_grupo("Escrituras al final de un archivo");
+	prueba_escrituras_al_final();
+	test_nuevo_grupo("Bloqueo de rangos");
+	prueba_bloqueo_de_rangos();
+	test_nuevo_grupo("Eventos de cambios");
+	prueba_eventos();
+	test_nuevo_grupo("Uso del sistema de archivos");
+	prueba_contadores_de_uso();
+	test_nuevo_grupo("Archivos dispersos");
+	prueba_archivos_dispersos();
+	test_nuevo_grupo("Copia de archivos con bloques compartidos");
+	prueba_copia_con_bloques_compartidos();
+	test_nuevo_grupo("Importación de un directorio del host");
+	prueba_importacion();
 	test_titulo("Persistencia de datos");
 	test_nuevo_grupo("Guardar y recuperar file system en un archivo");
 	prueba_persistencia();
+	test_nuevo_grupo("Formato de la imagen");
+	prueba_verificacion_de_la_imagen();
+	prueba_sumas_de_verificacion();
+	test_nuevo_grupo("Carga de contenido bajo demanda");
+	prueba_carga_bajo_demanda();
+	test_nuevo_grupo("Montaje de sólo lectura");
+	prueba_solo_lectura();
+	test_nuevo_grupo("Exportación de cambios a una réplica");
+	prueba_exportacion_de_cambios();
+	test_nuevo_grupo("Sincronización de cambios");
+	prueba_commits_agrupados();
+	test_nuevo_grupo("Biblioteca");
+	prueba_biblioteca();
+	test_nuevo_grupo("Trazas de operaciones");
+	prueba_trazas();
 	test_titulo("Funciones auxiliares");
 	test_mostrar_reporte();
 	return 0;
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// # Trazas de operaciones
+//
+// (Se incluye después de fs_lib.c.)
+//
+// Con --trace=<archivo>, fisopfs registra cada operación de FUSE en un
+// archivo binario: qué operación fue, sus argumentos, el resultado, cuándo
+// empezó, cuánto tardó y qué hilo la atendió. fs_replay reproduce la traza
+// directamente contra fs_lib, sin FUSE ni kernel de por medio.
+//
+// El archivo empieza con una cabecera (fs_trace_header_t) seguida de un
+// registro (fs_trace_record_t) por operación, cada uno seguido de path_len
+// bytes con el path (sin el '\0'). No se guarda el contenido de las
+// escrituras: al reproducirlas se escriben ceros del mismo tamaño.
+
+#define TRAZA_MAGIC "FISOTRC"
+#define TRAZA_VERSION 1
+
+enum {
+	TRAZA_GETATTR,
+	TRAZA_READDIR,
+	TRAZA_READ,
+	TRAZA_WRITE,
+	TRAZA_MKDIR,
+	TRAZA_CREATE,
+	TRAZA_UTIMENS,
+	TRAZA_TRUNCATE,
+	TRAZA_UNLINK,
+	TRAZA_RMDIR,
+	TRAZA_FALLOCATE,
+	TRAZA_FSYNC,
+	TRAZA_RMTREE,
+	TRAZA_OPERACIONES,
+};
+
+typedef struct fs_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t padding;
+	uint64_t start_time;  // hora de inicio (segundos desde epoch)
+} fs_trace_header_t;
+
+// Los argumentos que no usa una operación quedan en 0. En utimens, offset y
+// size guardan los segundos del último acceso y de la última modificación.
+typedef struct fs_trace_record {
+	uint64_t start_ns;  // desde el comienzo de la traza
+	uint32_t duration_ns;
+	uint32_t tid;
+	int64_t offset;
+	uint64_t size;
+	uint32_t mode;
+	int32_t status;
+	uint8_t op;
+	uint8_t path_len;
+	uint8_t padding[6];
+} fs_trace_record_t;
+
+typedef struct fs_trace {
+	FILE *file;
+	struct timespec start;
+} fs_trace_t;
+
+static uint64_t
+trace_elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec -
+	       start->tv_nsec;
+}
+
+// ## trace_open
+//
+// Crea el archivo de traza y escribe su cabecera.
+//
+// Devuelve la traza, o NULL si no se pudo crear.
+//
+static fs_trace_t *
+trace_open(const char *path)
+{
+	fs_trace_t *trace = calloc(1, sizeof(fs_trace_t));
+	if (!trace)
+		return NULL;
+
+	trace->file = fopen(path, "wb");
+	if (!trace->file) {
+		perror(path);
+		free(trace);
+		return NULL;
+	}
+
+	fs_trace_header_t header = { .magic = TRAZA_MAGIC,
+		                     .version = TRAZA_VERSION,
+		                     .start_time = time(NULL) };
+	clock_gettime(CLOCK_MONOTONIC, &trace->start);
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+		perror(path);
+		fclose(trace->file);
+		free(trace);
+		return NULL;
+	}
+
+	return trace;
+}
+
+// ## trace_close
+//
+// Escribe lo que quede en el buffer y cierra la traza.
+//
+static void
+trace_close(fs_trace_t *trace)
+{
+	if (!trace)
+		return;
+
+	fclose(trace->file);
+	free(trace);
+}
+
+// ## trace_start
+//
+// Devuelve el momento en que empieza una operación, para pasárselo a
+// trace_record (0 si no se está registrando una traza).
+//
+static uint64_t
+trace_start(fs_trace_t *trace)
+{
+	return trace ? trace_elapsed_ns(&trace->start) : 0;
+}
+
+// ## trace_record
+//
+// Registra una operación que empezó en start. Se puede llamar desde varios
+// hilos: cada registro se escribe con un solo fwrite, que es atómico
+// respecto de los demás.
+//
+static void
+trace_record(fs_trace_t *trace,
+             int op,
+             const char *path,
+             int64_t offset,
+             uint64_t size,
+             uint32_t mode,
+             int status,
+             uint64_t start)
+{
+	if (!trace)
+		return;
+
+	uint64_t end = trace_elapsed_ns(&trace->start);
+	size_t path_len = strnlen(path, UINT8_MAX);
+
+	char buf[sizeof(fs_trace_record_t) + UINT8_MAX];
+	fs_trace_record_t record = {
+		.start_ns = start,
+		.duration_ns = end - start > UINT32_MAX ? UINT32_MAX : end - start,
+		.tid = syscall(SYS_gettid),
+		.offset = offset,
+		.size = size,
+		.mode = mode,
+		.status = status,
+		.op = op,
+		.path_len = path_len,
+	};
+	memcpy(buf, &record, sizeof(record));
+	memcpy(buf + sizeof(record), path, path_len);
+
+	fwrite(buf, sizeof(record) + path_len, 1, trace->file);
+}
+
+// ## trace_read_header
+//
+// Lee y verifica la cabecera de una traza.
+//
+// Devuelve 0 si es válida, -1 en caso contrario.
+//
+static int
+trace_read_header(FILE *file, fs_trace_header_t *header)
+{
+	if (fread(header, sizeof(*header), 1, file) != 1 ||
+	    memcmp(header->magic, TRAZA_MAGIC, sizeof(TRAZA_MAGIC)) != 0 ||
+	    header->version != TRAZA_VERSION)
+		return -1;
+
+	return 0;
+}
+
+// ## trace_read
+//
+// Lee el siguiente registro de una traza y su path.
+//
+// Devuelve 1 si leyó un registro, 0 al llegar al final y -1 si el registro
+// está incompleto o es inválido.
+//
+static int
+trace_read(FILE *file, fs_trace_record_t *record, char path[UINT8_MAX + 1])
+{
+	size_t n = fread(record, 1, sizeof(*record), file);
+	if (n == 0)
+		return 0;
+
+	if (n != sizeof(*record) || record->op >= TRAZA_OPERACIONES ||
+	    fread(path, 1, record->path_len, file) != record->path_len)
+		return -1;
+
+	path[record->path_len] = '\0';
+	return 1;
+}
+
+static int
+discard_entry(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	return 0;
+}
+
+// ## trace_replay
+//
+// Reproduce una operación registrada contra fs, con los mismos locks que
+// toma fisopfs. buf debe tener lugar para el tamaño de la operación (las
+// lecturas y escrituras están acotadas por FUSE). Los fsync guardan la
+// imagen en image, o no hacen nada si image es NULL.
+//
+// Devuelve el resultado de la operación.
+//
+static int
+trace_replay(fs_t *fs,
+             const fs_trace_record_t *record,
+             const char *path,
+             char *buf,
+             const char *image)
+{
+	struct stat st;
+	struct timespec ts[2] = { { .tv_sec = record->offset },
+		                  { .tv_sec = record->size } };
+	int status;
+
+	switch (record->op) {
+	case TRAZA_GETATTR:
+		return fs_getattr(fs, path, &st);
+	case TRAZA_READDIR:
+		fs_lock(fs);
+		status = fs_readdir(fs, path, NULL, discard_entry, record->offset);
+		fs_unlock(fs);
+		return status;
+	case TRAZA_READ:
+		fs_lock(fs);
+		status = fs_read(fs, path, buf, record->size, record->offset);
+		fs_unlock(fs);
+		return status;
+	case TRAZA_FSYNC:
+		return image ? fs_fsync(fs, image) : 0;
+	}
+
+	fs_begin_update(fs);
+	switch (record->op) {
+	case TRAZA_WRITE:
+		memset(buf, 0, record->size);
+		status = fs_write(fs, path, buf, record->size, record->offset);
+		break;
+	case TRAZA_MKDIR:
+		status = fs_mkdir(fs, path, record->mode);
+		break;
+	case TRAZA_CREATE:
+		status = fs_create(fs, path, record->mode);
+		break;
+	case TRAZA_UTIMENS:
+		status = fs_utimens(fs, path, ts);
+		break;
+	case TRAZA_TRUNCATE:
+		status = fs_truncate(fs, path, record->offset);
+		break;
+	case TRAZA_UNLINK:
+		status = fs_unlink(fs, path);
+		break;
+	case TRAZA_RMDIR:
+		status = fs_rmdir(fs, path);
+		break;
+	case TRAZA_RMTREE:
+		status = fs_rmtree(fs, path);
+		break;
+	case TRAZA_FALLOCATE:
+		status = fs_fallocate(fs, path, record->mode, record->offset, record->size);
+		break;
+	default:
+		status = -EINVAL;
+	}
+	fs_end_update(fs);
+
+	return status;
+}
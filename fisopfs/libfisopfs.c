@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "libfisopfs.h"
+
+// La biblioteca no escribe en la salida estándar del proceso que la usa
+#define FS_DEBUG 0
+#include "fs_lib.c"
+
+// # libfisopfs
+//
+// Implementación de libfisopfs.h sobre fs_lib.c, con los mismos locks que
+// toma fisopfs para cada operación. Sólo se exportan las funciones del
+// header (la biblioteca se compila con -fvisibility=hidden).
+//
+// Como fs_lib identifica los archivos por path, un archivo abierto guarda su
+// path y sus flags.
+
+#define PUBLICA __attribute__((visibility("default")))
+
+struct fisopfs {
+	fs_t *fs;
+	char image[PATH_MAX];  // vacío si no tiene imagen
+};
+
+struct fisopfs_file {
+	fisopfs_t *owner;
+	char path[MAX_NAME];
+	int flags;
+};
+
+PUBLICA fisopfs_t *
+fisopfs_mount(const char *image)
+{
+	fisopfs_t *handle = calloc(1, sizeof(fisopfs_t));
+	if (!handle)
+		return NULL;
+
+	if (image && strlen(image) >= PATH_MAX) {
+		free(handle);
+		return NULL;
+	}
+
+	if (image) {
+		strcpy(handle->image, image);
+		handle->fs = fs_init(image);
+		if (handle->fs)
+			fs_scrub_start(handle->fs);
+	} else {
+		handle->fs = fs_build();
+	}
+
+	if (!handle->fs) {
+		free(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
+PUBLICA int
+fisopfs_unmount(fisopfs_t *fs, int save)
+{
+	int status = 0;
+	if (save && fs->image[0] == '\0')
+		status = -EINVAL;
+	else if (save && fs_save(fs->image, fs->fs) != 0)
+		status = -EIO;
+
+	fs_free(fs->fs);
+	free(fs);
+	return status;
+}
+
+PUBLICA int
+fisopfs_sync(fisopfs_t *fs)
+{
+	if (fs->image[0] == '\0')
+		return -EINVAL;
+
+	return fs_fsync(fs->fs, fs->image);
+}
+
+// ## open_file
+//
+// Busca o crea (según flags) el archivo que se está abriendo. Se llama con
+// el lock de modificación tomado.
+//
+// Devuelve 0 o un error negativo.
+//
+static int
+open_file(fs_t *fs, const char *path, int flags, mode_t mode)
+{
+	if (get_dir(fs, path))
+		return -EISDIR;
+
+	fs_file_t *file = get_file(fs, path);
+	if (file && (flags & O_CREAT) && (flags & O_EXCL))
+		return -EEXIST;
+
+	if (!file) {
+		if (!(flags & O_CREAT))
+			return -ENOENT;
+		int status = fs_create(fs, path, __S_IFREG | (mode & 07777));
+		if (status < 0)
+			return status;
+	}
+
+	if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)
+		return fs_truncate(fs, path, 0);
+
+	return 0;
+}
+
+PUBLICA int
+fisopfs_open(fisopfs_t *fs,
+             const char *path,
+             int flags,
+             mode_t mode,
+             fisopfs_file_t **file)
+{
+	if (strlen(path) >= MAX_NAME)
+		return -ENAMETOOLONG;
+
+	fisopfs_file_t *handle = calloc(1, sizeof(fisopfs_file_t));
+	if (!handle)
+		return -ENOMEM;
+
+	int status;
+	if (flags & (O_CREAT | O_TRUNC)) {
+		fs_begin_update(fs->fs);
+		status = open_file(fs->fs, path, flags, mode);
+		fs_end_update(fs->fs);
+	} else {
+		fs_lock(fs->fs);
+		status = open_file(fs->fs, path, flags, mode);
+		fs_unlock(fs->fs);
+	}
+
+	if (status < 0) {
+		free(handle);
+		return status;
+	}
+
+	handle->owner = fs;
+	strcpy(handle->path, path);
+	handle->flags = flags;
+	*file = handle;
+	return 0;
+}
+
+PUBLICA void
+fisopfs_close(fisopfs_file_t *file)
+{
+	fs_unlock_owner(file->owner->fs, file->path, (uintptr_t) file);
+	free(file);
+}
+
+static int
+can_read(fisopfs_file_t *file)
+{
+	return (file->flags & O_ACCMODE) != O_WRONLY;
+}
+
+static int
+can_write(fisopfs_file_t *file)
+{
+	return (file->flags & O_ACCMODE) != O_RDONLY;
+}
+
+PUBLICA ssize_t
+fisopfs_preadv(fisopfs_file_t *file,
+               const struct iovec *iov,
+               int iovcnt,
+               off_t offset)
+{
+	if (!can_read(file))
+		return -EBADF;
+
+	fs_t *fs = file->owner->fs;
+	ssize_t done = 0;
+	fs_lock(fs);
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > INT_MAX) {
+			done = done > 0 ? done : -EINVAL;
+			break;
+		}
+
+		int n = fs_read(
+		        fs, file->path, iov[i].iov_base, iov[i].iov_len, offset + done);
+		if (n < 0) {
+			done = done > 0 ? done : n;
+			break;
+		}
+		done += n;
+		if ((size_t) n < iov[i].iov_len)
+			break;
+	}
+	fs_unlock(fs);
+
+	return done;
+}
+
+PUBLICA ssize_t
+fisopfs_pwritev(fisopfs_file_t *file,
+                const struct iovec *iov,
+                int iovcnt,
+                off_t offset)
+{
+	if (!can_write(file))
+		return -EBADF;
+
+	fs_t *fs = file->owner->fs;
+	int append = (file->flags & O_APPEND) != 0;
+	fs_lock_shared(fs);
+	ssize_t done = fs_appendv(fs, file->path, iov, iovcnt, offset, append);
+	fs_unlock(fs);
+	if (done != -EAGAIN)
+		return done;
+
+	done = 0;
+	fs_begin_update(fs);
+	if (append) {
+		fs_file_t *f = get_file(fs, file->path);
+		offset = f ? (off_t) f->size : 0;
+	}
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > INT_MAX) {
+			done = done > 0 ? done : -EINVAL;
+			break;
+		}
+
+		int n = fs_write(
+		        fs, file->path, iov[i].iov_base, iov[i].iov_len, offset + done);
+		if (n < 0) {
+			done = done > 0 ? done : n;
+			break;
+		}
+		done += n;
+		if ((size_t) n < iov[i].iov_len)
+			break;
+	}
+	fs_end_update(fs);
+
+	return done;
+}
+
+PUBLICA ssize_t
+fisopfs_pread(fisopfs_file_t *file, void *buf, size_t size, off_t offset)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = size };
+	return fisopfs_preadv(file, &iov, 1, offset);
+}
+
+PUBLICA ssize_t
+fisopfs_pwrite(fisopfs_file_t *file,
+               const void *buf,
+               size_t size,
+               off_t offset)
+{
+	struct iovec iov = { .iov_base = (void *) buf, .iov_len = size };
+	return fisopfs_pwritev(file, &iov, 1, offset);
+}
+
+PUBLICA ssize_t
+fisopfs_copy_file_range(fisopfs_file_t *in,
+                        off_t off_in,
+                        fisopfs_file_t *out,
+                        off_t off_out,
+                        size_t len)
+{
+	if (!can_read(in) || !can_write(out) || (out->flags & O_APPEND))
+		return -EBADF;
+	if (in->owner != out->owner)
+		return -EXDEV;
+
+	fs_t *fs = out->owner->fs;
+	fs_begin_update(fs);
+	ssize_t done = fs_copy_file_range(
+	        fs, in->path, off_in, out->path, off_out, len);
+	fs_end_update(fs);
+	return done;
+}
+
+PUBLICA int
+fisopfs_ftruncate(fisopfs_file_t *file, off_t size)
+{
+	if (!can_write(file))
+		return -EBADF;
+
+	fs_t *fs = file->owner->fs;
+	fs_begin_update(fs);
+	int status = fs_truncate(fs, file->path, size);
+	fs_end_update(fs);
+	return status;
+}
+
+PUBLICA off_t
+fisopfs_lseek(fisopfs_file_t *file, off_t offset, int whence)
+{
+	fs_t *fs = file->owner->fs;
+	fs_lock_shared(fs);
+	off_t found = fs_lseek(fs, file->path, offset, whence);
+	fs_unlock(fs);
+	return found;
+}
+
+PUBLICA int
+fisopfs_fstat(fisopfs_file_t *file, struct stat *st)
+{
+	return fs_getattr(file->owner->fs, file->path, st);
+}
+
+PUBLICA int
+fisopfs_stat(fisopfs_t *fs, const char *path, struct stat *st)
+{
+	return fs_getattr(fs->fs, path, st);
+}
+
+PUBLICA size_t
+fisopfs_stat_batch(fisopfs_t *fs,
+                   const char *const paths[],
+                   size_t n,
+                   struct stat st[],
+                   int results[])
+{
+	size_t found = 0;
+
+	// Con el lock tomado, todos los atributos son del mismo momento
+	fs_lock(fs->fs);
+	for (size_t i = 0; i < n; i++) {
+		results[i] = lookup_stat(fs->fs, paths[i], &st[i]);
+		if (results[i] == 0)
+			found++;
+	}
+	fs_unlock(fs->fs);
+
+	return found;
+}
+
+PUBLICA int
+fisopfs_statfs(fisopfs_t *fs, struct statvfs *st)
+{
+	return fs_statfs(fs->fs, st);
+}
+
+// Los locks de un archivo abierto son del archivo abierto: su dueño es la
+// dirección del fisopfs_file_t.
+
+PUBLICA int
+fisopfs_getlk(fisopfs_file_t *file, struct flock *lock)
+{
+	return fs_getlk(file->owner->fs, file->path, (uintptr_t) file, lock);
+}
+
+PUBLICA int
+fisopfs_setlk(fisopfs_file_t *file, const struct flock *lock, int wait)
+{
+	fs_t *fs = file->owner->fs;
+	return fs_setlk(fs, file->path, (uintptr_t) file, lock, wait, NULL);
+}
+
+PUBLICA int
+fisopfs_flock(fisopfs_file_t *file, int op)
+{
+	fs_t *fs = file->owner->fs;
+	return fs_flock(fs, file->path, (uintptr_t) file, op, NULL);
+}
+
+typedef struct readdir_adapter {
+	fisopfs_dir_cb callback;
+	void *arg;
+} readdir_adapter_t;
+
+static int
+readdir_fill(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	readdir_adapter_t *adapter = buf;
+	return adapter->callback(name, st, adapter->arg);
+}
+
+PUBLICA int
+fisopfs_readdir(fisopfs_t *fs,
+                const char *path,
+                fisopfs_dir_cb callback,
+                void *arg)
+{
+	readdir_adapter_t adapter = { .callback = callback, .arg = arg };
+	fs_lock(fs->fs);
+	int status = fs_readdir(fs->fs, path, &adapter, readdir_fill, 0);
+	fs_unlock(fs->fs);
+	return status;
+}
+
+PUBLICA int
+fisopfs_mkdir(fisopfs_t *fs, const char *path, mode_t mode)
+{
+	fs_begin_update(fs->fs);
+	int status = fs_mkdir(fs->fs, path, __S_IFDIR | (mode & 07777));
+	fs_end_update(fs->fs);
+	return status;
+}
+
+PUBLICA int
+fisopfs_unlink(fisopfs_t *fs, const char *path)
+{
+	fs_begin_update(fs->fs);
+	int status = fs_unlink(fs->fs, path);
+	fs_end_update(fs->fs);
+	return status;
+}
+
+PUBLICA int
+fisopfs_rmdir(fisopfs_t *fs, const char *path)
+{
+	fs_begin_update(fs->fs);
+	int status = fs_rmdir(fs->fs, path);
+	fs_end_update(fs->fs);
+	return status;
+}
+
+PUBLICA int
+fisopfs_rmtree(fisopfs_t *fs, const char *path)
+{
+	fs_begin_update(fs->fs);
+	int status = fs_rmtree(fs->fs, path);
+	fs_end_update(fs->fs);
+	return status;
+}
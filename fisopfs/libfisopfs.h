@@ -0,0 +1,230 @@
+#ifndef LIBFISOPFS_H
+#define LIBFISOPFS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+// # libfisopfs
+//
+// Biblioteca para usar un sistema de archivos de fisopfs dentro de un
+// proceso, sin pasar por FUSE ni por el kernel. Se compila con
+// `make libfisopfs.a` o `make libfisopfs.so`.
+//
+// Todas las funciones son seguras para usar desde varios hilos y, como las
+// operaciones de FUSE, devuelven un error negativo (-ENOENT, -EBADF, ...)
+// en lugar de modificar errno.
+
+typedef struct fisopfs fisopfs_t;
+typedef struct fisopfs_file fisopfs_file_t;
+
+// Recibe el nombre y los atributos de cada entrada de un directorio. Si
+// devuelve algo distinto de 0, se deja de listar.
+typedef int (*fisopfs_dir_cb)(const char *name,
+                              const struct stat *st,
+                              void *arg);
+
+// ## fisopfs_mount
+//
+// Abre el sistema de archivos guardado en image, o uno vacío si image no
+// existe, está vacío o es NULL. Los bloques de la imagen se verifican en
+// segundo plano mientras se usa el sistema de archivos.
+//
+// Devuelve NULL si la imagen es inválida o no hay memoria suficiente.
+//
+fisopfs_t *fisopfs_mount(const char *image);
+
+// ## fisopfs_unmount
+//
+// Cierra el sistema de archivos. Si save es distinto de 0, antes lo guarda
+// en su imagen. Los archivos abiertos tienen que estar cerrados.
+//
+// Devuelve 0, o un error negativo si no se pudo guardar (el sistema de
+// archivos se cierra igual).
+//
+int fisopfs_unmount(fisopfs_t *fs, int save);
+
+// ## fisopfs_sync
+//
+// Hace durables todos los cambios guardando la imagen. Las llamadas
+// concurrentes comparten un mismo guardado.
+//
+// Devuelve 0, -EINVAL si el sistema de archivos no tiene imagen o -EIO.
+//
+int fisopfs_sync(fisopfs_t *fs);
+
+// ## fisopfs_open
+//
+// Abre el archivo path. flags acepta O_RDONLY, O_WRONLY, O_RDWR, O_CREAT
+// (con los permisos de mode), O_EXCL, O_TRUNC y O_APPEND.
+//
+// Devuelve 0 y guarda el archivo abierto en file, o un error negativo.
+//
+int fisopfs_open(fisopfs_t *fs,
+                 const char *path,
+                 int flags,
+                 mode_t mode,
+                 fisopfs_file_t **file);
+
+// ## fisopfs_close
+//
+// Cierra un archivo abierto con fisopfs_open, soltando sus locks.
+//
+void fisopfs_close(fisopfs_file_t *file);
+
+// ## fisopfs_pread, fisopfs_pwrite
+//
+// Leen o escriben size bytes a partir de offset. Con O_APPEND, las
+// escrituras van siempre al final del archivo. Las escrituras al final de
+// archivos distintos se hacen en paralelo.
+//
+// Devuelven la cantidad de bytes leídos o escritos, o un error negativo.
+//
+ssize_t fisopfs_pread(fisopfs_file_t *file,
+                      void *buf,
+                      size_t size,
+                      off_t offset);
+ssize_t fisopfs_pwrite(fisopfs_file_t *file,
+                       const void *buf,
+                       size_t size,
+                       off_t offset);
+
+// ## fisopfs_preadv, fisopfs_pwritev
+//
+// Como fisopfs_pread y fisopfs_pwrite, pero con varios buffers. Todos se
+// leen o escriben en una sola operación: otro hilo no ve el archivo a mitad
+// de camino.
+//
+ssize_t fisopfs_preadv(fisopfs_file_t *file,
+                       const struct iovec *iov,
+                       int iovcnt,
+                       off_t offset);
+ssize_t fisopfs_pwritev(fisopfs_file_t *file,
+                        const struct iovec *iov,
+                        int iovcnt,
+                        off_t offset);
+
+// ## fisopfs_copy_file_range
+//
+// Como copy_file_range(2): copia len bytes de in (desde off_in) a out
+// (desde off_out). Los bloques que la copia cubre por completo no se
+// duplican: quedan compartidos entre ambos archivos, también en la imagen,
+// hasta que alguno de los dos los modifica.
+//
+// Devuelve la cantidad de bytes copiados (0 al final de in), -EBADF si in
+// no está abierto para lectura o out no está abierto para escritura (o
+// tiene O_APPEND), -EXDEV si son de sistemas de archivos distintos, o algún
+// otro error negativo.
+//
+ssize_t fisopfs_copy_file_range(fisopfs_file_t *in,
+                                off_t off_in,
+                                fisopfs_file_t *out,
+                                off_t off_out,
+                                size_t len);
+
+// ## fisopfs_ftruncate
+//
+// Cambia el tamaño de un archivo abierto para escritura.
+//
+int fisopfs_ftruncate(fisopfs_file_t *file, off_t size);
+
+// ## fisopfs_lseek
+//
+// Como lseek(2) con SEEK_DATA o SEEK_HOLE: busca, desde offset, el
+// comienzo de los próximos datos o del próximo hueco del archivo, con
+// granularidad de bloque. El final del archivo cuenta como un hueco.
+//
+// Devuelve el offset encontrado, -ENXIO si offset está al final del
+// archivo o más allá (o no hay más datos), o algún otro error negativo.
+//
+off_t fisopfs_lseek(fisopfs_file_t *file, off_t offset, int whence);
+
+// ## fisopfs_fstat, fisopfs_stat
+//
+// Obtienen los atributos de un archivo abierto o de un path.
+//
+// Devuelven 0 o un error negativo.
+//
+int fisopfs_fstat(fisopfs_file_t *file, struct stat *st);
+int fisopfs_stat(fisopfs_t *fs, const char *path, struct stat *st);
+
+// ## fisopfs_stat_batch
+//
+// Obtiene los atributos de n paths a la vez, todos del mismo momento.
+// results[i] queda en 0 si se encontró paths[i] (y sus atributos en
+// st[i]), o en un error negativo.
+//
+// Devuelve la cantidad de paths encontrados.
+//
+size_t fisopfs_stat_batch(fisopfs_t *fs,
+                          const char *const paths[],
+                          size_t n,
+                          struct stat st[],
+                          int results[]);
+
+// ## fisopfs_statfs
+//
+// Obtiene, como statvfs(3), la capacidad del sistema de archivos y cuántos
+// bloques e inodos quedan libres. No espera a las demás operaciones.
+//
+// Devuelve 0 o un error negativo.
+//
+int fisopfs_statfs(fisopfs_t *fs, struct statvfs *st);
+
+// ## fisopfs_getlk, fisopfs_setlk
+//
+// Como fcntl(F_GETLK) y fcntl(F_SETLK) (o F_SETLKW si wait es distinto de
+// 0). Los locks son de cada archivo abierto, no del proceso: dos archivos
+// abiertos del mismo path se bloquean entre sí. No se detectan deadlocks.
+//
+// Devuelven 0, -EAGAIN si otro archivo abierto tiene un lock incompatible
+// y no se espera, o algún otro error negativo.
+//
+int fisopfs_getlk(fisopfs_file_t *file, struct flock *lock);
+int fisopfs_setlk(fisopfs_file_t *file, const struct flock *lock, int wait);
+
+// ## fisopfs_flock
+//
+// Como flock(2), con LOCK_SH, LOCK_EX o LOCK_UN y opcionalmente LOCK_NB.
+// Estos locks no interactúan con los de fisopfs_setlk.
+//
+// Devuelve 0, -EWOULDBLOCK o algún otro error negativo.
+//
+int fisopfs_flock(fisopfs_file_t *file, int op);
+
+// ## fisopfs_readdir
+//
+// Llama a callback con cada entrada del directorio path, incluidas "." y
+// "..".
+//
+// Devuelve 0 o un error negativo.
+//
+int fisopfs_readdir(fisopfs_t *fs,
+                    const char *path,
+                    fisopfs_dir_cb callback,
+                    void *arg);
+
+// ## fisopfs_mkdir, fisopfs_unlink, fisopfs_rmdir
+//
+// Crean o borran directorios y archivos.
+//
+// Devuelven 0 o un error negativo.
+//
+int fisopfs_mkdir(fisopfs_t *fs, const char *path, mode_t mode);
+int fisopfs_unlink(fisopfs_t *fs, const char *path);
+int fisopfs_rmdir(fisopfs_t *fs, const char *path);
+
+// ## fisopfs_rmtree
+//
+// Borra el directorio path con todo su contenido en una sola operación. La
+// memoria de los archivos borrados se libera en segundo plano.
+//
+// Devuelve 0 o un error negativo (-EBUSY si path es la raíz).
+//
+int fisopfs_rmtree(fisopfs_t *fs, const char *path);
+
+#endif